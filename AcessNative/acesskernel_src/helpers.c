@@ -135,6 +135,16 @@ Sint64 now(void)
 	return tv.tv_sec * 1000 + tv.tv_usec/1000;
 }
 
+/**
+ * \brief Microsecond timestamp, for timing syscalls
+ */
+Sint64 now_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (Sint64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 void IPStack_SendDebugText(const char *str)
 {
 	// nop
@@ -161,6 +171,19 @@ int CheckMem(const void *buf, size_t len)
 	return 1;
 }
 
+// The host's vsnprintf can't replay saved arguments, so the log history keeps text instead
+int vsnprintf_capture(const char *Format, va_list Args, Uint64 *Values, int MaxValues, char *Strings, size_t StringSpace)
+{
+	return -1;
+}
+
+int snprintf_captured(char *Dest, size_t MaxLen, const char *Format, const Uint64 *Values, int NumValues)
+{
+	if( Dest && MaxLen )
+		Dest[0] = '\0';
+	return 0;
+}
+
 void itoa(char *buf, Uint64 num, int base, int minLength, char pad)
 {
 	static const char cUCDIGITS[] = "0123456789ABCDEF";
@@ -40,6 +40,8 @@ struct sShortSpinlock
 #define SHORTREL(...)
 #define CPU_HAS_LOCK(...)	0
 
+#define TRACE_ENABLED	0	// No tracepoints in the native kernel
+
 //#define	NUM_CFG_ENTRIES	10
 
 extern void	Debug_PutCharDebug(char ch);
@@ -1,17 +1,6 @@
 #ifndef _THREADS_INT_H_
 #define _THREADS_INT_H_
 
-/**
- * \brief IPC Message
- */
-typedef struct sMessage
-{
-	struct sMessage	*Next;	//!< Next message in thread's inbox
-	tTID	Source;	//!< Source thread ID
-	Uint	Length;	//!< Length of message data in bytes
-	Uint8	Data[];	//!< Message data
-} tMsg;
-
 typedef struct sProcess
 {
 	 int	nThreads;
@@ -54,8 +43,8 @@ struct sThread
 	void	*EventSem;	// Should be SDL_sem, but I don't want SDL in this header
 
 	// Message queue
-	tMsg * volatile	Messages;	//!< Message Queue
-	tMsg	*LastMessage;	//!< Last Message (speeds up insertion)
+	struct sMsgQueue	*MsgQueue;	//!< Message Queue (see Kernel/messages.c)
+	struct sMsgWaiter	*MsgSendWait;	//!< Set while blocked sending to a full queue
 };
 
 enum {
@@ -74,5 +63,8 @@ enum {
 };
 extern struct sThread	*Threads_GetThread(Uint TID);
 
+// === messages.c ===
+extern void	Proc_int_CancelSend(struct sThread *Thread);
+
 #endif
 
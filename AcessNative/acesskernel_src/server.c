@@ -23,18 +23,31 @@ typedef int	socklen_t;
 #endif
 #define DONT_INCLUDE_SYSCALL_NAMES
 #include "../syscalls.h"
+#ifdef __linux__
+# include <sys/mman.h>
+# include <fcntl.h>
+# include "../shm_channel.h"
+# define SUPPORT_SHM	1
+#else
+# define SUPPORT_SHM	0
+#endif
 #include <logdebug.h>	// acess but std
 #include <errno.h>
 
 #define	USE_TCP	1
-#define MAX_CLIENTS	16
 
 // === TYPES ===
-typedef struct {
+// One per Acess thread (ClientID is the TID), so a process's threads are serviced concurrently
+typedef struct sClient {
+	struct sClient	*Next;
 	 int	ClientID;
 	SDL_Thread	*WorkerThread;
+	volatile int	bWorkerExited;	// Set by the worker on the way out, reaped in Server_GetClient
 	#if USE_TCP
 	 int	Socket;
+	tShmChannel	*Shm;	// Requests are passed here instead of over Socket (if non-NULL)
+	char	ShmName[32];
+	uint32_t	ShmReqSeq;	// Request sequence when mapped (before the client is told it can send)
 	#else
 	tRequestHeader	*CurrentRequest;
 	struct sockaddr_in	ClientAddr;
@@ -44,15 +57,24 @@ typedef struct {
 }	tClient;
 
 // === IMPORTS ===
-extern tRequestHeader *SyscallRecieve(tRequestHeader *Request, int *ReturnLength);
+extern tRequestHeader *SyscallRecieve(tRequestHeader *Request, int *ReturnLength, tShmChannel *Shm);
 extern int	Threads_CreateRootProcess(void);
 extern void	Threads_SetThread(int TID);
 extern void	*Threads_GetThread(int TID);
 extern void	Threads_PostEvent(void *Thread, uint32_t Event);
+extern void	Syscall_DumpStats(void);
 
 // === PROTOTYPES ===
 tClient	*Server_GetClient(int ClientID);
+void	Server_int_ReapClients(void);
  int	Server_WorkerThread(void *ClientPtr);
+#if USE_TCP
+ int	Server_HandleSocketRequest(tClient *Client);
+#endif
+#if SUPPORT_SHM
+ int	Server_MapShm(tClient *Client, const char *Name);
+void	Server_ShmWorker(tClient *Client);
+#endif
  int	SyscallServer(void);
  int	Server_ListenThread(void *Unused);
 
@@ -64,53 +86,77 @@ SOCKET	gSocket = INVALID_SOCKET;
 # define INVALID_SOCKET -1
  int	gSocket = INVALID_SOCKET;
 #endif
-tClient	gaServer_Clients[MAX_CLIENTS];
+SDL_mutex	*glServer_Clients;	// Protects the gpServer_Clients list
+tClient	*gpServer_Clients;
+__thread tClient	*gpServer_CurClient;	// Client serviced by this worker
 SDL_Thread	*gpServer_ListenThread;
 
 // === CODE ===
 int Server_GetClientID(void)
 {
-	 int	i;
-	Uint32	thisId = SDL_ThreadID();
-	
-	for( i = 0; i < MAX_CLIENTS; i ++ )
-	{
-		if( SDL_GetThreadID(gaServer_Clients[i].WorkerThread) == thisId )
-			return gaServer_Clients[i].ClientID;
-	}
+	if( gpServer_CurClient )
+		return gpServer_CurClient->ClientID;
 	
 	fprintf(stderr, "ERROR: Server_GetClientID - Thread is not allocated\n");
 	
 	return 0;
 }
 
+/**
+ * \brief Free clients whose worker has terminated
+ * \note Called with glServer_Clients held
+ */
+void Server_int_ReapClients(void)
+{
+	for( tClient **pnp = &gpServer_Clients; *pnp; )
+	{
+		tClient	*client = *pnp;
+		if( !client->bWorkerExited ) {
+			pnp = &client->Next;
+			continue ;
+		}
+		*pnp = client->Next;
+		SDL_WaitThread(client->WorkerThread, NULL);
+		#if USE_TCP
+		if( client->Socket > 0 )
+			close(client->Socket);
+		#else
+		SDL_DestroyCond(client->WaitFlag);
+		SDL_DestroyMutex(client->Mutex);
+		#endif
+		free(client);
+	}
+}
+
 tClient *Server_GetClient(int ClientID)
 {
-	tClient	*ret = NULL;
-	 int	i;
+	tClient	*ret;
 	
 	// Allocate an ID if needed
 	if(ClientID == 0)
 		ClientID = Threads_CreateRootProcess();
 	
-	for( i = 0; i < MAX_CLIENTS; i ++ )
+	SDL_mutexP(glServer_Clients);
+	Server_int_ReapClients();
+	for( ret = gpServer_Clients; ret; ret = ret->Next )
 	{
-		if( gaServer_Clients[i].ClientID == ClientID ) {
-			return &gaServer_Clients[i];
+		if( ret->ClientID == ClientID ) {
+			SDL_mutexV(glServer_Clients);
+			return ret;
 		}
-		if(!ret && gaServer_Clients[i].ClientID == 0)
-			ret = &gaServer_Clients[i];
 	}
 	
-	// Uh oh, no free slots
-	// TODO: Dynamic allocation
-	if( !ret )
+	ret = calloc(1, sizeof(tClient));
+	if( !ret ) {
+		SDL_mutexV(glServer_Clients);
 		return NULL;
+	}
 	
 	// Allocate a thread for the process
 	ret->ClientID = ClientID;
 	#if USE_TCP
 	ret->Socket = 0;
+	ret->Shm = NULL;
 	#else
 	ret->CurrentRequest = NULL;
 	#endif
@@ -126,6 +172,10 @@ tClient *Server_GetClient(int ClientID)
 		ret->WorkerThread = SDL_CreateThread( Server_WorkerThread, ret );
 	}
 	
+	ret->Next = gpServer_Clients;
+	gpServer_Clients = ret;
+	SDL_mutexV(glServer_Clients);
+	
 	return ret;
 }
 
@@ -134,12 +184,18 @@ int Server_WorkerThread(void *ClientPtr)
 	tClient	*Client = ClientPtr;
 
 	Log_Debug("Server", "Worker %p", ClientPtr);	
+	gpServer_CurClient = Client;
 
 	#if USE_TCP
 	while( *((volatile typeof(Client->Socket)*)&Client->Socket) == 0 )
 		;
 	Threads_SetThread( Client->ClientID );
 	
+	#if SUPPORT_SHM
+	if( Client->Shm )
+		Server_ShmWorker(Client);
+	else
+	#endif
 	while( Client->ClientID != -1 )
 	{
 		fd_set	fds;
@@ -156,103 +212,8 @@ int Server_WorkerThread(void *ClientPtr)
 
 		if( FD_ISSET(Client->Socket, &fds) )
 		{
-			const int	ciMaxParamCount = 6;
-			char	lbuf[sizeof(tRequestHeader) + ciMaxParamCount*sizeof(tRequestValue)];
-			tRequestHeader	*hdr = (void*)lbuf;
-			size_t	len = recv(Client->Socket, (void*)hdr, sizeof(*hdr), 0);
-//			Log_Debug("Server", "%i bytes of header", len);
-			if( len == 0 ) {
-				Log_Notice("Server", "Zero RX on %i (worker %p)", Client->Socket, Client);
-				break;
-			}
-			if( len == -1 ) {
-				perror("recv header");
-//				Log_Warning("Server", "recv() error - %s", strerror(errno));
+			if( !Server_HandleSocketRequest(Client) )
 				break;
-			}
-			if( len != sizeof(*hdr) ) {
-				// Oops?
-				Log_Warning("Server", "FD%i bad sized (%i != exp %i)",
-					Client->Socket, len, sizeof(*hdr));
-				continue ;
-			}
-
-			if( hdr->NParams > ciMaxParamCount ) {
-				// Oops.
-				Log_Warning("Server", "FD%i too many params (%i > max %i)",
-					Client->Socket, hdr->NParams, ciMaxParamCount);
-				break ;
-			}
-
-			if( hdr->NParams > 0 )
-			{
-				len = recv(Client->Socket, (void*)hdr->Params, hdr->NParams*sizeof(tRequestValue), 0);
-//				Log_Debug("Server", "%i bytes of params", len);
-				if( len != hdr->NParams*sizeof(tRequestValue) ) {
-					// Oops.
-					perror("recv params");
-					Log_Warning("Sever", "Recieving params failed");
-					break ;
-				}
-			}
-			else
-			{
-//				Log_Debug("Server", "No params?");
-			}
-
-			// Get buffer size
-			size_t	hdrsize = sizeof(tRequestHeader) + hdr->NParams*sizeof(tRequestValue);
-			size_t	bufsize = hdrsize;
-			 int	i;
-			for( i = 0; i < hdr->NParams; i ++ )
-			{
-				if( hdr->Params[i].Flags & ARG_FLAG_ZEROED )
-					;
-				else {
-					bufsize += hdr->Params[i].Length;
-				}
-			}
-
-			// Allocate full buffer
-			hdr = malloc(bufsize);
-			memcpy(hdr, lbuf, hdrsize);
-			if( bufsize > hdrsize )
-			{
-				size_t	rem = bufsize - hdrsize;
-				char	*ptr = (void*)( hdr->Params + hdr->NParams );
-				while( rem )
-				{
-					len = recv(Client->Socket, ptr, rem, 0);
-//					Log_Debug("Server", "%i bytes of data", len);
-					if( len == -1 ) {
-						// Oops?
-						perror("recv data");
-						Log_Warning("Sever", "Recieving data failed");
-						break ;
-					}
-					rem -= len;
-					ptr += len;
-				}
-				if( rem ) {
-					break;
-				}
-			}
-//			else
-//				Log_Debug("Server", "no data");
-
-			 int	retlen;
-			tRequestHeader	*retHeader;
-			retHeader = SyscallRecieve(hdr, &retlen);
-			if( !retHeader ) {
-				// Some sort of error
-				Log_Warning("Server", "SyscallRecieve failed?");
-				continue ;
-			}
-			
-			send(Client->Socket, (void*)retHeader, retlen, 0); 
-
-			// Clean up
-			free(hdr);
 		}
 	}
 	#else
@@ -288,7 +249,7 @@ int Server_WorkerThread(void *ClientPtr)
 		}
 		
 		// Get the response
-		retHeader = SyscallRecieve(Client->CurrentRequest, &retSize);
+		retHeader = SyscallRecieve(Client->CurrentRequest, &retSize, NULL);
 
 		if( !retHeader ) {
 			// Return an error to the client
@@ -326,9 +287,214 @@ int Server_WorkerThread(void *ClientPtr)
 	}
 	#endif
 	Log_Notice("Server", "Terminated Worker %p", ClientPtr);	
+	Client->bWorkerExited = 1;
 	return 0;
 }
 
+#if USE_TCP
+/**
+ * \brief Read a request from the client's socket, run it and send the reply
+ * \return Boolean, false if the connection is no longer usable
+ */
+int Server_HandleSocketRequest(tClient *Client)
+{
+	const int	ciMaxParamCount = 6;
+	char	lbuf[sizeof(tRequestHeader) + ciMaxParamCount*sizeof(tRequestValue)];
+	tRequestHeader	*hdr = (void*)lbuf;
+	size_t	len = recv(Client->Socket, (void*)hdr, sizeof(*hdr), 0);
+//			Log_Debug("Server", "%i bytes of header", len);
+	if( len == 0 ) {
+		Log_Notice("Server", "Zero RX on %i (worker %p)", Client->Socket, Client);
+		return 0;
+	}
+	if( len == -1 ) {
+		perror("recv header");
+//				Log_Warning("Server", "recv() error - %s", strerror(errno));
+		return 0;
+	}
+	if( len != sizeof(*hdr) ) {
+		// Oops?
+		Log_Warning("Server", "FD%i bad sized (%i != exp %i)",
+			Client->Socket, len, sizeof(*hdr));
+		return 1;
+	}
+
+	if( hdr->NParams > ciMaxParamCount ) {
+		// Oops.
+		Log_Warning("Server", "FD%i too many params (%i > max %i)",
+			Client->Socket, hdr->NParams, ciMaxParamCount);
+		return 0;
+	}
+
+	if( hdr->NParams > 0 )
+	{
+		len = recv(Client->Socket, (void*)hdr->Params, hdr->NParams*sizeof(tRequestValue), 0);
+//				Log_Debug("Server", "%i bytes of params", len);
+		if( len != hdr->NParams*sizeof(tRequestValue) ) {
+			// Oops.
+			perror("recv params");
+			Log_Warning("Sever", "Recieving params failed");
+			return 0;
+		}
+	}
+	else
+	{
+//				Log_Debug("Server", "No params?");
+	}
+
+	// Get buffer size
+	size_t	hdrsize = sizeof(tRequestHeader) + hdr->NParams*sizeof(tRequestValue);
+	size_t	bufsize = hdrsize;
+	 int	i;
+	for( i = 0; i < hdr->NParams; i ++ )
+	{
+		if( hdr->Params[i].Flags & ARG_FLAG_ZEROED )
+			;
+		else {
+			bufsize += hdr->Params[i].Length;
+		}
+	}
+
+	// Allocate full buffer
+	hdr = malloc(bufsize);
+	memcpy(hdr, lbuf, hdrsize);
+	if( bufsize > hdrsize )
+	{
+		size_t	rem = bufsize - hdrsize;
+		char	*ptr = (void*)( hdr->Params + hdr->NParams );
+		while( rem )
+		{
+			len = recv(Client->Socket, ptr, rem, 0);
+//					Log_Debug("Server", "%i bytes of data", len);
+			if( len == -1 ) {
+				// Oops?
+				perror("recv data");
+				Log_Warning("Sever", "Recieving data failed");
+				break ;
+			}
+			rem -= len;
+			ptr += len;
+		}
+		if( rem ) {
+			free(hdr);
+			return 0;
+		}
+	}
+//			else
+//				Log_Debug("Server", "no data");
+
+	 int	retlen;
+	tRequestHeader	*retHeader;
+	retHeader = SyscallRecieve(hdr, &retlen, NULL);
+	if( !retHeader ) {
+		// Some sort of error
+		Log_Warning("Server", "SyscallRecieve failed?");
+		free(hdr);
+		return 1;
+	}
+	
+	send(Client->Socket, (void*)retHeader, retlen, 0); 
+
+	// Clean up
+	free(retHeader);
+	free(hdr);
+	return 1;
+}
+#endif
+
+#if SUPPORT_SHM
+/**
+ * \brief Map the shared memory channel created by a client
+ * \return Boolean success
+ */
+int Server_MapShm(tClient *Client, const char *Name)
+{
+	 int	fd = shm_open(Name, O_RDWR, 0);
+	if( fd == -1 ) {
+		perror("Server_MapShm - shm_open");
+		Log_Warning("Server", "Can't open shared memory '%s'", Name);
+		return 0;
+	}
+	tShmChannel	*ch = mmap(NULL, sizeof(tShmChannel) + SHM_CHANNEL_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if( ch == MAP_FAILED ) {
+		perror("Server_MapShm - mmap");
+		Log_Warning("Server", "Can't map shared memory '%s'", Name);
+		return 0;
+	}
+	// Sanity check, the client sets this before connecting
+	if( ch->Size > SHM_CHANNEL_SIZE ) {
+		Log_Warning("Server", "Shared memory '%s' bad size (0x%x > max 0x%x)",
+			Name, ch->Size, SHM_CHANNEL_SIZE);
+		munmap(ch, sizeof(tShmChannel) + SHM_CHANNEL_SIZE);
+		return 0;
+	}
+	strncpy(Client->ShmName, Name, sizeof(Client->ShmName));
+	Client->ShmReqSeq = ch->ReqSeq;
+	Client->Shm = ch;
+	return 1;
+}
+
+/**
+ * \brief Service requests passed through a client's shared memory channel
+ * \note Requests too large for the channel still come over the socket (flagged with SHM_FLAG_SOCKET)
+ */
+void Server_ShmWorker(tClient *Client)
+{
+	tShmChannel	*ch = Client->Shm;
+	// Not read from the channel here, the client may already have sent a request
+	uint32_t	seq = Client->ShmReqSeq;
+	
+	while( Client->ClientID != -1 )
+	{
+		if( !Shm_Wait(&ch->ReqSeq, seq, &ch->ServerWaiting, 1000) )
+		{
+			// Idle, check that the client is still connected
+			fd_set	fds;
+			struct timeval	tv = {0, 0};
+			char	tmp;
+			FD_ZERO(&fds);
+			FD_SET(Client->Socket, &fds);
+			if( select(Client->Socket+1, &fds, NULL, NULL, &tv) != 1 )
+				continue ;
+			if( recv(Client->Socket, &tmp, 1, MSG_PEEK) <= 0 ) {
+				Log_Notice("Server", "Client %i closed (worker %p)", Client->ClientID, Client);
+				break;
+			}
+			// Unflagged data is from a client that couldn't re-attach after execve
+			if( !(ch->Flags & SHM_FLAG_SOCKET) && !Server_HandleSocketRequest(Client) )
+				break;
+			continue ;
+		}
+		seq ++;
+		
+		if( ch->Flags & SHM_FLAG_SOCKET )
+		{
+			if( !Server_HandleSocketRequest(Client) )
+				break;
+			continue ;
+		}
+		
+		 int	retlen;
+		tRequestHeader	*retHeader = SyscallRecieve((void*)ch->Data, &retlen, ch);
+		if( !retHeader ) {
+			// Return an error to the client (over the request, it's no longer needed)
+			Log_Warning("Server", "SyscallRecieve failed?");
+			retHeader = (void*)ch->Data;
+			retHeader->NParams = 0;
+			retHeader->MessageLength = sizeof(*retHeader);
+			ch->ReplyOfs = 0;
+		}
+		
+		Shm_Signal(&ch->RespSeq, &ch->ClientWaiting);
+	}
+	
+	munmap(ch, sizeof(tShmChannel) + SHM_CHANNEL_SIZE);
+	shm_unlink(Client->ShmName);
+	Client->Shm = NULL;
+}
+#endif
+
 int SyscallServer(void)
 {
 	struct sockaddr_in	server;
@@ -382,6 +548,8 @@ int SyscallServer(void)
 	listen(gSocket, 5);
 	#endif
 	
+	glServer_Clients = SDL_CreateMutex();
+	
 	Log_Notice("AcessSrv", "Listening on 0.0.0.0:%i", SERVER_PORT);
 	gpServer_ListenThread = SDL_CreateThread( Server_ListenThread, NULL );
 	return 0;
@@ -390,18 +558,23 @@ int SyscallServer(void)
 int Server_Shutdown(void)
 {
 	close(gSocket);
-	for( int i = 0; i < MAX_CLIENTS; i ++ )
+	SDL_mutexP(glServer_Clients);
+	for( tClient *client = gpServer_Clients; client; client = client->Next )
 	{
-		if( gaServer_Clients[i].ClientID == 0 )
+		if( client->ClientID == 0 || client->bWorkerExited )
 			continue ;
-		Threads_PostEvent( Threads_GetThread(gaServer_Clients[i].ClientID), 0 );
-		gaServer_Clients[i].ClientID = -1;
+		Threads_PostEvent( Threads_GetThread(client->ClientID), 0 );
+		client->ClientID = -1;
 		#if USE_TCP
-		close(gaServer_Clients[i].Socket);
+		if( client->Socket > 0 )
+			close(client->Socket);
 		#else
-		SDL_CondSignal(gaServer_Clients[i].WaitFlag);
+		SDL_CondSignal(client->WaitFlag);
 		#endif
 	}
+	SDL_mutexV(glServer_Clients);
+	
+	Syscall_DumpStats();
 	return 0;
 }
 
@@ -442,7 +615,12 @@ int Server_ListenThread(void *Unused)
 		if( authhdr.pid == 0 ) {
 			// Allocate PID and client structure/thread
 			client = Server_GetClient(0);
-			client->Socket = clientSock;
+			if( !client ) {
+				Log_Warning("Server", "Can't allocate a client struct for %s:%i",
+					addrstr, clientaddr.sin_port);
+				close(clientSock);
+				continue ;
+			}
 			authhdr.pid = client->ClientID;
 		}
 		else {
@@ -461,10 +639,19 @@ int Server_ListenThread(void *Unused)
 				close(clientSock);
 				continue;
 			}
-			else {
-				client->Socket = clientSock;
-			}
 		}
+		
+		// Channel has to be ready before the worker sees the socket
+		#if SUPPORT_SHM
+		if( authhdr.key & AUTH_FLAG_SHM ) {
+			authhdr.ShmName[sizeof(authhdr.ShmName)-1] = '\0';
+			if( !Server_MapShm(client, authhdr.ShmName) )
+				authhdr.key &= ~AUTH_FLAG_SHM;
+		}
+		#else
+		authhdr.key &= ~AUTH_FLAG_SHM;
+		#endif
+		client->Socket = clientSock;
 		Log_Debug("Server", "Client given PID %i - info %p", authhdr.pid, client);
 		
 		len = send(clientSock, (void*)&authhdr, sizeof(authhdr), 0);
@@ -16,9 +16,15 @@
 // === IMPORTS ===
 extern int	Threads_Fork(void);	// AcessNative only function
 extern int	Threads_Spawn(int nFD, int FDs[], const void *info);
+extern Sint64	now_us(void);
 
 // === TYPES ===
 typedef int	(*tSyscallHandler)(Uint *Errno, const char *Format, void *Args, int *Sizes);
+typedef struct {
+	Uint64	Count;
+	Uint64	TotalUS;
+	Uint64	MaxUS;
+} tSyscallStats;
 
 // === MACROS ===
 #define SYSCALL6(_name, _fmtstr, _t0, _t1, _t2, _t3, _t4, _t5, _call) int _name(Uint*Errno,const char*Fmt,void*Args,int*Sizes){\
@@ -214,6 +220,10 @@ SYSCALL2(Syscall_SendMessage, "id", int, void *,
 	return Proc_SendMessage(a0, Sizes[1], a1);
 );
 
+SYSCALL3(Syscall_SendMessageEx, "idi", int, void *, int,
+	return Proc_SendMessageEx(a0, Sizes[1], a1, a2);
+);
+
 SYSCALL2(Syscall_GetMessage, "dd", uint32_t *, void *,
 	if( a0 && Sizes[0] < sizeof(*a0) ) {
 		Log_Notice("Syscalls", "Syscall_GetMessage - Arg 1 Undersize (%i < %i)",
@@ -235,47 +245,56 @@ SYSCALL1(Syscall_WaitEvent, "i", int,
 	return Threads_WaitEvents(a0);
 );
 
-const tSyscallHandler	caSyscalls[] = {
-	Syscall_Null,
-	Syscall_Exit,
-	Syscall_Open,
-	Syscall_Close,
-	Syscall_Read,
-	Syscall_Write,
-	Syscall_Seek,
-	Syscall_Tell,
-	Syscall_IOCtl,
-	Syscall_FInfo,
-	Syscall_ReadDir,
-	Syscall_OpenChild,
-	Syscall_GetACL,
-	Syscall_Mount,
-	NULL,	// SYS_REOPEN
-	Syscall_Chdir,
+// Indexed by call number (syscalls_list.h), gaps are unimplemented
+const tSyscallHandler	caSyscalls[N_SYSCALLS] = {
+	[SYS_NULL]	= Syscall_Null,
+	[SYS_EXIT]	= Syscall_Exit,
+	[SYS_OPEN]	= Syscall_Open,
+	[SYS_CLOSE]	= Syscall_Close,
+	[SYS_READ]	= Syscall_Read,
+	[SYS_WRITE]	= Syscall_Write,
+	[SYS_SEEK]	= Syscall_Seek,
+	[SYS_TELL]	= Syscall_Tell,
+	[SYS_IOCTL]	= Syscall_IOCtl,
+	[SYS_FINFO]	= Syscall_FInfo,
+	[SYS_READDIR]	= Syscall_ReadDir,
+	[SYS_OPENCHILD]	= Syscall_OpenChild,
+	[SYS_GETACL]	= Syscall_GetACL,
+	[SYS_MOUNT]	= Syscall_Mount,
+	[SYS_CHDIR]	= Syscall_Chdir,
 	
-	Syscall_WaitTID,
-	Syscall_SetUID,
-	Syscall_SetGID,
+	[SYS_WAITTID]	= Syscall_WaitTID,
+	[SYS_SETUID]	= Syscall_SetUID,
+	[SYS_SETGID]	= Syscall_SetGID,
 	
-	Syscall_GetTID,
-	Syscall_GetPID,
-	Syscall_GetUID,
-	Syscall_GetGID,
+	[SYS_GETTID]	= Syscall_GetTID,
+	[SYS_GETPID]	= Syscall_GetPID,
+	[SYS_GETUID]	= Syscall_GetUID,
+	[SYS_GETGID]	= Syscall_GetGID,
 
-	Syscall_Sleep,
-	Syscall_AN_Fork,
-	Syscall_AN_Spawn,
+	[SYS_SLEEP]	= Syscall_Sleep,
+	[SYS_AN_FORK]	= Syscall_AN_Fork,
+	[SYS_AN_SPAWN]	= Syscall_AN_Spawn,
 
-	Syscall_SendMessage,
-	Syscall_GetMessage,
-	Syscall_select,
-	Syscall_WaitEvent
+	[SYS_SENDMSG]	= Syscall_SendMessage,
+	[SYS_GETMSG]	= Syscall_GetMessage,
+	[SYS_SELECT]	= Syscall_select,
+	[SYS_WAITEVENT]	= Syscall_WaitEvent,
+	[SYS_SENDMSGEX]	= Syscall_SendMessageEx
 };
 const int	ciNumSyscalls = sizeof(caSyscalls)/sizeof(caSyscalls[0]);
+// Updated atomically, requests are handled by several workers at once
+tSyscallStats	gaSyscall_Stats[N_SYSCALLS];
+
+#define SHM_ALIGN(ofs)	(((ofs) + 15) & ~15)
+
 /**
  * \brief Recieve a syscall structure from the server code
+ * \param Shm	Channel that \a Request was built in, or NULL if it came from a socket
+ * \note With \a Shm, output buffers are handed to the syscall in place and the reply
+ *       is built in the channel (at Shm->ReplyOfs)
  */
-tRequestHeader *SyscallRecieve(tRequestHeader *Request, int *ReturnLength)
+tRequestHeader *SyscallRecieve(tRequestHeader *Request, int *ReturnLength, tShmChannel *Shm)
 {
 	char	formatString[Request->NParams+1];
 	char	*inData = (char*)&Request->Params[Request->NParams];
@@ -285,8 +304,10 @@ tRequestHeader *SyscallRecieve(tRequestHeader *Request, int *ReturnLength)
 	 int	retValueCount;
 	 int	retDataLen;
 	void	*returnData[Request->NParams];
+	 int	returnOfs[Request->NParams];	// Offset in Shm, or -1 if returned inline
 	 int	argSizes[Request->NParams];
 	Uint	ret_errno = 0;
+	size_t	shmFree = 0, maxReplyLen;
 	
 	// Clear errno (Acess verson) at the start of the request
 	errno = 0;
@@ -302,6 +323,8 @@ tRequestHeader *SyscallRecieve(tRequestHeader *Request, int *ReturnLength)
 		return NULL;
 	}
 
+	Sint64	startTime = now_us();
+
 	// Init return count/size
 	retValueCount = 2;
 	retDataLen = sizeof(Uint64) + sizeof(Uint32);	
@@ -344,6 +367,17 @@ tRequestHeader *SyscallRecieve(tRequestHeader *Request, int *ReturnLength)
 	}
 	formatString[i] = '\0';
 	
+	// Reserve enough of the channel for a reply with everything inline
+	maxReplyLen = sizeof(tRequestHeader) + retValueCount * sizeof(tRequestValue) + retDataLen;
+	if( Shm ) {
+		shmFree = SHM_ALIGN(Request->MessageLength);
+		if( shmFree + maxReplyLen > Shm->Size ) {
+			Log_Notice("Syscalls", "Request too large for shared memory (%i+%i > %i)",
+				(int)shmFree, (int)maxReplyLen, Shm->Size);
+			return NULL;
+		}
+	}
+	
 	LOG("Request %i(%s) '%s'", Request->CallID, casSYSCALL_NAMES[Request->CallID], formatString);
 	
 	{
@@ -353,6 +387,7 @@ tRequestHeader *SyscallRecieve(tRequestHeader *Request, int *ReturnLength)
 		for( i = 0; i < Request->NParams; i ++ )
 		{
 			returnData[i] = NULL;
+			returnOfs[i] = -1;
 			switch(Request->Params[i].Type)
 			{
 			case ARG_TYPE_VOID:
@@ -388,8 +423,21 @@ tRequestHeader *SyscallRecieve(tRequestHeader *Request, int *ReturnLength)
 				}
 				else if( Request->Params[i].Flags & ARG_FLAG_ZEROED )
 				{
-					// Allocate and zero the buffer
-					returnData[i] = calloc(1, Request->Params[i].Length);
+					size_t	len = Request->Params[i].Length;
+					if( Shm && (Request->Params[i].Flags & ARG_FLAG_RETURN)
+					 && SHM_ALIGN(shmFree + len) + maxReplyLen <= Shm->Size )
+					{
+						// Output straight into the channel, the reply just points at it
+						returnOfs[i] = shmFree;
+						returnData[i] = Shm->Data + shmFree;
+						memset(returnData[i], 0, len);
+						shmFree = SHM_ALIGN(shmFree + len);
+						retDataLen += sizeof(Uint32) - len;
+					}
+					else {
+						// Allocate and zero the buffer
+						returnData[i] = calloc(1, len);
+					}
 					//LOG("%i ZDAT: %i %p", i,
 					//	Request->Params[i].Length, returnData[i]);
 					*(void**)&argListData[argListLen] = returnData[i];
@@ -397,6 +445,11 @@ tRequestHeader *SyscallRecieve(tRequestHeader *Request, int *ReturnLength)
 				}
 				else
 				{
+					if( Shm && (Request->Params[i].Flags & ARG_FLAG_RETURN) ) {
+						// Already in the channel
+						returnOfs[i] = (char*)inData - (char*)Shm->Data;
+						retDataLen += sizeof(Uint32) - Request->Params[i].Length;
+					}
 					returnData[i] = (void*)inData;
 					//LOG("%i DATA: %i %p", i,
 					//	Request->Params[i].Length, returnData[i]);
@@ -421,7 +474,13 @@ tRequestHeader *SyscallRecieve(tRequestHeader *Request, int *ReturnLength)
 	
 	// Allocate the return
 	size_t	msglen = sizeof(tRequestHeader) + retValueCount * sizeof(tRequestValue) + retDataLen;
-	ret = malloc(msglen);
+	if( Shm ) {
+		// Space was reserved above
+		Shm->ReplyOfs = shmFree;
+		ret = (void*)(Shm->Data + shmFree);
+	}
+	else
+		ret = malloc(msglen);
 	ret->ClientID = Request->ClientID;
 	ret->CallID = Request->CallID;
 	ret->NParams = retValueCount;
@@ -459,15 +518,57 @@ tRequestHeader *SyscallRecieve(tRequestHeader *Request, int *ReturnLength)
 		LOG("Ret %i: Type %i, Len %i",
 			i, Request->Params[i].Type, Request->Params[i].Length);
 		
-		memcpy(inData, returnData[i], Request->Params[i].Length);
-		inData += Request->Params[i].Length;
-		
-		if( Request->Params[i].Flags & ARG_FLAG_ZEROED )
-			free( returnData[i] );	// Free temp buffer from above
+		if( returnOfs[i] != -1 ) {
+			ret->Params[retValueCount].Flags = ARG_FLAG_SHMOFS;
+			*(Uint32*)inData = returnOfs[i];
+			inData += sizeof(Uint32);
+		}
+		else {
+			memcpy(inData, returnData[i], Request->Params[i].Length);
+			inData += Request->Params[i].Length;
+			
+			if( Request->Params[i].Flags & ARG_FLAG_ZEROED )
+				free( returnData[i] );	// Free temp buffer from above
+		}
 		retValueCount ++;
 	}
 	
 	*ReturnLength = ret->MessageLength;
 	
+	// Update statistics (includes argument/reply marshalling)
+	{
+		tSyscallStats	*stats = &gaSyscall_Stats[Request->CallID];
+		Uint64	time = now_us() - startTime;
+		Uint64	max = __atomic_load_n(&stats->MaxUS, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&stats->Count, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&stats->TotalUS, time, __ATOMIC_RELAXED);
+		while( time > max && !__atomic_compare_exchange_n(&stats->MaxUS, &max, time,
+				0, __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+			;
+	}
+	
 	return ret;
 }
+
+/**
+ * \brief Print call counts and service times for each syscall (on shutdown)
+ */
+void Syscall_DumpStats(void)
+{
+	Log_Notice("Syscalls", "%-16s %10s %10s %8s %8s", "Call", "Count", "Total us", "Avg us", "Max us");
+	for( int i = 0; i < N_SYSCALLS; i ++ )
+	{
+		tSyscallStats	*stats = &gaSyscall_Stats[i];
+		if( stats->Count == 0 )
+			continue ;
+		#ifdef DONT_INCLUDE_SYSCALL_NAMES
+		char	name[16];
+		snprintf(name, sizeof(name), "#%i", i);
+		#else
+		const char	*name = casSYSCALL_NAMES[i];
+		#endif
+		Log_Notice("Syscalls", "%-16s %10llu %10llu %8llu %8llu", name,
+			(unsigned long long)stats->Count, (unsigned long long)stats->TotalUS,
+			(unsigned long long)(stats->TotalUS / stats->Count), (unsigned long long)stats->MaxUS);
+	}
+}
@@ -41,6 +41,7 @@ tThread	gThreadZero = {
 	.Process = &gProcessZero
 };
 tThread	*gpThreads = &gThreadZero;
+tMutex	glThreadList;	// Server workers create threads concurrently (readers walk the list unlocked)
 __thread tThread	*gpCurrentThread = &gThreadZero;
  int	giThreads_NextThreadID = 1;
 
@@ -98,18 +99,20 @@ tThread *Threads_CloneTCB(tThread *TemplateThread)
 	
 	memcpy(ret, TemplateThread, sizeof(tThread));
 	
-	ret->TID = giThreads_NextThreadID ++;
-	
 	ret->ThreadName = strdup(TemplateThread->ThreadName);
 	Threads_Glue_SemInit( &ret->EventSem, 0 );
 	
 	ret->WaitingThreads = NULL;
 	ret->WaitingThreadsEnd = NULL;
+	ret->MsgQueue = NULL;
+	ret->MsgSendWait = NULL;
 	
-	// Add to the end of the queue
-	// TODO: Handle concurrency issues
+	// Add to the start of the list, fully initialised before it's visible
+	Mutex_Acquire(&glThreadList);
+	ret->TID = giThreads_NextThreadID ++;
 	ret->GlobalNext = gpThreads;
 	gpThreads = ret;
+	Mutex_Release(&glThreadList);
 	
 	return ret;
 }
@@ -15,6 +15,7 @@ typedef void	**tShortSpinlock;
 #include <unistd.h>
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdlib.h>
 //#include "/usr/include/signal.h"
 #include <SDL/SDL.h>
 #include <pthread.h>
@@ -22,6 +23,10 @@ typedef void	**tShortSpinlock;
 
 #include <logdebug.h>	// Kernel land, but uses standards
 
+// === GLOBALS ===
+// Serialises the lazy creation of native locks (kernel locks are statically zeroed)
+static pthread_mutex_t	glThreads_Glue_InitLock = PTHREAD_MUTEX_INITIALIZER;
+
 // === CODE ===
 void Threads_Glue_Yield(void)
 {
@@ -30,11 +35,18 @@ void Threads_Glue_Yield(void)
 
 void Threads_Glue_AcquireMutex(void **Lock)
 {
-	if(!*Lock) {
-		*Lock = malloc( sizeof(pthread_mutex_t) );
-		pthread_mutex_init( *Lock, NULL );
+	pthread_mutex_t	*mutex = __atomic_load_n(Lock, __ATOMIC_ACQUIRE);
+	if( !mutex ) {
+		pthread_mutex_lock( &glThreads_Glue_InitLock );
+		mutex = *Lock;
+		if( !mutex ) {
+			mutex = malloc( sizeof(pthread_mutex_t) );
+			pthread_mutex_init( mutex, NULL );
+			__atomic_store_n(Lock, mutex, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock( &glThreads_Glue_InitLock );
 	}
-	pthread_mutex_lock( *Lock );
+	pthread_mutex_lock( mutex );
 }
 
 void Threads_Glue_ReleaseMutex(void **Lock)
@@ -74,22 +86,32 @@ int Threads_Glue_SemSignal( void *Ptr, int AmmountToAdd )
 // --------------------------------------------------------------------
 // Event handling
 // --------------------------------------------------------------------
-int RWLock_AcquireRead(tRWLock *Lock)
+// Get (creating on first use) the native rwlock stored in a kernel lock field
+static pthread_rwlock_t *RWLock_int_Native(void **Slot)
 {
-	if( !Lock->ReaderWaiting ) {
-		Lock->ReaderWaiting = malloc(sizeof(pthread_rwlock_t));
-		pthread_rwlock_init( (void*)Lock->ReaderWaiting, 0 );
+	pthread_rwlock_t	*rwl = __atomic_load_n(Slot, __ATOMIC_ACQUIRE);
+	if( !rwl ) {
+		pthread_mutex_lock( &glThreads_Glue_InitLock );
+		rwl = *Slot;
+		if( !rwl ) {
+			rwl = malloc(sizeof(pthread_rwlock_t));
+			pthread_rwlock_init( rwl, 0 );
+			__atomic_store_n(Slot, rwl, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock( &glThreads_Glue_InitLock );
 	}
-	pthread_rwlock_rdlock( (void*)Lock->ReaderWaiting );
+	return rwl;
+}
+
+// HACK: Use `Lock->ReaderWaiting` as space for the pthread lock
+int RWLock_AcquireRead(tRWLock *Lock)
+{
+	pthread_rwlock_rdlock( RWLock_int_Native((void**)&Lock->ReaderWaiting) );
 	return 0;
 }
 int RWLock_AcquireWrite(tRWLock *Lock)
 {
-	if( !Lock->ReaderWaiting ) {
-		Lock->ReaderWaiting = malloc(sizeof(pthread_rwlock_t));
-		pthread_rwlock_init( (void*)Lock->ReaderWaiting, 0 );
-	}
-	pthread_rwlock_wrlock( (void*)Lock->ReaderWaiting );
+	pthread_rwlock_wrlock( RWLock_int_Native((void**)&Lock->ReaderWaiting) );
 	return 0;
 }
 void RWLock_Release(tRWLock *Lock)
@@ -97,3 +119,24 @@ void RWLock_Release(tRWLock *Lock)
 	pthread_rwlock_unlock( (void*)Lock->ReaderWaiting );
 }
 
+// Reader-scaled locks are plain rwlocks natively
+// HACK: Use `Lock->Owner` as space for the pthread lock
+static pthread_rwlock_t *PCPURWLock_int_Native(tPCPURWLock *Lock)
+{
+	return RWLock_int_Native((void**)&Lock->Owner);
+}
+int PCPURWLock_AcquireRead(tPCPURWLock *Lock)
+{
+	pthread_rwlock_rdlock( PCPURWLock_int_Native(Lock) );
+	return 0;
+}
+int PCPURWLock_AcquireWrite(tPCPURWLock *Lock)
+{
+	pthread_rwlock_wrlock( PCPURWLock_int_Native(Lock) );
+	return 0;
+}
+void PCPURWLock_Release(tPCPURWLock *Lock)
+{
+	pthread_rwlock_unlock( PCPURWLock_int_Native(Lock) );
+}
+
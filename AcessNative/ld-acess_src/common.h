@@ -38,6 +38,7 @@ static inline int _SysSetMemFlags(uintptr_t Addr, unsigned int flags, unsigned i
 
 
 extern int	AllocateMemory(uintptr_t VirtAddr, size_t ByteCount);
+extern int	FreeMemory(uintptr_t VirtAddr, size_t ByteCount);
 extern uintptr_t	FindFreeRange(size_t ByteCount, int MaxBits);
 
 extern void	Warning(const char *Format, ...);
@@ -8,6 +8,7 @@
 #include "../../Usermode/Libraries/ld-acess.so_src/include_exp/acess/sys.h"
 #include "../syscalls.h"
 #include "exports.h"
+#include "../../Usermode/Libraries/libc.so_src/include_exp/errno.enum.h"
 #include <stdarg.h>
 #include <stddef.h>
 
@@ -23,6 +24,9 @@ extern int	fprintf(FILE *,const char *, ...);
 extern int	sprintf(char *,const char *, ...);
 extern int	vprintf(const char *, va_list);
 extern int	strncmp(const char *, const char *, size_t);
+extern void	*memcpy(void *, const void *, size_t);
+extern void	*malloc(size_t);
+extern void	free(void *);
 
 extern int	gSocket;
 extern int	giSyscall_ClientID;	// Needed for execve
@@ -32,6 +36,7 @@ extern void	_CloseSyscalls(void);
 extern void	Warning(const char *Format, ...);
 extern void	Debug(const char *Format, ...);
 extern int	AllocateMemory(uintptr_t VirtAddr, size_t ByteCount);
+extern int	FreeMemory(uintptr_t VirtAddr, size_t ByteCount);
 
 // === CONSTANTS ===
 #define NATIVE_FILE_MASK	0x40000000
@@ -95,6 +100,42 @@ size_t acess__SysWrite(int FD, const void *Src, size_t Bytes) {
 	return _Syscall(SYS_WRITE, ">i >i >d", FD, Bytes, Bytes, Src);
 }
 
+// Vectored IO is gathered into one buffer so it is still a single server request
+size_t acess__SysReadV(int FD, const t_sysIOVec *Vecs, int Count) {
+	size_t	total = 0, ret, ofs = 0;
+	for( int i = 0; i < Count; i ++ )
+		total += Vecs[i].len;
+	char	*buf = malloc(total + 1);
+	if( !buf )
+		return -1;
+	ret = acess__SysRead(FD, buf, total);
+	for( int i = 0; i < Count && ret != (size_t)-1 && ofs < ret; i ++ )
+	{
+		size_t	len = (ret - ofs < Vecs[i].len ? ret - ofs : Vecs[i].len);
+		memcpy(Vecs[i].base, buf + ofs, len);
+		ofs += len;
+	}
+	free(buf);
+	return ret;
+}
+
+size_t acess__SysWriteV(int FD, const t_sysIOVec *Vecs, int Count) {
+	size_t	total = 0, ret, ofs = 0;
+	for( int i = 0; i < Count; i ++ )
+		total += Vecs[i].len;
+	char	*buf = malloc(total + 1);
+	if( !buf )
+		return -1;
+	for( int i = 0; i < Count; i ++ )
+	{
+		memcpy(buf + ofs, Vecs[i].base, Vecs[i].len);
+		ofs += Vecs[i].len;
+	}
+	ret = acess__SysWrite(FD, buf, total);
+	free(buf);
+	return ret;
+}
+
 int acess__SysSeek(int FD, int64_t Ofs, int Dir)
 {
 	if(FD & NATIVE_FILE_MASK) {
@@ -229,6 +270,23 @@ uint64_t acess__SysAllocate(uintptr_t vaddr)
 	return vaddr;	// Just ignore the need for paddrs :)
 }
 
+void *acess__SysMMap(void *addr, size_t length, unsigned int protflags, int fd, uint64_t offset)
+{
+	// Only anonymous memory, MMAP_MAP_HUGE is left to the host
+	if( !((protflags >> 16) & MMAP_MAP_ANONYMOUS) ) {
+		Warning("_SysMMap: File mappings are not supported");
+		return NULL;
+	}
+	if( AllocateMemory((uintptr_t)addr, length) == -1 )
+		return NULL;
+	return addr;
+}
+
+int acess__SysMUnmap(void *addr, size_t length)
+{
+	return FreeMemory((uintptr_t)addr, length);
+}
+
 // --- Process Management ---
 int acess__SysClone(int flags, void *stack)
 {
@@ -274,7 +332,8 @@ int acess__SysKill(int pid, int sig)
 
 int acess__SysExecVE(char *path, char **argv, const char **envp)
 {
-	 int	i, argc;
+	 int	i, argc, n;
+	extern int	gbRequest_UseShm;
 	
 	DEBUG("acess_execve: (path='%s', argv=%p, envp=%p)", path, argv, envp);
 	
@@ -282,7 +341,7 @@ int acess__SysExecVE(char *path, char **argv, const char **envp)
 	for( argc = 0; argv[argc]; argc ++ ) ;
 	DEBUG(" acess_execve: argc = %i", argc);
 
-	const char	*new_argv[7+argc+1];
+	const char	*new_argv[8+argc+1];
 	char	client_id_str[11];
 	char	socket_fd_str[11];
 	sprintf(client_id_str, "%i", giSyscall_ClientID);
@@ -292,13 +351,16 @@ int acess__SysExecVE(char *path, char **argv, const char **envp)
 	new_argv[2] = client_id_str;
 	new_argv[3] = "--socket";	// Socket
 	new_argv[4] = socket_fd_str;
-	new_argv[5] = "--binary";	// Set the binary path (instead of using argv[0])
-	new_argv[6] = path;
-	for( i = 0; i < argc; i ++ )	new_argv[7+i] = argv[i];
-	new_argv[7+i] = NULL;
+	n = 5;
+	if( gbRequest_UseShm )
+		new_argv[n++] = "--shm";	// Re-attach to the shared memory channel
+	new_argv[n++] = "--binary";	// Set the binary path (instead of using argv[0])
+	new_argv[n++] = path;
+	for( i = 0; i < argc; i ++ )	new_argv[n+i] = argv[i];
+	new_argv[n+i] = NULL;
 	
 	#if 1
-	argc += 7;
+	argc += n;
 	for( i = 0; i < argc; i ++ )
 		printf("\"%s\" ", new_argv[i]);
 	printf("\n");
@@ -374,6 +436,12 @@ int acess__SysSendMessage(int DestTID, int Length, void *Data)
 	return _Syscall(SYS_SENDMSG, ">i >d", DestTID, Length, Data);
 }
 
+int acess__SysSendMessageEx(int DestTID, int Length, void *Data, int Flags)
+{
+	DEBUG("%s(%i, 0x%x, %p, 0x%x)", __func__, DestTID, Length, Data, Flags);
+	return _Syscall(SYS_SENDMSGEX, ">i >d >i", DestTID, Length, Data, Flags);
+}
+
 int acess__SysGetMessage(int *SourceTID, int BufLen, void *Data)
 {
 	DEBUG("%s(%p, %p)", __func__, SourceTID, Data);
@@ -383,6 +451,23 @@ int acess__SysGetMessage(int *SourceTID, int BufLen, void *Data)
 		);
 }
 
+int acess__SysFutex(volatile uint32_t *Address, int Op, uint32_t Value, const int64_t *Timeout)
+{
+	// Address is in our own (native) address space, no need to involve the server
+	 int	rv = native_futex(Address, Op, Value, Timeout);
+	if( rv < 0 ) {
+		switch(-rv)
+		{
+		case NATIVE_FUTEX_ETIMEDOUT:	acess__errno = ETIMEDOUT;	break;
+		case NATIVE_FUTEX_EAGAIN:	acess__errno = EAGAIN;	break;
+		case NATIVE_FUTEX_EINTR:	acess__errno = EINTR;	break;
+		default:	acess__errno = EINVAL;	break;
+		}
+		return -1;
+	}
+	return rv;
+}
+
 int acess__SysWaitEvent(int Mask)
 {
 	DEBUG("%s(%x)", __func__, Mask);
@@ -431,6 +516,8 @@ const tSym	caBuiltinSymbols[] = {
 	DEFSYM(_SysClose),
 	DEFSYM(_SysRead),
 	DEFSYM(_SysWrite),
+	DEFSYM(_SysReadV),
+	DEFSYM(_SysWriteV),
 	DEFSYM(_SysSeek),
 	DEFSYM(_SysTell),
 	DEFSYM(_SysIOCtl),
@@ -446,6 +533,7 @@ const tSym	caBuiltinSymbols[] = {
 //	DEFSYM(sleep),
 	
 	DEFSYM(_SysWaitTID),
+	DEFSYM(_SysFutex),
 	DEFSYM(gettid),
 	DEFSYM(_SysGetPID),
 	DEFSYM(setuid),
@@ -454,9 +542,12 @@ const tSym	caBuiltinSymbols[] = {
 	DEFSYM(getgid),
 
 	DEFSYM(_SysSendMessage),
+	DEFSYM(_SysSendMessageEx),
 	DEFSYM(_SysGetMessage),
 	
 	DEFSYM(_SysAllocate),
+	DEFSYM(_SysMMap),
+	DEFSYM(_SysMUnmap),
 	DEFSYM(_SysSetMemFlags),
 	DEFSYM(_SysDebug),
 	DEFSYM(_SysSetFaultHandler),
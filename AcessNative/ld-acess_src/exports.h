@@ -25,6 +25,18 @@ extern uint64_t	native_tell(int FD);
 extern int	native_execve(const char *filename, const char *const argv[], const char *const envp[]);
 extern int	native_spawn(const char *filename, const char *const argv[], const char *const envp[]);
 
+/**
+ * \brief Host-independent failure codes from native_futex (returned negated)
+ * \note syscalls.c sees the host errno.h, exports.c sees Acess' - these bridge the two
+ */
+enum eNativeFutexErrors {
+	NATIVE_FUTEX_EOTHER = 1,
+	NATIVE_FUTEX_ETIMEDOUT,
+	NATIVE_FUTEX_EAGAIN,
+	NATIVE_FUTEX_EINTR
+};
+extern int	native_futex(volatile uint32_t *Address, int Op, uint32_t Value, const int64_t *Timeout);
+
 // Syscalls used by the linker
 extern int	acess__SysOpen(const char *Path, int Flags);
 extern void	acess__SysClose(int FD);
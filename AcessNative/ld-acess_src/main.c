@@ -9,6 +9,7 @@
 // === IMPORTS ===
 extern int	gSocket;
 extern int	giSyscall_ClientID;
+extern int	gbRequest_UseShm;
 extern void	acess__exit(int Status);
 extern void	Request_Preinit(void);
 
@@ -47,6 +48,11 @@ int main(int argc, char *argv[], char **envp)
 			continue ;
 		}
 		
+		if(strcmp(argv[i], "--shm") == 0) {
+			gbRequest_UseShm = 1;
+			continue ;
+		}
+		
 		if(strcmp(argv[i], "--binary") == 0) {
 			appPath = argv[++i];
 			continue ;
@@ -68,6 +74,7 @@ int main(int argc, char *argv[], char **envp)
 			"Usage: ld-acess <executable> [arguments ...]\n"
 			"\n"
 			"--key\t(internal) used to pass the system call handle when run with execve\n"
+			"--shm\t(internal) use the shared memory channel set up before execve\n"
 			"--binary\tLoad a local binary directly\n"
 			"--open\tOpen a file before executing\n"
 			);
@@ -12,6 +12,7 @@
 
 // === PROTOTYPES ===
  int	AllocateMemory(uintptr_t VirtAddr, size_t ByteCount);
+ int	FreeMemory(uintptr_t VirtAddr, size_t ByteCount);
 uintptr_t	FindFreeRange(size_t ByteCount, int MaxBits);
 
 // === CODE ===
@@ -56,6 +57,23 @@ int AllocateMemory(uintptr_t VirtAddr, size_t ByteCount)
 	return 0;
 }
 
+int FreeMemory(uintptr_t VirtAddr, size_t ByteCount)
+{
+	uintptr_t	base = (VirtAddr >> 12) << 12;
+	size_t	size = (VirtAddr & 0xFFF) + ByteCount;
+	#if __WIN32__
+	// Pages can only be decommitted, the reservation stays
+	if( !VirtualFree((void*)base, size, MEM_DECOMMIT) )
+		return -1;
+	#else
+	if( munmap((void*)base, size) ) {
+		perror("FreeMemory");
+		return -1;
+	}
+	#endif
+	return 0;
+}
+
 uintptr_t FindFreeRange(size_t ByteCount, int MaxBits)
 {
 	uintptr_t	base, ofs, size;
@@ -24,12 +24,24 @@
 #endif
 #include "request.h"
 #include "../syscalls.h"
+#ifdef __linux__
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <errno.h>
+# include "../shm_channel.h"
+# define SUPPORT_SHM	1
+#else
+# define SUPPORT_SHM	0
+#endif
 
 #define USE_TCP	1
 
 // === PROTOTYPES ===
 void	SendData(void *Data, int Length);
  int	ReadData(void *Dest, int MaxLen, int Timeout);
+#if SUPPORT_SHM
+ int	Request_MapShm(int bCreate);
+#endif
 
 // === GLOBALS ===
 #ifdef __WIN32__
@@ -43,6 +55,12 @@ SOCKET	gSocket = INVALID_SOCKET;
 // TODO: Implement such that each thread gets a different one
  int	giSyscall_ClientID = 0;
 struct sockaddr_in	gSyscall_ServerAddr;
+// Use a shared memory channel instead of sending requests over the socket
+// - Set by ACESSNATIVE_TRANSPORT=shm, or --shm (passed on by acess__SysExecVE)
+ int	gbRequest_UseShm;
+#if SUPPORT_SHM
+tShmChannel	*gpRequest_Shm;
+#endif
 
 // === CODE ===
 void Request_Preinit(void)
@@ -52,8 +70,59 @@ void Request_Preinit(void)
 	gSyscall_ServerAddr.sin_family = AF_INET;
 	gSyscall_ServerAddr.sin_port = htons(SERVER_PORT);
 	gSyscall_ServerAddr.sin_addr.s_addr = htonl(0x7F000001);
+	
+	const char *transport = getenv("ACESSNATIVE_TRANSPORT");
+	if( transport && strcmp(transport, "shm") == 0 )
+		gbRequest_UseShm = SUPPORT_SHM;
 }
 
+#if SUPPORT_SHM
+/**
+ * \brief Create (or attach to, after an execve) this process's shared memory channel
+ * \return Boolean success
+ */
+int Request_MapShm(int bCreate)
+{
+	char	name[32];
+	 int	fd;
+	
+	// Named after the host PID, which execve keeps
+	snprintf(name, sizeof(name), "/AcessNative.%i", (int)getpid());
+	if( bCreate ) {
+		fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+		if( fd == -1 && errno == EEXIST ) {
+			// Left behind by a crashed process with the same PID
+			shm_unlink(name);
+			fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+		}
+		if( fd != -1 && ftruncate(fd, sizeof(tShmChannel) + SHM_CHANNEL_SIZE) == -1 ) {
+			close(fd);
+			shm_unlink(name);
+			fd = -1;
+		}
+	}
+	else
+		fd = shm_open(name, O_RDWR, 0);
+	if( fd == -1 ) {
+		perror("Request_MapShm - shm_open");
+		return 0;
+	}
+	
+	gpRequest_Shm = mmap(NULL, sizeof(tShmChannel) + SHM_CHANNEL_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if( gpRequest_Shm == MAP_FAILED ) {
+		perror("Request_MapShm - mmap");
+		gpRequest_Shm = NULL;
+		if( bCreate )
+			shm_unlink(name);
+		return 0;
+	}
+	if( bCreate )
+		gpRequest_Shm->Size = SHM_CHANNEL_SIZE;
+	return 1;
+}
+#endif
+
 int _InitSyscalls(void)
 {
 	#ifdef __WIN32__
@@ -120,8 +189,15 @@ int _InitSyscalls(void)
 	#if USE_TCP
 	{
 		tRequestAuthHdr auth;
+		memset(&auth, 0, sizeof(auth));
 		auth.pid = giSyscall_ClientID;
 		auth.key = 0;
+		#if SUPPORT_SHM
+		if( gbRequest_UseShm && Request_MapShm(1) ) {
+			auth.key |= AUTH_FLAG_SHM;
+			snprintf(auth.ShmName, sizeof(auth.ShmName), "/AcessNative.%i", (int)getpid());
+		}
+		#endif
 		SendData(&auth, sizeof(auth));
 		int len = ReadData(&auth, sizeof(auth), 5);
 		if( len == 0 ) { 
@@ -129,6 +205,15 @@ int _InitSyscalls(void)
 			exit(-1);
 		}
 		giSyscall_ClientID = auth.pid;
+		#if SUPPORT_SHM
+		// Server couldn't map it, stick to the socket
+		if( gpRequest_Shm && !(auth.key & AUTH_FLAG_SHM) ) {
+			munmap(gpRequest_Shm, sizeof(tShmChannel) + SHM_CHANNEL_SIZE);
+			gpRequest_Shm = NULL;
+			shm_unlink(auth.ShmName);
+		}
+		gbRequest_UseShm = (gpRequest_Shm != NULL);
+		#endif
 	}
 	#else
 	// Ask server for a client ID
@@ -167,10 +252,89 @@ void _CloseSyscalls(void)
 	#else
 	close(gSocket);
 	#endif
+	#if SUPPORT_SHM
+	// Parent's channel (after fork), the server removes the name once the socket closes
+	if( gpRequest_Shm ) {
+		munmap(gpRequest_Shm, sizeof(tShmChannel) + SHM_CHANNEL_SIZE);
+		gpRequest_Shm = NULL;
+	}
+	#endif
 }
 
-int SendRequest(tRequestHeader *Request, int RequestSize, int ResponseSize)
+/**
+ * \brief Get a buffer to build a request in
+ * \param RequestSize	Size of the request message
+ * \param ResponseSize	Largest possible reply (with all returned data inline)
+ * \note The request is built directly in the shared memory channel if it will fit
+ */
+void *Request_AllocBuffer(size_t RequestSize, size_t ResponseSize)
 {
+	#if SUPPORT_SHM
+	if( gSocket == INVALID_SOCKET )
+		_InitSyscalls();
+	if( gbRequest_UseShm && !gpRequest_Shm && !Request_MapShm(0) )
+		gbRequest_UseShm = 0;
+	// Request, output buffers and the reply (plus alignment)
+	if( gpRequest_Shm && RequestSize + 2*ResponseSize + 64 <= gpRequest_Shm->Size )
+		return gpRequest_Shm->Data;
+	#endif
+	return malloc( RequestSize > ResponseSize ? RequestSize : ResponseSize );
+}
+
+void Request_FreeBuffer(void *Buffer)
+{
+	#if SUPPORT_SHM
+	if( gpRequest_Shm && Buffer == gpRequest_Shm->Data )
+		return ;
+	#endif
+	free(Buffer);
+}
+
+/**
+ * \brief Convert an ARG_FLAG_SHMOFS reply value into a pointer
+ */
+void *Request_ShmData(uint32_t Offset)
+{
+	#if SUPPORT_SHM
+	if( gpRequest_Shm && Offset < gpRequest_Shm->Size )
+		return gpRequest_Shm->Data + Offset;
+	#endif
+	fprintf(stderr, "[ERROR %i] Bad shared memory offset 0x%x in reply\n", giSyscall_ClientID, Offset);
+	exit(-1);
+}
+
+#if SUPPORT_SHM
+/**
+ * \brief Pass a request built by Request_AllocBuffer through the channel
+ * \return Request, now holding the reply
+ */
+static tRequestHeader *SendRequest_Shm(tRequestHeader *Request)
+{
+	tShmChannel	*ch = gpRequest_Shm;
+	uint32_t	seq = ch->RespSeq;
+	
+	Shm_Signal(&ch->ReqSeq, &ch->ServerWaiting);
+	if( Request->CallID == SYS_EXIT )	return Request;
+	
+	// Wait for the reply, checking that the server is still there every so often
+	while( !Shm_Wait(&ch->RespSeq, seq, &ch->ClientWaiting, 1000) )
+	{
+		char	tmp;
+		if( recv(gSocket, &tmp, 1, MSG_PEEK|MSG_DONTWAIT) == 0 ) {
+			fprintf(stderr, "[ERROR %i] Connection closed.\n", giSyscall_ClientID);
+			exit(0);
+		}
+	}
+	return (void*)(ch->Data + ch->ReplyOfs);
+}
+#endif
+
+int SendRequest(tRequestHeader **RequestPtr, int RequestSize, int ResponseSize)
+{
+	tRequestHeader	*Request = *RequestPtr;
+	#if SUPPORT_SHM
+	 int	bShmSocket = 0;	// Too large for the channel, server is told to read the socket
+	#endif
 	if( gSocket == INVALID_SOCKET )
 	{
 		_InitSyscalls();		
@@ -221,8 +385,25 @@ int SendRequest(tRequestHeader *Request, int RequestSize, int ResponseSize)
 	}
 	#endif
 	
+	#if SUPPORT_SHM
+	if( gpRequest_Shm )
+	{
+		if( (void*)Request == gpRequest_Shm->Data ) {
+			*RequestPtr = Request = SendRequest_Shm(Request);
+			if( Request->CallID == SYS_EXIT )	return 0;
+			goto _reply;
+		}
+		gpRequest_Shm->Flags |= SHM_FLAG_SOCKET;
+		bShmSocket = 1;
+	}
+	#endif
+	
 	// Send it off
 	SendData(Request, RequestSize);
+	#if SUPPORT_SHM
+	if( bShmSocket )
+		Shm_Signal(&gpRequest_Shm->ReqSeq, &gpRequest_Shm->ServerWaiting);
+	#endif
 
 	if( Request->CallID == SYS_EXIT )	return 0;
 
@@ -244,6 +425,11 @@ int SendRequest(tRequestHeader *Request, int RequestSize, int ResponseSize)
 		// TODO: Warning
 	}
 	
+	#if SUPPORT_SHM
+	if( bShmSocket )
+		gpRequest_Shm->Flags &= ~SHM_FLAG_SOCKET;
+_reply:
+	#endif
 	#if DEBUG
 	{
 		 int	i;
@@ -267,7 +453,9 @@ int SendRequest(tRequestHeader *Request, int RequestSize, int ResponseSize)
 				break;
 			case ARG_TYPE_DATA:
 				DEBUG_S(" %p:0x%x", (char*)data, Request->Params[i].Length);
-				if( !(Request->Params[i].Flags & ARG_FLAG_ZEROED) )
+				if( Request->Params[i].Flags & ARG_FLAG_SHMOFS )
+					data += sizeof(uint32_t);
+				else if( !(Request->Params[i].Flags & ARG_FLAG_ZEROED) )
 					data += Request->Params[i].Length;
 				break;
 			}
@@ -275,7 +463,7 @@ int SendRequest(tRequestHeader *Request, int RequestSize, int ResponseSize)
 		DEBUG_S("\n");
 	}
 	#endif
-	return recvbytes;
+	return Request->MessageLength;
 }
 
 void SendData(void *Data, int Length)
@@ -10,6 +10,9 @@
 
 #include "../syscalls.h"
 
-extern int	SendRequest(tRequestHeader *Request, int RequestSize, int ResponseSize);
+extern int	SendRequest(tRequestHeader **Request, int RequestSize, int ResponseSize);
+extern void	*Request_AllocBuffer(size_t RequestSize, size_t ResponseSize);
+extern void	Request_FreeBuffer(void *Buffer);
+extern void	*Request_ShmData(uint32_t Offset);
 
 #endif
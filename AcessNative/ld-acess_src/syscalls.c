@@ -12,7 +12,14 @@
 #ifndef __WIN32__
 # include <spawn.h>	// posix_spawn
 #endif
+#ifdef __linux__
+# include <errno.h>
+# include <sys/syscall.h>	// SYS_futex
+# include <linux/futex.h>
+# include <time.h>
+#endif
 #include "request.h"
+#include "exports.h"
 
 #if SYSCALL_TRACE
 #define DEBUG(str, x...)	Debug(str, x)
@@ -174,6 +181,7 @@ uint64_t _Syscall(int SyscallID, const char *ArgTypes, ...)
 	void	**retPtrs;	// Pointers to return buffers
 	const char	*str;
 	tRequestHeader	*req;
+	void	*reqBuf;	// req is replaced by the reply, which may be elsewhere in the channel
 	void	*dataPtr;
 	uint64_t	retValue;
 	 int	i;
@@ -213,10 +221,7 @@ uint64_t _Syscall(int SyscallID, const char *ArgTypes, ...)
 	
 	// Allocate buffers
 	retPtrs = malloc( sizeof(void*) * (retCount+1) );
-	if( dataLength > retLength)
-		req = malloc( dataLength );
-	else
-		req = malloc( retLength );
+	reqBuf = req = Request_AllocBuffer( dataLength, retLength );
 	req->ClientID = 0;	//< Filled later
 	req->CallID = SyscallID;
 	req->NParams = paramCount;
@@ -244,7 +249,7 @@ uint64_t _Syscall(int SyscallID, const char *ArgTypes, ...)
 	va_end(args);
 	
 	// --- Send syscall request
-	if( SendRequest(req, dataLength, retLength) < 0 ) {
+	if( SendRequest(&req, dataLength, retLength) < 0 ) {
 		fprintf(stderr, "syscalls.c: SendRequest failed (SyscallID = %i)\n", SyscallID);
 		exit(127);
 	}
@@ -279,11 +284,17 @@ uint64_t _Syscall(int SyscallID, const char *ArgTypes, ...)
 		printf("\n");
 		#endif
 		assert( req->Params[i].Type == ARG_TYPE_DATA );
+		if( req->Params[i].Flags & ARG_FLAG_SHMOFS ) {
+			// Left in the shared memory channel
+			memcpy( retPtrs[retCount++], Request_ShmData(*(uint32_t*)dataPtr), req->Params[i].Length );
+			dataPtr += sizeof(uint32_t);
+			continue ;
+		}
 		memcpy( retPtrs[retCount++], dataPtr, req->Params[i].Length );
 		dataPtr += req->Params[i].Length;
 	}
 	
-	free( req );
+	Request_FreeBuffer( reqBuf );
 	free( retPtrs );
 	
 	DEBUG(": %i 0x%llx", SyscallID, retValue);
@@ -354,3 +365,43 @@ int native_spawn(const char *filename, const char *const argv[], const char *con
 	
 	return rv;
 }
+
+int native_futex(volatile uint32_t *Address, int Op, uint32_t Value, const int64_t *Timeout)
+{
+	#ifdef __linux__
+	struct timespec	ts, *tsp = NULL;
+	 int	rv;
+	if( Timeout ) {
+		ts.tv_sec = *Timeout / 1000;
+		ts.tv_nsec = (*Timeout % 1000) * 1000000;
+		tsp = &ts;
+	}
+	switch(Op)
+	{
+	case 0:	// FUTEX_WAIT
+		rv = syscall(SYS_futex, Address, FUTEX_WAIT, Value, tsp, NULL, 0);
+		break;
+	case 1:	// FUTEX_WAKE
+		rv = syscall(SYS_futex, Address, FUTEX_WAKE, Value, NULL, NULL, 0);
+		break;
+	default:
+		return -NATIVE_FUTEX_EOTHER;
+	}
+	if( rv < 0 ) {
+		switch(errno)
+		{
+		case ETIMEDOUT:	return -NATIVE_FUTEX_ETIMEDOUT;
+		case EAGAIN:	return -NATIVE_FUTEX_EAGAIN;
+		case EINTR:	return -NATIVE_FUTEX_EINTR;
+		default:	return -NATIVE_FUTEX_EOTHER;
+		}
+	}
+	return rv;
+	#else
+	// No threads share memory under native, so nobody could wake us
+	if( Op == 0 && *Address == Value && !Timeout ) {
+		Warning("native_futex: Wait with no possible waker");
+	}
+	return Op == 0 ? -NATIVE_FUTEX_EAGAIN : 0;
+	#endif
+}
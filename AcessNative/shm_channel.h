@@ -0,0 +1,57 @@
+/*
+ * Acess2 - AcessNative
+ *
+ * shm_channel.h
+ * - Wait/wake on a tShmChannel sequence counter (shared by ld-acess and the server)
+ */
+#ifndef _NATIVE_SHM_CHANNEL_H_
+#define _NATIVE_SHM_CHANNEL_H_
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "syscalls.h"
+
+// Polls before sleeping, most syscalls finish quicker than a futex round trip
+#define SHM_SPIN_COUNT	4000
+
+/**
+ * \brief Publish a request/reply and wake the other side if it's asleep
+ */
+static inline void Shm_Signal(volatile uint32_t *Seq, volatile uint32_t *PeerWaiting)
+{
+	__atomic_add_fetch(Seq, 1, __ATOMIC_SEQ_CST);
+	// Pairs with the store in Shm_Wait, one of the two sides sees the other's write
+	if( __atomic_load_n(PeerWaiting, __ATOMIC_SEQ_CST) )
+		syscall(SYS_futex, Seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/**
+ * \brief Wait for \a Seq to move on from \a Old
+ * \param TimeoutMS	Give up after this long (0 for no timeout)
+ * \return Boolean, false on timeout (which may be early)
+ */
+static inline int Shm_Wait(volatile uint32_t *Seq, uint32_t Old, volatile uint32_t *Waiting, int TimeoutMS)
+{
+	struct timespec	ts = {TimeoutMS / 1000, (TimeoutMS % 1000) * 1000000};
+
+	for( int i = 0; i < SHM_SPIN_COUNT; i ++ )
+	{
+		if( __atomic_load_n(Seq, __ATOMIC_ACQUIRE) != Old )
+			return 1;
+	}
+
+	__atomic_store_n(Waiting, 1, __ATOMIC_SEQ_CST);
+	while( __atomic_load_n(Seq, __ATOMIC_SEQ_CST) == Old )
+	{
+		syscall(SYS_futex, Seq, FUTEX_WAIT, Old, (TimeoutMS ? &ts : NULL), NULL, 0);
+		// Timed out (or a spurious wakeup), either way let the caller check on the other side
+		if( TimeoutMS )
+			break;
+	}
+	__atomic_store_n(Waiting, 0, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(Seq, __ATOMIC_ACQUIRE) != Old;
+}
+
+#endif
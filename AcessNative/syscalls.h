@@ -16,9 +16,41 @@
 
 typedef struct {
 	uint32_t	pid;
-	uint32_t	key;
+	uint32_t	key;	//!< \see eAuthFlags
+	char	ShmName[32];	//!< Shared memory channel to use instead of the socket (AUTH_FLAG_SHM)
 } tRequestAuthHdr;
 
+enum eAuthFlags {
+	AUTH_FLAG_SHM = 0x1	// Set by the server in the reply if it mapped the channel
+};
+
+/*
+ * Shared memory transport (ACESSNATIVE_TRANSPORT=shm)
+ *
+ * The request is built at Data[0] and ReqSeq incremented. The server places
+ * output buffers after it (passed back by offset, see ARG_FLAG_SHMOFS), writes
+ * the reply at Data[ReplyOfs] and increments RespSeq. The socket is still used
+ * for the initial handshake, for requests too large for the channel (flagged
+ * with SHM_FLAG_SOCKET) and to detect the client going away.
+ */
+#define SHM_CHANNEL_SIZE	(4*1024*1024)
+
+typedef struct sShmChannel {
+	volatile uint32_t	ReqSeq;
+	volatile uint32_t	RespSeq;
+	volatile uint32_t	ServerWaiting;	//!< Server is (about to be) in FUTEX_WAIT on ReqSeq
+	volatile uint32_t	ClientWaiting;	//!< Client is (about to be) in FUTEX_WAIT on RespSeq
+	volatile uint32_t	Flags;	//!< \see eShmFlags
+	uint32_t	ReplyOfs;
+	uint32_t	Size;	//!< Bytes available in Data
+	uint32_t	Reserved;
+	uint8_t	Data[] __attribute__((aligned(16)));
+} tShmChannel;
+
+enum eShmFlags {
+	SHM_FLAG_SOCKET = 0x1	// This request is being sent over the socket instead
+};
+
 typedef struct sRequestValue {
 	/// \see eArgumentTypes
 	uint16_t	Type;
@@ -61,7 +93,8 @@ enum eArgumentTypes {
 };
 enum eArgumentFlags {
 	ARG_FLAG_RETURN = 0x40,	// Pass back in the return message
-	ARG_FLAG_ZEROED = 0x80	// Not present in the message, just fill with zero
+	ARG_FLAG_ZEROED = 0x80,	// Not present in the message, just fill with zero
+	ARG_FLAG_SHMOFS = 0x100	// (Reply) Data is a uint32_t offset into the shared memory channel
 };
 
 #endif
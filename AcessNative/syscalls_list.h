@@ -36,4 +36,5 @@ _(SYS_SENDMSG),
 _(SYS_GETMSG),
 _(SYS_SELECT),
 _(SYS_WAITEVENT),
+_(SYS_SENDMSGEX),
 
@@ -1,5 +1,14 @@
 #!/usr/bin/perl
 #
+# Generates include/syscalls.h, include/syscalls.inc.asm and include/syscalls_args.h
+#
+# syscalls.lst lines are "NAME<tab>Description", optionally followed by "| <args>",
+# a comma separated list of argument descriptors checked before the call is run
+# (see SARG_* in syscalls.c):
+#   INT          Not checked
+#   STR, STR0    NUL terminated user string (STR0 allows NULL)
+#   BUF(n)       User buffer, sized by argument n (BUF0 allows NULL)
+#   PTR(size)    User object of a fixed size (PTR0 allows NULL)
 #
 
 open(FILE, "syscalls.lst");
@@ -8,13 +17,13 @@ $num = 0;
 @calls = ();
 while($_ = <FILE>)
 {
-	if(/(\d+)/)
+	if(/^(\d+)/)
 	{
 		$num = $1;
 	}
-	elsif(/([A-Z_]+)\s+(.+)/)
+	elsif(/^([A-Z_]+)\s+(.+?)(?:\s+\|\s*(.+?))?\s*$/)
 	{
-		push @calls, [$num, $1, $2];
+		push @calls, [$num, $1, $2, $3];
 		$num ++;
 	}
 }
@@ -85,3 +94,31 @@ foreach $call (@calls)
 	print ASM "%define ", $call->[1], "\t", $call->[0], "\t ;", $call->[2], "\n";
 }
 close(ASM);
+
+# Argument descriptors (kernel only)
+open(ARGS, ">include/syscalls_args.h");
+print ARGS "/*
+ * Acess2 Kernel
+ * - By John Hodge (thePowersGang)
+ *
+ * syscalls_args.h
+ * - System Call Argument Descriptors (included by syscalls.c)
+ *
+ * NOTE: Generated from Kernel/syscalls.lst
+ */
+#ifndef _SYSCALLS_ARGS_H
+#define _SYSCALLS_ARGS_H
+
+static const tSyscallArgs caSyscallArgs[NUM_SYSCALLS] = {
+";
+foreach $call (@calls)
+{
+	next unless defined $call->[3];
+	my @args = map { "SARG_".$_ } split(/\s*,\s*/, $call->[3]);
+	print ARGS "\t[", $call->[1], "] = {", join(", ", @args), "},\n";
+}
+print ARGS "};
+
+#endif
+";
+close(ARGS);
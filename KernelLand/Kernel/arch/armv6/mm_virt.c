@@ -765,6 +765,16 @@ void MM_ClearUser(void)
 //	MM_DumpTables(0, 0x80000000);
 }
 
+/**
+ * \brief Count the resident user pages of a process
+ * \todo Not implemented on this architecture (user pages aren't accounted)
+ */
+void MM_CountUserPages(tProcess *Process, size_t *Shared, size_t *Private)
+{
+	*Shared = 0;
+	*Private = 0;
+}
+
 void *MM_MapTemp(tPAddr PAddr)
 {
 	tVAddr	ret;
@@ -39,6 +39,12 @@ tPAddr MM_Allocate(tVAddr Dest)
 	return Dest;
 }
 
+tPAddr MM_AllocateZero(tVAddr Dest)
+{
+	memset((void*)Dest, 0, PAGE_SIZE);
+	return Dest;
+}
+
 void MM_Deallocate(tVAddr Addr)
 {
 }
@@ -47,6 +53,16 @@ void MM_ClearUser(void)
 {
 }
 
+/**
+ * \brief Count the resident user pages of a process
+ * \todo Not implemented on this architecture (user pages aren't accounted)
+ */
+void MM_CountUserPages(tProcess *Process, size_t *Shared, size_t *Private)
+{
+	*Shared = 0;
+	*Private = 0;
+}
+
 void MM_DumpTables(tVAddr Start, tVAddr End)
 {
 
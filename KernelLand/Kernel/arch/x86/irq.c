@@ -3,6 +3,7 @@
  * irq.c
  */
 #include <acess.h>
+#include <trace.h>
 
 // === CONSTANTS ===
 #define	MAX_CALLBACKS_PER_IRQ	4
@@ -29,6 +30,7 @@ void IRQ_Handler(tRegs *Regs)
 	 int	bHandled = 0;
 
 	//Log("IRQ_Handler: (Regs={int_num:%i})", Regs->int_num);
+	TRACE_POINT1(TRACE_EV_IRQ, irq);
 
 	for( i = 0; i < MAX_CALLBACKS_PER_IRQ; i++ )
 	{
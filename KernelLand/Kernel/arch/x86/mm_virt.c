@@ -16,6 +16,8 @@
 #include <mm_phys.h>
 #include <proc.h>
 #include <hal_proc.h>
+#include <trace.h>
+#include <vfs_threads.h>
 #include <arch_int.h>
 
 #define TAB	22
@@ -96,6 +98,7 @@ tPAddr	MM_DuplicatePage(tVAddr VAddr);
 #define gaPAE_TmpDir	((tTabEnt*)PAE_TMP_DIR_ADDR)
 #define gaPAE_TmpPDPT	((tTabEnt*)PAE_TMP_PDPT_ADDR)
  int	gbUsePAE = 0;
+tPAddr	gMM_ZeroPage;
 tMutex	glTempMappings;
 tMutex	glTempFractal;
 Uint32	gWorkerStacks[(NUM_WORKER_STACKS+31)/32];
@@ -165,6 +168,7 @@ void MM_FinishVirtualInit(void)
 void MM_PageFault(tVAddr Addr, Uint ErrorCode, tRegs *Regs)
 {
 	//ENTER("xAddr bErrorCode", Addr, ErrorCode);
+	TRACE_POINT3(TRACE_EV_PAGEFAULT, Addr, ErrorCode, Regs->eip);
 	
 	// -- Check for COW --
 	if( gaPageDir  [Addr>>22] & PF_PRESENT  && gaPageTable[Addr>>12] & PF_PRESENT
@@ -192,6 +196,14 @@ void MM_PageFault(tVAddr Addr, Uint ErrorCode, tRegs *Regs)
 		return;
 	}
 
+	// Demand-paged file mapping (only if IRQs were on, the fill can sleep)
+	if( !(ErrorCode & 1) && Addr < USER_MAX && (Regs->eflags & 0x200) )
+	{
+		__asm__ __volatile__ ("sti");
+		if( VFS_MMap_PageFault(Addr, ErrorCode & 2) == 0 )
+			return ;
+	}
+
 	// Disable instruction tracing	
 	__ASM__("pushf; andw $0xFEFF, 0(%esp); popf");
 	Proc_GetCurThread()->bInstrTrace = 0;
@@ -389,6 +401,25 @@ tPAddr MM_Allocate(tVAddr VAddr)
 	return paddr;
 }
 
+/**
+ * \brief Map the shared zero page (COW) at \a VAddr
+ */
+tPAddr MM_AllocateZero(tVAddr VAddr)
+{
+	if( !gMM_ZeroPage ) {
+		gMM_ZeroPage = MM_Allocate(VAddr);
+		if( !gMM_ZeroPage )
+			return 0;
+		MM_RefPhys(gMM_ZeroPage);	// Never free the zero page
+		memset((void*)VAddr, 0, PAGE_SIZE);
+	}
+	else if( !MM_Map(VAddr, gMM_ZeroPage) ) {
+		return 0;
+	}
+	MM_SetFlags(VAddr, MM_PFLAG_COW, MM_PFLAG_COW);
+	return gMM_ZeroPage;
+}
+
 /**
  * \fn void MM_Deallocate(tVAddr VAddr)
  */
@@ -521,6 +552,16 @@ void MM_ClearUser(void)
 	INVLPG( gaPageDir );
 }
 
+/**
+ * \brief Count the resident user pages of a process
+ * \todo Not implemented on this architecture (user pages aren't accounted)
+ */
+void MM_CountUserPages(tProcess *Process, size_t *Shared, size_t *Private)
+{
+	*Shared = 0;
+	*Private = 0;
+}
+
 /**
  * \brief Deallocate an address space
  */
@@ -9,6 +9,7 @@
 #include <mm_virt.h>
 #include <errno.h>
 #include <hal_proc.h>
+#include <trace.h>
 #include <arch_int.h>
 #include <proc_int.h>
 #if USE_MP
@@ -774,6 +775,8 @@ void Proc_Reschedule(void)
 	}
 	#endif
 
+	TRACE_POINT2(TRACE_EV_SCHED_SWITCH, (curthread ? curthread->TID : -1), nextthread->TID);
+
 	// Update CPU state
 	gaCPUs[cpu].Current = nextthread;
 	gaCPUs[cpu].LastTimerThread = NULL;
@@ -111,9 +111,11 @@ Desctab_Init:
 	mov edx, 0xFFFFFFFF
 	wrmsr
 	; Set IA32_FMASK (flags mask)
+	; - Clear TF, IF, DF, IOPL, NT and AC on entry, SyscallStub enables IRQs
+	;   once it's off the user stack
 	mov ecx, 0xC0000084
 	rdmsr
-	mov eax, ~0x202
+	mov eax, 0x47700
 	wrmsr
 	; Set IA32_STAR (Kernel/User CS)
 	mov ecx, 0xC0000081
@@ -277,6 +279,7 @@ DEFIRQ	i
 %endrep
 
 [extern Proc_int_SetIRQIP]
+[extern Trace_IRQ]
 
 [global IrqCommon]
 IrqCommon:
@@ -299,6 +302,11 @@ IrqCommon:
 	
 	; Check all callbacks
 	sub rsp, 8	; Shadow of argument
+	
+	; Tracepoint (rbx is preserved)
+	mov rdi, [rsp+(16+2+1+1)*8]	; Get IRQ number
+	call Trace_IRQ
+	
 	%assign i 0
 	%rep NUM_IRQ_CALLBACKS
 	; Get callback address
@@ -359,6 +367,8 @@ PIT_IRQ:
 	;PUSH_FPU
 	;PUSH_XMM
 	
+	mov rdi, [rsp+0x80]	; Interrupted RIP (for the profiler)
+	mov rsi, rbp	; Interrupted RBP
 	call Time_UpdateTimestamp
 
 	%if 0
@@ -380,10 +390,13 @@ csUserSS:	db	"User SS: 0x%x",0
 	iretq
 
 [extern ci_offsetof_tThread_KernelStack]
+[extern ci_offsetof_tThread_UserRIP]
 [extern SyscallHandler]
 [global SyscallStub]
 SyscallStub:
 	mov rbp, dr0
+	mov ebx, [rel ci_offsetof_tThread_UserRIP]
+	mov [rbp+rbx], rcx	; Save user RIP (inline Proc_int_SetIRQIP)
 	mov ebx, [rel ci_offsetof_tThread_KernelStack]
 	mov rbp, [rbp+rbx]	; Get kernel stack
 	xchg rbp, rsp	; Swap stacks
@@ -391,6 +404,7 @@ SyscallStub:
 	push rbp	; Save User RSP
 	push rcx	; RIP
 	push r11	; RFLAGS
+	sti	; Masked by IA32_FMASK until now
 
 	; RDI
 	; RSI
@@ -408,9 +422,6 @@ SyscallStub:
 	mov [rsp+0x30], r8	; Arg5
 	mov [rsp+0x38], r9	; Arg6
 
-	mov rdi, rcx	
-	call Proc_int_SetIRQIP
-
 	mov rdi, rsp
 	sub rsp, 8
 	call SyscallHandler
@@ -429,6 +440,7 @@ csSyscallReturn:	db	"Syscall Return: 0x%x",0
 	mov rax, [rsp+0]	; Get return
 	add rsp, (6+2)*8
 
+	cli	; No IRQs on the user stack (SYSRET restores IF from R11)
 	pop r11
 	pop rcx
 	pop rsp 	; Change back to user stack
@@ -6,6 +6,7 @@
 #include <proc.h>
 #include <mm_virt.h>
 #include <threads_int.h>	// Needed for SSE handling
+#include <trace.h>
 
 #define MAX_BACKTRACE	6
 
@@ -109,6 +110,38 @@ void Error_Handler(tRegs *Regs)
 		__asm__ __volatile__ ("hlt");
 }
 
+/**
+ * \brief Walk the stack from \a BP, storing return addresses
+ * \param IP	Current Instruction Pointer (stored as the first entry)
+ * \param BP	Current Base Pointer (Stack Frame)
+ * \param Frames	Output buffer
+ * \param MaxFrames	Maximum number of entries to store
+ * \return Number of entries stored
+ * \note Doesn't print anything, so is safe to use from IRQs (e.g. the profiler)
+ */
+int Error_BacktraceCapture(Uint IP, Uint BP, Uint *Frames, int MaxFrames)
+{
+	 int	n = 0;
+	
+	if( MaxFrames <= 0 )	return 0;
+	Frames[n++] = IP;
+	
+	// Executing from a data area, BP is probably junk too
+	if( IP > USER_MAX && IP < MM_KERNEL_CODE
+	 && (MM_MODULE_MIN > IP || IP > MM_MODULE_MAX)
+		)
+	{
+		return n;
+	}
+	
+	while( n < MaxFrames && MM_GetPhysAddr( (void*)BP) && MM_GetPhysAddr((void*)(BP+8+7)) )
+	{
+		Frames[n++] = ((Uint*)BP)[1];
+		BP = ((Uint*)BP)[0];
+	}
+	return n;
+}
+
 /**
  * \fn void Error_Backtrace(Uint eip, Uint ebp)
  * \brief Unrolls the stack to trace execution
@@ -117,13 +150,8 @@ void Error_Handler(tRegs *Regs)
  */
 void Error_Backtrace(Uint IP, Uint BP)
 {
-	 int	i = 0;
-	
-	//if(eip < 0xC0000000 && eip > 0x1000)
-	//{
-	//	LogF("Backtrace: User - 0x%x\n", eip);
-	//	return;
-	//}
+	Uint	frames[1+MAX_BACKTRACE];
+	 int	i, n;
 	
 	if( IP > USER_MAX && IP < MM_KERNEL_CODE
 	 && (MM_MODULE_MIN > IP || IP > MM_MODULE_MAX)
@@ -133,27 +161,15 @@ void Error_Backtrace(Uint IP, Uint BP)
 		return;
 	}
 	
-	//str = Debug_GetSymbol(eip, &delta);
-	//if(str == NULL)
-		LogF("Backtrace: %p", IP);
-	//else
-	//	LogF("Backtrace: %s+0x%x", str, delta);
+	LogF("Backtrace: %p", IP);
 	if( !MM_GetPhysAddr( (void*)BP ) )
 	{
 		LogF("\nBacktrace: Invalid BP, stopping\n");
 		return;
 	}
 	
-	
-	while( MM_GetPhysAddr( (void*)BP) && MM_GetPhysAddr((void*)(BP+8+7)) && i < MAX_BACKTRACE )
-	{
-		//str = Debug_GetSymbol(*(Uint*)(ebp+4), &delta);
-		//if(str == NULL)
-			LogF(" >> 0x%llx", ((Uint*)BP)[1]);
-		//else
-		//	LogF(" >> %s+0x%x", str, delta);
-		BP = ((Uint*)BP)[0];
-		i++;
-	}
+	n = Error_BacktraceCapture(IP, BP, frames, 1+MAX_BACKTRACE);
+	for( i = 1; i < n; i ++ )
+		LogF(" >> 0x%llx", frames[i]);
 	LogF("\n");
 }
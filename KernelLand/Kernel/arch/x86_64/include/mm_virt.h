@@ -12,6 +12,7 @@
 #include <arch.h>
 
 #define PAGE_SIZE	0x1000
+#define MM_LARGE_PAGE_SIZE	0x200000	// 2 MiB
 
 // === Memory Location Definitions ===
 /*
@@ -30,13 +31,15 @@
  *       C000 00000000 -       D000 00000000	44	16	TiB	Hardware Mappings
  *       D000 00000000 -       D080 00000000	39	512	GiB	Per-Process Data
  *       D080 00000000 -       D100 00000000	39	512	GiB	Kernel Supplied User Code
- *       ---- GAP ----                      		15	TiB
+ *       ---- GAP ----                      		7	TiB
+ *       D800 00000000 -       E000 00000000	43	8	TiB	Physical Memory Direct Map (2 MiB pages)
  *       E000 00000000 -       E800 00000000	43	8	TiB	Physical Page Nodes (2**40 pages * 8 bytes)
  *       E800 00000000 -       EC00 00000000	42	4	TiB	Physical Page Reference Counts (2**40 pg * 4 bytes)
  *       EC00 00000000 -       EC80 00000000	39	512	GiB	Physical Page Bitmap (1 page per bit)
- *       EC80 00000000 -       ED00 00000000	39	512	GiB	Physical Page DblAlloc Bitmap (1 page per bit)
  *       ED00 00000000 -       ED00 80000000	31	2	GiB	Physical Page Super Bitmap (64 pages per bit)
- *       ---- GAP ----                      		9	TiB
+ *       EE00 00000000 -       F600 00000000	43	8	TiB	Physical Page Buddy Links (2**40 pages * 8 bytes)
+ *       F600 00000000 -       F700 00000000	40	1	TiB	Physical Page Buddy Info (2**40 pages * 1 byte)
+ *       ---- GAP ----                      		7	TiB
  *       FE00 00000000 -       FE80 00000000	39	512	GiB	Fractal Mapping (PML4 508)
  *       FE80 00000000 -       FF00 00000000	39	512	GiB	Temp Fractal Mapping
  *       FF00 00000000 -       FF80 00000000	39	512	GiB	Temporary page mappings
@@ -66,12 +69,15 @@
 #define MM_PPD_CFG  	MM_PPD_BASE
 #define MM_PPD_HANDLES 	(MM_KERNEL_RANGE|(0xD008##00000000))
 #define MM_USER_CODE	(MM_KERNEL_RANGE|(0xD080##00000000))
+#define MM_DIRECTMAP_BASE	(MM_KERNEL_RANGE|(0xD800##00000000))
+#define MM_DIRECTMAP_END	(MM_KERNEL_RANGE|(0xE000##00000000))
 
 #define MM_PAGE_NODES	(MM_KERNEL_RANGE|(0xE000##00000000))
 #define MM_PAGE_COUNTS	(MM_KERNEL_RANGE|(0xE800##00000000))
 #define MM_PAGE_BITMAP	(MM_KERNEL_RANGE|(0xEC00##00000000))
-#define MM_PAGE_DBLBMP	(MM_KERNEL_RANGE|(0xEC00##00000000))
 #define MM_PAGE_SUPBMP	(MM_KERNEL_RANGE|(0xED00##00000000))
+#define MM_PAGE_BUDDY	(MM_KERNEL_RANGE|(0xEE00##00000000))
+#define MM_PAGE_BUDDYINFO	(MM_KERNEL_RANGE|(0xF600##00000000))
 
 #define MM_FRACTAL_BASE	(MM_KERNEL_RANGE|(0xFE00##00000000))
 #define MM_TMPFRAC_BASE	(MM_KERNEL_RANGE|(0xFE80##00000000))
@@ -82,7 +88,11 @@
 
 
 // === FUNCTIONS ===
+struct sPMemMapEnt;
 void	MM_FinishVirtualInit(void);
+void	MM_InitDirectMap(int NPMemRanges, struct sPMemMapEnt *PMemRanges);
+tPAddr	MM_AllocateLarge(tVAddr VAddr);
+ int	MM_SplitLarge(tVAddr VAddr);
 tVAddr	MM_NewKStack(void);
 tVAddr	MM_Clone(int bCopyUser);
 tVAddr	MM_NewWorkerStack(void *StackData, size_t StackSize);
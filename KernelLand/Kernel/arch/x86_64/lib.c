@@ -7,6 +7,7 @@
 #define DEBUG_TO_SERIAL	1
 #define	SERIAL_PORT	0x3F8
 #define	GDB_SERIAL_PORT	0x2F8
+#define ERMS_MIN	128	// Below this, rep movsb/stosb startup costs more than it saves
 
 
 // === IMPORTS ===
@@ -19,6 +20,7 @@ extern void	*Proc_GetCurThread(void);
 
 // === PROTOTYPEs ===
  int	putDebugChar(char ch);
+static int	Lib_int_HasERMS(void);
 
 // === CODE ===
 /**
@@ -317,12 +319,34 @@ int memcmp(const void *__dest, const void *__src, size_t __count)
 	return 0;
 }
 
+/**
+ * \brief Check for Enhanced REP MOVSB/STOSB (CPUID.07h:EBX[9])
+ * \note The kernel is built without SSE (its state is only saved for
+ *       userland), so fast strings are the best bulk copy available here
+ */
+static int Lib_int_HasERMS(void)
+{
+	static int	has_erms = -1;
+	if( has_erms == -1 )
+	{
+		Uint32	eax, ebx, ecx, edx;
+		__asm__ __volatile__ ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0));
+		if( eax >= 7 ) {
+			__asm__ __volatile__ ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(7), "c"(0));
+			has_erms = !!(ebx & (1 << 9));
+		}
+		else
+			has_erms = 0;
+	}
+	return has_erms;
+}
+
 void *memcpy(void *__dest, const void *__src, size_t __count)
 {
 	tVAddr	dst = (tVAddr)__dest, src = (tVAddr)__src;
-	if( (dst & 7) != (src & 7) )
+	if( (dst & 7) != (src & 7) || (__count >= ERMS_MIN && Lib_int_HasERMS()) )
 	{
-		__asm__ __volatile__ ("rep movsb" : : "D"(dst),"S"(src),"c"(__count));
+		__asm__ __volatile__ ("rep movsb" : "+D"(dst), "+S"(src), "+c"(__count) : : "memory");
 	}
 	else
 	{
@@ -331,7 +355,8 @@ void *memcpy(void *__dest, const void *__src, size_t __count)
 			__count --;
 		}
 
-		__asm__ __volatile__ ("rep movsq" : "=D"(dst),"=S"(src) : "0"(dst),"1"(src),"c"(__count/8));
+		size_t	qwords = __count / 8;
+		__asm__ __volatile__ ("rep movsq" : "+D"(dst), "+S"(src), "+c"(qwords) : : "memory");
 		__count = __count & 7;
 		while( __count-- )
 			*(char*)dst++ = *(char*)src++;
@@ -341,23 +366,32 @@ void *memcpy(void *__dest, const void *__src, size_t __count)
 
 void *memset(void *__dest, int __val, size_t __count)
 {
-	if( __val != 0 || ((tVAddr)__dest & 7) != 0 )
-		__asm__ __volatile__ ("rep stosb" : : "D"(__dest),"a"(__val),"c"(__count));
-	else {
-		Uint8   *dst = __dest;
-
-		__asm__ __volatile__ ("rep stosq" : : "D"(dst),"a"(0),"c"(__count/8));
-		dst += __count & ~7;
-		__count = __count & 7;
-		while( __count-- )
-		        *dst++ = 0;
+	Uint8	*dst = __dest;
+	
+	if( __count >= ERMS_MIN && Lib_int_HasERMS() )
+	{
+		__asm__ __volatile__ ("rep stosb" : "+D"(dst), "+c"(__count) : "a"(__val) : "memory");
+		return __dest;
+	}
+	
+	// Fill by qword, with the value replicated into each byte
+	Uint64	pattern = 0x0101010101010101ULL * (Uint8)__val;
+	while( ((tVAddr)dst & 7) && __count ) {
+		*dst++ = __val;
+		__count --;
 	}
+	size_t	qwords = __count / 8;
+	__asm__ __volatile__ ("rep stosq" : "+D"(dst), "+c"(qwords) : "a"(pattern) : "memory");
+	__count = __count & 7;
+	while( __count-- )
+		*dst++ = __val;
 	return __dest;
 }
 
 void *memsetd(void *__dest, Uint32 __val, size_t __count)
 {
-	__asm__ __volatile__ ("rep stosl" : : "D"(__dest),"a"(__val),"c"(__count));
+	void	*dst = __dest;
+	__asm__ __volatile__ ("rep stosl" : "+D"(dst), "+c"(__count) : "a"(__val) : "memory");
 	return __dest;
 }
 
@@ -19,6 +19,7 @@
 // === IMPORTS ===
 extern void	Desctab_Init(void);
 extern void	MM_InitVirt(void);
+extern void	MM_InitDirectMap(int NPMemRanges, tPMemMapEnt *PMemRanges);
 extern int	Time_Setup(void);
 
 extern char	gKernelEnd[];
@@ -63,6 +64,7 @@ void kmain(Uint MbMagic, void *MbInfoPtr)
 	}
 	
 	MM_InitPhys( nPMemMapEnts, pmemmap );	// Set up physical memory manager
+	MM_InitDirectMap( nPMemMapEnts, pmemmap );	// Map all of RAM for MM_MapTemp
 	Log("gsBootCmdLine = '%s'", gsBootCmdLine);
 	
 	switch(MbMagic)
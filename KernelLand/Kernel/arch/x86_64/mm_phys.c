@@ -2,15 +2,30 @@
  * Acess2 x86_64 Port
  * 
  * Physical Memory Manager
+ *
+ * Free pages are kept on binary buddy lists, one set per physical address
+ * range (so MaxBits requests never need to scan). Single page allocations
+ * and frees go through a small per-CPU cache of hot pages, which is refilled
+ * from (and drained to) the buddy lists in batches.
  */
 #define DEBUG	0
 #include <acess.h>
 #include <archinit.h>
 #include <pmemmap.h>
 #include <mm_virt.h>
+#include <hal_proc.h>
+#include <reclaim.h>
 
 #define TRACE_REF	0
 
+#define MM_BUDDY_MAX_ORDER	10	// Largest block is 2**10 pages (4 MiB)
+#define MM_HOTPAGE_MAX  	32	// Order-0 pages cached per CPU
+#define MM_HOTPAGE_BATCH	16	// Pages moved between a CPU cache and the buddy lists at once
+
+#define BUDDY_INFO_FREEHEAD	0x80	// Page starts a free block (order in the low bits)
+#define BUDDY_INFO_HOT  	0x40	// Page is in a per-CPU cache
+#define BUDDY_INFO_ORDER	0x3F
+
 enum eMMPhys_Ranges
 {
 	MM_PHYS_16BIT,	// Does anything need this?
@@ -21,6 +36,24 @@ enum eMMPhys_Ranges
 	NUM_MM_PHYS_RANGES
 };
 
+// === TYPES ===
+typedef struct sMM_BuddyLink
+{
+	Uint32	Next;	// Page numbers, 0 terminates (page 0 is never free)
+	Uint32	Prev;
+} tMM_BuddyLink;
+
+typedef struct sMM_HotPages
+{
+	tShortSpinlock	Lock;
+	 int	Count;
+	Uint32	Pages[MM_HOTPAGE_MAX];
+	// Statistics
+	Uint64	nHits;	// Allocations served from the cache
+	Uint64	nRefills;	// Times the cache was refilled from the buddy lists
+	Uint64	nDrains;	// Times the cache overflowed back to the buddy lists
+} tMM_HotPages;
+
 // === IMPORTS ===
 extern char	gKernelBase[];
 extern char	gKernelEnd[];
@@ -32,26 +65,36 @@ extern char	gKernelEnd[];
 //void	MM_RefPhys(tPAddr PAddr);
 //void	MM_DerefPhys(tPAddr PAddr);
  int	MM_int_GetRangeID( tPAddr Addr );
+static void	MM_int_BuddyListAdd(int Range, int Order, Uint64 Page);
+static void	MM_int_BuddyListRemove(int Range, int Order, Uint64 Page);
+static void	MM_int_BuddyFree(Uint64 Page, int Order);
+static Uint64	MM_int_BuddyAlloc(int Range, int Order);
+static int	MM_int_BuddyClaim(Uint64 Page);
+static Uint64	MM_int_AllocScan(int Range, int Pages);
+static Uint64	MM_int_AllocHot(void);
+static Uint64	MM_int_AllocRange(int Pages, int RangeID);
+static void	MM_int_FreePage(Uint64 Page);
+static void	MM_int_ClaimFreePage(Uint64 Page);
 
 // === MACROS ===
 #define PAGE_ALLOC_TEST(__page) 	(gaMainBitmap[(__page)>>6] & (1ULL << ((__page)&63)))
 #define PAGE_ALLOC_SET(__page)  	do{gaMainBitmap[(__page)>>6] |= (1ULL << ((__page)&63));}while(0)
 #define PAGE_ALLOC_CLEAR(__page)	do{gaMainBitmap[(__page)>>6] &= ~(1ULL << ((__page)&63));}while(0)
-//#define PAGE_MULTIREF_TEST(__page)	(gaMultiBitmap[(__page)>>6] & (1ULL << ((__page)&63)))
-//#define PAGE_MULTIREF_SET(__page)	do{gaMultiBitmap[(__page)>>6] |= 1ULL << ((__page)&63);}while(0)
-//#define PAGE_MULTIREF_CLEAR(__page)	do{gaMultiBitmap[(__page)>>6] &= ~(1ULL << ((__page)&63));}while(0)
+#define RANGE_HOT_OK(__range)	((__range) >= MM_PHYS_32BIT)	// Ranges that feed the per-CPU caches
 
 // === GLOBALS ===
-tMutex	glPhysicalPages;
+tShortSpinlock	glPhysicalPages;	// Protects the buddy lists
 Uint64	*gaSuperBitmap = (void*)MM_PAGE_SUPBMP;	// 1 bit = 64 Pages, 16 MiB per Word
 Uint64	*gaMainBitmap = (void*)MM_PAGE_BITMAP;	// 1 bit = 1 Page, 256 KiB per Word
-Uint64	*gaMultiBitmap = (void*)MM_PAGE_DBLBMP;	// Each bit means that the page is being used multiple times
 Uint32	*gaiPageReferences = (void*)MM_PAGE_COUNTS;	// Reference Counts
 void	**gapPageNodes = (void*)MM_PAGE_NODES;	// Reference Counts
-tPAddr	giFirstFreePage;	// First possibly free page
-Uint64	giPhysRangeFree[NUM_MM_PHYS_RANGES];	// Number of free pages in each range
-Uint64	giPhysRangeFirst[NUM_MM_PHYS_RANGES];	// First free page in each range
-Uint64	giPhysRangeLast[NUM_MM_PHYS_RANGES];	// Last free page in each range
+tMM_BuddyLink	*gaBuddyLinks = (void*)MM_PAGE_BUDDY;	// Free list links (only valid for free block heads)
+Uint8	*gaBuddyInfo = (void*)MM_PAGE_BUDDYINFO;	// BUDDY_INFO_* for each page
+Uint32	gaBuddyHeads[NUM_MM_PHYS_RANGES][MM_BUDDY_MAX_ORDER+1];
+Uint64	giBuddyBlocks[NUM_MM_PHYS_RANGES][MM_BUDDY_MAX_ORDER+1];	// Number of free blocks of each order
+Uint64	giPhysRangeFree[NUM_MM_PHYS_RANGES];	// Number of pages on the buddy lists of each range
+tMM_HotPages	gaMM_HotPages[MAX_CPUS];
+const int	caiPhysRangeBits[NUM_MM_PHYS_RANGES] = {16, 20, 24, 32, 64};
 Uint64	giMaxPhysPage = 0;	// Maximum Physical page
 Uint64	giTotalMemorySize = 0;
 // Only used in init, allows the init code to provide pages for use by
@@ -67,7 +110,7 @@ tPAddr	gaiStaticAllocPages[NUM_STATIC_ALLOC] = {0};
 void MM_InitPhys(int NPMemRanges, tPMemMapEnt *PMemRanges)
 {
 	Uint64	maxAddr = 0;
-	 int	numPages, superPages;
+	 int	numPages, superPages, linkPages, infoPages;
 	 int	i;
 	Uint64	base, size;
 	tVAddr	vaddr;
@@ -99,12 +142,25 @@ void MM_InitPhys(int NPMemRanges, tPMemMapEnt *PMemRanges)
 	// Get counts of pages needed for basic structures
 	superPages = ((giMaxPhysPage+64*8-1)/(64*8) + 0xFFF) >> 12;
 	numPages = ((giMaxPhysPage+7)/8 + 0xFFF) >> 12;	// bytes to hold bitmap, divided up to nearest page
-	LOG("numPages = %i, superPages = %i", numPages, superPages);
+	linkPages = ((giMaxPhysPage+1)*sizeof(tMM_BuddyLink) + 0xFFF) >> 12;
+	infoPages = ((giMaxPhysPage+1) + 0xFFF) >> 12;
+	LOG("numPages = %i, superPages = %i, linkPages = %i, infoPages = %i",
+		numPages, superPages, linkPages, infoPages);
 	
 	// --- Allocate Bitmaps ---
-	 int	todo = numPages*2 + superPages;
+	const struct {
+		tVAddr	Base;
+		 int	Pages;
+	} regions[] = {
+		{MM_PAGE_BITMAP, numPages},
+		{MM_PAGE_SUPBMP, superPages},
+		{MM_PAGE_BUDDY, linkPages},
+		{MM_PAGE_BUDDYINFO, infoPages}
+	};
+	 int	todo = numPages + superPages + linkPages + infoPages;
 	 int	mapent = NPMemRanges-1;
-	vaddr = MM_PAGE_BITMAP;
+	 int	region = 0, regionDone = 0;
+	vaddr = regions[0].Base;
 	paddr = -1;
 	while( todo )
 	{
@@ -137,10 +193,11 @@ void MM_InitPhys(int NPMemRanges, tPMemMapEnt *PMemRanges)
 			
 			// Update virtual pointer
 			vaddr += 0x1000;
-			if( todo == numPages + superPages )
-				vaddr = MM_PAGE_DBLBMP;
-			if( todo == superPages )
-				vaddr = MM_PAGE_SUPBMP;
+			if( ++regionDone == regions[region].Pages && todo ) {
+				region ++;
+				regionDone = 0;
+				vaddr = regions[region].Base;
+			}
 		}		
 
 		// Update physical pointer
@@ -161,9 +218,7 @@ void MM_InitPhys(int NPMemRanges, tPMemMapEnt *PMemRanges)
 	// Save the current value of paddr to simplify the allocation later
 	firstFreePage = paddr;
 	
-	LOG("Clearing multi bitmap");
 	// Fill the bitmaps (set most to "allocated")
-	memset(gaMultiBitmap, 0, numPages<<12);
 	memset(gaMainBitmap,  255, numPages<<12);
 	// - Clear all Type=1 areas
 	LOG("Clearing valid regions");
@@ -231,25 +286,14 @@ void MM_InitPhys(int NPMemRanges, tPMemMapEnt *PMemRanges)
 			gaSuperBitmap[ i/64 ] |= 1ULL << (i % 64);
 	}
 	
-	// Set free page counts for each address class
+	// Put all free pages on the buddy lists (merging as they go)
+	LOG("Building buddy lists");
+	memset(gaBuddyInfo, 0, infoPages<<12);
 	for( base = 1; base < giMaxPhysPage; base ++ )
 	{
-		 int	rangeID;
 		// Skip allocated
-		if( gaMainBitmap[ base >> 6 ] & (1LL << (base&63))  )	continue;
-		
-		// Get range ID
-		rangeID = MM_int_GetRangeID( base << 12 );
-		
-		// Increment free page count
-		giPhysRangeFree[ rangeID ] ++;
-		
-		// Check for first free page in range
-		if(giPhysRangeFirst[ rangeID ] == 0)
-			giPhysRangeFirst[ rangeID ] = base;
-		// Set last (when the last free page is reached, this won't be
-		// updated anymore, hence will be correct)
-		giPhysRangeLast[ rangeID ] = base;
+		if( PAGE_ALLOC_TEST(base) )	continue;
+		MM_int_BuddyFree(base, 0);
 	}	
 
 	LEAVE('-');
@@ -257,7 +301,378 @@ void MM_InitPhys(int NPMemRanges, tPMemMapEnt *PMemRanges)
 
 void MM_DumpStatistics(void)
 {
-	// TODO: Statistics for x86_64 PMM
+	Uint64	totalFree = 0;
+
+	for( int r = 0; r < NUM_MM_PHYS_RANGES; r ++ )
+	{
+		char	orders[(MM_BUDDY_MAX_ORDER+1)*12];
+		 int	len = 0, maxOrder = -1;
+		Uint64	bigFree = 0;
+
+		if( giPhysRangeFree[r] == 0 )
+			continue ;
+		for( int o = 0; o <= MM_BUDDY_MAX_ORDER; o ++ )
+		{
+			len += snprintf(orders+len, sizeof(orders)-len, " %lli", giBuddyBlocks[r][o]);
+			if( giBuddyBlocks[r][o] )
+				maxOrder = o;
+			// Pages in blocks of 64 KiB or more are counted as unfragmented
+			if( o >= 4 )
+				bigFree += giBuddyBlocks[r][o] << o;
+		}
+		Log_Log("MMPhys", "%ipbit - %lli free pages, largest block order %i, %lli%% fragmented",
+			caiPhysRangeBits[r], giPhysRangeFree[r], maxOrder,
+			100 - bigFree * 100 / giPhysRangeFree[r]);
+		Log_Log("MMPhys", "%ipbit - free blocks by order:%s", caiPhysRangeBits[r], orders);
+		totalFree += giPhysRangeFree[r];
+	}
+	for( int i = 0; i < MAX_CPUS; i ++ )
+	{
+		tMM_HotPages	*hp = &gaMM_HotPages[i];
+		if( !hp->nHits && !hp->nRefills && !hp->Count )
+			continue ;
+		Log_Log("MMPhys", "CPU%i - %i hot pages, %lli hits, %lli refills, %lli drains",
+			i, hp->Count, hp->nHits, hp->nRefills, hp->nDrains);
+		totalFree += hp->Count;
+	}
+	Log_Log("MMPhys", "%lli/%lli total pages free", totalFree, giTotalMemorySize);
+}
+
+/**
+ * \brief Push a free block onto a buddy list
+ * \note glPhysicalPages must be held
+ */
+static void MM_int_BuddyListAdd(int Range, int Order, Uint64 Page)
+{
+	Uint32	head = gaBuddyHeads[Range][Order];
+	gaBuddyLinks[Page].Next = head;
+	gaBuddyLinks[Page].Prev = 0;
+	if( head )
+		gaBuddyLinks[head].Prev = Page;
+	gaBuddyHeads[Range][Order] = Page;
+	gaBuddyInfo[Page] = BUDDY_INFO_FREEHEAD|Order;
+	giBuddyBlocks[Range][Order] ++;
+	giPhysRangeFree[Range] += 1ULL << Order;
+}
+
+/**
+ * \brief Unlink a free block from its buddy list
+ * \note glPhysicalPages must be held
+ */
+static void MM_int_BuddyListRemove(int Range, int Order, Uint64 Page)
+{
+	tMM_BuddyLink	*link = &gaBuddyLinks[Page];
+	if( link->Prev )
+		gaBuddyLinks[link->Prev].Next = link->Next;
+	else
+		gaBuddyHeads[Range][Order] = link->Next;
+	if( link->Next )
+		gaBuddyLinks[link->Next].Prev = link->Prev;
+	gaBuddyInfo[Page] = 0;
+	giBuddyBlocks[Range][Order] --;
+	giPhysRangeFree[Range] -= 1ULL << Order;
+}
+
+/**
+ * \brief Return a block to the buddy lists, merging with free buddies
+ * \note glPhysicalPages must be held
+ */
+static void MM_int_BuddyFree(Uint64 Page, int Order)
+{
+	 int	range = MM_int_GetRangeID(Page << 12);
+
+	for( Uint64 i = 0; i < (1ULL << Order); i ++ ) {
+		PAGE_ALLOC_CLEAR(Page + i);
+		gaSuperBitmap[(Page+i) >> 12] &= ~(1ULL << (((Page+i) >> 6) & 63));
+	}
+
+	while( Order < MM_BUDDY_MAX_ORDER )
+	{
+		Uint64	buddy = Page ^ (1ULL << Order);
+		if( buddy == 0 || buddy > giMaxPhysPage )
+			break;
+		// Blocks never span address ranges (so MaxBits can be honoured)
+		if( MM_int_GetRangeID(buddy << 12) != range )
+			break;
+		if( gaBuddyInfo[buddy] != (BUDDY_INFO_FREEHEAD|Order) )
+			break;
+		MM_int_BuddyListRemove(range, Order, buddy);
+		Page &= ~(1ULL << Order);
+		Order ++;
+	}
+	MM_int_BuddyListAdd(range, Order, Page);
+}
+
+/**
+ * \brief Allocate a block of 2**Order pages from a range
+ * \return First page number, or 0 if there is no large enough block
+ * \note glPhysicalPages must be held
+ */
+static Uint64 MM_int_BuddyAlloc(int Range, int Order)
+{
+	 int	o;
+	Uint64	page;
+
+	for( o = Order; o <= MM_BUDDY_MAX_ORDER && !gaBuddyHeads[Range][o]; o ++ )
+		;
+	if( o > MM_BUDDY_MAX_ORDER )
+		return 0;
+
+	page = gaBuddyHeads[Range][o];
+	MM_int_BuddyListRemove(Range, o, page);
+	// Split, returning the upper halves
+	while( o > Order )
+	{
+		o --;
+		MM_int_BuddyListAdd(Range, o, page + (1ULL << o));
+	}
+
+	for( Uint64 i = 0; i < (1ULL << Order); i ++ ) {
+		PAGE_ALLOC_SET(page + i);
+		if( gaMainBitmap[(page+i) >> 6] + 1 == 0 )
+			gaSuperBitmap[(page+i) >> 12] |= 1ULL << (((page+i) >> 6) & 63);
+	}
+	return page;
+}
+
+/**
+ * \brief Remove a specific page from the buddy lists
+ * \return Boolean success (false if the page isn't on a buddy list)
+ * \note glPhysicalPages must be held
+ */
+static int MM_int_BuddyClaim(Uint64 Page)
+{
+	 int	range = MM_int_GetRangeID(Page << 12);
+	Uint64	head = 0;
+	 int	o;
+
+	// Find the free block containing the page
+	for( o = 0; o <= MM_BUDDY_MAX_ORDER; o ++ )
+	{
+		head = Page & ~((1ULL << o) - 1);
+		if( gaBuddyInfo[head] == (BUDDY_INFO_FREEHEAD|o) )
+			break;
+	}
+	if( o > MM_BUDDY_MAX_ORDER )
+		return 0;
+
+	MM_int_BuddyListRemove(range, o, head);
+	// Split down to the page, returning the other halves
+	while( o > 0 )
+	{
+		o --;
+		if( Page >= head + (1ULL << o) ) {
+			MM_int_BuddyListAdd(range, o, head);
+			head += 1ULL << o;
+		}
+		else {
+			MM_int_BuddyListAdd(range, o, head + (1ULL << o));
+		}
+	}
+
+	PAGE_ALLOC_SET(Page);
+	if( gaMainBitmap[Page >> 6] + 1 == 0 )
+		gaSuperBitmap[Page >> 12] |= 1ULL << ((Page >> 6) & 63);
+	return 1;
+}
+
+/**
+ * \brief Find and claim a run of pages too large for a buddy block
+ * \note glPhysicalPages must be held
+ */
+static Uint64 MM_int_AllocScan(int Range, int Pages)
+{
+	Uint64	first = (Range == 0 ? 1 : 1ULL << (caiPhysRangeBits[Range-1] - 12));
+	Uint64	last = (Range == MM_PHYS_MAX ? giMaxPhysPage : (1ULL << (caiPhysRangeBits[Range] - 12)) - 1);
+	Uint64	addr, nFree = 0;
+
+	if( last > giMaxPhysPage )
+		last = giMaxPhysPage;
+	if( giPhysRangeFree[Range] < Pages )
+		return 0;
+
+	for( addr = first; addr <= last && nFree < Pages; )
+	{
+		// Check the super bitmap
+		if( gaSuperBitmap[addr >> (6+6)] + 1 == 0 ) {
+			nFree = 0;
+			addr = (addr + (1ULL << (6+6))) & ~0xFFFULL;
+			continue;
+		}
+		// Check page block (64 pages)
+		if( gaMainBitmap[addr >> 6] + 1 == 0) {
+			nFree = 0;
+			addr = (addr + 64) & ~0x3FULL;
+			continue;
+		}
+		// Check individual page (pages in CPU caches can't be claimed here)
+		if( PAGE_ALLOC_TEST(addr) || (gaBuddyInfo[addr] & BUDDY_INFO_HOT) ) {
+			nFree = 0;
+			addr ++;
+			continue;
+		}
+		nFree ++;
+		addr ++;
+	}
+	if( nFree != Pages )
+		return 0;
+
+	addr -= Pages;
+	for( int i = 0; i < Pages; i ++ )
+		MM_int_BuddyClaim(addr + i);
+	return addr;
+}
+
+/**
+ * \brief Allocate a single page from this CPU's cache
+ * \return Page number, or 0 if no page is available
+ */
+static Uint64 MM_int_AllocHot(void)
+{
+	tMM_HotPages	*hp = &gaMM_HotPages[GetCPUNum()];
+	Uint64	page;
+
+	SHORTLOCK( &hp->Lock );
+	if( hp->Count == 0 )
+	{
+		// Refill from the highest range that has pages
+		SHORTLOCK( &glPhysicalPages );
+		for( int r = MM_PHYS_MAX; RANGE_HOT_OK(r) && hp->Count < MM_HOTPAGE_BATCH; r -- )
+		{
+			while( hp->Count < MM_HOTPAGE_BATCH && (page = MM_int_BuddyAlloc(r, 0)) )
+			{
+				PAGE_ALLOC_CLEAR(page);
+				gaBuddyInfo[page] = BUDDY_INFO_HOT;
+				hp->Pages[hp->Count++] = page;
+			}
+		}
+		SHORTREL( &glPhysicalPages );
+		hp->nRefills ++;
+		if( hp->Count == 0 ) {
+			SHORTREL( &hp->Lock );
+			return 0;
+		}
+	}
+	else
+		hp->nHits ++;
+
+	page = hp->Pages[--hp->Count];
+	gaBuddyInfo[page] = 0;
+	PAGE_ALLOC_SET(page);
+	SHORTREL( &hp->Lock );
+	return page;
+}
+
+/**
+ * \brief Release a page that has no more references
+ */
+static void MM_int_FreePage(Uint64 Page)
+{
+	 int	range = MM_int_GetRangeID(Page << 12);
+
+	if( RANGE_HOT_OK(range) )
+	{
+		tMM_HotPages	*hp = &gaMM_HotPages[GetCPUNum()];
+		SHORTLOCK( &hp->Lock );
+		if( hp->Count == MM_HOTPAGE_MAX )
+		{
+			// Cache is full, return the oldest pages to the buddy lists
+			SHORTLOCK( &glPhysicalPages );
+			for( int i = 0; i < MM_HOTPAGE_BATCH; i ++ )
+				MM_int_BuddyFree(hp->Pages[i], 0);
+			SHORTREL( &glPhysicalPages );
+			memmove(hp->Pages, hp->Pages + MM_HOTPAGE_BATCH,
+				(MM_HOTPAGE_MAX - MM_HOTPAGE_BATCH) * sizeof(hp->Pages[0]));
+			hp->Count -= MM_HOTPAGE_BATCH;
+			hp->nDrains ++;
+		}
+		PAGE_ALLOC_CLEAR(Page);
+		gaBuddyInfo[Page] = BUDDY_INFO_HOT;
+		hp->Pages[hp->Count++] = Page;
+		SHORTREL( &hp->Lock );
+	}
+	else
+	{
+		SHORTLOCK( &glPhysicalPages );
+		MM_int_BuddyFree(Page, 0);
+		SHORTREL( &glPhysicalPages );
+	}
+}
+
+/**
+ * \brief Take a free page off the free structures (MM_RefPhys on a free page)
+ * \note A free page only enters a CPU cache under glPhysicalPages (refill),
+ *       so BUDDY_INFO_HOT is checked with it held. It can leave a cache
+ *       (drain/allocation) while we search the caches, in which case the
+ *       whole check is retried.
+ */
+static void MM_int_ClaimFreePage(Uint64 Page)
+{
+	for( ;; )
+	{
+		SHORTLOCK( &glPhysicalPages );
+		if( !(gaBuddyInfo[Page] & BUDDY_INFO_HOT) )
+		{
+			if( !MM_int_BuddyClaim(Page) )
+				PAGE_ALLOC_SET(Page);	// Not on a list (e.g. hidden by init)
+			SHORTREL( &glPhysicalPages );
+			return ;
+		}
+		// Cache locks are taken before glPhysicalPages, so drop it to search
+		SHORTREL( &glPhysicalPages );
+		
+		for( int cpu = 0; cpu < MAX_CPUS; cpu ++ )
+		{
+			tMM_HotPages	*hp = &gaMM_HotPages[cpu];
+			 int	i;
+			SHORTLOCK( &hp->Lock );
+			for( i = 0; i < hp->Count && hp->Pages[i] != Page; i ++ )
+				;
+			if( i < hp->Count ) {
+				hp->Pages[i] = hp->Pages[--hp->Count];
+				gaBuddyInfo[Page] = 0;
+				PAGE_ALLOC_SET(Page);
+				SHORTREL( &hp->Lock );
+				return ;
+			}
+			SHORTREL( &hp->Lock );
+		}
+	}
+}
+
+/**
+ * \brief Take \a Pages contiguous pages from \a RangeID or below
+ * \return First page number, or 0 if nothing was free
+ */
+static Uint64 MM_int_AllocRange(int Pages, int RangeID)
+{
+	Uint64	addr = 0;
+	 int	order;
+
+	// Single pages come from the per-CPU cache
+	if( Pages == 1 && RangeID == MM_PHYS_MAX )
+		addr = MM_int_AllocHot();
+	if( addr )
+		return addr;
+
+	for( order = 0; (1 << order) < Pages; order ++ )
+		;
+
+	SHORTLOCK( &glPhysicalPages );
+	// Prefer the highest allowed range, falling back to lower ones
+	for( ; RangeID >= 0 && !addr; RangeID -- )
+	{
+		if( order <= MM_BUDDY_MAX_ORDER && (addr = MM_int_BuddyAlloc(RangeID, order)) )
+		{
+			// Return the unused tail of the block
+			for( Uint64 tail = addr + Pages; tail < addr + (1ULL << order); tail ++ )
+				MM_int_BuddyFree(tail, 0);
+		}
+		else
+			addr = MM_int_AllocScan(RangeID, Pages);
+	}
+	SHORTREL( &glPhysicalPages );
+	return addr;
 }
 
 /**
@@ -270,9 +685,8 @@ void MM_DumpStatistics(void)
  */
 tPAddr MM_AllocPhysRange(int Pages, int MaxBits)
 {
-	tPAddr	addr, ret;
+	Uint64	addr, nfree = 0;
 	 int	rangeID;
-	 int	nFree = 0, i;
 	
 	ENTER("iPages iBits", Pages, MaxBits);
 	
@@ -283,87 +697,16 @@ tPAddr MM_AllocPhysRange(int Pages, int MaxBits)
 	
 	LOG("rangeID = %i", rangeID);
 	
-	Mutex_Acquire(&glPhysicalPages);
-	
-	// Check if the range actually has any free pages
-	while(giPhysRangeFree[rangeID] == 0 && rangeID)
-		rangeID --;
-	
-	LOG("rangeID = %i", rangeID);
-	
-	// What the? Oh, man. No free pages
-	if(giPhysRangeFree[rangeID] == 0) {
-		Mutex_Release(&glPhysicalPages);
-		// TODO: Page out
-		// ATM. Just Warning
-		Warning(" MM_AllocPhysRange: Out of free pages");
-		Log_Warning("Arch",
-			"Out of memory (unable to fulfil request for %i pages), zero remaining",
-			Pages
-			);
-		LEAVE('i', 0);
-		return 0;
-	}
+	addr = MM_int_AllocRange(Pages, rangeID);
+	// Out of memory, have the caches give some back and try again
+	if( !addr && Reclaim_Direct(Pages) )
+		addr = MM_int_AllocRange(Pages, rangeID);
 	
-	// Check if there is enough in the range
-	if(giPhysRangeFree[rangeID] >= Pages)
-	{
-		LOG("{%i,0x%x -> 0x%x}",
-			giPhysRangeFree[rangeID],
-			giPhysRangeFirst[rangeID], giPhysRangeLast[rangeID]
-			);
-		// Do a cheap scan, scanning upwards from the first free page in
-		// the range
-		nFree = 0;
-		addr = giPhysRangeFirst[ rangeID ];
-		while( addr <= giPhysRangeLast[ rangeID ] )
-		{
-			//Log(" MM_AllocPhysRange: addr = 0x%x", addr);
-			// Check the super bitmap
-			if( gaSuperBitmap[addr >> (6+6)] + 1 == 0 ) {
-				LOG("nFree = %i = 0 (super) (0x%x)", nFree, addr);
-				nFree = 0;
-				addr += 1LL << (6+6);
-				addr &= ~0xFFF;	// (1LL << 6+6) - 1
-				continue;
-			}
-			// Check page block (64 pages)
-			if( gaMainBitmap[addr >> 6] + 1 == 0) {
-				LOG("nFree = %i = 0 (main) (0x%x)", nFree, addr);
-				nFree = 0;
-				addr += 1LL << (6);
-				addr &= ~0x3F;
-				continue;
-			}
-			// Check individual page
-			if( gaMainBitmap[addr >> 6] & (1LL << (addr & 63)) ) {
-				LOG("nFree = %i = 0 (page) (0x%x)", nFree, addr);
-				nFree = 0;
-				addr ++;
-				continue;
-			}
-			nFree ++;
-			addr ++;
-			LOG("nFree(%i) == %i (0x%x)", nFree, Pages, addr);
-			if(nFree == Pages)
-				break;
-		}
-		LOG("nFree = %i", nFree);
-		// If we don't find a contiguous block, nFree will not be equal
-		// to Num, so we set it to zero and do the expensive lookup.
-		if(nFree != Pages)	nFree = 0;
-	}
+	for( int r = 0; r < NUM_MM_PHYS_RANGES; r ++ )
+		nfree += giPhysRangeFree[r];
+	Reclaim_CheckWatermark(nfree, giTotalMemorySize);
 	
-	if( !nFree )
-	{
-		// Oops. ok, let's do an expensive check (scan down the list
-		// until a free range is found)
-//		nFree = 1;
-//		addr = giPhysRangeLast[ rangeID ];
-		// TODO: Expensive Check
-		Mutex_Release(&glPhysicalPages);
-		// TODO: Page out
-		// ATM. Just Warning
+	if( !addr ) {
 		Warning(" MM_AllocPhysRange: Out of memory (unable to fulfil request for %i pages)", Pages);
 		Log_Warning("Arch",
 			"Out of memory (unable to fulfil request for %i pages)",
@@ -372,41 +715,19 @@ tPAddr MM_AllocPhysRange(int Pages, int MaxBits)
 		LEAVE('i', 0);
 		return 0;
 	}
-	LOG("nFree = %i, addr = 0x%08x", nFree, addr);
 	
-	// Mark pages as allocated
-	addr -= Pages;
-	for( i = 0; i < Pages; i++, addr++ )
-	{
-		gaMainBitmap[addr >> 6] |= 1LL << (addr & 63);
-		if( MM_GetPhysAddr( &gaiPageReferences[addr] ) )
-			gaiPageReferences[addr] = 1;
-//		Log("page %P refcount = %i", MM_GetRefCount(addr<<12)); 
-		rangeID = MM_int_GetRangeID(addr << 12);
-		giPhysRangeFree[ rangeID ] --;
-		LOG("%x == %x", addr, giPhysRangeFirst[ rangeID ]);
-		if(addr == giPhysRangeFirst[ rangeID ])
-			giPhysRangeFirst[ rangeID ] += 1;
-	}
-	addr -= Pages;
-	ret = addr;	// Save the return address
-	
-	// Update super bitmap
-	Pages += addr & (64-1);
-	addr &= ~(64-1);
-	Pages = (Pages + (64-1)) & ~(64-1);
-	for( i = 0; i < Pages/64; i++ )
+	// Set reference counts
+	for( int i = 0; i < Pages; i++ )
 	{
-		if( gaMainBitmap[ addr >> 6 ] + 1 == 0 )
-			gaSuperBitmap[addr>>12] |= 1LL << ((addr >> 6) & 63);
+		if( MM_GetPhysAddr( &gaiPageReferences[addr+i] ) )
+			gaiPageReferences[addr+i] = 1;
 	}
 	
-	Mutex_Release(&glPhysicalPages);
 	#if TRACE_REF
-	Log("MM_AllocPhysRange: ret = %P (Ref %i)", ret << 12, MM_GetRefCount(ret<<12));
+	Log("MM_AllocPhysRange: ret = %P (Ref %i)", addr << 12, MM_GetRefCount(addr<<12));
 	#endif
-	LEAVE('x', ret << 12);
-	return ret << 12;
+	LEAVE('x', addr << 12);
+	return addr << 12;
 }
 
 /**
@@ -464,9 +785,7 @@ void MM_RefPhys(tPAddr PAddr)
 	else
 	{
 		// Allocate
-		PAGE_ALLOC_SET(page);
-		if( gaMainBitmap[page >> 6] + 1 == 0 )
-			gaSuperBitmap[page>> 12] |= 1LL << ((page >> 6) & 63);
+		MM_int_ClaimFreePage(page);
 		if( MM_GetPhysAddr( &gaiPageReferences[page] ) )
 			gaiPageReferences[page] = 1;
 	}
@@ -484,32 +803,16 @@ void MM_DerefPhys(tPAddr PAddr)
 	Uint64	page = PAddr >> 12;
 	
 	if( PAddr >> 12 > giMaxPhysPage )	return ;
+	if( !PAGE_ALLOC_TEST(page) )	return ;
 	
 	if( MM_GetPhysAddr( &gaiPageReferences[page] ) )
 	{
 		gaiPageReferences[ page ] --;
 		if( gaiPageReferences[ page ] == 0 )
-			PAGE_ALLOC_CLEAR(page);
+			MM_int_FreePage(page);
 	}
 	else
-		PAGE_ALLOC_CLEAR(page);
-	
-	// Update the free counts if the page was freed
-	if( !PAGE_ALLOC_TEST(page) )
-	{
-		 int	rangeID;
-		rangeID = MM_int_GetRangeID( PAddr );
-		giPhysRangeFree[ rangeID ] ++;
-		if( giPhysRangeFirst[rangeID] > page )
-			giPhysRangeFirst[rangeID] = page;
-		if( giPhysRangeLast[rangeID] < page )
-			giPhysRangeLast[rangeID] = page;
-	}
-	
-	// If the bitmap entry is not -1, unset the bit in the super bitmap
-	if(gaMainBitmap[ page >> 6 ] + 1 != 0 ) {
-		gaSuperBitmap[page >> 12] &= ~(1LL << ((page >> 6) & 63));
-	}
+		MM_int_FreePage(page);
 	
 	#if TRACE_REF
 	Log("Page %P dereferenced (%i)", page << 12, MM_GetRefCount(page << 12));
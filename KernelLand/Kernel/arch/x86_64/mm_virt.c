@@ -9,6 +9,9 @@
 #include <threads_int.h>
 #include <proc.h>
 #include <hal_proc.h>
+#include <trace.h>
+#include <vfs_threads.h>
+#include <pmemmap.h>
 
 // === DEBUG OPTIONS ===
 #define TRACE_COW	0
@@ -31,12 +34,16 @@
 #define	PF_PRESENT	0x001
 #define	PF_WRITE	0x002
 #define	PF_USER		0x004
+#define	PF_PWT		0x008
+#define	PF_PCD		0x010
 #define	PF_LARGE	0x080
 #define	PF_GLOBAL	0x100
 #define	PF_COW		0x200
 #define	PF_PAGED	0x400
 #define	PF_NX		0x80000000##00000000
 
+#define MM_TMPMAP_SLOTS	64	// Temporary mapping slots per CPU (maximum nesting depth)
+
 // === MACROS ===
 #define PAGETABLE(idx)	(*((Uint64*)MM_FRACTAL_BASE+((idx)&PAGE_MASK)))
 #define PAGEDIR(idx)	PAGETABLE((MM_FRACTAL_BASE>>12)+((idx)&TABLE_MASK))
@@ -49,6 +56,8 @@
 #define TMPDIRPTR(idx)	PAGEDIR((MM_TMPFRAC_BASE>>21)+((idx)&PDP_MASK))
 #define TMPMAPLVL4(idx)	PAGEDIRPTR((MM_TMPFRAC_BASE>>30)+((idx)&PML4_MASK))
 
+#define MM_IS_USER(__addr)	((tVAddr)(__addr) < 0x800000000000)
+
 #define INVLPG(__addr)	__asm__ __volatile__ ("invlpg (%0)"::"r"(__addr))
 #define INVLPG_ALL()	__asm__ __volatile__ ("mov %cr3,%rax;\n\tmov %rax,%cr3;")
 #define INVLPG_GLOBAL()	__asm__ __volatile__ ("mov %cr4,%rax;\n\txorl $0x80, %eax;\n\tmov %rax,%cr4;\n\txorl $0x80, %eax;\n\tmov %rax,%cr4")
@@ -56,8 +65,16 @@
 // === CONSTS ===
 //tPAddr	* const gaPageTable = MM_FRACTAL_BASE;
 
+// === TYPES ===
+typedef struct sMM_TempSlots
+{
+	tShortSpinlock	Lock;
+	Uint64	Used;	// Bit set for each slot in use
+} tMM_TempSlots;
+
 // === IMPORTS ===
 extern void	Error_Backtrace(Uint IP, Uint BP);
+extern Uint64	giMaxPhysPage;
 extern tPAddr	gInitialPML4[512];
 extern void	Threads_SegFault(tVAddr Addr);
 extern char	_UsertextBase[];
@@ -65,12 +82,18 @@ extern char	_UsertextBase[];
 // === PROTOTYPES ===
 void	MM_InitVirt(void);
 //void	MM_FinishVirtualInit(void);
-void	MM_int_ClonePageEnt( Uint64 *Ent, void *NextLevel, tVAddr Addr, int bTable );
+void	MM_int_ClonePageEnt( Uint64 *Ent, void *NextLevel, tVAddr Addr, int Level );
+static int	MM_int_UnshareTables(tVAddr Addr);
+static void	MM_int_RefLarge(tPAddr Base, int bDeref);
  int	MM_PageFault(tVAddr Addr, Uint ErrorCode, tRegs *Regs);
 void	MM_int_DumpTablesEnt(tVAddr RangeStart, size_t Length, tPAddr Expected);
+size_t	MM_int_DumpLargeRun(tVAddr Start, size_t MaxLength, int Shift);
 //void	MM_DumpTables(tVAddr Start, tVAddr End);
- int	MM_GetPageEntryPtr(tVAddr Addr, BOOL bTemp, BOOL bAllocate, BOOL bLargePage, tPAddr **Pointer);
- int	MM_MapEx(tVAddr VAddr, tPAddr PAddr, BOOL bTemp, BOOL bLarge);
+ int	MM_GetPageEntryPtr(tVAddr Addr, BOOL bTemp, BOOL bAllocate, int LargeShift, tPAddr **Pointer);
+ int	MM_MapEx(tVAddr VAddr, tPAddr PAddr, BOOL bTemp, int LargeShift);
+static int	MM_int_Has1GPages(void);
+static int	MM_int_DirectMapRAM(int NPMemRanges, tPMemMapEnt *PMemRanges, tPAddr Base, tPAddr Size);
+static int	MM_int_DirectMapRange(int NPMemRanges, tPMemMapEnt *PMemRanges, tPAddr Base, int Shift);
 // int	MM_Map(tVAddr VAddr, tPAddr PAddr);
 void	MM_Unmap(tVAddr VAddr);
 void	MM_int_ClearTableLevel(tVAddr VAddr, int LevelBits, int MaxEnts);
@@ -80,6 +103,8 @@ void	MM_int_ClearTableLevel(tVAddr VAddr, int LevelBits, int MaxEnts);
 // === GLOBALS ===
 tMutex	glMM_TempFractalLock;
 tPAddr	gMM_ZeroPage;
+tPAddr	giMM_DirectMapLimit;	// End of the direct map (zero until MM_InitDirectMap)
+tMM_TempSlots	gaMM_TempSlots[MAX_CPUS];
 
 // === CODE ===
 void MM_InitVirt(void)
@@ -93,14 +118,121 @@ void MM_FinishVirtualInit(void)
 	PAGEMAPLVL4(0) = 0;
 }
 
+/**
+ * \brief Determine how much of a physical range is RAM
+ * \return 0 if none of it is, 1 if some is, 2 if all of it is
+ */
+static int MM_int_DirectMapRAM(int NPMemRanges, tPMemMapEnt *PMemRanges, tPAddr Base, tPAddr Size)
+{
+	tPAddr	covered = 0;
+	for( int i = 0; i < NPMemRanges; i ++ )
+	{
+		tPMemMapEnt	*ent = &PMemRanges[i];
+		if( ent->Type != PMEMTYPE_FREE && ent->Type != PMEMTYPE_USED )
+			continue ;
+		tPAddr	start = (ent->Start > Base ? ent->Start : Base);
+		tPAddr	end = ent->Start + ent->Length;
+		if( end > Base + Size )
+			end = Base + Size;
+		if( start < end )
+			covered += end - start;
+	}
+	if( covered == 0 )	return 0;
+	if( covered >= Size )	return 2;
+	return 1;
+}
+
+/**
+ * \brief Map \a Base in the direct map with the largest page that is all RAM or all hole
+ * \return Non-zero if out of memory for page tables
+ * \note Holes (MMIO, firmware) are mapped uncached so speculative fetches through
+ *       a write-back mapping can't hit device memory
+ */
+static int MM_int_DirectMapRange(int NPMemRanges, tPMemMapEnt *PMemRanges, tPAddr Base, int Shift)
+{
+	 int	ram = MM_int_DirectMapRAM(NPMemRanges, PMemRanges, Base, 1ULL << Shift);
+	tPAddr	*ent;
+	
+	// Mixed - split into the next size down (partial 4 KiB pages count as RAM)
+	if( ram == 1 && Shift > PTAB_SHIFT )
+	{
+		for( int i = 0; i < 512; i ++ )
+		{
+			if( MM_int_DirectMapRange(NPMemRanges, PMemRanges, Base + ((tPAddr)i << (Shift-9)), Shift-9) )
+				return 1;
+		}
+		return 0;
+	}
+	
+	if( MM_GetPageEntryPtr(MM_DIRECTMAP_BASE + Base, 0, 1, (Shift > PTAB_SHIFT ? Shift : 0), &ent) < 0 )
+		return 1;
+	*ent = Base | PF_NX|PF_GLOBAL|PF_WRITE|PF_PRESENT;
+	if( Shift > PTAB_SHIFT )
+		*ent |= PF_LARGE;
+	if( ram == 0 )
+		*ent |= PF_PCD|PF_PWT;
+	return 0;
+}
+
+/**
+ * \brief Map all of physical memory at MM_DIRECTMAP_BASE and set up the temp slots
+ * \param NPMemRanges	Number of entries in \a PMemRanges
+ * \param PMemRanges	Physical memory map (used to map holes uncached)
+ * \note Must be called after MM_InitPhys, and before the first MM_Clone (so the
+ *       PML4 entries are shared by every address space)
+ */
+void MM_InitDirectMap(int NPMemRanges, tPMemMapEnt *PMemRanges)
+{
+	tPAddr	limit = (giMaxPhysPage + 1) << 12;
+	tPAddr	paddr;
+	 int	i;
+	
+	// Use 1 GiB pages if the CPU has them, 2 MiB otherwise
+	const int	shift = (MM_int_Has1GPages() ? PDP_SHIFT : PDIR_SHIFT);
+	
+	// Round up to a whole page, and clip to the size of the window
+	limit = (limit + (1ULL << shift) - 1) & ~((1ULL << shift) - 1);
+	if( limit > MM_DIRECTMAP_END - MM_DIRECTMAP_BASE )
+		limit = MM_DIRECTMAP_END - MM_DIRECTMAP_BASE;
+	
+	for( paddr = 0; paddr < limit; paddr += (1ULL << shift) )
+	{
+		if( MM_int_DirectMapRange(NPMemRanges, PMemRanges, paddr, shift) )
+			break;
+	}
+	if( paddr < limit ) {
+		Log_Warning("MMVirt", "Direct map truncated at %P, out of memory", paddr);
+		limit = paddr;
+	}
+	giMM_DirectMapLimit = limit;
+	
+	// Pre-allocate the page tables for the temporary slots
+	for( i = 0; i < MAX_CPUS * MM_TMPMAP_SLOTS; i ++ )
+		MM_GetPageEntryPtr(MM_TMPMAP_BASE + i * PAGE_SIZE, 0, 1, 0, NULL);
+	
+	Log_Log("MMVirt", "Direct map of 0x%llx bytes at %p (%s pages)",
+		(Uint64)limit, MM_DIRECTMAP_BASE, (shift == PDP_SHIFT ? "1 GiB" : "2 MiB"));
+}
+
+/**
+ * \brief Check if the CPU supports 1 GiB pages (CPUID.80000001h:EDX[26])
+ */
+static int MM_int_Has1GPages(void)
+{
+	Uint32	eax, ebx, ecx, edx;
+	__asm__ __volatile__ ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000001));
+	return !!(edx & (1 << 26));
+}
+
 /**
  * \brief Clone a page from an entry
  * \param Ent	Pointer to the entry in the PML4/PDP/PD/PT
  * \param NextLevel	Pointer to contents of the entry
  * \param Addr	Dest address
+ * \param Level	What \a NextLevel is: 0 = Page, 1 = Page Table, 2 = Directory, 3 = PDPT
  * \note Used in COW
  */
-void MM_int_ClonePageEnt( Uint64 *Ent, void *NextLevel, tVAddr Addr, int bTable )
+void MM_int_ClonePageEnt( Uint64 *Ent, void *NextLevel, tVAddr Addr, int Level )
 {
 	tPAddr	curpage = *Ent & PADDR_MASK; 
 	 int	bCopied = 0;
@@ -140,12 +272,14 @@ void MM_int_ClonePageEnt( Uint64 *Ent, void *NextLevel, tVAddr Addr, int bTable
 		*Ent &= PF_USER;
 		*Ent |= paddr|PF_PRESENT|PF_WRITE;
 		
+		if( Level == 0 && MM_IS_USER(Addr) )
+			Proc_GetCurThread()->Process->nCOWCopies ++;
 		bCopied = 1;
 	}
 	INVLPG( (tVAddr)NextLevel );
 	
 	// Mark COW on contents if it's a PDPT, Dir or Table
-	if(bTable) 
+	if( Level > 0 )
 	{
 		Uint64	*dp = NextLevel;
 		 int	i;
@@ -154,8 +288,22 @@ void MM_int_ClonePageEnt( Uint64 *Ent, void *NextLevel, tVAddr Addr, int bTable
 			if( !(dp[i] & PF_PRESENT) )
 				continue;
 			
-			if( bCopied )
+			if( bCopied && Level == 2 && (dp[i] & PF_LARGE) )
+				MM_int_RefLarge( dp[i] & PADDR_MASK, 0 );
+			else if( bCopied )
 				MM_RefPhys( dp[i] & PADDR_MASK );
+			// Pages only this table references aren't shared any more (e.g. the
+			// other process has exec'd), so resolve them now instead of faulting
+			// on each one. Only valid for leaves, a sole-owned table can still
+			// contain writable entries to pages shared with a copy of it.
+			else if( Level == 1 && MM_GetRefCount(dp[i] & PADDR_MASK) == 1 )
+			{
+				if( dp[i] & PF_COW ) {
+					dp[i] &= ~PF_COW;
+					dp[i] |= PF_WRITE;
+				}
+				continue ;
+			}
 			if( dp[i] & PF_WRITE ) {
 				dp[i] &= ~PF_WRITE;
 				dp[i] |= PF_COW;
@@ -164,12 +312,52 @@ void MM_int_ClonePageEnt( Uint64 *Ent, void *NextLevel, tVAddr Addr, int bTable
 	}
 }
 
+/**
+ * \brief Resolve COW on the PML4 and PDP entries above \a Addr
+ * \return Non-zero if anything was copied
+ */
+static int MM_int_UnshareTables(tVAddr Addr)
+{
+	 int	rv = 0;
+	// PML4 Entry
+	if( PAGEMAPLVL4(Addr>>39) & PF_COW )
+	{
+		tPAddr	*dp = &PAGEDIRPTR((Addr>>39)*512);
+		MM_int_ClonePageEnt( &PAGEMAPLVL4(Addr>>39), dp, Addr, 3 );
+		rv = 1;
+	}
+	// PDP Entry
+	if( PAGEDIRPTR(Addr>>30) & PF_COW )
+	{
+		tPAddr	*dp = &PAGEDIR( (Addr>>30)*512 );
+		MM_int_ClonePageEnt( &PAGEDIRPTR(Addr>>30), dp, Addr, 2 );
+		rv = 1;
+	}
+	return rv;
+}
+
+/**
+ * \brief Take (or drop) the reference a 2 MiB page holds on each of its 4 KiB pages
+ */
+static void MM_int_RefLarge(tPAddr Base, int bDeref)
+{
+	Base &= ~(tPAddr)(MM_LARGE_PAGE_SIZE-1);
+	for( int i = 0; i < MM_LARGE_PAGE_SIZE/PAGE_SIZE; i ++ )
+	{
+		if( bDeref )
+			MM_DerefPhys( Base + i * PAGE_SIZE );
+		else
+			MM_RefPhys( Base + i * PAGE_SIZE );
+	}
+}
+
 /*
  * \brief Called on a page fault
  */
 int MM_PageFault(tVAddr Addr, Uint ErrorCode, tRegs *Regs)
 {
 //	Log_Debug("MMVirt", "Addr = %p, ErrorCode = %x", Addr, ErrorCode);
+	TRACE_POINT3(TRACE_EV_PAGEFAULT, Addr, ErrorCode, Regs->RIP);
 
 	// Catch reserved bits first
 	if( ErrorCode & 0x8 )
@@ -188,27 +376,36 @@ int MM_PageFault(tVAddr Addr, Uint ErrorCode, tRegs *Regs)
 		for(;;);
 	}
 
-	// TODO: Implement Copy-on-Write
+	// Copy-on-Write
 	#if 1
+	// - 2 MiB pages shared by a fork are split into COW 4 KiB pages, so a
+	//   write only copies the page it touches (on the retried access)
 	if( PAGEMAPLVL4(Addr>>39) & PF_PRESENT
 	 && PAGEDIRPTR (Addr>>30) & PF_PRESENT
-	 && PAGEDIR    (Addr>>21) & PF_PRESENT
-	 && PAGETABLE  (Addr>>12) & PF_PRESENT )
+	 && (PAGEDIR(Addr>>21) & (PF_PRESENT|PF_LARGE)) == (PF_PRESENT|PF_LARGE) )
 	{
-		// PML4 Entry
-		if( PAGEMAPLVL4(Addr>>39) & PF_COW )
-		{
-			tPAddr	*dp = &PAGEDIRPTR((Addr>>39)*512);
-			MM_int_ClonePageEnt( &PAGEMAPLVL4(Addr>>39), dp, Addr, 1 );
-//			MM_DumpTables(Addr>>39 << 39, (((Addr>>39) + 1) << 39) - 1);
-		}
-		// PDP Entry
-		if( PAGEDIRPTR(Addr>>30) & PF_COW )
+		 int	bCopied = MM_int_UnshareTables(Addr);
+		if( PAGEDIR(Addr>>21) & PF_COW )
 		{
-			tPAddr	*dp = &PAGEDIR( (Addr>>30)*512 );
-			MM_int_ClonePageEnt( &PAGEDIRPTR(Addr>>30), dp, Addr, 1 );
-//			MM_DumpTables(Addr>>30 << 30, (((Addr>>30) + 1) << 30) - 1);
+			if( MM_GetRefCount(PAGEDIR(Addr>>21) & PADDR_MASK) == 1 ) {
+				PAGEDIR(Addr>>21) &= ~PF_COW;
+				PAGEDIR(Addr>>21) |= PF_WRITE;
+				INVLPG( Addr & ~(tVAddr)(MM_LARGE_PAGE_SIZE-1) );
+			}
+			else if( MM_SplitLarge(Addr) ) {
+				Threads_SegFault(Addr);
+			}
+			return 0;
 		}
+		if( bCopied )
+			return 0;
+	}
+	else if( PAGEMAPLVL4(Addr>>39) & PF_PRESENT
+	 && PAGEDIRPTR (Addr>>30) & PF_PRESENT
+	 && PAGEDIR    (Addr>>21) & PF_PRESENT
+	 && PAGETABLE  (Addr>>12) & PF_PRESENT )
+	{
+		MM_int_UnshareTables(Addr);
 		// PD Entry
 		if( PAGEDIR(Addr>>21) & PF_COW )
 		{
@@ -225,6 +422,14 @@ int MM_PageFault(tVAddr Addr, Uint ErrorCode, tRegs *Regs)
 		}
 	}
 	#endif
+
+	// Demand-paged file mapping (only if IRQs were on, the fill can sleep)
+	if( !(ErrorCode & 1) && Addr < USER_MAX && (Regs->RFlags & 0x200) )
+	{
+		__asm__ __volatile__ ("sti");
+		if( VFS_MMap_PageFault(Addr, ErrorCode & 2) == 0 )
+			return 0;
+	}
 	
 	// If it was a user, tell the thread handler
 	if(ErrorCode & 4) {
@@ -290,6 +495,43 @@ void MM_int_DumpTablesEnt(tVAddr RangeStart, size_t Length, tPAddr Expected)
 	#undef CANOICAL
 }
 
+/**
+ * \brief Dump a run of large pages with contiguous physical addresses
+ * \return Length of the run in bytes
+ */
+size_t MM_int_DumpLargeRun(tVAddr Start, size_t MaxLength, int Shift)
+{
+	#define LGENT(a)	(Shift == PDP_SHIFT ? PAGEDIRPTR((a)>>PDP_SHIFT) : PAGEDIR((a)>>PDIR_SHIFT))
+	const tPAddr	FLAGS = PF_PRESENT|PF_WRITE|PF_USER|PF_COW|PF_NX|PF_GLOBAL|PF_LARGE;
+	const size_t	pgsize = 1ULL << Shift;
+	tPAddr	first = LGENT(Start);
+	size_t	len = pgsize;
+	
+	while( len < MaxLength )
+	{
+		tVAddr	addr = Start + len;
+		if( !(PAGEMAPLVL4(addr >> PML4_SHIFT) & PF_PRESENT) )	break;
+		if( Shift == PDIR_SHIFT && (PAGEDIRPTR(addr >> PDP_SHIFT) & (PF_PRESENT|PF_LARGE)) != PF_PRESENT )
+			break;
+		if( (LGENT(addr) & FLAGS) != (first & FLAGS) )	break;
+		if( (LGENT(addr) & PADDR_MASK) != (first & PADDR_MASK) + len )	break;
+		len += pgsize;
+	}
+	
+	LogF("%016llx => %13llx : 0x%6llx (%c%c%c%c%c%c) %s\r\n",
+		Start, first & PADDR_MASK, (Uint64)len,
+		(first & PF_GLOBAL ? 'G' : '-'),
+		(first & PF_NX ? '-' : 'x'),
+		(first & PF_PAGED ? 'p' : '-'),
+		(first & PF_COW ? 'C' : '-'),
+		(first & PF_USER ? 'U' : '-'),
+		(first & PF_WRITE ? 'W' : '-'),
+		(Shift == PDP_SHIFT ? "1G" : "2M")
+		);
+	return len;
+	#undef LGENT
+}
+
 /**
  * \brief Dumps the layout of the page tables
  */
@@ -305,6 +547,8 @@ void MM_DumpTables(tVAddr Start, tVAddr End)
 	tPAddr	expected_pml4 = PF_WRITE|PF_USER;	
 	tPAddr	expected_pdp = PF_WRITE|PF_USER;	
 	tPAddr	expected_pd = PF_WRITE|PF_USER;	
+	 int	largeShift;
+	Uint64	nPages[3] = {0};	// 4 KiB, 2 MiB, 1 GiB
 
 	Log("Table Entries: (%p to %p)", Start, End);
 	
@@ -321,6 +565,30 @@ void MM_DumpTables(tVAddr Start, tVAddr End)
 		//Debug("&PAGEDIR(%i page>>9) = %p", page>>9, &PAGEDIR(page>>9));
 		//Debug("&PAGETABLE(%i page) = %p", page, &PAGETABLE(page));
 		
+		// Large pages (their "page table" is data, so don't walk it)
+		largeShift = 0;
+		if( PAGEMAPLVL4(page>>27) & PF_PRESENT )
+		{
+			if( (PAGEDIRPTR(page>>18) & (PF_PRESENT|PF_LARGE)) == (PF_PRESENT|PF_LARGE) )
+				largeShift = PDP_SHIFT;
+			else if( (PAGEDIRPTR(page>>18) & PF_PRESENT)
+			 && (PAGEDIR(page>>9) & (PF_PRESENT|PF_LARGE)) == (PF_PRESENT|PF_LARGE) )
+				largeShift = PDIR_SHIFT;
+		}
+		if( largeShift )
+		{
+			size_t	len;
+			if(expected != CHANGEABLE_BITS)
+				MM_int_DumpTablesEnt( rangeStart, curPos - rangeStart, expected );
+			expected = CHANGEABLE_BITS;
+			
+			len = MM_int_DumpLargeRun(curPos, (End - page) << 12, largeShift);
+			nPages[largeShift == PDP_SHIFT ? 2 : 1] += len >> largeShift;
+			page += (len >> 12) - 1;
+			curPos += len - 0x1000;
+			continue;
+		}
+		
 		// End of a range
 		if(!(PAGEMAPLVL4(page>>27) & PF_PRESENT)
 		||  (PAGEMAPLVL4(page>>27) & FIXED_BITS) != expected_pml4
@@ -373,6 +641,8 @@ void MM_DumpTables(tVAddr Start, tVAddr End)
 			expected_pd   = (PAGEDIR    (page>> 9) & FIXED_BITS);
 			rangeStart = curPos;
 		}
+		if(expected != CHANGEABLE_BITS)
+			nPages[0] ++;
 		if(gMM_ZeroPage && (expected & PADDR_MASK) == gMM_ZeroPage )
 			expected = expected;
 		else if(expected != CHANGEABLE_BITS)
@@ -386,6 +656,8 @@ void MM_DumpTables(tVAddr Start, tVAddr End)
 		MM_int_DumpTablesEnt( rangeStart, curPos - rangeStart, expected );
 		expected = 0;
 	}
+	
+	Log("Pages: %lli 4KiB, %lli 2MiB, %lli 1GiB", nPages[0], nPages[1], nPages[2]);
 }
 
 /**
@@ -393,11 +665,11 @@ void MM_DumpTables(tVAddr Start, tVAddr End)
  * \param Addr	Virtual Address
  * \param bTemp	Use the Temporary fractal mapping
  * \param bAllocate	Allocate entries
- * \param bLargePage	Request a large page
+ * \param LargeShift	Stop at the large page level of this size (PDIR_SHIFT or PDP_SHIFT), 0 for a normal page
  * \param Pointer	Location to place the calculated pointer
  * \return Page size, or -ve on error
  */
-int MM_GetPageEntryPtr(tVAddr Addr, BOOL bTemp, BOOL bAllocate, BOOL bLargePage, tPAddr **Pointer)
+int MM_GetPageEntryPtr(tVAddr Addr, BOOL bTemp, BOOL bAllocate, int LargeShift, tPAddr **Pointer)
 {
 	tPAddr	*pmlevels[4];
 	tPAddr	tmp;
@@ -428,10 +700,10 @@ int MM_GetPageEntryPtr(tVAddr Addr, BOOL bTemp, BOOL bAllocate, BOOL bLargePage,
 		Uint64	*ent = &pmlevels[i][Addr >> size];
 //		INVLPG( &pmlevels[i][ (Addr >> ADDR_SIZES[i]) & 
 		
-		// Check for a free large page slot
-		// TODO: Better support with selectable levels
-		if( (Addr & ((1ULL << size)-1)) == 0 && bLargePage )
+		// Requested large page level
+		if( size == LargeShift )
 		{
+			if( (Addr & ((1ULL << size)-1)) != 0 )	return -3;
 			if(Pointer)	*Pointer = ent;
 			return size;
 		}
@@ -451,8 +723,9 @@ int MM_GetPageEntryPtr(tVAddr Addr, BOOL bTemp, BOOL bAllocate, BOOL bLargePage,
 		// Catch large pages
 		else if( *ent & PF_LARGE )
 		{
-			// Alignment
-			if( (Addr & ((1ULL << size)-1)) != 0 )	return -3;
+			// A lookup anywhere in a large page gets that page's entry (and size),
+			// only a request for a specific large page must be aligned
+			if( LargeShift && (Addr & ((1ULL << size)-1)) != 0 )	return -3;
 			if(Pointer)	*Pointer = ent;
 			return size;	// Large page warning
 		}
@@ -468,25 +741,32 @@ int MM_GetPageEntryPtr(tVAddr Addr, BOOL bTemp, BOOL bAllocate, BOOL bLargePage,
  * \param VAddr	Target virtual address
  * \param PAddr	Physical address of page
  * \param bTemp	Use tempoary mappings
- * \param bLarge	Treat as a large page
+ * \param LargeShift	Map a large page of this size (PDIR_SHIFT or PDP_SHIFT), 0 for 4 KiB
  */
-int MM_MapEx(tVAddr VAddr, tPAddr PAddr, BOOL bTemp, BOOL bLarge)
+int MM_MapEx(tVAddr VAddr, tPAddr PAddr, BOOL bTemp, int LargeShift)
 {
 	tPAddr	*ent;
 	 int	rv;
 	
-	ENTER("pVAddr PPAddr", VAddr, PAddr);
+	ENTER("pVAddr PPAddr iLargeShift", VAddr, PAddr, LargeShift);
 	
 	// Get page pointer (Allow allocating)
-	rv = MM_GetPageEntryPtr(VAddr, bTemp, 1, bLarge, &ent);
+	rv = MM_GetPageEntryPtr(VAddr, bTemp, 1, LargeShift, &ent);
 	if(rv < 0)	LEAVE_RET('i', 0);
 	
+	// Already mapped (or a large page is requested over an existing table)
 	if( *ent & 1 )	LEAVE_RET('i', 0);
 	
 	*ent = PAddr | 3;
+	if( LargeShift )
+		*ent |= PF_LARGE;
 
-	if( VAddr < 0x800000000000 )
+	if( MM_IS_USER(VAddr) ) {
 		*ent |= PF_USER;
+		// Temporary mappings are into another address space
+		if( !bTemp )
+			Threads_AccountPages( 1 << ((LargeShift ? LargeShift : PTAB_SHIFT) - PTAB_SHIFT) );
+	}
 
 	INVLPG( VAddr );
 
@@ -513,9 +793,26 @@ void MM_Unmap(tVAddr VAddr)
 	if( !(PAGEMAPLVL4(VAddr >> 39) & 1) )	return ;
 	// Check PDP
 	if( !(PAGEDIRPTR(VAddr >> 30) & 1) )	return ;
+	// Large pages are removed as a whole
+	if( PAGEDIRPTR(VAddr >> 30) & PF_LARGE ) {
+		PAGEDIRPTR(VAddr >> 30) = 0;
+		INVLPG( VAddr );
+		if( MM_IS_USER(VAddr) )
+			Threads_AccountPages( -(1 << (PDP_SHIFT-PTAB_SHIFT)) );
+		return ;
+	}
 	// Check Page Dir
 	if( !(PAGEDIR(VAddr >> 21) & 1) )	return ;
+	if( PAGEDIR(VAddr >> 21) & PF_LARGE ) {
+		PAGEDIR(VAddr >> 21) = 0;
+		INVLPG( VAddr );
+		if( MM_IS_USER(VAddr) )
+			Threads_AccountPages( -(1 << (PDIR_SHIFT-PTAB_SHIFT)) );
+		return ;
+	}
 
+	if( (PAGETABLE(VAddr >> PTAB_SHIFT) & PF_PRESENT) && MM_IS_USER(VAddr) )
+		Threads_AccountPages( -1 );
 	PAGETABLE(VAddr >> PTAB_SHIFT) = 0;
 	INVLPG( VAddr );
 }
@@ -529,6 +826,9 @@ tPAddr MM_Allocate(tVAddr VAddr)
 	
 	ENTER("xVAddr", VAddr);
 	
+	if( MM_IS_USER(VAddr) && Threads_CheckMemLimit(1) )
+		LEAVE_RET('i', 0);
+	
 	// Ensure the tables are allocated before the page (keeps things neat)
 	MM_GetPageEntryPtr(VAddr, 0, 1, 0, NULL);
 	
@@ -553,6 +853,9 @@ tPAddr MM_AllocateZero(tVAddr VAddr)
 {
 	tPAddr	ret = gMM_ZeroPage;
 	
+	if( MM_IS_USER(VAddr) && Threads_CheckMemLimit(1) )
+		return 0;
+	
 	MM_GetPageEntryPtr(VAddr, 0, 1, 0, NULL);
 
 	if(!gMM_ZeroPage) {
@@ -571,17 +874,94 @@ tPAddr MM_AllocateZero(tVAddr VAddr)
 
 /**
  * \brief Deallocate a page at a virtual address
+ * \note A large page is released whole if \a VAddr is its base, otherwise it is
+ *       split first and only the 4 KiB page at \a VAddr is released
  */
 void MM_Deallocate(tVAddr VAddr)
 {
-	tPAddr	phys;
+	tPAddr	*ent, phys;
+	 int	size;
 	
-	phys = MM_GetPhysAddr( (void*)VAddr );
-	if(!phys)	return ;
+	size = MM_GetPageEntryPtr(VAddr, 0, 0, 0, &ent);
+	if( size < 0 || !(*ent & PF_PRESENT) )	return ;
+	if( size > PTAB_SHIFT && (VAddr & ((1ULL << size)-1)) )
+	{
+		if( size != PDIR_SHIFT || MM_SplitLarge(VAddr) ) {
+			Log_Warning("MMVirt", "MM_Deallocate - Can't split large page containing %p", VAddr);
+			return ;
+		}
+		size = MM_GetPageEntryPtr(VAddr, 0, 0, 0, &ent);
+		if( size < 0 )	return ;
+	}
+	phys = *ent & PADDR_MASK & ~((1ULL << size)-1);
 	
 	MM_Unmap(VAddr);
 	
-	MM_DerefPhys(phys);
+	// Large pages hold a reference on each of their 4 KiB pages
+	for( Uint64 i = 0; i < (1ULL << (size - 12)); i ++ )
+		MM_DerefPhys(phys + i * PAGE_SIZE);
+}
+
+/**
+ * \brief Allocate a 2 MiB page at a virtual address
+ * \param VAddr	Target address (must be 2 MiB aligned)
+ * \return Physical address, or 0 if no aligned block could be found (use MM_Allocate instead)
+ */
+tPAddr MM_AllocateLarge(tVAddr VAddr)
+{
+	const int	npages = MM_LARGE_PAGE_SIZE / PAGE_SIZE;
+	tPAddr	ret;
+	 int	i;
+	
+	if( VAddr & (MM_LARGE_PAGE_SIZE-1) )	return 0;
+	if( MM_IS_USER(VAddr) && Threads_CheckMemLimit(npages) )	return 0;
+	
+	// Buddy blocks are naturally aligned, so this is aligned unless we fell back to a scan
+	ret = MM_AllocPhysRange(npages, -1);
+	if( !ret )	return 0;
+	if( (ret & (MM_LARGE_PAGE_SIZE-1)) || !MM_MapEx(VAddr, ret, 0, PDIR_SHIFT) )
+	{
+		for( i = 0; i < npages; i ++ )
+			MM_DerefPhys(ret + i * PAGE_SIZE);
+		return 0;
+	}
+	return ret;
+}
+
+/**
+ * \brief Split the 2 MiB page containing \a VAddr into a table of 4 KiB pages
+ * \return 0 on success, 1 if there is no large page there or no memory for the table
+ * \note Each new entry takes over the large page's reference on its 4 KiB page,
+ *       and keeps its protection (including COW)
+ */
+int MM_SplitLarge(tVAddr VAddr)
+{
+	Uint64	*table, flags;
+	tPAddr	base, tabphys;
+	
+	if( !(PAGEMAPLVL4(VAddr>>39) & PF_PRESENT) || !(PAGEDIRPTR(VAddr>>30) & PF_PRESENT) )
+		return 1;
+	if( (PAGEDIR(VAddr>>21) & (PF_PRESENT|PF_LARGE)) != (PF_PRESENT|PF_LARGE) )
+		return 1;
+	
+	// The directory is about to be modified
+	MM_int_UnshareTables(VAddr);
+	
+	tabphys = MM_AllocPhys();
+	if( !tabphys )	return 1;
+	
+	base = PAGEDIR(VAddr>>21) & PADDR_MASK & ~(tPAddr)(MM_LARGE_PAGE_SIZE-1);
+	// (bit 7 is PAT in a 4 KiB entry, so PF_LARGE must not be copied)
+	flags = PAGEDIR(VAddr>>21) & (PF_PRESENT|PF_WRITE|PF_USER|PF_GLOBAL|PF_COW|PF_PAGED|PF_NX);
+	table = MM_MapTemp(tabphys);
+	for( int i = 0; i < MM_LARGE_PAGE_SIZE/PAGE_SIZE; i ++ )
+		table[i] = (base + i * PAGE_SIZE) | flags;
+	MM_FreeTemp(table);
+	
+	PAGEDIR(VAddr>>21) = tabphys | PF_PRESENT | PF_WRITE | (flags & PF_USER);
+	INVLPG( VAddr & ~(tVAddr)(MM_LARGE_PAGE_SIZE-1) );
+	INVLPG( &PAGETABLE((VAddr>>21)*512) );
+	return 0;
 }
 
 /**
@@ -615,12 +995,16 @@ tPAddr MM_GetPhysAddr(volatile const void *Ptr)
 	tPAddr	*ptr;
 	 int	ret;
 	
+	if( MM_DIRECTMAP_BASE <= Addr && Addr < MM_DIRECTMAP_BASE + giMM_DirectMapLimit )
+		return Addr - MM_DIRECTMAP_BASE;
+	
 	ret = MM_GetPageEntryPtr(Addr, 0, 0, 0, &ptr);
 	if( ret < 0 )	return 0;
 	
 	if( !(*ptr & 1) )	return 0;
 	
-	return (*ptr & PADDR_MASK) | (Addr & 0xFFF);
+	// Large pages cover more of the address
+	return (*ptr & PADDR_MASK & ~((1ULL << ret)-1)) | (Addr & ((1ULL << ret)-1));
 }
 
 /**
@@ -666,7 +1050,6 @@ void MM_SetFlags(tVAddr VAddr, Uint Flags, Uint Mask)
 		if( Flags & MM_PFLAG_COW ) {
 			*ent &= ~PF_WRITE;
 			*ent |= PF_COW;
-	INVLPG_ALL();
 		}
 		else {
 			*ent &= ~PF_COW;
@@ -684,6 +1067,8 @@ void MM_SetFlags(tVAddr VAddr, Uint Flags, Uint Mask)
 			*ent |= PF_NX;
 		}
 	}
+	
+	INVLPG( VAddr );
 }
 
 /**
@@ -717,78 +1102,37 @@ Uint MM_GetFlags(tVAddr VAddr)
  */
 int MM_IsValidBuffer(tVAddr Addr, size_t Size)
 {
-	 int	bIsUser;
-	Uint64	pml4, pdp, dir, tab;
+	 int	bIsUser = -1;
 
 	Size += Addr & (PAGE_SIZE-1);
 	Addr &= ~(PAGE_SIZE-1);
 	// NC addr
 	if( ((Addr >> 47) & 1) != ((Addr>>48) == 0xFFFF))
 		return 0;
-	Addr &= ((1UL << 48)-1);	// Clamp to address space
 
-	pml4 = Addr >> 39;
-	pdp = Addr >> 30;
-	dir = Addr >> 21;
-	tab = Addr >> 12;
-
-	if( !(PAGEMAPLVL4(pml4) & 1) ) {
-		Log_Debug("MMVirt", "PML4E %i NP", pml4);
-		return 0;
-	}
-	if( !(PAGEDIRPTR(pdp) & 1) ) {
-		Log_Debug("MMVirt", "PDPE %i NP", pdp);
-		return 0;
-	}
-	if( !(PAGEDIR(dir) & 1) ) {
-		Log_Debug("MMVirt", "PDE %i NP", dir);
-		return 0;
-	}
-	if( !(PAGETABLE(tab) & 1) ) {
-		Log_Debug("MMVirt", "PTE %i NP", tab);
-		return 0;
-	}
-	
-	bIsUser = !!(PAGETABLE(tab) & PF_USER);
-
-	while( Size >= PAGE_SIZE )
+	for( ;; )
 	{
-		tab ++;
-		Size -= PAGE_SIZE;
-		
-		if( (tab & 511) == 0 )
-		{
-			dir ++;
-			if( (dir & 511) == 0 )
-			{
-				pdp ++;
-				if( (pdp & 511) == 0 )
-				{
-					pml4 ++;
-					if( !(PAGEMAPLVL4(pml4) & 1) ) {
-						Log_Debug("MMVirt", "IsValidBuffer - PML4E %x NP, Size=%x", pml4, Size);
-						return 0;
-					}
-				}
-				if( !(PAGEDIRPTR(pdp) & 1) ) {
-					Log_Debug("MMVirt", "IsValidBuffer - PDPE %x NP", pdp);
-					return 0;
-				}
-			}
-			if( !(PAGEDIR(dir) & 1) ) {
-				Log_Debug("MMVirt", "IsValidBuffer - PDE %x NP", dir);
-				return 0;
-			}
-		}
+		tPAddr	*ent;
+		tVAddr	next;
+		 int	size = MM_GetPageEntryPtr(Addr, 0, 0, 0, &ent);
 		
-		if( !(PAGETABLE(tab) & 1) ) {
-			Log_Debug("MMVirt", "IsValidBuffer - PTE %x NP", tab);
+		if( size < 0 || !(*ent & PF_PRESENT) ) {
+			Log_Debug("MMVirt", "IsValidBuffer - %p NP", Addr);
 			return 0;
 		}
-		if( bIsUser && !(PAGETABLE(tab) & PF_USER) ) {
-			Log_Debug("MMVirt", "IsValidBuffer - PTE %x Not user", tab);
+		if( bIsUser == -1 )
+			bIsUser = !!(*ent & PF_USER);
+		else if( bIsUser && !(*ent & PF_USER) ) {
+			Log_Debug("MMVirt", "IsValidBuffer - %p Not user", Addr);
 			return 0;
 		}
+		
+		// Large pages cover several 4 KiB steps at once
+		next = (Addr | ((1ULL << size) - 1)) + 1;
+		if( next - Addr > Size )
+			break;
+		Size -= next - Addr;
+		Addr = next;
 	}
 	return 1;
 }
@@ -799,29 +1143,53 @@ int MM_IsValidBuffer(tVAddr Addr, size_t Size)
  */
 void *MM_MapHWPages(tPAddr PAddr, Uint Number)
 {
-	tVAddr	ret;
-	 int	num;
+	const Uint	large_pages = MM_LARGE_PAGE_SIZE / PAGE_SIZE;
+	tVAddr	ret, first = MM_HWMAP_BASE, step = PAGE_SIZE;
+	Uint	num;
+	
+	// If the range covers an aligned 2 MiB block, only search addresses that
+	// share PAddr's offset in a large page (so that block can be a large page)
+	tPAddr	large_base = (PAddr + MM_LARGE_PAGE_SIZE - 1) & ~(tPAddr)(MM_LARGE_PAGE_SIZE - 1);
+	 int	bLarge = (large_base + MM_LARGE_PAGE_SIZE <= PAddr + (tPAddr)Number * PAGE_SIZE);
+	if( bLarge ) {
+		first += PAddr & (MM_LARGE_PAGE_SIZE - 1);
+		step = MM_LARGE_PAGE_SIZE;
+	}
 	
 	//TODO: Add speedups (memory of first possible free)
-	for( ret = MM_HWMAP_BASE; ret < MM_HWMAP_TOP; ret += 0x1000 )
+	for( ret = first; ret + Number * PAGE_SIZE <= MM_HWMAP_TOP; ret += step )
 	{
-		for( num = Number; num -- && ret < MM_HWMAP_TOP; ret += 0x1000 )
+		for( num = 0; num < Number; num ++ )
 		{
-			if( MM_GetPhysAddr( (void*)ret ) != 0 )
+			if( MM_GetPhysAddr( (void*)(ret + num * PAGE_SIZE) ) != 0 )
 				break;
 		}
-		if( num >= 0 )	continue;
+		if( num < Number ) {
+			// Skip past the used page
+			if( !bLarge )	ret += num * PAGE_SIZE;
+			continue;
+		}
 		
-//		Log_Debug("MMVirt", "Mapping %i pages to %p (base %P)", Number, ret-Number*0x1000, PAddr);
-
-		PAddr += 0x1000 * Number;
+//		Log_Debug("MMVirt", "Mapping %i pages to %p (base %P)", Number, ret, PAddr);
 		
-		while( Number -- )
+		for( num = 0; num < Number; )
 		{
-			ret -= 0x1000;
-			PAddr -= 0x1000;
-			MM_Map(ret, PAddr);
-			MM_RefPhys(PAddr);
+			tVAddr	va = ret + num * PAGE_SIZE;
+			tPAddr	pa = PAddr + num * PAGE_SIZE;
+			// Use a 2 MiB page where the block is aligned and entirely in the range
+			if( bLarge && !(pa & (MM_LARGE_PAGE_SIZE-1)) && Number - num >= large_pages
+			 && MM_MapEx(va, pa, 0, PDIR_SHIFT) )
+			{
+				for( Uint i = 0; i < large_pages; i ++ )
+					MM_RefPhys(pa + i * PAGE_SIZE);
+				num += large_pages;
+			}
+			else
+			{
+				MM_Map(va, pa);
+				MM_RefPhys(pa);
+				num ++;
+			}
 		}
 		
 		return (void*)ret;
@@ -836,12 +1204,18 @@ void *MM_MapHWPages(tPAddr PAddr, Uint Number)
  */
 void MM_UnmapHWPages(tVAddr VAddr, Uint Number)
 {
-//	Log_KernelPanic("MM", "TODO: Implement MM_UnmapHWPages");
-	while( Number -- )
+	while( Number > 0 )
 	{
-		MM_DerefPhys( MM_GetPhysAddr((void*)VAddr) );
-		MM_Unmap(VAddr);
-		VAddr += 0x1000;
+		tPAddr	*ent;
+		 int	size = MM_GetPageEntryPtr(VAddr, 0, 0, 0, &ent);
+		Uint	count = (size > 12 ? 1 << (size - 12) : 1);
+		
+		// Drops the reference on every page covered by the entry
+		MM_Deallocate(VAddr);
+		
+		if( count > Number )	count = Number;
+		VAddr += count * PAGE_SIZE;
+		Number -= count;
 	}
 }
 
@@ -892,34 +1266,70 @@ void *MM_AllocDMA(int Pages, int MaxBits, tPAddr *PhysAddr)
 }
 
 // --- Tempory Mappings ---
+/**
+ * \brief Get a kernel pointer to a physical page
+ * \return Page-aligned pointer to the page (the offset in \a PAddr is ignored)
+ * \note Pages within the direct map need no mapping at all, others use a
+ *       per-CPU slot (nestable to MM_TMPMAP_SLOTS deep).
+ */
 void *MM_MapTemp(tPAddr PAddr)
 {
-	const int max_slots = (MM_TMPMAP_END - MM_TMPMAP_BASE) / PAGE_SIZE;
-	tVAddr	ret = MM_TMPMAP_BASE;
-	 int	i;
+	PAddr &= ~(PAGE_SIZE-1);
 	
-	for( i = 0; i < max_slots; i ++, ret += PAGE_SIZE )
-	{
-		tPAddr	*ent;
-		if( MM_GetPageEntryPtr( ret, 0, 1, 0, &ent) < 0 ) {
-			continue ;
-		}
-
-		if( *ent & 1 )
-			continue ;
-
-		*ent = PAddr | 3;
-		MM_RefPhys(PAddr);
-		INVLPG(ret);
-		return (void*)ret;
+	if( PAddr < giMM_DirectMapLimit )
+		return (void*)(MM_DIRECTMAP_BASE + PAddr);
+	
+	// Outside the direct map (or before it's set up), use this CPU's slots
+	tMM_TempSlots	*slots = &gaMM_TempSlots[GetCPUNum()];
+	 int	slot;
+	tVAddr	ret;
+	
+	SHORTLOCK( &slots->Lock );
+	if( slots->Used + 1 == 0 ) {
+		SHORTREL( &slots->Lock );
+		Log_Warning("MMVirt", "MM_MapTemp - CPU%i out of temporary slots", GetCPUNum());
+		return NULL;
 	}
-	return 0;
+	// Lowest free slot, so properly nested users behave like a stack
+	slot = __builtin_ctzll( ~slots->Used );
+	slots->Used |= 1ULL << slot;
+	ret = MM_TMPMAP_BASE + ((slots - gaMM_TempSlots) * MM_TMPMAP_SLOTS + slot) * PAGE_SIZE;
+	
+	if( MM_GetPageEntryPtr(ret, 0, 1, 0, NULL) < 0 ) {
+		slots->Used &= ~(1ULL << slot);
+		SHORTREL( &slots->Lock );
+		return NULL;
+	}
+	PAGETABLE(ret >> PTAB_SHIFT) = PAddr | PF_WRITE|PF_PRESENT;
+	// Slots are never global, so a task switch (CR3 reload) flushes them from
+	// any other CPU the caller migrates to; only this CPU needs an INVLPG.
+	INVLPG( ret );
+	SHORTREL( &slots->Lock );
+	
+	return (void*)ret;
 }
 
 void MM_FreeTemp(void *Ptr)
 {
-	MM_Deallocate((tVAddr)Ptr);
-	return ;
+	tVAddr	addr = (tVAddr)Ptr & ~(PAGE_SIZE-1);
+	
+	// Direct map, nothing to do
+	if( MM_DIRECTMAP_BASE <= addr && addr < MM_DIRECTMAP_END )
+		return ;
+	
+	if( addr < MM_TMPMAP_BASE || addr >= MM_TMPMAP_BASE + MAX_CPUS*MM_TMPMAP_SLOTS*PAGE_SIZE ) {
+		Log_Warning("MMVirt", "MM_FreeTemp - %p is not a temporary mapping", Ptr);
+		return ;
+	}
+	
+	// Release to the owning CPU (which may not be this one if we migrated)
+	 int	idx = (addr - MM_TMPMAP_BASE) / PAGE_SIZE;
+	tMM_TempSlots	*slots = &gaMM_TempSlots[idx / MM_TMPMAP_SLOTS];
+	SHORTLOCK( &slots->Lock );
+	PAGETABLE(addr >> PTAB_SHIFT) = 0;
+	INVLPG( addr );
+	slots->Used &= ~(1ULL << (idx % MM_TMPMAP_SLOTS));
+	SHORTREL( &slots->Lock );
 }
 
 
@@ -928,18 +1338,23 @@ tPAddr MM_Clone(int bNoUserCopy)
 {
 	tPAddr	ret;
 	 int	i;
-	tVAddr	kstackbase;
+	 int	bProtectedUser = 0;
+	tVAddr	kstackbase, kstackused;
+	Uint	rsp;
 
 	// #1 Create a copy of the PML4
 	ret = MM_AllocPhys();
 	if(!ret)	return 0;
 	
 	// #2 Alter the fractal pointer
+	// - Only the new PML4 is accessed through the old view, and the kernel
+	//   stack tables below are fresh (MM_GetPageEntryPtr invalidates them)
 	Mutex_Acquire(&glMM_TempFractalLock);
 	TMPCR3() = ret | 3;
-	INVLPG_ALL();
+	INVLPG( &TMPMAPLVL4(0) );
 	
-	// #3 Set Copy-On-Write to all user pages
+	// #3 Share the user page tables, Copy-On-Write
+	// - Subtrees are only copied when written (see MM_int_ClonePageEnt)
 	if( Threads_GetPID() != 0 && !bNoUserCopy )
 	{
 		for( i = 0; i < 256; i ++)
@@ -947,6 +1362,7 @@ tPAddr MM_Clone(int bNoUserCopy)
 			if( PAGEMAPLVL4(i) & PF_WRITE ) {
 				PAGEMAPLVL4(i) |= PF_COW;
 				PAGEMAPLVL4(i) &= ~PF_WRITE;
+				bProtectedUser = 1;
 			}
 	
 			TMPMAPLVL4(i) = PAGEMAPLVL4(i);
@@ -992,18 +1408,25 @@ tPAddr MM_Clone(int bNoUserCopy)
 	//  tThread->KernelStack is the top
 	//  There is 1 guard page below the stack
 	kstackbase = Proc_GetCurThread()->KernelStack - KERNEL_STACK_SIZE;
+	// Only the part of the stack above RSP is live, the rest is just mapped
+	__asm__ __volatile__ ("mov %%rsp, %0" : "=r"(rsp));
+	kstackused = (rsp - 128) & ~(tVAddr)0xFFF;	// 128 bytes leeway for the call below
+	if( kstackused < kstackbase )	kstackused = kstackbase;
 
 	// Clone stack
 	TMPMAPLVL4(MM_KSTACK_BASE >> PML4_SHIFT) = 0;
 	for( i = 1; i < KERNEL_STACK_SIZE/0x1000; i ++ )
 	{
+		tVAddr	page = kstackbase + i*0x1000;
 		tPAddr	phys = MM_AllocPhys();
 		void	*tmpmapping;
-		MM_MapEx(kstackbase+i*0x1000, phys, 1, 0);
+		MM_MapEx(page, phys, 1, 0);
 		
+		if( page < kstackused )
+			continue ;
 		tmpmapping = MM_MapTemp(phys);
-		if( MM_GetPhysAddr( (void*)(kstackbase+i*0x1000) ) )
-			memcpy(tmpmapping, (void*)(kstackbase+i*0x1000), 0x1000);
+		if( MM_GetPhysAddr( (void*)page ) )
+			memcpy(tmpmapping, (void*)page, 0x1000);
 		else
 			memset(tmpmapping, 0, 0x1000);
 //		if( i == 0xF )
@@ -1015,7 +1438,10 @@ tPAddr MM_Clone(int bNoUserCopy)
 
 	// #7 Return
 	TMPCR3() = 0;
-	INVLPG_ALL();
+	// Our own user mappings were write-protected, drop any writable TLB entries
+	// (user pages are never global, so a CR3 reload is cheapest)
+	if( bProtectedUser )
+		INVLPG_ALL();
 	Mutex_Release(&glMM_TempFractalLock);
 //	Log("MM_Clone: RETURN %P", ret);
 	return ret;
@@ -1035,6 +1461,12 @@ void MM_int_ClearTableLevel(tVAddr VAddr, int LevelBits, int MaxEnts)
 			continue ;
 		}
 	
+		// Large pages reference every 4 KiB page they cover
+		if( LevelBits == PDIR_SHIFT && (table[i] & PF_LARGE) ) {
+			MM_int_RefLarge(table[i] & PADDR_MASK, 1);
+			table[i] = 0;
+			continue ;
+		}
 		if( (table[i] & PF_COW) && MM_GetRefCount(table[i] & PADDR_MASK) > 1 ) {
 			MM_DerefPhys(table[i] & PADDR_MASK);
 			table[i] = 0;
@@ -1051,6 +1483,47 @@ void MM_int_ClearTableLevel(tVAddr VAddr, int LevelBits, int MaxEnts)
 void MM_ClearUser(void)
 {
 	MM_int_ClearTableLevel(0, 39, 256);	
+	Proc_GetCurThread()->Process->nResidentPages = 0;
+}
+
+/**
+ * \brief Count pages under a table of another address space
+ * \param bShared	An ancestor table is referenced by more than one address space
+ */
+static void MM_int_CountTable(tPAddr Table, int Level, int bShared, int MaxEnts, size_t *Shared, size_t *Private)
+{
+	Uint64	*ents = MM_MapTemp(Table);
+	
+	if( !ents )	return ;
+	for( int i = 0; i < MaxEnts; i ++ )
+	{
+		tPAddr	phys = ents[i] & PADDR_MASK;
+		 int	bEntShared = bShared;
+		
+		if( !(ents[i] & PF_PRESENT) )	continue ;
+		// COW after a fork, the page cache and the zero page all hold extra references
+		if( MM_GetRefCount(phys) > 1 )
+			bEntShared = 1;
+		
+		if( Level == 0 || (ents[i] & PF_LARGE) )
+			*(bEntShared ? Shared : Private) += 1ULL << (9*Level);
+		else
+			MM_int_CountTable(phys, Level-1, bEntShared, 512, Shared, Private);
+	}
+	MM_FreeTemp(ents);
+}
+
+/**
+ * \brief Count the user pages of a process that are shared with something
+ *        else, and those that only it references
+ */
+void MM_CountUserPages(tProcess *Process, size_t *Shared, size_t *Private)
+{
+	*Shared = 0;
+	*Private = 0;
+	if( !Process->MemState.CR3 )
+		return ;
+	MM_int_CountTable(Process->MemState.CR3 & PADDR_MASK, 3, 0, 256, Shared, Private);
 }
 
 tVAddr MM_NewWorkerStack(void *StackData, size_t StackSize)
@@ -14,6 +14,7 @@
 #endif
 #include <arch_config.h>
 #include <hal_proc.h>
+#include <trace.h>
 
 // === FLAGS ===
 #define DEBUG_TRACE_SWITCH	0
@@ -52,7 +53,7 @@ extern tThread	gThreadZero;
 extern tProcess	gProcessZero;
 extern void	Threads_Dump(void);
 extern void	Proc_ReturnToUser(tVAddr Handler, tVAddr KStackTop, int Argument);
-extern void	Time_UpdateTimestamp(void);
+extern void	Time_UpdateTimestamp(Uint IP, Uint BP);
 extern void	SwitchTasks(Uint NewSP, Uint *OldSP, Uint NewIP, Uint *OldIO, Uint CR3);
 
 // === PROTOTYPES ===
@@ -80,6 +81,7 @@ Uint	Proc_int_SetIRQIP(Uint RIP);
 // === GLOBALS ===
 //!\brief Used by desctab.asm in SyscallStub
 const int ci_offsetof_tThread_KernelStack = offsetof(tThread, KernelStack);
+const int ci_offsetof_tThread_UserRIP = offsetof(tThread, SavedState.UserRIP);
 // --- Multiprocessing ---
 #if USE_MP
 volatile int	giNumInitingCPUs = 0;
@@ -761,6 +763,8 @@ void Proc_Reschedule(void)
 		);
 	#endif
 
+	TRACE_POINT2(TRACE_EV_SCHED_SWITCH, (curthread ? curthread->TID : -1), nextthread->TID);
+
 	// Update CPU state
 	gaCPUs[cpu].Current = nextthread;
 	gTSSs[cpu].RSP0 = nextthread->KernelStack-sizeof(void*);
@@ -5,6 +5,7 @@
  */
 #include <acess.h>
 #include <arch_config.h>
+#include <trace.h>
 
 // === MACROS ===
 #define	TIMER_QUANTUM	100
@@ -25,7 +26,7 @@ volatile Uint64	giTime_TSCPerTick = 0;
 // === PROTOTYPES ===
 //Sint64	now(void);
  int	Time_Setup(void);
-void	Time_UpdateTimestamp(void);
+void	Time_UpdateTimestamp(Uint IP, Uint BP);
 Uint64	Time_ReadTSC(void);
 
 // === CODE ===
@@ -62,8 +63,10 @@ int Time_Setup(void)
 
 /**
  * \brief Called on the timekeeping IRQ
+ * \param IP	Interrupted RIP
+ * \param BP	Interrupted RBP
  */
-void Time_UpdateTimestamp(void)
+void Time_UpdateTimestamp(Uint IP, Uint BP)
 {
 	Uint64	curTSC = Time_ReadTSC();
 	
@@ -81,6 +84,14 @@ void Time_UpdateTimestamp(void)
 		giPartMiliseconds -= 0x80000000;
 	}
 	
+	#if TRACE_ENABLED
+	if( Trace_SampleDue() )
+	{
+		Uint	frames[TRACE_SAMPLE_DEPTH];
+		Trace_Sample( Error_BacktraceCapture(IP, BP, frames, TRACE_SAMPLE_DEPTH), frames );
+	}
+	#endif
+	
 	Timer_CallTimers();
 }
 
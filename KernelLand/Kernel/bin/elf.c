@@ -28,7 +28,7 @@ static int	GetSymbol(const char *Name, void **Value, size_t *Size) {
 	return 1;
 }
 #define AddLoaded(a,b)	do{}while(0)
-#define LoadLibrary(a,b,c)	(Log_Debug("ELF", "Module requested lib '%s'",a),0)
+#define LoadLibrary(a,b,c)	(Log_Debug("ELF", "Module requested lib '%s'",a),(void*)0)
 #define _SysSetMemFlags(ad,f,m)	do{}while(0)
 #include "../../../Usermode/Libraries/ld-acess.so_src/elf.c"
 // ---- / ----
@@ -8,6 +8,7 @@
 #include <mm_virt.h>
 #include <hal_proc.h>
 #include <vfs_threads.h>
+#include <threads_int.h>
 
 // === CONSTANTS ===
 #define BIN_LOWEST	MM_USER_MIN		// 1MiB
@@ -16,6 +17,7 @@
 #define	KLIB_LOWEST	MM_MODULE_MIN
 #define KLIB_GRANUALITY	0x10000		// 32KiB
 #define	KLIB_HIGHEST	(MM_MODULE_MAX-KLIB_GRANUALITY)
+#define BIN_HASH_SIZE	64	// Buckets in the loaded binary cache (power of two)
 
 // === TYPES ===
 typedef struct sKernelBin {
@@ -46,10 +48,12 @@ Uint	Binary_GetSymbolEx(const char *Name, Uint *Value);
 Uint	Binary_FindSymbol(void *Base, const char *Name, Uint *Val);
 #endif
  int	Binary_int_CheckMemFree( tVAddr _start, size_t _len );
+static int	Binary_int_Hash(tMount MountID, tInode Inode);
+size_t	Binary_GenStatsFile(char *Buffer, size_t Length);
 
 // === GLOBALS ===
 tShortSpinlock	glBinListLock;
-tBinary	*glLoadedBinaries = NULL;
+tBinary	*gaLoadedBinaries[BIN_HASH_SIZE];	// Hashed on (mount, inode)
 char	**gsaRegInterps = NULL;
  int	giRegInterps = 0;
 tShortSpinlock	glKBinListLock;
@@ -241,6 +245,7 @@ int Proc_Execve(const char *File, const char **ArgV, const char **EnvP, int Data
 		void	*handles;
 		handles = VFS_SaveHandles(nfd, NULL);
 		VFS_CloseAllUserHandles();
+		VFS_MMap_ClearAreas( Proc_GetCurThread()->Process );
 		MM_ClearUser();
 		VFS_RestoreHandles(nfd, handles);
 		VFS_FreeSavedHandles(nfd, handles);
@@ -353,12 +358,73 @@ tVAddr Binary_Load(const char *Path, tVAddr *EntryPoint)
 tBinary *Binary_GetInfo(tMount MountID, tInode InodeID)
 {
 	tBinary	*pBinary;
-	for(pBinary = glLoadedBinaries; pBinary; pBinary = pBinary->Next)
+	SHORTLOCK(&glBinListLock);
+	for(pBinary = gaLoadedBinaries[Binary_int_Hash(MountID, InodeID)]; pBinary; pBinary = pBinary->Next)
 	{
 		if(pBinary->MountID == MountID && pBinary->Inode == InodeID)
-			return pBinary;
+			break;
+	}
+	SHORTREL(&glBinListLock);
+	return pBinary;
+}
+
+static int Binary_int_Hash(tMount MountID, tInode Inode)
+{
+	Uint64	h = Inode * 0x9E3779B97F4A7C15ULL + MountID;
+	return (h >> 32) & (BIN_HASH_SIZE-1);
+}
+
+/**
+ * \brief Generate /Devices/system/Binaries (see SysFS_RegisterGenFile)
+ * 
+ * One line per cached binary:
+ * <path>\t<maps>\t<ro pages>\t<ro resident>\t<ro shared>\t<rw pages>\n
+ * - ro resident/shared: pages of read-only sections in the page cache, and
+ *   those of them mapped by more than one address space
+ * - rw pages: pages of writable sections, which become private to each
+ *   mapping as they are written (or zero filled for BSS)
+ */
+size_t Binary_GenStatsFile(char *Buffer, size_t Length)
+{
+	size_t	len = 0;
+	#define ADD(...)	do { \
+		 int	_n = snprintf(len < Length ? Buffer + len : NULL, len < Length ? Length - len : 0, __VA_ARGS__); \
+		if( _n > 0 )	len += _n; \
+	} while(0)
+
+	// Cached binaries are never freed and new entries are only ever
+	// prepended, so the chains can be walked without the lock
+	for( int i = 0; i < BIN_HASH_SIZE; i ++ )
+	{
+		for( tBinary *bin = gaLoadedBinaries[i]; bin; bin = bin->Next )
+		{
+			size_t	ro_pages = 0, ro_resident = 0, ro_shared = 0, rw_pages = 0;
+			 int	fd;
+
+			fd = VFS_OpenInode(bin->MountID, bin->Inode, VFS_OPENFLAG_READ);
+			for( int j = 0; j < bin->NumSections; j ++ )
+			{
+				tBinarySection	*sect = &bin->LoadSections[j];
+				size_t	npages = (sect->Virtual % PAGE_SIZE + sect->MemSize + PAGE_SIZE - 1) / PAGE_SIZE;
+				if( !(sect->Flags & BIN_SECTFLAG_RO) ) {
+					rw_pages += npages;
+					continue ;
+				}
+				ro_pages += npages;
+				if( fd != -1 )
+					VFS_MMap_CountCached(fd, sect->Offset, sect->FileSize, &ro_resident, &ro_shared);
+			}
+			if( fd != -1 )
+				VFS_Close(fd);
+
+			ADD("%s\t%i\t%i\t%i\t%i\t%i\n",
+				bin->Path, bin->ReferenceCount,
+				(int)ro_pages, (int)ro_resident, (int)ro_shared, (int)rw_pages);
+		}
 	}
-	return NULL;
+
+	#undef ADD
+	return len;
 }
 
 /**
@@ -570,19 +636,35 @@ tBinary *Binary_DoLoad(tMount MountID, tInode Inode, const char *Path)
 	pBinary->ReferenceCount = 0;
 	pBinary->MountID = MountID;
 	pBinary->Inode = Inode;
+	pBinary->Path = strdup(Path);
 	
 	// Debug Information
 	LOG("Interpreter: '%s'", pBinary->Interpreter);
 	LOG("Base: 0x%x, Entry: 0x%x", pBinary->Base, pBinary->Entry);
 	LOG("NumSections: %i", pBinary->NumSections);
 	
-	// Add to the list
-	SHORTLOCK(&glBinListLock);
-	pBinary->Next = glLoadedBinaries;
-	glLoadedBinaries = pBinary;
-	SHORTREL(&glBinListLock);
-
-	// TODO: Register the path with the binary	
+	// Add to the cache (unless another thread beat us to it)
+	{
+		tBinary	**bucket = &gaLoadedBinaries[ Binary_int_Hash(MountID, Inode) ];
+		tBinary	*other;
+		SHORTLOCK(&glBinListLock);
+		for( other = *bucket; other; other = other->Next )
+		{
+			if( other->MountID == MountID && other->Inode == Inode )
+				break;
+		}
+		if( !other ) {
+			pBinary->Next = *bucket;
+			*bucket = pBinary;
+		}
+		SHORTREL(&glBinListLock);
+		if( other ) {
+			LOG("Raced with another load, using %p", other);
+			free( (void*)pBinary->Path );
+			free( pBinary );
+			pBinary = other;
+		}
+	}
 
 	// Return
 	LEAVE('p', pBinary);
@@ -884,6 +966,11 @@ int Binary_int_CheckMemFree( tVAddr _start, size_t _len )
 	_len = (_len + PAGE_SIZE - 1) & ~(PAGE_SIZE-1);
 	_start &= ~(PAGE_SIZE-1);
 	LOG("_start = %p, _len = 0x%x", _start, _len);
+	// Mappings that haven't been touched yet have no pages
+	if( _start < USER_MAX && VFS_MMap_IsReserved(_start, _len) ) {
+		LEAVE('i', 1);
+		return 1;
+	}
 	for( ; _len > PAGE_SIZE; _len -= PAGE_SIZE, _start += PAGE_SIZE ) {
 		if( MM_GetPhysAddr( (void*)_start ) != 0 ) {
 			LEAVE('i', 1);
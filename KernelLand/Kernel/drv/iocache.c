@@ -9,6 +9,7 @@
 #define DEBUG	0
 #include <acess.h>
 #include <iocache.h>
+#include <reclaim.h>
 #define IOCACHE_USE_PAGES	1
 
 // === TYPES ===
@@ -28,7 +29,6 @@ struct sIOCache_Ent
 struct sIOCache_PageInfo
 {
 	tIOCache_PageInfo	*CacheNext;
-	tIOCache_PageInfo	*GlobalNext;
 	tIOCache	*Owner;
 	Sint64	LastAccess;
 	
@@ -57,14 +57,20 @@ struct sIOCache
 
 #if IOCACHE_USE_PAGES
 tIOCache_PageInfo	*IOCache_int_GetPage(tIOCache *Cache, Uint64 Sector, tIOCache_PageInfo **Prev, size_t *Offset);
+tIOCache_PageInfo	*IOCache_int_TakeOldest(tIOCache *Cache);
+size_t	IOCache_int_Shrink(tReclaim_Shrinker *Self, size_t Pages, int Flags);
 #endif
 
 // === GLOBALS ===
-tShortSpinlock	glIOCache_Caches;
+tMutex	glIOCache_Caches;
 tIOCache	*gIOCache_Caches = NULL;
  int	giIOCache_NumCaches = 0;
 #if IOCACHE_USE_PAGES
-tIOCache_PageInfo	*gIOCache_GlobalPages;
+ int	gbIOCache_ShrinkerRegistered;
+tReclaim_Shrinker	gIOCache_Shrinker = {
+	.Name = "IOCache",
+	.Shrink = IOCache_int_Shrink
+};
 #endif
 
 // === CODE ===
@@ -93,11 +99,18 @@ tIOCache *IOCache_Create( tIOCache_WriteCallback Write, void *ID, int SectorSize
 	ret->Write = Write;
 	ret->CacheSize = CacheSize;
 	
+	#if IOCACHE_USE_PAGES
+	if( !gbIOCache_ShrinkerRegistered ) {
+		gbIOCache_ShrinkerRegistered = 1;
+		Reclaim_Register( &gIOCache_Shrinker );
+	}
+	#endif
+	
 	// Append to list
-	SHORTLOCK( &glIOCache_Caches );
+	Mutex_Acquire( &glIOCache_Caches );
 	ret->Next = gIOCache_Caches;
 	gIOCache_Caches = ret;
-	SHORTREL( &glIOCache_Caches );
+	Mutex_Release( &glIOCache_Caches );
 	
 	// Return
 	return ret;
@@ -121,6 +134,81 @@ tIOCache_PageInfo *IOCache_int_GetPage(tIOCache *Cache, Uint64 Sector, tIOCache_
 		*Prev = prev;
 	return NULL;
 }
+
+/**
+ * \brief Remove the least recently used page from a cache
+ * \return Page (written back if it was dirty), or NULL if the cache is empty
+ * \note Cache->Lock must be held
+ */
+tIOCache_PageInfo *IOCache_int_TakeOldest(tIOCache *Cache)
+{
+	tIOCache_PageInfo *oldest = NULL, *oldestPrev = NULL, *prev = NULL;
+	for( tIOCache_PageInfo *ent = Cache->Pages; ent; prev = ent, ent = ent->CacheNext )
+	{
+		if( !oldest || ent->LastAccess < oldest->LastAccess ) {
+			oldest = ent;
+			oldestPrev = prev;
+		}
+	}
+	if( !oldest )
+		return NULL;
+	
+	// Remove oldest from list
+	*(oldestPrev ? &oldestPrev->CacheNext : &Cache->Pages) = oldest->CacheNext;
+	
+	// Flush
+	if( oldest->DirtySectors && Cache->Mode != IOCACHE_VIRTUAL )
+	{
+		char	*page_map = MM_MapTemp( oldest->BasePhys );
+		for( int i = 0; i < PAGE_SIZE/Cache->SectorSize; i ++ )
+		{
+			if( !(oldest->DirtySectors & (1 << i)) )
+				continue ;
+			Cache->Write(Cache->ID, oldest->BaseOffset/Cache->SectorSize+i,
+				page_map + i * Cache->SectorSize);
+		}
+		MM_FreeTemp( page_map );
+	}
+	return oldest;
+}
+
+/**
+ * \brief Shrinker, takes the least recently used page from each cache in turn
+ * \note Dirty pages are written back before being dropped, so this can't run
+ *       from the allocator
+ */
+size_t IOCache_int_Shrink(tReclaim_Shrinker *Self, size_t Pages, int Flags)
+{
+	size_t	freed = 0;
+
+	if( Flags & RECLAIM_FLAG_ATOMIC )
+		return 0;
+
+	Mutex_Acquire( &glIOCache_Caches );
+	while( freed < Pages )
+	{
+		size_t	round = 0;
+		for( tIOCache *cache = gIOCache_Caches; cache && freed < Pages; cache = cache->Next )
+		{
+			Mutex_Acquire( &cache->Lock );
+			tIOCache_PageInfo *page = IOCache_int_TakeOldest(cache);
+			if( page ) {
+				cache->CacheUsed --;
+				MM_DerefPhys( page->BasePhys );
+				free( page );
+				round ++;
+				freed ++;
+			}
+			Mutex_Release( &cache->Lock );
+		}
+		if( round == 0 )
+			break;
+	}
+	Mutex_Release( &glIOCache_Caches );
+	
+	LOG("Freed %i pages", freed);
+	return freed;
+}
 #endif
 
 /**
@@ -221,37 +309,26 @@ int IOCache_Add( tIOCache *Cache, Uint64 Sector, const void *Buffer )
 		Mutex_Release( &Cache->Lock );
 		return ret;
 	}
-	else if( Cache->CacheUsed <= Cache->CacheSize )
+	else if( Cache->CacheUsed < Cache->CacheSize || !Cache->Pages )
 	{
 		page = malloc( sizeof(tIOCache_PageInfo) );
-		page->BasePhys = MM_AllocPhys();
-		page_map = MM_MapTemp( page->BasePhys );
-		
-		page->GlobalNext = gIOCache_GlobalPages;
-		gIOCache_GlobalPages = page;
+		if( page && !(page->BasePhys = MM_AllocPhys()) ) {
+			free(page);
+			page = NULL;
+		}
+		if( !page ) {
+			Mutex_Release( &Cache->Lock );
+			return -1;
+		}
+		Cache->CacheUsed ++;
 	}
 	else
 	{
-		tIOCache_PageInfo *oldest = Cache->Pages, *oldestPrev = NULL;
-		for( tIOCache_PageInfo *ent = Cache->Pages; ent; prev = ent, ent = ent->CacheNext )
-		{
-			if( ent->LastAccess < oldest->LastAccess ) {
-				oldest = ent;
-				oldestPrev = prev;
-			}
-		}
-		// Remove oldest from list
-		*(oldestPrev ? &oldestPrev->CacheNext : &Cache->Pages) = oldest->CacheNext;
-		page = oldest;
-		page_map = MM_MapTemp( page->BasePhys );
-		// Flush
-		if( page->DirtySectors && Cache->Mode != IOCACHE_VIRTUAL )
-		{
-			for( int i = 0; i < PAGE_SIZE/Cache->SectorSize; i ++ )
-				Cache->Write(Cache->ID, page->BaseOffset/Cache->SectorSize+i,
-					page_map + i * Cache->SectorSize);
-		}
+		page = IOCache_int_TakeOldest(Cache);
+		// The list changed, find the insertion point again
+		IOCache_int_GetPage(Cache, Sector, &prev, NULL);
 	}
+	page_map = MM_MapTemp( page->BasePhys );
 
 	// Create a new page
 	page->CacheNext = prev->CacheNext;
@@ -261,10 +338,11 @@ int IOCache_Add( tIOCache *Cache, Uint64 Sector, const void *Buffer )
 	page->LastAccess = now();
 	
 	page->BaseOffset = (Sector*Cache->SectorSize) & ~(PAGE_SIZE-1);
-	page->PresentSectors = 0;
+	page->PresentSectors = 1 << offset/Cache->SectorSize;
 	page->DirtySectors = 0;
 	
 	memcpy( page_map + offset, Buffer, Cache->SectorSize ); 
+	MM_FreeTemp( page_map );
 	
 	#else
 	tIOCache_Ent	*ent, *prev;
@@ -456,7 +534,7 @@ void IOCache_Destroy( tIOCache *Cache )
 	IOCache_Flush(Cache);
 	
 	// Remove from list
-	SHORTLOCK( &glIOCache_Caches );
+	Mutex_Acquire( &glIOCache_Caches );
 	{
 		tIOCache	*cache;
 		tIOCache	*prev_cache = (tIOCache*)&gIOCache_Caches;
@@ -470,7 +548,7 @@ void IOCache_Destroy( tIOCache *Cache )
 			}
 		}
 	}
-	SHORTREL( &glIOCache_Caches );
+	Mutex_Release( &glIOCache_Caches );
 	
 	free(Cache);
 }
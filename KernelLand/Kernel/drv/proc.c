@@ -34,6 +34,7 @@ typedef struct sSysFS_Ent
  int	SysFS_Comm_ReadDir(tVFS_Node *Node, int Id, char Dest[FILENAME_MAX]);
 tVFS_Node	*SysFS_Comm_FindDir(tVFS_Node *Node, const char *Filename, Uint Flags);
 size_t	SysFS_Comm_ReadFile(tVFS_Node *Node, off_t Offset, size_t Length, void *Buffer, Uint Flags);
+size_t	SysFS_Comm_ReadGenFile(tVFS_Node *Node, off_t Offset, size_t Length, void *Buffer, Uint Flags);
 void	SysFS_Comm_CloseFile(tVFS_Node *Node);
 
 // === GLOBALS ===
@@ -44,6 +45,10 @@ tVFS_NodeType	gSysFS_FileNodeType = {
 	.TypeName = "SysFS File",
 	.Read = SysFS_Comm_ReadFile
 	};
+tVFS_NodeType	gSysFS_GenFileNodeType = {
+	.TypeName = "SysFS Generated File",
+	.Read = SysFS_Comm_ReadGenFile
+	};
 tVFS_NodeType	gSysFS_DirNodeType = {
 	.TypeName = "SysFS Dir",
 	.ReadDir = SysFS_Comm_ReadDir,
@@ -252,7 +257,7 @@ int SysFS_UpdateFile(int ID, const char *Data, int Length)
 {
 	tSysFS_Ent	*ent;
 	
-	for( ent = gSysFS_FileList; ent; ent = ent->Next )
+	for( ent = gSysFS_FileList; ent; ent = ent->ListNext )
 	{
 		// It's a reverse sorted list
 		if(ent->Node.Inode < (Uint64)ID)
@@ -268,6 +273,29 @@ int SysFS_UpdateFile(int ID, const char *Data, int Length)
 	return 0;
 }
 
+/**
+ * \brief Registers a file that is regenerated on each read from offset 0
+ * \param Path	Path for the file (relative to SysFS root)
+ * \param Generate	Function to format the file's contents
+ * \return The file's identifier
+ */
+int SysFS_RegisterGenFile(const char *Path, tSysFS_Generator *Generate)
+{
+	 int	id = SysFS_RegisterFile(Path, NULL, 0);
+	tSysFS_Ent	*ent;
+	
+	if( id <= 0 )	return id;
+	
+	for( ent = gSysFS_FileList; ent; ent = ent->ListNext )
+	{
+		if(ent->Node.Inode == (Uint64)id)
+			break;
+	}
+	ent->Node.Type = &gSysFS_GenFileNodeType;
+	ent->Node.Data = Generate;
+	return id;
+}
+
 /**
  * \fn int SysFS_RemoveFile(int ID)
  * \brief Removes a file from user access
@@ -391,6 +419,39 @@ size_t SysFS_Comm_ReadFile(tVFS_Node *Node, off_t Offset, size_t Length, void *B
 	return Length;
 }
 
+/**
+ * \brief Read from a generated file
+ * \note The contents are regenerated when read from offset 0, later reads
+ *       come from that snapshot
+ */
+size_t SysFS_Comm_ReadGenFile(tVFS_Node *Node, off_t Offset, size_t Length, void *Buffer, Uint Flags)
+{
+	tSysFS_Generator	*generate = Node->Data;
+	size_t	ret;
+	
+	Mutex_Acquire( &Node->Lock );
+	if( Offset == 0 || !Node->ImplPtr )
+	{
+		// Size it first, then allow for a little growth before the real pass
+		size_t	len = generate(NULL, 0);
+		size_t	space = len + len/4 + 64;
+		char	*buf = malloc( space );
+		if( !buf ) {
+			Mutex_Release( &Node->Lock );
+			return -1;
+		}
+		len = generate(buf, space);
+		if( len > space )	len = space;
+		
+		free( Node->ImplPtr );
+		Node->ImplPtr = buf;
+		Node->Size = len;
+	}
+	ret = SysFS_Comm_ReadFile(Node, Offset, Length, Buffer, Flags);
+	Mutex_Release( &Node->Lock );
+	return ret;
+}
+
 /**
  * \fn void SysFS_Comm_CloseFile(tVFS_Node *Node)
  * \brief Closes an open file
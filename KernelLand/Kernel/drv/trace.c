@@ -0,0 +1,91 @@
+/*
+ * Acess2 Kernel
+ * - By John Hodge (thePowersGang)
+ *
+ * drv/trace.c
+ * - /Devices/trace (tracepoint and profiler control/output)
+ *
+ * Reading returns (and consumes) an array of tTraceRecord.
+ * Writing accepts text commands:
+ *   start        - Allocate buffers and enable tracepoints
+ *   stop         - Disable tracepoints
+ *   sample <n>   - Take a profiler sample every <n> timer ticks (0 = off)
+ *   clear        - Discard buffered records
+ *   stats        - Print ring statistics to the kernel log
+ */
+#define DEBUG	0
+#include <acess.h>
+#include <modules.h>
+#include <fs_devfs.h>
+#include <trace.h>
+
+// === PROTOTYPES ===
+ int	TraceDev_Install(char **Arguments);
+size_t	TraceDev_Read(tVFS_Node *Node, off_t Offset, size_t Length, void *Buffer, Uint Flags);
+size_t	TraceDev_Write(tVFS_Node *Node, off_t Offset, size_t Length, const void *Buffer, Uint Flags);
+
+// === GLOBALS ===
+MODULE_DEFINE(0, 0x0100, TraceDev, TraceDev_Install, NULL, NULL);
+tVFS_ACL	gTraceDev_ACL = { {0,0}, {0,VFS_PERM_READ|VFS_PERM_WRITE} };	// Root only
+tVFS_NodeType	gTraceDev_NodeType = {
+	.TypeName = "TraceDev",
+	.Read  = TraceDev_Read,
+	.Write = TraceDev_Write
+};
+tDevFS_Driver	gTraceDev_Node = {
+	NULL, "trace",
+	{
+	.Size = 0, .NumACLs = 1,
+	.ACLs = &gTraceDev_ACL,
+	.Type = &gTraceDev_NodeType
+	}
+};
+
+// === CODE ===
+int TraceDev_Install(char **Arguments)
+{
+	DevFS_AddDevice( &gTraceDev_Node );
+	return MODULE_ERR_OK;
+}
+
+size_t TraceDev_Read(tVFS_Node *Node, off_t Offset, size_t Length, void *Buffer, Uint Flags)
+{
+	return Trace_Read(Buffer, Length);
+}
+
+size_t TraceDev_Write(tVFS_Node *Node, off_t Offset, size_t Length, const void *Buffer, Uint Flags)
+{
+	char	cmd[32];
+	size_t	len = Length;
+
+	if( len >= sizeof(cmd) )
+		len = sizeof(cmd)-1;
+	memcpy(cmd, Buffer, len);
+	cmd[len] = '\0';
+	// Trim trailing newline (e.g. from `echo start > /Devices/trace`)
+	while( len > 0 && (cmd[len-1] == '\n' || cmd[len-1] == ' ') )
+		cmd[--len] = '\0';
+
+	LOG("cmd = '%s'", cmd);
+	if( strcmp(cmd, "start") == 0 ) {
+		if( Trace_Start() ) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	else if( strcmp(cmd, "stop") == 0 )
+		Trace_Stop();
+	else if( strncmp(cmd, "sample ", 7) == 0 )
+		Trace_SetSampleInterval( atoi(cmd+7) );
+	else if( strcmp(cmd, "clear") == 0 )
+		Trace_Clear();
+	else if( strcmp(cmd, "stats") == 0 )
+		Trace_DumpStats();
+	else {
+		Log_Notice("Trace", "Unknown command '%s'", cmd);
+		errno = EINVAL;
+		return -1;
+	}
+	return Length;
+}
+
@@ -0,0 +1,206 @@
+/*
+ * Acess2 Kernel
+ * - By John Hodge (thePowersGang)
+ *
+ * futex.c
+ * - User address keyed wait queues (backing for userland locks)
+ */
+#define DEBUG	0
+#include <acess.h>
+#include <threads_int.h>
+#include <events.h>
+#include <timers.h>
+#include <futex.h>
+
+#define FUTEX_HASH_BITS	6
+#define FUTEX_HASH_SIZE	(1 << FUTEX_HASH_BITS)
+
+// === TYPES ===
+typedef struct sFutexWaiter	tFutexWaiter;
+typedef struct sFutexBucket	tFutexBucket;
+
+/**
+ * \brief Waiting thread record (lives on the waiter's kernel stack)
+ */
+struct sFutexWaiter
+{
+	tFutexWaiter	*Next;
+	tThread	*Thread;
+	tProcess	*Process;	//!< Address space the address belongs to
+	const volatile Uint32	*Address;
+	volatile int	bWoken;
+};
+
+struct sFutexBucket
+{
+	tShortSpinlock	Lock;
+	tFutexWaiter	*First;
+	tFutexWaiter	*Last;
+};
+
+// === PROTOTYPES ===
+static tFutexBucket	*Futex_int_GetBucket(tProcess *Process, const volatile Uint32 *Address);
+static void	Futex_int_Unlink(tFutexBucket *Bucket, tFutexWaiter *Waiter);
+
+// === GLOBALS ===
+tFutexBucket	gaFutex_Buckets[FUTEX_HASH_SIZE];
+
+// === CODE ===
+static tFutexBucket *Futex_int_GetBucket(tProcess *Process, const volatile Uint32 *Address)
+{
+	Uint	hash = ((tVAddr)Address >> 2) ^ ((tVAddr)Process >> 4);
+	hash ^= hash >> FUTEX_HASH_BITS;
+	hash ^= hash >> (FUTEX_HASH_BITS*2);
+	return &gaFutex_Buckets[hash & (FUTEX_HASH_SIZE-1)];
+}
+
+/**
+ * \note Caller holds Bucket->Lock
+ */
+static void Futex_int_Unlink(tFutexBucket *Bucket, tFutexWaiter *Waiter)
+{
+	tFutexWaiter	*prev = NULL;
+	for( tFutexWaiter *w = Bucket->First; w; prev = w, w = w->Next )
+	{
+		if( w != Waiter )	continue ;
+		if( prev )
+			prev->Next = w->Next;
+		else
+			Bucket->First = w->Next;
+		if( Bucket->Last == w )
+			Bucket->Last = prev;
+		return ;
+	}
+}
+
+int Futex_Wait(const volatile Uint32 *Address, Uint32 Value, const tTime *Timeout)
+{
+	tThread	*us = Proc_GetCurThread();
+	tFutexWaiter	waiter;
+	tFutexBucket	*bucket;
+	tTimer	*timer = NULL;
+	Uint32	events;
+
+	ENTER("pAddress xValue pTimeout", Address, Value, Timeout);
+
+	if( (tVAddr)Address & 3 ) {
+		errno = -EINVAL;
+		LEAVE('i', -1);
+		return -1;
+	}
+
+	bucket = Futex_int_GetBucket(us->Process, Address);
+
+	waiter.Next = NULL;
+	waiter.Thread = us;
+	waiter.Process = us->Process;
+	waiter.Address = Address;
+	waiter.bWoken = 0;
+
+	Threads_ClearEvent( THREAD_EVENT_FUTEX|THREAD_EVENT_TIMER );
+
+	// Value check and enqueue must be atomic with respect to Futex_Wake.
+	// The word is read once unlocked first, so any page fault (demand paging,
+	// VFS_MMap_PageFault) happens with IRQs enabled. Under the lock it is only
+	// dereferenced if still mapped, otherwise the fault-in is retried.
+	for( ;; )
+	{
+		if( *Address != Value ) {
+			errno = -EAGAIN;
+			LEAVE('i', -1);
+			return -1;
+		}
+		SHORTLOCK( &bucket->Lock );
+		if( MM_GetPhysAddr( (const void*)Address ) )
+			break;
+		SHORTREL( &bucket->Lock );
+	}
+	if( *Address != Value ) {
+		SHORTREL( &bucket->Lock );
+		errno = -EAGAIN;
+		LEAVE('i', -1);
+		return -1;
+	}
+	if( bucket->Last )
+		bucket->Last->Next = &waiter;
+	else
+		bucket->First = &waiter;
+	bucket->Last = &waiter;
+	SHORTREL( &bucket->Lock );
+
+	if( !Timeout || *Timeout > 0 )
+	{
+		if( Timeout ) {
+			timer = Time_AllocateTimer(NULL, NULL);
+			Time_ScheduleTimer(timer, *Timeout);
+		}
+		events = Threads_WaitEvents( THREAD_EVENT_FUTEX|THREAD_EVENT_TIMER|THREAD_EVENT_SIGNAL );
+		LOG("events = 0x%x", events);
+		if( timer )
+			Time_FreeTimer(timer);
+	}
+	else
+	{
+		// Zero timeout, just a value check
+		events = THREAD_EVENT_TIMER;
+	}
+
+	// If we weren't woken by Futex_Wake, we're still on the list
+	SHORTLOCK( &bucket->Lock );
+	if( !waiter.bWoken )
+		Futex_int_Unlink(bucket, &waiter);
+	SHORTREL( &bucket->Lock );
+
+	Threads_ClearEvent( THREAD_EVENT_FUTEX|THREAD_EVENT_TIMER );
+
+	if( waiter.bWoken ) {
+		LEAVE('i', 0);
+		return 0;
+	}
+
+	errno = (events & THREAD_EVENT_TIMER) ? -ETIMEDOUT : -EINTR;
+	LEAVE('i', -1);
+	return -1;
+}
+
+int Futex_Wake(const volatile Uint32 *Address, int Count)
+{
+	tProcess	*proc = Proc_GetCurThread()->Process;
+	tFutexBucket	*bucket = Futex_int_GetBucket(proc, Address);
+	tFutexWaiter	*prev = NULL, *next;
+	 int	nWoken = 0;
+
+	ENTER("pAddress iCount", Address, Count);
+
+	SHORTLOCK( &bucket->Lock );
+	for( tFutexWaiter *w = bucket->First; w && nWoken < Count; w = next )
+	{
+		next = w->Next;
+		if( w->Address != Address || w->Process != proc ) {
+			prev = w;
+			continue ;
+		}
+
+		// Unlink
+		if( prev )
+			prev->Next = next;
+		else
+			bucket->First = next;
+		if( bucket->Last == w )
+			bucket->Last = prev;
+
+		// The waiter can't leave Futex_Wait until we release the bucket lock,
+		// so the thread pointer is still valid here.
+		w->bWoken = 1;
+		Threads_PostEvent(w->Thread, THREAD_EVENT_FUTEX);
+		nWoken ++;
+	}
+	SHORTREL( &bucket->Lock );
+
+	LEAVE('i', nWoken);
+	return nWoken;
+}
+
+// === EXPORTS ===
+EXPORT(Futex_Wait);
+EXPORT(Futex_Wake);
@@ -53,9 +53,9 @@ void Heap_Install(void)
  */
 void *Heap_Extend(int Bytes)
 {
-	Uint	i;
 	tHeapHead	*head = gHeapEnd;
 	tHeapFoot	*foot;
+	tVAddr	addr, newEnd;
 	
 	// Bounds Check
 	if( (tVAddr)gHeapEnd == MM_KHEAP_MAX )
@@ -66,27 +66,44 @@ void *Heap_Extend(int Bytes)
 		return NULL;
 	}
 	
+	newEnd = (tVAddr)gHeapEnd + ((Bytes+0xFFF)&~0xFFF);
+	#ifdef MM_LARGE_PAGE_SIZE
+	// Past the first large page, grow to a large page boundary so the rest
+	// of the heap can be mapped with large pages
+	if( newEnd > MM_KHEAP_BASE + MM_LARGE_PAGE_SIZE )
+		newEnd = (newEnd + MM_LARGE_PAGE_SIZE-1) & ~(tVAddr)(MM_LARGE_PAGE_SIZE-1);
+	#endif
+	
 	// Bounds Check
-	if( (tVAddr)gHeapEnd + ((Bytes+0xFFF)&~0xFFF) > MM_KHEAP_MAX ) {
+	if( newEnd > MM_KHEAP_MAX ) {
 //		Bytes = MM_KHEAP_MAX - (tVAddr)gHeapEnd;
 		return NULL;
 	}
 	
 	// Heap expands in pages
-	for( i = 0; i < (Bytes+0xFFF) >> 12; i ++ )
+	for( addr = (tVAddr)gHeapEnd; addr < newEnd; )
 	{
-		if( !MM_Allocate( (tVAddr)gHeapEnd+(i<<12) ) )
+		#ifdef MM_LARGE_PAGE_SIZE
+		if( !(addr & (MM_LARGE_PAGE_SIZE-1)) && addr + MM_LARGE_PAGE_SIZE <= newEnd
+		 && MM_AllocateLarge(addr) )
+		{
+			addr += MM_LARGE_PAGE_SIZE;
+			continue ;
+		}
+		#endif
+		if( !MM_Allocate( addr ) )
 		{
 			Warning("OOM - Heap_Extend");
 			return NULL;
 		}
+		addr += 0x1000;
 	}
 	
 	// Increas heap end
-	gHeapEnd = (Uint8*)gHeapEnd + (i << 12);
+	gHeapEnd = (void*)newEnd;
 	
 	// Create Block
-	head->Size = (Bytes+0xFFF)&~0xFFF;
+	head->Size = newEnd - (tVAddr)head;
 	head->Magic = MAGIC_FREE;
 	foot = (void*)( (Uint)gHeapEnd - sizeof(tHeapFoot) );
 	foot->Head = head;
@@ -183,6 +183,13 @@ extern Uint64	inq(Uint16 Port);
  * \return Physical address allocated
  */
 extern tPAddr	MM_Allocate(tVAddr VAddr) __attribute__ ((warn_unused_result));
+/**
+ * \brief Map the shared zero page copy-on-write at \a VAddr
+ * \param VAddr	Virtual address to map at
+ * \return Physical address of the zero page
+ * \note A real page is only allocated on the first write
+ */
+extern tPAddr	MM_AllocateZero(tVAddr VAddr);
 /**
  * \brief Deallocate a page
  * \param VAddr	Virtual address to unmap
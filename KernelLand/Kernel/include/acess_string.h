@@ -17,6 +17,9 @@
 extern int	vsnprintf(char *__s, size_t __maxlen, const char *__format, va_list args);
 extern int	snprintf(char *__s, size_t __n, const char *__format, ...);
 extern int	sprintf(char *__s, const char *__format, ...);
+// - Deferred formatting (arguments saved now, formatted later)
+extern int	vsnprintf_capture(const char *Format, va_list Args, Uint64 *Values, int MaxValues, char *Strings, size_t StringSpace);
+extern int	snprintf_captured(char *__s, size_t __maxlen, const char *__format, const Uint64 *Values, int NumValues);
 extern size_t	strlen(const char *Str);
 extern char	*strcpy(char *__dest, const char *__src);
 extern char	*strncpy(char *__dest, const char *__src, size_t max);
@@ -58,6 +58,7 @@ typedef struct sBinary
 
 	tMount	MountID;	//!< Mount ID
 	tInode	Inode;  	//!< Inode (Used for fast reopen)
+	const char	*Path;	//!< Path the binary was first loaded from
 
 	/**
 	 * \brief Interpreter used to load the file
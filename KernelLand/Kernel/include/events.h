@@ -27,6 +27,8 @@
 #define THREAD_EVENT_SHORTWAIT	0x00000010
 //! Fired when a child process quits
 #define THREAD_EVENT_DEADCHILD	0x00000020
+//! Woken from a futex wait (SYS_FUTEX)
+#define THREAD_EVENT_FUTEX	0x00000040
 
 #define THREAD_EVENT_USER1	0x10000000
 #define THREAD_EVENT_USER2	0x20000000
@@ -32,6 +32,22 @@ extern int	SysFS_RegisterFile(const char *Path, const char *Data, int Length);
  */
 extern int	SysFS_UpdateFile(int ID, const char *Data, int Length);
 
+/**
+ * \brief Formats the contents of a generated file
+ * \param Buffer	Destination buffer
+ * \param Length	Size of \a Buffer
+ * \return Number of bytes the full contents need (may be more than \a Length)
+ */
+typedef size_t	tSysFS_Generator(char *Buffer, size_t Length);
+
+/**
+ * \brief Registers a file whose contents are generated when it is read
+ * \param Path	Path relative to the SysFS root
+ * \param Generate	Called each time the file is read from the start
+ * \return An ID number to refer to the file, or -1 on error
+ */
+extern int	SysFS_RegisterGenFile(const char *Path, tSysFS_Generator *Generate);
+
 /**
  * \brief Removes a file from the SysFS tree
  * \param ID	Number returned by ::SysFS_RegisterFile
@@ -0,0 +1,30 @@
+/*
+ * Acess2 Kernel
+ * futex.h
+ * - User address keyed wait queues
+ */
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+#include <acess.h>
+#include <acess/futex.h>
+
+/**
+ * \brief Sleep on a user address if it still contains the expected value
+ * \param Address	User address to wait on (must be 4-byte aligned)
+ * \param Value	Value expected at \a Address
+ * \param Timeout	Maximum time to wait in ms (NULL for no timeout)
+ * \return 0 if woken by Futex_Wake, -1 on error/timeout (errno set)
+ */
+extern int	Futex_Wait(const volatile Uint32 *Address, Uint32 Value, const tTime *Timeout);
+
+/**
+ * \brief Wake threads sleeping on a user address
+ * \param Address	User address
+ * \param Count	Maximum number of threads to wake
+ * \return Number of threads woken
+ */
+extern int	Futex_Wake(const volatile Uint32 *Address, int Count);
+
+#endif
+
@@ -78,6 +78,13 @@ extern void	Proc_Reschedule(void);
  * \brief Clear the user's memory space back to the minimum required to run
  */
 extern void	MM_ClearUser(void);
+/**
+ * \brief Count the resident user pages of a process
+ * \param Process	Process to inspect (need not be the current one)
+ * \param Shared	Pages also referenced elsewhere (other address spaces, the page cache)
+ * \param Private	Pages only this process references
+ */
+extern void	MM_CountUserPages(tProcess *Process, size_t *Shared, size_t *Private);
 /**
  * \brief Dump the address space to the debug channel
  * \param Start	First address
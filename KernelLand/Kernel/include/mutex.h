@@ -25,13 +25,22 @@ struct sMutex
  * \return zero on success, -1 if terminated
  * 
  * This type of mutex checks if the mutex is avaliable, and acquires it
- * if it is. Otherwise, the current thread is added to the mutex's wait
- * queue and the thread suspends. When the holder of the mutex completes,
+ * if it is. If the owner is currently running on another CPU, the caller
+ * spins for a short time waiting for it to be released. Otherwise, the
+ * current thread is added to the mutex's wait queue and the thread suspends. When the holder of the mutex completes,
  * the oldest thread (top thread) on the queue is given the lock and
  * restarted.
  */
 extern int	Mutex_Acquire(tMutex *Mutex);
 
+/**
+ * \brief Acquire a mutex only if it is free
+ * \param Mutex	Mutex to acquire
+ * \return zero if the mutex was acquired, -1 if it is held
+ * \note Never sleeps, so it can be used where blocking isn't allowed
+ */
+extern int	Mutex_TryAcquire(tMutex *Mutex);
+
 /**
  * \brief Release a held mutex
  * \param Mutex	Mutex to release
@@ -45,4 +54,9 @@ extern void	Mutex_Release(tMutex *Mutex);
  */
 extern int	Mutex_IsLocked(tMutex *Mutex);
 
+/**
+ * \brief Dump per-mutex contention statistics (if compiled in)
+ */
+extern void	Mutex_DumpStats(void);
+
 #endif
@@ -0,0 +1,70 @@
+/*
+ * Acess2 Kernel
+ * reclaim.h
+ * - Page reclaim under memory pressure
+ */
+#ifndef _RECLAIM_H_
+#define _RECLAIM_H_
+
+#include <acess.h>
+
+typedef struct sReclaim_Shrinker	tReclaim_Shrinker;
+
+/**
+ * \brief Shrinker flags
+ * \{
+ */
+//! Called from the physical allocator, the shrinker must not sleep (use
+//! Mutex_TryAcquire) or touch the heap
+#define RECLAIM_FLAG_ATOMIC	0x1
+/**
+ * \}
+ */
+
+/**
+ * \brief A cache that can give memory back when it is needed elsewhere
+ */
+struct sReclaim_Shrinker
+{
+	tReclaim_Shrinker	*Next;
+	const char	*Name;
+	/**
+	 * \brief Release up to \a Pages pages of memory
+	 * \param Self	This shrinker
+	 * \param Pages	Number of pages wanted
+	 * \param Flags	RECLAIM_FLAG_*
+	 * \return Number of pages actually freed
+	 */
+	size_t	(*Shrink)(tReclaim_Shrinker *Self, size_t Pages, int Flags);
+	void	*Ptr;	//!< Shrinker data
+
+	// Statistics (maintained by reclaim.c)
+	Uint64	nCalls;
+	Uint64	nReclaimed;	//!< Total pages returned
+};
+
+/**
+ * \brief Register a shrinker
+ * \note \a Shrinker must remain valid until unregistered
+ */
+extern void	Reclaim_Register(tReclaim_Shrinker *Shrinker);
+extern void	Reclaim_Unregister(tReclaim_Shrinker *Shrinker);
+
+/**
+ * \brief Called by the physical allocator after each allocation
+ * \param FreePages	Current number of free pages
+ * \param TotalPages	Number of allocatable pages
+ *
+ * Wakes the reclaimer thread if free memory is below the low watermark.
+ */
+extern void	Reclaim_CheckWatermark(Uint64 FreePages, Uint64 TotalPages);
+
+/**
+ * \brief Synchronous reclaim when an allocation would otherwise fail
+ * \param Pages	Number of pages the allocator needs
+ * \return Number of pages freed
+ */
+extern size_t	Reclaim_Direct(size_t Pages);
+
+#endif
+
@@ -8,8 +8,10 @@
 #define _RWLOCK_H
 
 #include <acess.h>
+#include <mutex.h>
 
 typedef struct sRWLock	tRWLock;
+typedef struct sPCPURWLock	tPCPURWLock;
 
 struct sRWLock
 {
@@ -49,4 +51,54 @@ extern int	RWLock_AcquireWrite(tRWLock *Lock);
  */
 extern void	RWLock_Release(tRWLock *Lock);
 
+/**
+ * \name Reader-scaled RW Locks
+ * \brief Read-mostly variant of tRWLock
+ *
+ * Readers only touch a per-CPU counter (no shared lock), so read
+ * acquires don't bounce a cache line between CPUs. Writers serialise on
+ * a mutex, block new readers, then wait for the counters to drain. This
+ * makes writes much more expensive than with tRWLock, so only use it
+ * for structures that are read far more often than written (e.g. the
+ * mount list and routing table).
+ * \note Read acquires do not nest if a writer may be waiting
+ * \{
+ */
+#define PCPURWLOCK_SLOTS	8	//!< Reader counters (indexed by CPU number modulo this)
+
+struct sPCPURWLock
+{
+	tMutex	WriterLock;	//!< Held by the current writer, readers sleep on it
+	struct sThread	*volatile Owner;	//!< Current writer
+	struct {
+		volatile int	Count;
+		char	_pad[64-sizeof(int)];	// Keep each counter on its own cache line
+	} Readers[PCPURWLOCK_SLOTS];
+};
+
+/**
+ * \brief Acquire a reader-scaled lock for reading
+ * \param Lock	Lock to acquire
+ * \return zero on success, -1 if terminated
+ */
+extern int	PCPURWLock_AcquireRead(tPCPURWLock *Lock);
+
+/**
+ * \brief Acquire a reader-scaled lock for writing
+ * \param Lock	Lock to acquire
+ * \return zero on success, -1 if terminated
+ *
+ * Blocks new readers, then waits for all existing readers to release.
+ */
+extern int	PCPURWLock_AcquireWrite(tPCPURWLock *Lock);
+
+/**
+ * \brief Release a reader-scaled lock (held for either reading or writing)
+ * \param Lock	Lock to release
+ */
+extern void	PCPURWLock_Release(tPCPURWLock *Lock);
+/**
+ * \}
+ */
+
 #endif
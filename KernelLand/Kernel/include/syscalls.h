@@ -31,6 +31,9 @@
 #define SYS_LOADBIN	18	// Load a binary into the current address space
 #define SYS_UNLOADBIN	19	// Unload a loaded binary
 #define SYS_LOADMOD	20	// Load a module into the kernel
+#define SYS_FUTEX	21	// Wait/wake on a user address
+#define SYS_SENDMSGEX	22	// Send an IPC message (with flags)
+#define SYS_SETMEMLIMIT	23	// Set the memory limit of the current process
 #define SYS_GETPHYS	32	// Get the physical address of a page
 #define SYS_MAP	33	// Map a physical address
 #define SYS_ALLOCATE	34	// Allocate a page
@@ -42,6 +45,8 @@
 #define SYS_GETGID	40	// Get current Group ID
 #define SYS_SETUID	41	// Set current user ID
 #define SYS_SETGID	42	// Set current Group ID
+#define SYS_MMAP	43	// Map memory or a file
+#define SYS_MUNMAP	44	// Unmap memory
 #define SYS_OPEN	64	// Open a file
 #define SYS_REOPEN	65	// Close a file and reuse its handle
 #define SYS_OPENCHILD	66	// Open a child entry in a directory
@@ -66,8 +71,10 @@
 #define SYS_GETCWD	85	// Get current directory
 #define SYS_MOUNT	86	// Mount a filesystem
 #define SYS_SELECT	87	// Wait for file handles
+#define SYS_READV	88	// Read into several buffers
+#define SYS_WRITEV	89	// Write from several buffers
 
-#define NUM_SYSCALLS	88
+#define NUM_SYSCALLS	90
 #define SYS_DEBUG	0x100
 
 #if !defined(__ASSEMBLER__) && !defined(NO_SYSCALL_STRS)
@@ -93,9 +100,9 @@ static const char *cSYSCALL_NAMES[] = {
 	"SYS_LOADBIN",
 	"SYS_UNLOADBIN",
 	"SYS_LOADMOD",
-	"",
-	"",
-	"",
+	"SYS_FUTEX",
+	"SYS_SENDMSGEX",
+	"SYS_SETMEMLIMIT",
 	"",
 	"",
 	"",
@@ -115,8 +122,8 @@ static const char *cSYSCALL_NAMES[] = {
 	"SYS_GETGID",
 	"SYS_SETUID",
 	"SYS_SETGID",
-	"",
-	"",
+	"SYS_MMAP",
+	"SYS_MUNMAP",
 	"",
 	"",
 	"",
@@ -160,6 +167,8 @@ static const char *cSYSCALL_NAMES[] = {
 	"SYS_GETCWD",
 	"SYS_MOUNT",
 	"SYS_SELECT",
+	"SYS_READV",
+	"SYS_WRITEV",
 
 	""
 };
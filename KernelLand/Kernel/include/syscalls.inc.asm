@@ -23,6 +23,9 @@
 %define SYS_LOADBIN	18	 ;Load a binary into the current address space
 %define SYS_UNLOADBIN	19	 ;Unload a loaded binary
 %define SYS_LOADMOD	20	 ;Load a module into the kernel
+%define SYS_FUTEX	21	 ;Wait/wake on a user address
+%define SYS_SENDMSGEX	22	 ;Send an IPC message (with flags)
+%define SYS_SETMEMLIMIT	23	 ;Set the memory limit of the current process
 %define SYS_GETPHYS	32	 ;Get the physical address of a page
 %define SYS_MAP	33	 ;Map a physical address
 %define SYS_ALLOCATE	34	 ;Allocate a page
@@ -34,6 +37,8 @@
 %define SYS_GETGID	40	 ;Get current Group ID
 %define SYS_SETUID	41	 ;Set current user ID
 %define SYS_SETGID	42	 ;Set current Group ID
+%define SYS_MMAP	43	 ;Map memory or a file
+%define SYS_MUNMAP	44	 ;Unmap memory
 %define SYS_OPEN	64	 ;Open a file
 %define SYS_REOPEN	65	 ;Close a file and reuse its handle
 %define SYS_OPENCHILD	66	 ;Open a child entry in a directory
@@ -58,3 +63,5 @@
 %define SYS_GETCWD	85	 ;Get current directory
 %define SYS_MOUNT	86	 ;Mount a filesystem
 %define SYS_SELECT	87	 ;Wait for file handles
+%define SYS_READV	88	 ;Read into several buffers
+%define SYS_WRITEV	89	 ;Write from several buffers
@@ -0,0 +1,35 @@
+/*
+ * Acess2 Kernel
+ * - By John Hodge (thePowersGang)
+ *
+ * syscalls_args.h
+ * - System Call Argument Descriptors (included by syscalls.c)
+ *
+ * NOTE: Generated from Kernel/syscalls.lst
+ */
+#ifndef _SYSCALLS_ARGS_H
+#define _SYSCALLS_ARGS_H
+
+static const tSyscallArgs caSyscallArgs[NUM_SYSCALLS] = {
+	[SYS_EXIT] = {SARG_INT},
+	[SYS_WAITTID] = {SARG_INT, SARG_PTR0(sizeof(int))},
+	[SYS_SETNAME] = {SARG_STR},
+	[SYS_SENDMSG] = {SARG_INT, SARG_INT, SARG_BUF(2)},
+	[SYS_SPAWN] = {SARG_STR},
+	[SYS_EXECVE] = {SARG_STR},
+	[SYS_LOADBIN] = {SARG_STR, SARG_PTR(sizeof(Uint))},
+	[SYS_FUTEX] = {SARG_PTR(sizeof(Uint32))},
+	[SYS_SENDMSGEX] = {SARG_INT, SARG_INT, SARG_BUF(2), SARG_INT},
+	[SYS_OPEN] = {SARG_STR, SARG_INT},
+	[SYS_REOPEN] = {SARG_INT, SARG_STR, SARG_INT},
+	[SYS_OPENCHILD] = {SARG_INT, SARG_STR, SARG_INT},
+	[SYS_READ] = {SARG_INT, SARG_BUF(3), SARG_INT},
+	[SYS_WRITE] = {SARG_INT, SARG_BUF(3), SARG_INT},
+	[SYS_READDIR] = {SARG_INT, SARG_PTR(256)},
+	[SYS_GETACL] = {SARG_INT, SARG_PTR(sizeof(tVFS_ACL))},
+	[SYS_MKDIR] = {SARG_STR},
+	[SYS_CHDIR] = {SARG_STR},
+	[SYS_SELECT] = {SARG_INT, SARG_PTR0(sizeof(fd_set)), SARG_PTR0(sizeof(fd_set)), SARG_PTR0(sizeof(fd_set)), SARG_PTR0(sizeof(tTime)), SARG_INT},
+};
+
+#endif
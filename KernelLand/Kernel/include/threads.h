@@ -32,11 +32,19 @@ extern int	Threads_SetGID(tUID ID);
 extern tTID	Threads_WaitTID(int TID, int *Status);
 
 
+extern int	Threads_CheckMemLimit(int Pages);
+extern void	Threads_AccountPages(int Delta);
+extern int	Threads_SetMemLimit(Uint64 Bytes);
+
 extern int	*Threads_GetMaxFD(void);
 extern char	**Threads_GetCWD(void);
 extern char	**Threads_GetChroot(void);
 
+//! Fail with EAGAIN instead of waiting if the destination queue is full
+#define SENDMSG_NONBLOCK	0x1
+
 extern int	Proc_SendMessage(Uint Dest, int Length, void *Data);
+extern int	Proc_SendMessageEx(Uint Dest, int Length, void *Data, Uint Flags);
 extern int	Proc_GetMessage(Uint *Source, Uint BufSize, void *Buffer);
 
 #endif
@@ -16,17 +16,6 @@
 
 typedef struct sProcess	tProcess;
 
-/**
- * \brief IPC Message
- */
-typedef struct sMessage
-{
-	struct sMessage	*Next;	//!< Next message in thread's inbox
-	tTID	Source;	//!< Source thread ID
-	Uint	Length;	//!< Length of message data in bytes
-	Uint8	Data[];	//!< Message data
-} tMsg;
-
 /**
  * \brief Process state
  */
@@ -48,6 +37,19 @@ struct sProcess
 	char	*RootDir;
 	
 	void	*SignalHandlers[NSIGNALS];
+
+	tMutex	MMapLock;	//!< Protects \a MMapAreas
+	struct sVFS_MMapArea	*MMapAreas;	//!< Demand-paged file mappings (vfs/mmap.c)
+
+	// Memory accounting (user pages, maintained by the MM)
+	volatile int	nResidentPages;	//!< Pages mapped in this address space
+	 int	nPeakResidentPages;	//!< High-water mark of \a nResidentPages
+	 int	MaxResidentPages;	//!< Allocation limit in pages (0 = none), inherited
+	 int	nLimitHits;	//!< Allocations refused by \a MaxResidentPages
+	 int	nCOWCopies;	//!< Pages copied on write faults
+
+	 int	ReferenceCount;	//!< Non-thread holders (the descriptor is freed once this is zero and \a bExited is set)
+	 int	bExited;	//!< Set (under glThreadListLock) once the last thread's cleanup is done
 };
 
 /**
@@ -93,8 +95,8 @@ struct sThread
 	 int	PendingSignal;	//!< Pending signal ID (0 = none)
 	
 	
-	tMsg * volatile	Messages;	//!< Message Queue
-	tMsg	*LastMessage;	//!< Last Message (speeds up insertion)
+	struct sMsgQueue	*MsgQueue;	//!< Message Queue (see messages.c)
+	struct sMsgWaiter	*MsgSendWait;	//!< Set while blocked sending to a full queue
 	
 	 int	Quantum, Remaining;	//!< Quantum Size and remaining timesteps
 	 int	Priority;	//!< Priority - 0: Realtime, higher means less time
@@ -163,4 +165,9 @@ extern tThread	*Threads_CloneThreadZero(void);
 extern void	Threads_int_WaitForStatusEnd(enum eThreadStatus Status);
 extern void	Semaphore_ForceWake(tThread *Thread);
 
+extern int	Proc_int_HasMessages(tThread *Thread);
+extern void	Proc_int_ClearMessages(tThread *Thread);
+extern void	Proc_int_CancelSend(tThread *Thread);
+extern void	Proc_int_DumpMessageQueue(tThread *Thread);
+
 #endif
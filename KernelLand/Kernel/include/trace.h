@@ -0,0 +1,112 @@
+/*
+ * Acess2 Kernel
+ * trace.h
+ * - Kernel tracepoints and sampling profiler
+ */
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <acess.h>
+
+/**
+ * \brief Compile-time switch for all tracepoints
+ * Set to 0 to compile every TRACE_POINT() out of the kernel
+ */
+#ifndef TRACE_ENABLED
+# define TRACE_ENABLED	1
+#endif
+
+#define TRACE_SAMPLE_DEPTH	6	//!< Maximum frames recorded per profiler sample
+
+/**
+ * \name Event types
+ * \{
+ */
+enum eTraceEvents
+{
+	TRACE_EV_NONE,
+	TRACE_EV_SCHED_SWITCH,	//!< [PrevTID, NextTID]
+	TRACE_EV_SYSCALL_ENTER,	//!< [Num, Arg1]
+	TRACE_EV_SYSCALL_EXIT,	//!< [Num, Return, Errno]
+	TRACE_EV_VFS_READ,	//!< [FD, Length, Return]
+	TRACE_EV_VFS_WRITE,	//!< [FD, Length, Return]
+	TRACE_EV_IRQ,	//!< [IRQ Number]
+	TRACE_EV_PAGEFAULT,	//!< [Address, ErrorCode, IP]
+	TRACE_EV_SAMPLE,	//!< Profiler sample, Data = IP followed by return addresses
+	NUM_TRACE_EV
+};
+/**
+ * \}
+ */
+
+/**
+ * \brief Binary trace record (as returned by reads from /Devices/trace)
+ */
+typedef struct sTraceRecord
+{
+	Uint64	Timestamp;	//!< TSC where available, otherwise milliseconds
+	Uint16	Event;	//!< TRACE_EV_*
+	Uint8	CPU;
+	Uint8	Count;	//!< Number of valid entries in \a Data
+	Uint32	TID;	//!< Thread that was running when the event fired
+	Uint64	Data[TRACE_SAMPLE_DEPTH];
+} tTraceRecord;
+
+extern volatile int	gbTrace_Enabled;
+extern void	Trace_Event(int Event, int Count, Uint64 A0, Uint64 A1, Uint64 A2);
+
+#if TRACE_ENABLED
+
+/**
+ * \brief Record an event if tracing is switched on
+ * \note Safe to use from interrupt context
+ */
+# define TRACE_POINT(ev, n, a0, a1, a2)	do { \
+	if( gbTrace_Enabled ) Trace_Event(ev, n, (Uint64)(a0), (Uint64)(a1), (Uint64)(a2)); \
+	} while(0)
+#else
+# define TRACE_POINT(ev, n, a0, a1, a2)	do { } while(0)
+#endif
+
+#define TRACE_POINT1(ev, a0)	TRACE_POINT(ev, 1, a0, 0, 0)
+#define TRACE_POINT2(ev, a0, a1)	TRACE_POINT(ev, 2, a0, a1, 0)
+#define TRACE_POINT3(ev, a0, a1, a2)	TRACE_POINT(ev, 3, a0, a1, a2)
+
+/**
+ * \brief Check if the profiler wants a sample on this timer tick
+ * \note Called from the architecture's timer IRQ
+ */
+extern int	Trace_SampleDue(void);
+/**
+ * \brief Record a profiler sample
+ * \param Count	Number of entries in \a Frames (interrupted IP first)
+ * \param Frames	Interrupted IP followed by return addresses
+ */
+extern void	Trace_Sample(int Count, const Uint *Frames);
+
+/**
+ * \brief Called on entry to an IRQ handler (from assembly stubs)
+ */
+extern void	Trace_IRQ(int IRQ);
+
+// --- Control (used by /Devices/trace) ---
+extern int	Trace_Start(void);
+extern void	Trace_Stop(void);
+extern void	Trace_SetSampleInterval(int Ticks);
+extern size_t	Trace_Read(void *Buffer, size_t Length);
+extern void	Trace_Clear(void);
+extern void	Trace_DumpStats(void);
+
+/**
+ * \brief Capture a backtrace into a buffer instead of printing it
+ * \param IP	Starting instruction pointer (stored as the first frame)
+ * \param BP	Starting frame pointer
+ * \param Frames	Output buffer
+ * \param MaxFrames	Size of \a Frames
+ * \return Number of frames stored
+ * \note Implemented by the architecture (next to Error_Backtrace)
+ */
+extern int	Error_BacktraceCapture(Uint IP, Uint BP, Uint *Frames, int MaxFrames);
+
+#endif
+
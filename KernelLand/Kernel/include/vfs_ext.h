@@ -108,6 +108,7 @@ enum eVFS_SeekDirs
 #define MMAP_MAP_PRIVATE	0x002	//!< Local (COW) copy
 #define MMAP_MAP_FIXED  	0x004	//!< Load to a fixed address
 #define MMAP_MAP_ANONYMOUS	0x008	//!< Not associated with a FD
+#define MMAP_MAP_HUGE     	0x010	//!< Back anonymous memory with large (2 MiB) pages where the architecture can
 /**
  * \}
  */
@@ -148,6 +149,18 @@ typedef struct sFInfo
 	tVFS_ACL	acls[];	//!< ACL buffer (size is passed in the \a MaxACLs argument to VFS_FInfo)
 } PACKED tFInfo;
 
+/**
+ * \brief One buffer of a SYS_READV/SYS_WRITEV call
+ */
+typedef struct sVFS_IOVec
+{
+	void	*Base;	//!< Start of the buffer
+	size_t	Length;	//!< Size of the buffer in bytes
+} tVFS_IOVec;
+
+//! Maximum number of buffers in one vectored call
+#define VFS_IOV_MAX	16
+
 // --- fd_set --
 #include "../../../Usermode/Libraries/ld-acess.so_src/include_exp/acess/fd_set.h"
 
@@ -313,6 +326,24 @@ extern size_t	VFS_Read(int FD, size_t Length, void *Buffer);
  * \return Number of bytes written
  */
 extern size_t	VFS_Write(int FD, size_t Length, const void *Buffer);
+/**
+ * \brief Reads data from a file into several buffers in turn
+ * \param FD	File handle returned by ::VFS_Open
+ * \param Vecs	Buffers to fill
+ * \param Count	Number of entries in \a Vecs
+ * \return Total number of bytes read
+ */
+extern size_t	VFS_ReadV(int FD, const tVFS_IOVec *Vecs, int Count);
+/**
+ * \brief Writes data to a file from several buffers in turn
+ * \param FD	File handle returned by ::VFS_Open
+ * \param Vecs	Buffers to write
+ * \param Count	Number of entries in \a Vecs
+ * \return Total number of bytes written
+ * \note Small gathers are written with a single call to the driver, so
+ *       pipes and terminals see them as one write
+ */
+extern size_t	VFS_WriteV(int FD, const tVFS_IOVec *Vecs, int Count);
 
 /**
  * \brief Reads from a specific offset in the file
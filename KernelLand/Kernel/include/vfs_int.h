@@ -46,7 +46,7 @@ typedef struct sVFS_MMapPage {
 } tVFS_MMapPage;
 
 // === GLOBALS ===
-extern tRWLock  	glVFS_MountList;
+extern tPCPURWLock	glVFS_MountList;
 extern tVFS_Mount	*gVFS_Mounts;
 extern tVFS_Driver	*gVFS_Drivers;
 
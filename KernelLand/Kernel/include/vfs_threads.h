@@ -16,4 +16,13 @@ extern void	*VFS_SaveHandles(int NumFDs, int *FDs);
 extern void	VFS_RestoreHandles(int NumFDs, void *Handles);
 extern void	VFS_FreeSavedHandles(int NumFDs, void *Handles);
 
+// --- Demand-paged mappings (vfs/mmap.c)
+struct sProcess;
+extern int	VFS_MMap_PageFault(tVAddr Addr, int bWrite);
+extern void	VFS_MMap_Populate(const void *Addr, size_t Length);
+extern int	VFS_MMap_IsReserved(tVAddr Addr, size_t Length);
+extern void	VFS_MMap_CloneAreas(struct sProcess *Dest);
+extern void	VFS_MMap_ClearAreas(struct sProcess *Process);
+extern void	VFS_MMap_CountCached(int FD, Uint64 Offset, size_t Length, size_t *Resident, size_t *Shared);
+
 #endif
@@ -7,6 +7,8 @@
  */
 #include <acess.h>
 #include <hal_proc.h>	// For MM_*
+#include <proc.h>	// USER_MAX
+#include <vfs_threads.h>	// VFS_MMap_PageFault
 #include <utf16.h>
 
 // === CONSTANTS ===
@@ -14,6 +16,11 @@
 #define	RANDOM_A	0x00731ADE
 #define	RANDOM_C	12345
 #define	RANDOM_SPRUCE	0xf12b039
+// Word at a time string scanning
+typedef tVAddr __attribute__((may_alias))	tLibWord;
+#define WORD_MASK	(sizeof(tLibWord)-1)
+#define WORD_ONES	((tLibWord)-1/0xFF)
+#define WORD_HASZERO(w)	(((w) - WORD_ONES) & ~(w) & (WORD_ONES*0x80))
 
 // === PROTOTYPES ===
 #if 0
@@ -48,6 +55,8 @@ void	*memmove(void *__dest, const void *__src, size_t len);
 EXPORT(atoi);
 EXPORT(itoa);
 EXPORT(vsnprintf);
+EXPORT(vsnprintf_capture);
+EXPORT(snprintf_captured);
 EXPORT(snprintf);
 EXPORT(sprintf);
 EXPORT(tolower);
@@ -146,15 +155,74 @@ int ParseInt(const char *string, int *Val)
 }
 
 static const char cUCDIGITS[] = "0123456789ABCDEF";
+#define _DEC_ROW(h)	h"0" h"1" h"2" h"3" h"4" h"5" h"6" h"7" h"8" h"9"
+#define _HEX_ROW(h)	_DEC_ROW(h) h"A" h"B" h"C" h"D" h"E" h"F"
+//! "00" to "99", two decimal digits per division
+static const char cDEC_PAIRS[] = _DEC_ROW("0") _DEC_ROW("1") _DEC_ROW("2") _DEC_ROW("3") _DEC_ROW("4")
+	_DEC_ROW("5") _DEC_ROW("6") _DEC_ROW("7") _DEC_ROW("8") _DEC_ROW("9");
+//! "00" to "FF", a byte per lookup
+static const char cHEX_PAIRS[] = _HEX_ROW("0") _HEX_ROW("1") _HEX_ROW("2") _HEX_ROW("3") _HEX_ROW("4")
+	_HEX_ROW("5") _HEX_ROW("6") _HEX_ROW("7") _HEX_ROW("8") _HEX_ROW("9")
+	_HEX_ROW("A") _HEX_ROW("B") _HEX_ROW("C") _HEX_ROW("D") _HEX_ROW("E") _HEX_ROW("F");
+#undef _DEC_ROW
+#undef _HEX_ROW
+
+/**
+ * \brief Write the digits of \a num backwards from \a End
+ * \return First digit written
+ */
+static char *_itoa_rev(char *End, Uint64 num, int base)
+{
+	Uint64	rem;
+	
+	if( base == 10 )
+	{
+		while( num >= 100 ) {
+			num = DivMod64U(num, 100, &rem);
+			End -= 2;
+			memcpy(End, &cDEC_PAIRS[rem*2], 2);
+		}
+		if( num >= 10 ) {
+			End -= 2;
+			memcpy(End, &cDEC_PAIRS[num*2], 2);
+		}
+		else
+			*--End = '0' + num;
+	}
+	else if( base == 16 )
+	{
+		while( num >= 0x100 ) {
+			End -= 2;
+			memcpy(End, &cHEX_PAIRS[(num & 0xFF)*2], 2);
+			num >>= 8;
+		}
+		if( num >= 0x10 ) {
+			End -= 2;
+			memcpy(End, &cHEX_PAIRS[num*2], 2);
+		}
+		else
+			*--End = cUCDIGITS[num];
+	}
+	else
+	{
+		while(num > base-1) {
+			num = DivMod64U(num, base, &rem);	// Shift `num` and get remainder
+			*--End = cUCDIGITS[ rem ];
+		}
+		*--End = cUCDIGITS[ num ];		// Last digit of `num`
+	}
+	return End;
+}
+
 /**
  * \fn void itoa(char *buf, Uint64 num, int base, int minLength, char pad)
  * \brief Convert an integer into a character string
  */
 void itoa(char *buf, Uint64 num, int base, int minLength, char pad)
 {
-	char	tmpBuf[64+1];
-	 int	pos=0, i;
-	Uint64	rem;
+	char	tmpBuf[64];
+	char	*digits;
+	 int	len, i = 0;
 
 	// Sanity check
 	if(!buf)	return;
@@ -165,22 +233,74 @@ void itoa(char *buf, Uint64 num, int base, int minLength, char pad)
 		return;
 	}
 	
-	// Convert 
-	while(num > base-1) {
-		num = DivMod64U(num, base, &rem);	// Shift `num` and get remainder
-		ASSERT(rem >= 0);
-		ASSERT(rem < base);
-		tmpBuf[pos] = cUCDIGITS[ rem ];
-		pos++;
-	}
-	tmpBuf[pos++] = cUCDIGITS[ num ];		// Last digit of `num`
+	digits = _itoa_rev(tmpBuf + sizeof(tmpBuf), num, base);
+	len = tmpBuf + sizeof(tmpBuf) - digits;
 	
-	// Put in reverse
-	i = 0;
-	minLength -= pos;
+	minLength -= len;
 	while(minLength-- > 0)	buf[i++] = pad;
-	while(pos-- > 0)		buf[i++] = tmpBuf[pos];	// Reverse the order of characters
-	buf[i] = 0;
+	memcpy(buf + i, digits, len);
+	buf[i+len] = 0;
+}
+
+/**
+ * \brief Argument source for vsnprintf
+ * 
+ * Either a va_list, or values saved from one by vsnprintf_capture (so a
+ * format can be expanded long after the call that supplied its arguments)
+ */
+typedef struct
+{
+	va_list	VA;
+	const Uint64	*Saved;	//!< Replaces VA if non-NULL
+	Uint64	*Capture;	//!< Values read from VA are also saved here
+	 int	Count;
+	 int	MaxCount;
+	char	*Strings;	//!< Space for copies of %s arguments (when capturing)
+	size_t	StringSpace;
+	 int	bCaptureOnly;	//!< Don't bother converting, just save the arguments
+	 int	bCaptureFailed;
+} tPrintfArgs;
+
+static int	_vsnprintf_int(char *__s, size_t __maxlen, const char *__format, tPrintfArgs *Args);
+
+static Uint64 _printf_arg(tPrintfArgs *Args, int bLarge)
+{
+	Uint64	val;
+	if( Args->Saved ) {
+		if( Args->Count >= Args->MaxCount )
+			return 0;
+		return Args->Saved[Args->Count++];
+	}
+	if( bLarge )
+		val = va_arg(Args->VA, Uint64);
+	else
+		val = va_arg(Args->VA, unsigned int);
+	if( Args->Capture ) {
+		if( Args->Count < Args->MaxCount )
+			Args->Capture[Args->Count] = val;
+		else
+			Args->bCaptureFailed = 1;
+	}
+	Args->Count ++;
+	return val;
+}
+
+/**
+ * \brief Replace the last captured (string) argument with a copy of it
+ */
+static void _printf_capture_str(tPrintfArgs *Args, const char *Str)
+{
+	size_t	len = strlen(Str) + 1;
+	if( !Args->Capture || Args->bCaptureFailed )
+		return ;
+	if( len > Args->StringSpace ) {
+		Args->bCaptureFailed = 1;
+		return ;
+	}
+	memcpy(Args->Strings, Str, len);
+	Args->Capture[Args->Count-1] = (Uint)Args->Strings;
+	Args->Strings += len;
+	Args->StringSpace -= len;
 }
 
 /**
@@ -194,18 +314,71 @@ void itoa(char *buf, Uint64 num, int base, int minLength, char pad)
 		} \
 		pos ++; \
 	} while(0)
-#define GETVAL()	do {\
-	if(isLongLong)	val = va_arg(args, Uint64);\
-	else	val = va_arg(args, unsigned int);\
-	}while(0)
+/**
+ * \brief Append a run of characters (one copy, clipped to the buffer)
+ */
+#define PUTS(str, len)	do { \
+		size_t	_l = (len); \
+		if(__s && pos < __maxlen) \
+			memcpy(__s + pos, (str), (__maxlen - pos < _l ? __maxlen - pos : _l)); \
+		pos += _l; \
+	} while(0)
+/**
+ * \brief Fetch a numeric argument, skipping the conversion when only capturing
+ * \note Not wrapped in do{}while(0) so the `continue` reaches the format loop,
+ *       only use it as a statement directly in a `case`
+ */
+#define GETVAL()	val = _printf_arg(Args, isLongLong);\
+	if(Args->bCaptureOnly)	continue
+#define GETPTR()	(_printf_arg(Args, sizeof(void*) > 4))
 /**
  * \brief VArg String Number Print Formatted
  */
 int vsnprintf(char *__s, size_t __maxlen, const char *__format, va_list args)
+{
+	tPrintfArgs	src = {.Saved = NULL};
+	 int	ret;
+	va_copy(src.VA, args);
+	ret = _vsnprintf_int(__s, __maxlen, __format, &src);
+	va_end(src.VA);
+	return ret;
+}
+
+/**
+ * \brief Save the arguments \a Format would use (without formatting it)
+ * \param Values	Destination for the raw argument values
+ * \param Strings	Space for copies of %s arguments (pointers in \a Values refer here)
+ * \return Number of values saved, or -1 if they (or the strings) didn't fit
+ * \note %ls and %C arguments can't be captured
+ */
+int vsnprintf_capture(const char *Format, va_list Args, Uint64 *Values, int MaxValues, char *Strings, size_t StringSpace)
+{
+	tPrintfArgs	src = {
+		.Capture = Values, .MaxCount = MaxValues,
+		.Strings = Strings, .StringSpace = StringSpace,
+		.bCaptureOnly = 1
+		};
+	va_copy(src.VA, Args);
+	_vsnprintf_int(NULL, 0, Format, &src);
+	va_end(src.VA);
+	return src.bCaptureFailed ? -1 : src.Count;
+}
+
+/**
+ * \brief Format using arguments saved by vsnprintf_capture
+ */
+int snprintf_captured(char *__s, size_t __maxlen, const char *__format, const Uint64 *Values, int NumValues)
+{
+	tPrintfArgs	src = {.Saved = Values, .MaxCount = NumValues};
+	return _vsnprintf_int(__s, __maxlen, __format, &src);
+}
+
+static int _vsnprintf_int(char *__s, size_t __maxlen, const char *__format, tPrintfArgs *Args)
 {
 	char	c, pad = ' ';
 	 int	minSize = 0, precision = -1, len;
-	char	tmpBuf[34];	// For Integers
+	char	tmpBuf[64];	// For Integers (filled from the end)
+	char	*tmpEnd = tmpBuf + sizeof(tmpBuf);
 	const char	*p = NULL;
 	 int	isLongLong = 0, isLong;
 	Uint64	val;
@@ -213,10 +386,17 @@ int vsnprintf(char *__s, size_t __maxlen, const char *__format, va_list args)
 	// Flags
 	 int	bPadLeft = 0;
 
-	while((c = *__format++) != 0)
+	for( ;; )
 	{
-		// Non control character
-		if(c != '%') { PUTCH(c); continue; }
+		// Non control characters, copied as a run
+		const char	*lit = __format;
+		while( *__format && *__format != '%' )
+			__format ++;
+		if( __format != lit )
+			PUTS(lit, __format - lit);
+		if( *__format == '\0' )
+			break;
+		__format ++;
 
 		c = *__format++;
 		if(c == '\0')	break;
@@ -226,16 +406,12 @@ int vsnprintf(char *__s, size_t __maxlen, const char *__format, va_list args)
 		
 		// Pointer - Done first for debugging
 		if(c == 'p') {
-			Uint	ptr = va_arg(args, Uint);
+			Uint	ptr = GETPTR();
+			if( Args->bCaptureOnly )
+				continue ;
 			PUTCH('*');	PUTCH('0');	PUTCH('x');
-			for( len = BITS/4; len -- && ((ptr>>(len*4))&15) == 0; )
-				;
-			len ++;
-			if( len == 0 )
-				PUTCH( '0' );
-			else
-				while( len -- )
-					PUTCH( cUCDIGITS[ (ptr>>(len*4))&15 ] );
+			p = _itoa_rev(tmpEnd, ptr, 16);
+			PUTS(p, tmpEnd - p);
 			continue ;
 		}
 
@@ -258,7 +434,7 @@ int vsnprintf(char *__s, size_t __maxlen, const char *__format, va_list args)
 		
 		// - Minimum length
 		if(c == '*') {	// Dynamic length
-			minSize = va_arg(args, unsigned int);
+			minSize = _printf_arg(Args, 0);
 			c = *__format++;
 		}
 		else if('1' <= c && c <= '9')
@@ -280,7 +456,7 @@ int vsnprintf(char *__s, size_t __maxlen, const char *__format, va_list args)
 			c = *__format++;
 			
 			if(c == '*') {	// Dynamic length
-				precision = va_arg(args, unsigned int);
+				precision = _printf_arg(Args, 0);
 				c = *__format++;
 			}
 			else if('1' <= c && c <= '9')
@@ -308,7 +484,6 @@ int vsnprintf(char *__s, size_t __maxlen, const char *__format, va_list args)
 		}
 		
 		// - Now get the format code
-		p = tmpBuf;
 		switch(c)
 		{
 		case 'd':
@@ -322,41 +497,43 @@ int vsnprintf(char *__s, size_t __maxlen, const char *__format, va_list args)
 				PUTCH('-');
 				val = -(Sint32)val;
 			}
-			itoa(tmpBuf, val, 10, minSize, pad);
-			goto printString;
+			p = _itoa_rev(tmpEnd, val, 10);
+			goto printNumber;
 		case 'u':	// Unsigned
 			GETVAL();
-			itoa(tmpBuf, val, 10, minSize, pad);
-			goto printString;
+			p = _itoa_rev(tmpEnd, val, 10);
+			goto printNumber;
 		case 'P':	// Physical Address
 			PUTCH('0');
 			PUTCH('x');
 			if(sizeof(tPAddr) > 4)	isLongLong = 1;
 			GETVAL();
-			itoa(tmpBuf, val, 16, minSize, pad);
-			goto printString;
+			p = _itoa_rev(tmpEnd, val, 16);
+			goto printNumber;
 		case 'X':	// Hex
 			if(BITS == 64)
 				isLongLong = 1;	// TODO: Handle non-x86 64-bit archs
 			GETVAL();
-			itoa(tmpBuf, val, 16, minSize, pad);
-			goto printString;
+			p = _itoa_rev(tmpEnd, val, 16);
+			goto printNumber;
 			
 		case 'x':	// Lower case hex
 			GETVAL();
-			itoa(tmpBuf, val, 16, minSize, pad);
-			goto printString;
+			p = _itoa_rev(tmpEnd, val, 16);
+			goto printNumber;
 		case 'o':	// Octal
 			GETVAL();
-			itoa(tmpBuf, val, 8, minSize, pad);
-			goto printString;
+			p = _itoa_rev(tmpEnd, val, 8);
+			goto printNumber;
 		case 'b':
 			GETVAL();
-			itoa(tmpBuf, val, 2, minSize, pad);
-			goto printString;
+			p = _itoa_rev(tmpEnd, val, 2);
+			goto printNumber;
 
 		case 'B':	//Boolean
-			val = va_arg(args, unsigned int);
+			val = _printf_arg(Args, 0);
+			if( Args->bCaptureOnly )
+				continue ;
 			if(val)	p = "True";
 			else	p = "False";
 			goto printString;
@@ -364,8 +541,11 @@ int vsnprintf(char *__s, size_t __maxlen, const char *__format, va_list args)
 		// String - Null Terminated Array
 		case 's':
 			if( isLong ) {
-				Uint16	*p16 = va_arg(args, Uint16*);
+				Uint16	*p16 = (Uint16*)(Uint)GETPTR();
 				Uint8	tmp[5];
+				Args->bCaptureFailed = 1;
+				if( Args->bCaptureOnly )
+					continue ;
 				while( *p16 && precision-- ) {
 					Uint32	cp;
 					p16 += ReadUTF16(p16, &cp);
@@ -375,24 +555,38 @@ int vsnprintf(char *__s, size_t __maxlen, const char *__format, va_list args)
 				}
 				break;
 			}
-			p = va_arg(args, char*);	// Get Argument
+			p = (const char*)(Uint)GETPTR();	// Get Argument
 			if( !p || !CheckString(p) )	p = "(inval)";	// Avoid #PFs  
+			if( Args->bCaptureOnly ) {
+				_printf_capture_str(Args, p);
+				continue ;
+			}
 		printString:
 			if(!p)		p = "(null)";
 			len = strlen(p);
-			if( !bPadLeft )	while(len++ < minSize)	PUTCH(pad);
-			while(*p && precision--) { PUTCH(*p); p++;} 
+			{
+				// Precision limits the characters copied
+				 int	n = (precision >= 0 && precision < len) ? precision : len;
+				if( !bPadLeft )	while(len++ < minSize)	PUTCH(pad);
+				PUTS(p, n);
+			}
 			if( bPadLeft )	while(len++ < minSize)	PUTCH(pad);
 			break;
+		printNumber:
+			// Numbers are always padded on the left
+			len = tmpEnd - p;
+			while(len++ < minSize)	PUTCH(pad);
+			PUTS(p, tmpEnd - p);
+			break;
 		
 		case 'C':	// Non-Null Terminated Character Array
-			p = va_arg(args, char*);
+			p = (const char*)(Uint)GETPTR();
+			Args->bCaptureFailed = 1;
+			if( Args->bCaptureOnly )
+				continue ;
 			if( !CheckMem(p, minSize) )	continue;	// No #PFs please
 			if(!p)	goto printString;
-			while(minSize--) {
-				PUTCH(*p);
-				p ++;
-			}
+			PUTS(p, minSize);
 			break;
 		
 		// Single Character
@@ -404,12 +598,15 @@ int vsnprintf(char *__s, size_t __maxlen, const char *__format, va_list args)
 		}
 	}
 	
-	if(__s && pos != __maxlen)
+	if(__s && pos < __maxlen)
 		__s[pos] = '\0';
 	
 	return pos;
 }
 #undef PUTCH
+#undef PUTS
+#undef GETVAL
+#undef GETPTR
 
 /**
  */
@@ -546,11 +743,26 @@ int strucmp(const char *Str1, const char *Str2)
  */
 char *strchr(const char *__s, int __c)
 {
-	for( ; *__s; __s ++ )
+	const char	ch = __c;
+	tLibWord	pattern = WORD_ONES * (Uint8)ch;
+	
+	for( ; (tVAddr)__s & WORD_MASK; __s ++ )
 	{
-		if( *__s == __c )	return (char*)__s;
+		if( *__s == ch )	return (char*)__s;
+		if( *__s == '\0' )	return NULL;
 	}
-	return NULL;
+	// Skip words with neither the character nor a NUL
+	for( ;; __s += sizeof(tLibWord) )
+	{
+		tLibWord	w = *(const tLibWord*)__s;
+		if( WORD_HASZERO(w) || WORD_HASZERO(w ^ pattern) )
+			break;
+	}
+	for( ; *__s != ch; __s ++ )
+	{
+		if( *__s == '\0' )	return NULL;
+	}
+	return (char*)__s;
 }
 
 char *strrchr(const char *__s, int __c)
@@ -582,9 +794,16 @@ int strpos(const char *Str, char Ch)
  */
 size_t strlen(const char *__str)
 {
-	size_t	ret = 0;
-	while(*__str++)	ret++;
-	return ret;
+	const char	*p = __str;
+	for( ; (tVAddr)p & WORD_MASK; p ++ )
+	{
+		if( *p == '\0' )	return p - __str;
+	}
+	// Aligned words never cross a page, so reading past the NUL is safe
+	while( !WORD_HASZERO(*(const tLibWord*)p) )
+		p += sizeof(tLibWord);
+	while( *p )	p ++;
+	return p - __str;
 }
 
 /**
@@ -756,10 +975,22 @@ void *memmove(void *__dest, const void *__src, size_t len)
 	memcpy(dest, src, len);
 	return ret;
 	#else
-	for( int i = len; i--; )
+	// Copy backwards, a word at a time if both ends line up
+	dest += len;
+	src += len;
+	if( ((tVAddr)dest & WORD_MASK) == ((tVAddr)src & WORD_MASK) )
 	{
-		dest[i] = src[i];
+		for( ; len && ((tVAddr)dest & WORD_MASK); len -- )
+			*--dest = *--src;
+		for( ; len >= sizeof(tLibWord); len -= sizeof(tLibWord) )
+		{
+			dest -= sizeof(tLibWord);
+			src -= sizeof(tLibWord);
+			*(tLibWord*)dest = *(const tLibWord*)src;
+		}
 	}
+	while( len-- )
+		*--dest = *--src;
 	return ret;
 	#endif
 	
@@ -781,7 +1012,7 @@ int CheckString(const char *String)
 
 	addr = (tVAddr)String;
 
-	if( !MM_GetPhysAddr( (void*)addr ) )
+	if( !MM_GetPhysAddr( (void*)addr ) && (addr >= USER_MAX || VFS_MMap_PageFault(addr, 0)) )
 		return 0;
 	
 	// Check 1st page
@@ -795,6 +1026,8 @@ int CheckString(const char *String)
 				return 0;
 			if(!bUser && !MM_GetPhysAddr((void*)addr) )
 				return 0;
+			if(bUser && !MM_GetPhysAddr((void*)addr) && VFS_MMap_PageFault(addr, 0) )
+				return 0;
 		}
 		addr ++;
 	}
@@ -807,6 +1040,12 @@ int CheckString(const char *String)
  */
 int CheckMem(const void *Mem, int NumBytes)
 {
+	if( MM_IsValidBuffer( (tVAddr)Mem, NumBytes ) )
+		return 1;
+	// Demand-paged file mappings may not have been touched yet
+	if( (tVAddr)Mem >= USER_MAX )
+		return 0;
+	VFS_MMap_Populate(Mem, NumBytes);
 	return MM_IsValidBuffer( (tVAddr)Mem, NumBytes );
 }
 /* *
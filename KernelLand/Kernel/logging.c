@@ -11,6 +11,11 @@
 #define PRINT_ON_APPEND	1
 #define USE_RING_BUFFER	1
 #define RING_BUFFER_SIZE	4096
+#define LOG_HISTORY	1	// Keep recent messages as format+arguments (see Log_GenHistoryFile)
+#define LOG_HISTORY_SIZE	128	// Messages kept
+#define LOG_HISTORY_ARGS	8
+#define LOG_HISTORY_STRINGS	96	// Space for copies of %s arguments
+#define LOG_PRINT_LEVEL	LOG_LEVEL_DEBUG	// Higher (less important) levels are only kept in the history (if LOG_HISTORY)
 
 // === CONSTANTS ===
 enum eLogLevels
@@ -47,10 +52,31 @@ typedef struct sLogList
 	tLogEntry	*Head;
 	tLogEntry	*Tail;
 }	tLogList;
+/**
+ * \brief History entry, formatted only when the history is read
+ * \note Format points into the caller's image, so messages from an unloaded
+ *       module can't be read back (modules aren't unloaded yet)
+ */
+typedef struct sLogRecord
+{
+	Sint64	Time;
+	tTID	TID;
+	Uint8	Level;
+	Uint8	NumArgs;
+	char	Ident[9];
+	const char	*Format;	// NULL if Strings holds the (truncated) message
+	Uint64	Args[LOG_HISTORY_ARGS];
+	char	Strings[LOG_HISTORY_STRINGS];
+}	tLogRecord;
 
 // === PROTOTYPES ===
 void	Log_AddEvent(const char *Ident, int Level, const char *Format, va_list Args);
 static void	Log_Int_PrintMessage(tLogEntry *Entry);
+#if LOG_HISTORY
+static void	Log_Int_Record(const char *Ident, int Level, const char *Format, va_list Args);
+static void	Log_Int_CopyRecord(tLogRecord *Dest, const tLogRecord *Src);
+size_t	Log_GenHistoryFile(char *Buffer, size_t Length);
+#endif
 //void	Log_KernelPanic(const char *Ident, const char *Message, ...);
 //void	Log_Panic(const char *Ident, const char *Message, ...);
 //void	Log_Error(const char *Ident, const char *Message, ...);
@@ -79,6 +105,11 @@ tLogList	gLog;
 tLogList	gLog_Levels[NUM_LOG_LEVELS];
 # endif	// USE_RING_BUFFER
 #endif // CACHE_MESSAGES
+#if LOG_HISTORY
+tShortSpinlock	glLog_History;
+Uint32	giLog_HistoryCount;	// Total recorded, the next slot is this modulo LOG_HISTORY_SIZE
+tLogRecord	gaLog_History[LOG_HISTORY_SIZE];
+#endif
 
 // === CODE ===
 /**
@@ -92,6 +123,11 @@ void Log_AddEvent(const char *Ident, int Level, const char *Format, va_list Args
 	
 	if( Level >= NUM_LOG_LEVELS )	return;
 
+	#if LOG_HISTORY
+	Log_Int_Record(Ident, Level, Format, Args);
+	#endif
+	if( Level > LOG_PRINT_LEVEL )	return;
+
 	va_copy(args_tmp, Args);
 	len = vsnprintf(NULL, 0, Format, args_tmp);
 	
@@ -151,6 +187,103 @@ void Log_AddEvent(const char *Ident, int Level, const char *Format, va_list Args
 	#endif
 }
 
+#if LOG_HISTORY
+/**
+ * \brief Save a message to the history (only the arguments, no formatting)
+ * \note Captured without the lock held, as copying %s arguments can fault
+ */
+void Log_Int_Record(const char *Ident, int Level, const char *Format, va_list Args)
+{
+	tLogRecord	rec;
+	 int	n;
+	
+	// Messages logged while the history is locked (on this CPU) are dropped
+	if( CPU_HAS_LOCK(&glLog_History) )
+		return ;
+	
+	rec.Time = now();
+	rec.TID = Threads_GetTID();
+	rec.Level = Level;
+	strncpy(rec.Ident, Ident, 8);
+	rec.Ident[8] = '\0';
+	n = vsnprintf_capture(Format, Args, rec.Args, LOG_HISTORY_ARGS, rec.Strings, sizeof(rec.Strings));
+	if( n < 0 ) {
+		// Arguments didn't fit (or can't be saved), keep what text does
+		vsnprintf(rec.Strings, sizeof(rec.Strings)-1, Format, Args);
+		rec.Strings[sizeof(rec.Strings)-1] = '\0';
+		rec.Format = NULL;
+		rec.NumArgs = 0;
+	}
+	else {
+		rec.Format = Format;
+		rec.NumArgs = n;
+	}
+	
+	SHORTLOCK( &glLog_History );
+	Log_Int_CopyRecord( &gaLog_History[giLog_HistoryCount % LOG_HISTORY_SIZE], &rec );
+	giLog_HistoryCount ++;
+	SHORTREL( &glLog_History );
+}
+
+/**
+ * \brief Copy a history record, moving captured %s pointers to the copy's Strings
+ */
+void Log_Int_CopyRecord(tLogRecord *Dest, const tLogRecord *Src)
+{
+	memcpy(Dest, Src, sizeof(*Dest));
+	for( int i = 0; i < Src->NumArgs; i ++ )
+	{
+		Uint	ptr = Src->Args[i];
+		if( ptr >= (Uint)Src->Strings && ptr < (Uint)Src->Strings + sizeof(Src->Strings) )
+			Dest->Args[i] = ptr - (Uint)Src->Strings + (Uint)Dest->Strings;
+	}
+}
+
+/**
+ * \brief Generate /Devices/system/Log, the most recent messages (oldest first)
+ * \note The records are copied out under the lock and formatted after it is released
+ */
+size_t Log_GenHistoryFile(char *Buffer, size_t Length)
+{
+	size_t	len = 0;
+	tLogRecord	*snap;
+	Uint32	count, first;
+	#define ADD(...)	do { \
+		 int	_n = snprintf(len < Length ? Buffer + len : NULL, len < Length ? Length - len : 0, __VA_ARGS__); \
+		if( _n > 0 )	len += _n; \
+	} while(0)
+	
+	snap = malloc( sizeof(tLogRecord) * LOG_HISTORY_SIZE );
+	if( !snap )
+		return 0;
+	
+	SHORTLOCK( &glLog_History );
+	count = giLog_HistoryCount;
+	first = (count > LOG_HISTORY_SIZE ? count - LOG_HISTORY_SIZE : 0);
+	for( Uint32 i = first; i < count; i ++ )
+		Log_Int_CopyRecord( &snap[i - first], &gaLog_History[i % LOG_HISTORY_SIZE] );
+	SHORTREL( &glLog_History );
+	
+	for( Uint32 i = 0; i < count - first; i ++ )
+	{
+		const tLogRecord	*rec = &snap[i];
+		ADD("%014lli%s [%-8s] %i - ", (long long)rec->Time, csaLevelCodes[rec->Level], rec->Ident, rec->TID);
+		if( rec->Format ) {
+			 int	_n = snprintf_captured(len < Length ? Buffer + len : NULL, len < Length ? Length - len : 0,
+				rec->Format, rec->Args, rec->NumArgs);
+			if( _n > 0 )	len += _n;
+		}
+		else
+			ADD("%s", rec->Strings);
+		ADD("\n");
+	}
+	free(snap);
+	
+	#undef ADD
+	return len;
+}
+#endif
+
 /**
  * \brief Prints a log message to the debug console
  */
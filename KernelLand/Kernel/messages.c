@@ -4,6 +4,11 @@
  *
  * messages.c
  * - IPC Messages
+ *
+ * Each thread has a bounded ring of fixed-size message slots (allocated on
+ * the first message sent to it). Small messages are stored inline in a slot,
+ * so the common case needs no allocation. Larger messages are copied once
+ * into an out-of-line buffer owned by the slot.
  */
 #define DEBUG	0
 #include <acess.h>
@@ -12,66 +17,202 @@
 #include <errno.h>
 #include <events.h>
 
+#define MSG_QUEUE_SLOTS	32	// Maximum number of queued messages per thread
+#define MSG_INLINE_SIZE	112	// Messages up to this size are stored in the slot
+#define MSG_MAX_LENGTH	(64*1024)	// Global maximum message length
+
+// === TYPES ===
+typedef struct sMsgSlot	tMsgSlot;
+typedef struct sMsgWaiter	tMsgWaiter;
+
+struct sMsgSlot
+{
+	tTID	Source;	//!< Source thread ID
+	Uint32	Length;	//!< Length of message data in bytes
+	void	*OutOfLine;	//!< Heap copy of data if Length > MSG_INLINE_SIZE
+	Uint8	Inline[MSG_INLINE_SIZE];
+};
+
+/**
+ * \brief Sender blocked on a full queue (lives on the sender's stack)
+ */
+struct sMsgWaiter
+{
+	tMsgWaiter	*Next;
+	tThread	*Thread;
+	tTID	Dest;	//!< Thread whose queue this waiter is on
+	volatile int	bWoken;
+};
+
+struct sMsgQueue
+{
+	 int	Head;	//!< Index of the oldest message
+	 int	Count;	//!< Number of queued messages
+	tMsgWaiter	*Senders;	//!< Senders waiting for a free slot
+
+	// Statistics
+	Uint	nSent;
+	Uint	nReceived;
+	Uint	nOutOfLine;	//!< Messages too large to store inline
+	Uint	nBlocked;	//!< Sends that had to wait for space
+	Uint	nRejected;	//!< Non-blocking sends refused due to a full queue
+	 int	MaxDepth;	//!< Highest observed Count
+
+	tMsgSlot	Slots[MSG_QUEUE_SLOTS];
+};
+
 // === CODE ===
 /**
  * \fn int Proc_SendMessage(Uint Dest, int Length, void *Data)
- * \brief Send an IPC message
+ * \brief Send an IPC message (blocking if the destination queue is full)
  * \param Dest	Destination Thread
  * \param Length	Length of the message
  * \param Data	Message data
  */
 int Proc_SendMessage(Uint Dest, int Length, void *Data)
+{
+	return Proc_SendMessageEx(Dest, Length, Data, 0);
+}
+
+/**
+ * \brief Send an IPC message
+ * \param Dest	Destination Thread
+ * \param Length	Length of the message
+ * \param Data	Message data
+ * \param Flags	SENDMSG_* flags
+ * \return 0 on success, -1 on error (errno = EAGAIN if the queue is full and SENDMSG_NONBLOCK is set,
+ *         EINTR if a signal arrived while waiting for space)
+ */
+int Proc_SendMessageEx(Uint Dest, int Length, void *Data, Uint Flags)
 {
 	tThread	*thread;
-	tMsg	*msg;
-	
-	ENTER("iDest iLength pData", Dest, Length, Data);
-	
+	struct sMsgQueue	*q, *newq = NULL;
+	tMsgSlot	*slot;
+	void	*ool = NULL;
+	tMsgWaiter	waiter;
+	tThread	*us = Proc_GetCurThread();
+	Uint32	events;
+
+	ENTER("iDest iLength pData xFlags", Dest, Length, Data, Flags);
+
 	if(Length <= 0 || !Data) {
 		errno = -EINVAL;
 		LEAVE_RET('i', -1);
 	}
-	
-	// TODO: Check message length against global/per-thread maximums
-	// TODO: Restrict queue length
-
-	// Get thread
-	thread = Threads_GetThread( Dest );
-	if(!thread)	LEAVE_RET('i', -1);
-	LOG("Destination %p(%i %s)", thread, thread->TID, thread->ThreadName);
-	
-	// Get Spinlock
-	SHORTLOCK( &thread->IsLocked );
-	
-	// Check if thread is still alive
-	if(thread->Status == THREAD_STAT_DEAD) {
-		SHORTREL( &thread->IsLocked );
+	if(Length > MSG_MAX_LENGTH) {
+		errno = -EINVAL;
 		LEAVE_RET('i', -1);
 	}
-	
-	// Create message
-	msg = malloc( sizeof(tMsg)+Length );
-	msg->Next = NULL;
-	msg->Source = Proc_GetCurThread()->TID;
-	msg->Length = Length;
-	memcpy(msg->Data, Data, Length);
-	
-	// If there are already messages
-	if(thread->LastMessage) {
-		thread->LastMessage->Next = msg;
-		thread->LastMessage = msg;
-	} else {
-		thread->Messages = msg;
-		thread->LastMessage = msg;
+
+	// Large messages are copied (once) outside of the lock
+	if( Length > MSG_INLINE_SIZE ) {
+		ool = malloc( Length );
+		if( !ool ) {
+			errno = -ENOMEM;
+			LEAVE_RET('i', -1);
+		}
+		memcpy(ool, Data, Length);
 	}
-	
+
+	for( ;; )
+	{
+		// Get thread (re-fetched each time, it may have died while we slept)
+		thread = Threads_GetThread( Dest );
+		if(!thread)	goto _err;
+		LOG("Destination %p(%i %s)", thread, thread->TID, thread->ThreadName);
+
+		// Get Spinlock
+		SHORTLOCK( &thread->IsLocked );
+
+		// Check if thread is still alive
+		if(thread->Status == THREAD_STAT_DEAD) {
+			SHORTREL( &thread->IsLocked );
+			goto _err;
+		}
+
+		q = thread->MsgQueue;
+		if( !q )
+		{
+			if( !newq ) {
+				// Can't allocate with the spinlock held
+				SHORTREL( &thread->IsLocked );
+				newq = calloc( 1, sizeof(struct sMsgQueue) );
+				if( !newq ) {
+					errno = -ENOMEM;
+					goto _err;
+				}
+				continue ;
+			}
+			thread->MsgQueue = q = newq;
+			newq = NULL;
+		}
+
+		if( q->Count < MSG_QUEUE_SLOTS )
+			break;
+
+		// Queue is full
+		if( Flags & SENDMSG_NONBLOCK ) {
+			q->nRejected ++;
+			SHORTREL( &thread->IsLocked );
+			errno = -EAGAIN;
+			goto _err;
+		}
+
+		LOG("Queue full, waiting");
+		q->nBlocked ++;
+		waiter.Thread = us;
+		waiter.Dest = Dest;
+		waiter.bWoken = 0;
+		waiter.Next = q->Senders;
+		q->Senders = &waiter;
+		// Lets Threads_Kill unlink the waiter if we die while blocked
+		us->MsgSendWait = &waiter;
+		Threads_ClearEvent( THREAD_EVENT_SHORTWAIT );
+		SHORTREL( &thread->IsLocked );
+
+		// SHORTWAIT is shared with drivers, so ignore wakeups not from the queue
+		events = 0;
+		while( !waiter.bWoken && !(events & THREAD_EVENT_SIGNAL) )
+			events = Threads_WaitEvents( THREAD_EVENT_SHORTWAIT|THREAD_EVENT_SIGNAL );
+		
+		// Interrupted - take the waiter off the queue before it goes out of scope
+		Proc_int_CancelSend(us);
+		if( !waiter.bWoken ) {
+			LOG("Interrupted");
+			errno = -EINTR;
+			goto _err;
+		}
+	}
+
+	// Fill the slot at the tail of the ring
+	slot = &q->Slots[ (q->Head + q->Count) % MSG_QUEUE_SLOTS ];
+	slot->Source = Proc_GetCurThread()->TID;
+	slot->Length = Length;
+	slot->OutOfLine = ool;
+	if( !ool )
+		memcpy(slot->Inline, Data, Length);
+	else
+		q->nOutOfLine ++;
+	q->Count ++;
+	q->nSent ++;
+	if( q->Count > q->MaxDepth )
+		q->MaxDepth = q->Count;
+
 	SHORTREL(&thread->IsLocked);
 
-	// Wake the thread	
+	// Lost the allocation race, free outside the lock
+	if( newq )
+		free(newq);
+
+	// Wake the thread
 	LOG("Waking %p (%i %s)", thread, thread->TID, thread->ThreadName);
 	Threads_PostEvent( thread, THREAD_EVENT_IPCMSG );
-	
+
 	LEAVE_RET('i', 0);
+_err:
+	if( newq )	free(newq);
+	if( ool )	free(ool);
+	LEAVE_RET('i', -1);
 }
 
 /**
@@ -85,33 +226,38 @@ int Proc_SendMessage(Uint Dest, int Length, void *Data)
 int Proc_GetMessage(Uint *Source, Uint BufSize, void *Buffer)
 {
 	 int	ret;
-	void	*tmp;
+	void	*ool;
 	tThread	*cur = Proc_GetCurThread();
+	struct sMsgQueue	*q = cur->MsgQueue;
+	tMsgSlot	*slot;
+	tMsgWaiter	*sender;
 
 	ENTER("pSource xBufSize pBuffer", Source, BufSize, Buffer);
-	
+
 	// Check if queue has any items
-	if(!cur->Messages) {
+	if(!q || q->Count == 0) {
 		LOG("empty queue");
 		LEAVE('i', 0);
 		return 0;
 	}
 
 	SHORTLOCK( &cur->IsLocked );
-	
+
+	slot = &q->Slots[q->Head];
+
 	if(Source) {
-		*Source = cur->Messages->Source;
+		*Source = slot->Source;
 		LOG("*Source = %i", *Source);
 	}
-	
+
 	// Get message length
 	if( !Buffer ) {
-		ret = cur->Messages->Length;
+		ret = slot->Length;
 		SHORTREL( &cur->IsLocked );
 		LEAVE('i', ret);
 		return ret;
 	}
-	
+
 	// Get message
 	if(Buffer != GETMSG_IGNORE)
 	{
@@ -123,30 +269,118 @@ int Proc_GetMessage(Uint *Source, Uint BufSize, void *Buffer)
 			LEAVE('i', -1);
 			return -1;
 		}
-		if( BufSize < cur->Messages->Length )
+		if( BufSize < slot->Length )
 			Log_Notice("Threads", "Buffer of 0x%x passed, but 0x%x long message, truncated",
-				BufSize, cur->Messages->Length);
-		else if( BufSize < cur->Messages->Length )
-			BufSize = cur->Messages->Length;
+				BufSize, slot->Length);
 		else
-			;	// equal
+			BufSize = slot->Length;
 		LOG("Copied to buffer");
-		memcpy(Buffer, cur->Messages->Data, BufSize);
+		memcpy(Buffer, (slot->OutOfLine ? slot->OutOfLine : slot->Inline), BufSize);
 	}
-	ret = cur->Messages->Length;
-	
-	// Remove from list
-	tmp = cur->Messages;
-	cur->Messages = cur->Messages->Next;
-	// - Removed last message? Clear the end-of-list pointer
-	if(cur->Messages == NULL)	cur->LastMessage = NULL;
-	//  > Otherwise, re-mark the IPCMSG event flag
-	else	cur->EventState |= THREAD_EVENT_IPCMSG;
-	
+	ret = slot->Length;
+	ool = slot->OutOfLine;
+	slot->OutOfLine = NULL;
+
+	// Remove from ring
+	q->Head = (q->Head + 1) % MSG_QUEUE_SLOTS;
+	q->Count --;
+	q->nReceived ++;
+	// - Still messages left? Re-mark the IPCMSG event flag
+	if( q->Count )
+		cur->EventState |= THREAD_EVENT_IPCMSG;
+
+	// Let a blocked sender have the slot
+	sender = q->Senders;
+	if( sender ) {
+		q->Senders = sender->Next;
+		sender->bWoken = 1;
+		Threads_PostEvent( sender->Thread, THREAD_EVENT_SHORTWAIT );
+	}
+
 	SHORTREL( &cur->IsLocked );
 
-	free(tmp);	// Free outside of lock
+	if( ool )
+		free(ool);	// Free outside of lock
 
 	LEAVE('i', ret);
 	return ret;
 }
+
+/**
+ * \brief Check if a thread has messages waiting
+ */
+int Proc_int_HasMessages(tThread *Thread)
+{
+	return Thread->MsgQueue && Thread->MsgQueue->Count > 0;
+}
+
+/**
+ * \brief Release a thread's message queue
+ * \note Called with Thread->IsLocked held, as the thread is being killed
+ */
+void Proc_int_ClearMessages(tThread *Thread)
+{
+	struct sMsgQueue	*q = Thread->MsgQueue;
+	if( !q )	return ;
+	Thread->MsgQueue = NULL;
+
+	// Blocked senders will re-check the thread and find it dead
+	while( q->Senders ) {
+		tMsgWaiter	*sender = q->Senders;
+		q->Senders = sender->Next;
+		sender->bWoken = 1;
+		Threads_PostEvent( sender->Thread, THREAD_EVENT_SHORTWAIT );
+	}
+
+	for( int i = 0; i < q->Count; i ++ )
+	{
+		tMsgSlot	*slot = &q->Slots[ (q->Head + i) % MSG_QUEUE_SLOTS ];
+		if( slot->OutOfLine )
+			free( slot->OutOfLine );
+	}
+	free( q );
+}
+
+/**
+ * \brief Remove a thread from the sender list of the queue it is blocked on
+ * \note Called by the sender itself when interrupted, or by Threads_Kill
+ */
+void Proc_int_CancelSend(tThread *Thread)
+{
+	tMsgWaiter	*waiter = Thread->MsgSendWait;
+	tThread	*dest;
+	if( !waiter )	return ;
+	Thread->MsgSendWait = NULL;
+	
+	// Woken waiters have already been removed from the list
+	if( waiter->bWoken )	return ;
+	
+	// If the destination has died, Proc_int_ClearMessages has set bWoken
+	dest = Threads_GetThread( waiter->Dest );
+	if( !dest )	return ;
+	
+	SHORTLOCK( &dest->IsLocked );
+	if( !waiter->bWoken && dest->MsgQueue )
+	{
+		tMsgWaiter	**pnp = &dest->MsgQueue->Senders;
+		while( *pnp && *pnp != waiter )
+			pnp = &(*pnp)->Next;
+		if( *pnp )
+			*pnp = waiter->Next;
+	}
+	SHORTREL( &dest->IsLocked );
+}
+
+/**
+ * \brief Print message queue statistics for a thread (used by Threads_Dump)
+ */
+void Proc_int_DumpMessageQueue(tThread *Thread)
+{
+	struct sMsgQueue	*q = Thread->MsgQueue;
+	if( !q )	return ;
+	Log("  Messages: %i/%i queued (max %i), %i sent, %i received, %i out-of-line",
+		q->Count, MSG_QUEUE_SLOTS, q->MaxDepth, q->nSent, q->nReceived, q->nOutOfLine);
+	if( q->nBlocked || q->nRejected )
+		Log("  Messages: %i sends blocked, %i rejected", q->nBlocked, q->nRejected);
+}
+
@@ -9,12 +9,54 @@
 #include <threads_int.h>
 #include <mutex.h>
 
+#define MUTEX_ADAPTIVE_SPIN	1	// Spin while the owner is running on another CPU
+#define MUTEX_SPIN_LIMIT	1000	// Maximum number of spin iterations before sleeping
+#define MUTEX_STATS	0	// Record per-mutex acquisition/contention statistics
+#define MUTEX_STATS_SLOTS	256	// Number of mutexes tracked (power of two)
+#define MUTEX_STATS_BUCKETS	12	// Wait-time histogram buckets (power of two ms)
+
+#if ARCHDIR_IS_x86 || ARCHDIR_IS_x86_64
+# define MUTEX_SPIN_RELAX()	__asm__ __volatile__ ("pause" ::: "memory")
+#else
+# define MUTEX_SPIN_RELAX()	__asm__ __volatile__ ("" ::: "memory")
+#endif
+
+// === TYPES ===
+#if MUTEX_STATS
+typedef struct sMutexStats
+{
+	tMutex	*Mutex;
+	const char	*Name;
+	Uint	Acquires;	//!< Total number of acquisitions
+	Uint	Contended;	//!< Acquisitions that found the mutex held
+	Uint	SpinHits;	//!< Contended acquisitions satisfied by spinning
+	Uint	Sleeps;	//!< Contended acquisitions that had to sleep
+	Uint	WaitHist[MUTEX_STATS_BUCKETS];	//!< Sleep time histogram (bucket N: < 2^N ms)
+} tMutexStats;
+#endif
+
 // === PROTOTYPES ===
 #if 0
  int	Mutex_Acquire(tMutex *Mutex);
+ int	Mutex_TryAcquire(tMutex *Mutex);
 void	Mutex_Release(tMutex *Mutex);
  int	Mutex_IsLocked(tMutex *Mutex);
 #endif
+#if MUTEX_ADAPTIVE_SPIN
+static int	Mutex_int_SpinWait(tMutex *Mutex, tThread *Us);
+#endif
+#if MUTEX_STATS
+static tMutexStats	*Mutex_int_GetStats(tMutex *Mutex);
+static void	Mutex_int_RecordAcquire(tMutex *Mutex, int bContended, int bSlept, tTime WaitTime);
+#endif
+
+// === GLOBALS ===
+#if MUTEX_STATS
+// NOTE: Statically allocated, as the heap itself is protected by a mutex
+tShortSpinlock	glMutex_StatsLock;
+tMutexStats	gaMutex_Stats[MUTEX_STATS_SLOTS];
+ int	giMutex_StatsDropped;
+#endif
 
 // === CODE ===
 //
@@ -23,6 +65,27 @@ void	Mutex_Release(tMutex *Mutex);
 int Mutex_Acquire(tMutex *Mutex)
 {
 	tThread	*us = Proc_GetCurThread();
+	#if MUTEX_STATS
+	 int	bContended = 0;	// Found held, but taken after spinning
+	tTime	waitStart = 0;
+	#endif
+	
+	#if MUTEX_ADAPTIVE_SPIN
+	// If the owner is running, it will probably release the lock soon
+	if( Mutex->Owner )
+	{
+		#if MUTEX_STATS
+		bContended = 1;
+		#endif
+		if( Mutex_int_SpinWait(Mutex, us) )
+		{
+			#if MUTEX_STATS
+			Mutex_int_RecordAcquire(Mutex, 1, 0, 0);
+			#endif
+			return 0;
+		}
+	}
+	#endif
 	
 	// Get protector
 	SHORTLOCK( &Mutex->Protector );
@@ -31,6 +94,9 @@ int Mutex_Acquire(tMutex *Mutex)
 	
 	// Check if the lock is already held
 	if( Mutex->Owner ) {
+		#if MUTEX_STATS
+		waitStart = now();
+		#endif
 		SHORTLOCK( &glThreadListLock );
 		// - Remove from active list
 		us = Threads_RemActive();
@@ -69,11 +135,17 @@ int Mutex_Acquire(tMutex *Mutex)
 		Threads_int_WaitForStatusEnd(THREAD_STAT_MUTEXSLEEP);
 		// We're only woken when we get the lock
 		us->WaitPointer = NULL;
+		#if MUTEX_STATS
+		Mutex_int_RecordAcquire(Mutex, 1, 1, now() - waitStart);
+		#endif
 	}
 	// Ooh, let's take it!
 	else {
 		Mutex->Owner = us;
 		SHORTREL( &Mutex->Protector );
+		#if MUTEX_STATS
+		Mutex_int_RecordAcquire(Mutex, bContended, 0, 0);
+		#endif
 	}
 	
 	#if 0
@@ -85,6 +157,23 @@ int Mutex_Acquire(tMutex *Mutex)
 	return 0;
 }
 
+// Acquire a mutex without waiting
+int Mutex_TryAcquire(tMutex *Mutex)
+{
+	 int	ret = -1;
+	SHORTLOCK( &Mutex->Protector );
+	if( !Mutex->Owner ) {
+		Mutex->Owner = Proc_GetCurThread();
+		ret = 0;
+	}
+	SHORTREL( &Mutex->Protector );
+	#if MUTEX_STATS
+	if( ret == 0 )
+		Mutex_int_RecordAcquire(Mutex, 0, 0, 0);
+	#endif
+	return ret;
+}
+
 // Release a mutex
 void Mutex_Release(tMutex *Mutex)
 {
@@ -119,7 +208,121 @@ int Mutex_IsLocked(tMutex *Mutex)
 	return Mutex->Owner != NULL;
 }
 
+#if MUTEX_ADAPTIVE_SPIN
+/**
+ * \brief Spin on a held mutex while its owner is executing on another CPU
+ * \return Non-zero if the mutex was acquired
+ * 
+ * Sleeping costs two context switches, which is far more than a short
+ * critical section on another CPU. Give up as soon as the owner stops
+ * running (it won't release until rescheduled) or the spin limit is hit.
+ */
+static int Mutex_int_SpinWait(tMutex *Mutex, tThread *Us)
+{
+	for( int i = 0; i < MUTEX_SPIN_LIMIT; i ++ )
+	{
+		tThread	*owner = Mutex->Owner;
+		if( !owner )
+		{
+			SHORTLOCK( &Mutex->Protector );
+			// Don't jump the queue if threads are already asleep on it
+			if( !Mutex->Owner && !Mutex->Waiting ) {
+				Mutex->Owner = Us;
+				SHORTREL( &Mutex->Protector );
+				return 1;
+			}
+			SHORTREL( &Mutex->Protector );
+			continue ;
+		}
+		// Owner isn't on a CPU (or is us, on a single CPU) - sleep instead
+		if( owner == Us || owner->CurCPU < 0 || owner->CurCPU == Us->CurCPU )
+			return 0;
+		MUTEX_SPIN_RELAX();
+	}
+	return 0;
+}
+#endif
+
+#if MUTEX_STATS
+/**
+ * \brief Locate (or allocate) the statistics slot for a mutex
+ * \note Caller must hold glMutex_StatsLock
+ */
+static tMutexStats *Mutex_int_GetStats(tMutex *Mutex)
+{
+	Uint	hash = ((tVAddr)Mutex >> 3) & (MUTEX_STATS_SLOTS-1);
+	for( int i = 0; i < MUTEX_STATS_SLOTS; i ++ )
+	{
+		tMutexStats	*ent = &gaMutex_Stats[ (hash + i) & (MUTEX_STATS_SLOTS-1) ];
+		if( ent->Mutex == Mutex )
+			return ent;
+		if( ent->Mutex == NULL ) {
+			ent->Mutex = Mutex;
+			ent->Name = Mutex->Name;
+			return ent;
+		}
+	}
+	return NULL;
+}
+
+static void Mutex_int_RecordAcquire(tMutex *Mutex, int bContended, int bSlept, tTime WaitTime)
+{
+	SHORTLOCK( &glMutex_StatsLock );
+	tMutexStats	*ent = Mutex_int_GetStats(Mutex);
+	if( !ent ) {
+		giMutex_StatsDropped ++;
+		SHORTREL( &glMutex_StatsLock );
+		return ;
+	}
+	ent->Acquires ++;
+	if( bContended )
+		ent->Contended ++;
+	if( bSlept )
+	{
+		 int	bucket = 0;
+		ent->Sleeps ++;
+		while( WaitTime > 0 && bucket < MUTEX_STATS_BUCKETS-1 ) {
+			WaitTime >>= 1;
+			bucket ++;
+		}
+		ent->WaitHist[bucket] ++;
+	}
+	else if( bContended )
+		ent->SpinHits ++;
+	SHORTREL( &glMutex_StatsLock );
+}
+#endif
+
+/**
+ * \brief Dump mutex contention statistics to the log
+ */
+void Mutex_DumpStats(void)
+{
+	#if MUTEX_STATS
+	// NOTE: Not locked, Log_Log can sleep. Counters may be slightly stale.
+	for( int i = 0; i < MUTEX_STATS_SLOTS; i ++ )
+	{
+		tMutexStats	*ent = &gaMutex_Stats[i];
+		if( !ent->Mutex || ent->Contended == 0 )
+			continue ;
+		Log_Log("Mutex", "%p '%s': %i acquires, %i contended (%i spun, %i slept)",
+			ent->Mutex, (ent->Name ? ent->Name : "-"),
+			ent->Acquires, ent->Contended, ent->SpinHits, ent->Sleeps);
+		for( int j = 0; j < MUTEX_STATS_BUCKETS; j ++ )
+		{
+			if( !ent->WaitHist[j] )	continue ;
+			Log_Log("Mutex", " - <%ims: %i", 1 << j, ent->WaitHist[j]);
+		}
+	}
+	if( giMutex_StatsDropped )
+		Log_Log("Mutex", "%i acquisitions not recorded (table full)", giMutex_StatsDropped);
+	#else
+	Log_Log("Mutex", "Statistics not compiled in (MUTEX_STATS)");
+	#endif
+}
+
 // === EXPORTS ===
 EXPORT(Mutex_Acquire);
 EXPORT(Mutex_Release);
 EXPORT(Mutex_IsLocked);
+EXPORT(Mutex_DumpStats);
@@ -0,0 +1,208 @@
+/*
+ * Acess2 Kernel
+ * - By John Hodge (thePowersGang)
+ *
+ * reclaim.c
+ * - Page reclaim under memory pressure
+ *
+ * Caches register a shrinker that can hand pages back. When free memory
+ * drops below the low watermark the reclaimer thread asks each shrinker in
+ * turn for pages until the high watermark is reached. If an allocation fails
+ * outright, the allocator calls Reclaim_Direct to shrink synchronously (with
+ * RECLAIM_FLAG_ATOMIC) before giving up.
+ */
+#define DEBUG	0
+#include <acess.h>
+#include <reclaim.h>
+#include <threads_int.h>
+#include <events.h>
+#include <fs_sysfs.h>
+
+#define RECLAIM_LOW_PERMILLE	40	// Wake the reclaimer when free memory drops below 4%
+#define RECLAIM_HIGH_PERMILLE	80	// ... and have it free up to 8%
+#define RECLAIM_BATCH	32	// Pages asked of a shrinker at once
+
+// === PROTOTYPES ===
+void	Reclaim_WorkerThread(void *Unused);
+static size_t	Reclaim_int_Run(size_t Pages, int Flags);
+static void	Reclaim_int_UpdateFile(void);
+
+// === GLOBALS ===
+tMutex	glReclaim_Shrinkers;
+tReclaim_Shrinker	*gReclaim_Shrinkers;
+tThread	*gpReclaim_Thread;
+volatile int	gbReclaim_Pending;
+volatile Uint64	giReclaim_FreePages;
+volatile Uint64	giReclaim_TotalPages;
+// - Statistics
+Uint64	giReclaim_Wakeups;
+Uint64	giReclaim_DirectCalls;
+Uint64	giReclaim_DirectFailed;
+ int	giReclaim_FileID = -1;
+char	*gsReclaim_File;
+
+// === CODE ===
+void Reclaim_Register(tReclaim_Shrinker *Shrinker)
+{
+	Mutex_Acquire( &glReclaim_Shrinkers );
+	Shrinker->Next = gReclaim_Shrinkers;
+	gReclaim_Shrinkers = Shrinker;
+	Mutex_Release( &glReclaim_Shrinkers );
+	Log_Debug("Reclaim", "Registered shrinker '%s'", Shrinker->Name);
+	if( giReclaim_FileID != -1 )
+		Reclaim_int_UpdateFile();
+}
+
+void Reclaim_Unregister(tReclaim_Shrinker *Shrinker)
+{
+	tReclaim_Shrinker	*prev = NULL;
+
+	Mutex_Acquire( &glReclaim_Shrinkers );
+	for( tReclaim_Shrinker *s = gReclaim_Shrinkers; s; prev = s, s = s->Next )
+	{
+		if( s != Shrinker )	continue ;
+		if( prev )
+			prev->Next = s->Next;
+		else
+			gReclaim_Shrinkers = s->Next;
+		break;
+	}
+	Mutex_Release( &glReclaim_Shrinkers );
+}
+
+void Reclaim_CheckWatermark(Uint64 FreePages, Uint64 TotalPages)
+{
+	giReclaim_FreePages = FreePages;
+	giReclaim_TotalPages = TotalPages;
+
+	if( FreePages * 1000 >= TotalPages * RECLAIM_LOW_PERMILLE )
+		return ;
+	if( gbReclaim_Pending || !gpReclaim_Thread )
+		return ;
+	gbReclaim_Pending = 1;
+	Threads_PostEvent(gpReclaim_Thread, THREAD_EVENT_SHORTWAIT);
+}
+
+size_t Reclaim_Direct(size_t Pages)
+{
+	size_t	freed;
+
+	if( !gReclaim_Shrinkers )
+		return 0;
+
+	giReclaim_DirectCalls ++;
+	freed = Reclaim_int_Run(Pages, RECLAIM_FLAG_ATOMIC);
+	if( freed < Pages )
+		giReclaim_DirectFailed ++;
+	LOG("%i/%i pages", freed, Pages);
+
+	// Get the background thread started on the rest
+	if( !gbReclaim_Pending && gpReclaim_Thread ) {
+		gbReclaim_Pending = 1;
+		Threads_PostEvent(gpReclaim_Thread, THREAD_EVENT_SHORTWAIT);
+	}
+	return freed;
+}
+
+/**
+ * \brief Background reclaimer, woken by Reclaim_CheckWatermark
+ */
+void Reclaim_WorkerThread(void *Unused)
+{
+	Threads_SetName("Page Reclaimer");
+	gpReclaim_Thread = Proc_GetCurThread();
+	giReclaim_FileID = SysFS_RegisterFile("MM/Reclaim", NULL, 0);
+	Reclaim_int_UpdateFile();
+
+	for( ;; )
+	{
+		Uint64	high, free;
+		size_t	freed = 0;
+
+		Threads_WaitEvents(THREAD_EVENT_SHORTWAIT);
+		giReclaim_Wakeups ++;
+
+		high = giReclaim_TotalPages * RECLAIM_HIGH_PERMILLE / 1000;
+		free = giReclaim_FreePages;
+		if( free < high )
+			freed = Reclaim_int_Run(high - free, 0);
+		LOG("Freed %i pages (%lli free, target %lli)", freed, free, high);
+		if( freed == 0 )
+			Log_Notice("Reclaim", "Memory is low (%lli pages free) and no cache would shrink", free);
+
+		gbReclaim_Pending = 0;
+		Reclaim_int_UpdateFile();
+	}
+}
+
+/**
+ * \brief Ask shrinkers for pages, round robin, until \a Pages are freed
+ *        or a full pass returns nothing
+ */
+static size_t Reclaim_int_Run(size_t Pages, int Flags)
+{
+	size_t	total = 0;
+
+	if( Flags & RECLAIM_FLAG_ATOMIC ) {
+		// Also stops recursion if a shrinker ends up back in the allocator
+		if( Mutex_TryAcquire( &glReclaim_Shrinkers ) )
+			return 0;
+	}
+	else
+		Mutex_Acquire( &glReclaim_Shrinkers );
+
+	while( total < Pages )
+	{
+		size_t	pass = 0;
+		for( tReclaim_Shrinker *s = gReclaim_Shrinkers; s && total < Pages; s = s->Next )
+		{
+			size_t	want = Pages - total, got;
+			if( want > RECLAIM_BATCH )
+				want = RECLAIM_BATCH;
+			got = s->Shrink(s, want, Flags);
+			s->nCalls ++;
+			s->nReclaimed += got;
+			pass += got;
+			total += got;
+		}
+		if( pass == 0 )
+			break;
+	}
+
+	Mutex_Release( &glReclaim_Shrinkers );
+	return total;
+}
+
+/**
+ * \brief Regenerate /Devices/system/MM/Reclaim
+ * \note Uses the heap, so never called from Reclaim_Direct
+ */
+static void Reclaim_int_UpdateFile(void)
+{
+	 int	len = 0, space = 128;
+	char	*buf;
+
+	Mutex_Acquire( &glReclaim_Shrinkers );
+	for( tReclaim_Shrinker *s = gReclaim_Shrinkers; s; s = s->Next )
+		space += strlen(s->Name) + 2*21 + 3;
+	buf = malloc( space );
+	if( !buf ) {
+		Mutex_Release( &glReclaim_Shrinkers );
+		return ;
+	}
+
+	// Format:
+	// free\t<pages>\nwakeups\t<count>\ndirect\t<calls>\t<short calls>\n
+	// Then one line per shrinker, <name>\t<calls>\t<pages reclaimed>\n
+	len += snprintf(buf+len, space-len, "free\t%lli\nwakeups\t%lli\n",
+		giReclaim_FreePages, giReclaim_Wakeups);
+	len += snprintf(buf+len, space-len, "direct\t%lli\t%lli\n",
+		giReclaim_DirectCalls, giReclaim_DirectFailed);
+	for( tReclaim_Shrinker *s = gReclaim_Shrinkers; s; s = s->Next )
+		len += snprintf(buf+len, space-len, "%s\t%lli\t%lli\n", s->Name, s->nCalls, s->nReclaimed);
+
+	SysFS_UpdateFile( giReclaim_FileID, buf, len );
+	if( gsReclaim_File )	free( gsReclaim_File );
+	gsReclaim_File = buf;
+	Mutex_Release( &glReclaim_Shrinkers );
+}
@@ -11,6 +11,10 @@
 #include <rwlock.h>
 
 // === PROTOTYPES ===
+static int	PCPURWLock_int_Slot(void);
+static int	PCPURWLock_int_ReaderCount(tPCPURWLock *Lock);
+
+// === CODE ===
 //
 // Acquire as a reader (see rwlock.h for documentation)
 //
@@ -135,7 +139,79 @@ void RWLock_Release(tRWLock *Lock)
 	SHORTREL( &Lock->Protector );
 }
 
+// --------------------------------------------------------------------
+// Reader-scaled locks
+// --------------------------------------------------------------------
+static int PCPURWLock_int_Slot(void)
+{
+	 int	cpu = Proc_GetCurThread()->CurCPU;
+	return (cpu < 0 ? 0 : cpu % PCPURWLOCK_SLOTS);
+}
+
+static int PCPURWLock_int_ReaderCount(tPCPURWLock *Lock)
+{
+	 int	total = 0;
+	// Counters can go negative (reader migrated CPUs), only the sum matters
+	for( int i = 0; i < PCPURWLOCK_SLOTS; i ++ )
+		total += Lock->Readers[i].Count;
+	return total;
+}
+
+int PCPURWLock_AcquireRead(tPCPURWLock *Lock)
+{
+	LOG("Acquire PCPURWLock Read %p", Lock);
+	for( ;; )
+	{
+		 int	slot = PCPURWLock_int_Slot();
+		__sync_fetch_and_add( &Lock->Readers[slot].Count, 1 );
+		// Pairs with the barrier after the writer sets Owner
+		__sync_synchronize();
+		if( !Lock->Owner )
+			break;
+		
+		// A writer is active (or draining readers), back off and sleep until it's done
+		__sync_fetch_and_sub( &Lock->Readers[slot].Count, 1 );
+		LOG("Waiting for writer %p", Lock->Owner);
+		Mutex_Acquire( &Lock->WriterLock );
+		Mutex_Release( &Lock->WriterLock );
+	}
+	LOG("Obtained");
+	return 0;
+}
+
+int PCPURWLock_AcquireWrite(tPCPURWLock *Lock)
+{
+	LOG("Acquire PCPURWLock Write %p", Lock);
+	Mutex_Acquire( &Lock->WriterLock );
+	Lock->Owner = Proc_GetCurThread();
+	__sync_synchronize();
+	
+	// New readers now back off, wait for the existing ones to leave
+	while( PCPURWLock_int_ReaderCount(Lock) != 0 )
+		Threads_Yield();
+	LOG("Obtained");
+	return 0;
+}
+
+void PCPURWLock_Release(tPCPURWLock *Lock)
+{
+	LOG("Release PCPURWLock %p", Lock);
+	if( Lock->Owner == Proc_GetCurThread() )
+	{
+		Lock->Owner = NULL;
+		__sync_synchronize();
+		Mutex_Release( &Lock->WriterLock );
+	}
+	else
+	{
+		__sync_fetch_and_sub( &Lock->Readers[PCPURWLock_int_Slot()].Count, 1 );
+	}
+}
+
 // === EXPORTS ===
 EXPORT(RWLock_AcquireRead);
 EXPORT(RWLock_AcquireWrite);
 EXPORT(RWLock_Release);
+EXPORT(PCPURWLock_AcquireRead);
+EXPORT(PCPURWLock_AcquireWrite);
+EXPORT(PCPURWLock_Release);
@@ -11,6 +11,9 @@
 #include <errno.h>
 #include <threads.h>
 #include <events.h>
+#include <futex.h>
+#include <trace.h>
+#include <vfs_threads.h>
 
 #if 1
 # define MERR(f,v...) Log_Debug("Syscalls", "0x%x "f, callNum ,## v)
@@ -37,14 +40,44 @@
 	if(tmp[i]) break;\
 } while(0)
 
+// Argument descriptors, see the "| ..." suffixes in syscalls.lst
+enum eSyscallArgTypes
+{
+	SARGT_END,	// No more checked arguments
+	SARGT_INT,	// Unchecked
+	SARGT_STR,	// String
+	SARGT_STR0,	// String or NULL
+	SARGT_BUF,	// Buffer sized by argument (param, 1-based)
+	SARGT_BUF0,	// As above, or NULL
+	SARGT_PTR,	// Object of (param) bytes
+	SARGT_PTR0	// As above, or NULL
+};
+#define SARG_INT	SARGT_INT
+#define SARG_STR	SARGT_STR
+#define SARG_STR0	SARGT_STR0
+#define SARG_BUF(n)	(SARGT_BUF|((n)<<8))
+#define SARG_BUF0(n)	(SARGT_BUF0|((n)<<8))
+#define SARG_PTR(size)	(SARGT_PTR|((size)<<8))
+#define SARG_PTR0(size)	(SARGT_PTR0|((size)<<8))
+typedef Uint32	tSyscallArgs[6];
+
+#include <syscalls_args.h>
+
 // === IMPORTS ===
 extern Uint	Binary_Load(const char *file, Uint *entryPoint);
 
 // === PROTOTYPES ===
 void	SyscallHandler(tSyscallRegs *Regs);
+ int	Syscall_int_CheckArgs(int CallNum, const tSyscallRegs *Regs);
  int	Syscall_ValidString(const char *Addr);
- int	Syscall_Valid(int Size, const void *Addr);
+ int	Syscall_Valid(size_t Size, const void *Addr);
+ int	Syscall_ValidIOVec(const tVFS_IOVec *Vecs, int Count);
  int	Syscall_MM_SetFlags(const void *Addr, Uint Flags, Uint Mask);
+size_t	Syscall_GenStatsFile(char *Buffer, size_t Length);
+
+// === GLOBALS ===
+Uint32	gaSyscall_Counts[NUM_SYSCALLS];
+Uint32	gaSyscall_Errors[NUM_SYSCALLS];
 
 // === CODE ===
 // TODO: Do sanity checking on arguments, ATM the user can really fuck with the kernel
@@ -65,6 +98,21 @@ void SyscallHandler(tSyscallRegs *Regs)
 	}
 	#endif
 	
+	TRACE_POINT2(TRACE_EV_SYSCALL_ENTER, callNum, Regs->Arg1);
+	
+	if( callNum < NUM_SYSCALLS )
+	{
+		__atomic_add_fetch(&gaSyscall_Counts[callNum], 1, __ATOMIC_RELAXED);
+		// Pointer arguments described in syscalls.lst
+		 int	bad = Syscall_int_CheckArgs(callNum, Regs);
+		if( bad ) {
+			MERR("Argument %i invalid", bad);
+			ret = -1;
+			err = -EINVAL;
+			goto _return;
+		}
+	}
+	
 	switch(Regs->Num)
 	{
 	// -- Exit the current thread
@@ -99,10 +147,28 @@ void SyscallHandler(tSyscallRegs *Regs)
 		ret = Threads_WaitEvents(Regs->Arg1);
 		break;
 
+	// -- Wait/wake on a user address
+	case SYS_FUTEX:
+		switch(Regs->Arg2)
+		{
+		case FUTEX_WAIT:
+			CHECK_NUM_NULLOK( (tTime*)Regs->Arg4, sizeof(tTime) );
+			// *Address, Value, *Timeout
+			ret = Futex_Wait( (Uint32*)Regs->Arg1, Regs->Arg3, (tTime*)Regs->Arg4 );
+			break;
+		case FUTEX_WAKE:
+			// *Address, Count
+			ret = Futex_Wake( (Uint32*)Regs->Arg1, Regs->Arg3 );
+			break;
+		default:
+			err = -EINVAL;
+			ret = -1;
+			break;
+		}
+		break;
+
 	// -- Wait for a thread
 	case SYS_WAITTID:
-		// Sanity Check (Status can be NULL)
-		CHECK_NUM_NULLOK( (int*)Regs->Arg2, sizeof(int) );
 		// TID, *Status
 		ret = Threads_WaitTID(Regs->Arg1, (int*)Regs->Arg2);
 		break;
@@ -121,11 +187,44 @@ void SyscallHandler(tSyscallRegs *Regs)
 	// -- Unmap an address
 	case SYS_UNMAP:		MM_Deallocate(Regs->Arg1);	break;
 	
+	// -- Limit the process's resident memory (bytes, 0 = none)
+	case SYS_SETMEMLIMIT:
+		ret = Threads_SetMemLimit(Regs->Arg1);
+		break;
+	
 	// -- Change the protection on an address
 	case SYS_SETFLAGS:
 		ret = Syscall_MM_SetFlags((void*)Regs->Arg1, Regs->Arg2, Regs->Arg3);
 		break;
 
+	// -- Map memory (anonymous or from a file)
+	case SYS_MMAP:
+		// Address, Length, Protection|(Flags<<16), FD, Offset (returns NULL on error)
+		// - No address space allocator yet, so the (page aligned) address is required
+		if( !Regs->Arg1 || (Regs->Arg1 & (PAGE_SIZE-1)) || !Regs->Arg2
+		 || Regs->Arg1 >= USER_MAX || USER_MAX - Regs->Arg1 < Regs->Arg2 )
+		{
+			err = -EINVAL;
+			ret = -1;
+			break;
+		}
+		#if BITS == 64
+		ret = (Uint)VFS_MMap( (void*)Regs->Arg1, Regs->Arg2, Regs->Arg3 & 0xFFFF, Regs->Arg3 >> 16,
+			Regs->Arg4, Regs->Arg5 );
+		#else
+		ret = (Uint)VFS_MMap( (void*)Regs->Arg1, Regs->Arg2, Regs->Arg3 & 0xFFFF, Regs->Arg3 >> 16,
+			Regs->Arg4, Regs->Arg5|(((Uint64)Regs->Arg6)<<32) );
+		#endif
+		break;
+	case SYS_MUNMAP:
+		if( Regs->Arg1 >= USER_MAX || USER_MAX - Regs->Arg1 < Regs->Arg2 ) {
+			err = -EINVAL;
+			ret = -1;
+			break;
+		}
+		ret = VFS_MUnmap( (void*)Regs->Arg1, Regs->Arg2 );
+		break;
+
 	// -- Get Thread/Process IDs
 	case SYS_GETTID:	ret = Threads_GetTID();	break;
 	case SYS_GETPID:	ret = Threads_GetPID();	break;
@@ -140,10 +239,13 @@ void SyscallHandler(tSyscallRegs *Regs)
 	
 	// -- Send Message
 	case SYS_SENDMSG:
-		CHECK_NUM_NONULL( (void*)Regs->Arg3, Regs->Arg2 );
 		// Destination, Size, *Data
 		ret = Proc_SendMessage(Regs->Arg1, Regs->Arg2, (void*)Regs->Arg3);
 		break;
+	case SYS_SENDMSGEX:
+		// Destination, Size, *Data, Flags
+		ret = Proc_SendMessageEx(Regs->Arg1, Regs->Arg2, (void*)Regs->Arg3, Regs->Arg4);
+		break;
 	// -- Check for messages
 	case SYS_GETMSG:
 		CHECK_NUM_NULLOK( (Uint*)Regs->Arg1, sizeof(Uint) );
@@ -160,7 +262,6 @@ void SyscallHandler(tSyscallRegs *Regs)
 	
 	// -- Set the thread's name
 	case SYS_SETNAME:
-		CHECK_STR_NONULL( (char*) Regs->Arg1);
 		Threads_SetName( (char*)Regs->Arg1 );
 		break;
 	
@@ -169,7 +270,6 @@ void SyscallHandler(tSyscallRegs *Regs)
 	// ---
 	// -- Create a new process
 	case SYS_SPAWN:
-		CHECK_STR_NONULL((const char*)Regs->Arg1);
 		CHECK_STR_ARRAY((const char**)Regs->Arg2);
 		CHECK_STR_ARRAY((const char**)Regs->Arg3);
 		if( Regs->Arg4 > 0 )
@@ -181,7 +281,6 @@ void SyscallHandler(tSyscallRegs *Regs)
 		break;
 	// -- Replace the current process with another
 	case SYS_EXECVE:
-		CHECK_STR_NONULL((char*)Regs->Arg1);
 		CHECK_STR_ARRAY( (char**)Regs->Arg2 );
 		if( Regs->Arg3 )
 			CHECK_STR_ARRAY( (char**)Regs->Arg3 );
@@ -194,8 +293,6 @@ void SyscallHandler(tSyscallRegs *Regs)
 		break;
 	// -- Load a binary into the current process
 	case SYS_LOADBIN:
-		CHECK_STR_NONULL( (char*)Regs->Arg1 );
-		CHECK_NUM_NONULL( (Uint*)Regs->Arg2, sizeof(Uint) );
 		// Path, *Entrypoint
 		ret = Binary_Load((char*)Regs->Arg1, (Uint*)Regs->Arg2);
 		break;
@@ -204,12 +301,10 @@ void SyscallHandler(tSyscallRegs *Regs)
 	// Virtual Filesystem
 	// ---
 	case SYS_OPEN:
-		CHECK_STR_NONULL( (char*)Regs->Arg1 );
 		LOG("VFS_Open(\"%s\", 0x%x)", (char*)Regs->Arg1, Regs->Arg2 | VFS_OPENFLAG_USER);
 		ret = VFS_Open((char*)Regs->Arg1, Regs->Arg2 | VFS_OPENFLAG_USER);
 		break;
 	case SYS_REOPEN:
-		CHECK_STR_NONULL( (char*)Regs->Arg2 );
 		LOG("VFS_Reopen(%i, \"%s\", 0x%x)", Regs->Arg1, (char*)Regs->Arg2, Regs->Arg3 | VFS_OPENFLAG_USER);
 		ret = VFS_Reopen(Regs->Arg1, (char*)Regs->Arg2, Regs->Arg3 | VFS_OPENFLAG_USER);
 		break;
@@ -242,15 +337,36 @@ void SyscallHandler(tSyscallRegs *Regs)
 		break;
 	
 	case SYS_WRITE:
-		CHECK_NUM_NONULL( (void*)Regs->Arg2, Regs->Arg3 );
 		ret = VFS_Write( Regs->Arg1, Regs->Arg3, (void*)Regs->Arg2 );
 		break;
 	
 	case SYS_READ:
-		CHECK_NUM_NONULL( (void*)Regs->Arg2, Regs->Arg3 );
 		ret = VFS_Read( Regs->Arg1, Regs->Arg3, (void*)Regs->Arg2 );
 		break;
 	
+	case SYS_READV:
+	case SYS_WRITEV: {
+		// FD, Vectors, Count
+		// - The vector array is copied in, so it can't change after being checked
+		tVFS_IOVec	vecs[VFS_IOV_MAX];
+		if( Regs->Arg3 > VFS_IOV_MAX ) {
+			err = -EINVAL;
+			ret = -1;
+			break;
+		}
+		CHECK_NUM_NONULL( (void*)Regs->Arg2, Regs->Arg3*sizeof(tVFS_IOVec) );
+		memcpy(vecs, (void*)Regs->Arg2, Regs->Arg3*sizeof(tVFS_IOVec));
+		if( !Syscall_ValidIOVec(vecs, Regs->Arg3) ) {
+			err = -EINVAL;
+			ret = -1;
+			break;
+		}
+		if( callNum == SYS_READV )
+			ret = VFS_ReadV( Regs->Arg1, vecs, Regs->Arg3 );
+		else
+			ret = VFS_WriteV( Regs->Arg1, vecs, Regs->Arg3 );
+		break; }
+	
 	case SYS_FINFO:
 		CHECK_NUM_NONULL( (void*)Regs->Arg2, sizeof(tFInfo) + Regs->Arg3*sizeof(tVFS_ACL) );
 		// FP, Dest, MaxACLs
@@ -259,34 +375,30 @@ void SyscallHandler(tSyscallRegs *Regs)
 	
 	// Get ACL Value
 	case SYS_GETACL:
-		CHECK_NUM_NONULL( (void*)Regs->Arg2, sizeof(tVFS_ACL) );
 		ret = VFS_GetACL( Regs->Arg1, (void*)Regs->Arg2 );
 		break;
 	
 	// Read Directory
 	case SYS_READDIR:
 		// TODO: What if the filename is longer?
-		// Maybe force it to be a 256 byte buffer
-		CHECK_NUM_NONULL( (void*)Regs->Arg2, 256 );
+		// - syscalls.lst forces a 256 byte buffer
 		ret = VFS_ReadDir( Regs->Arg1, (void*)Regs->Arg2 );
 		break;
 	
 	// Open a file that is a entry in an open directory
 	case SYS_OPENCHILD:
-		CHECK_STR_NONULL( (char*)Regs->Arg2 );
 		ret = VFS_OpenChild( Regs->Arg1, (char*)Regs->Arg2, Regs->Arg3 | VFS_OPENFLAG_USER);
 		break;
 	
 	// Change Directory
 	case SYS_CHDIR:
-		CHECK_STR_NONULL( (const char*)Regs->Arg1 );
 		ret = VFS_ChDir( (const char*)Regs->Arg1 );
 		break;
 	
 	// IO Control
 	case SYS_IOCTL:
 		// All sanity checking should be done by the driver
-		if( Regs->Arg3 && !MM_IsUser(Regs->Arg3) ) {
+		if( Regs->Arg3 && (Regs->Arg3 >= USER_MAX || !MM_IsUser(Regs->Arg3)) ) {
 			MERR("IOCtl Invalid arg %p", Regs->Arg3);
 			err = -EINVAL;	ret = -1;	break;
 		}
@@ -330,17 +442,7 @@ void SyscallHandler(tSyscallRegs *Regs)
 		
 	// Wait on a set of handles
 	case SYS_SELECT:
-		// Sanity checks
-		if( (Regs->Arg2 && !Syscall_Valid(sizeof(fd_set), (void*)Regs->Arg2))
-		 || (Regs->Arg3 && !Syscall_Valid(sizeof(fd_set), (void*)Regs->Arg3))
-		 || (Regs->Arg4 && !Syscall_Valid(sizeof(fd_set), (void*)Regs->Arg4))
-		 || (Regs->Arg5 && !Syscall_Valid(sizeof(tTime), (void*)Regs->Arg5)) )
-		{
-			err = -EINVAL;
-			ret = -1;
-			break;
-		}
-		// Perform the call
+		// (Sets and timeout checked by syscalls.lst)
 		ret = VFS_Select(
 			Regs->Arg1,	// Max handle
 			(fd_set *)Regs->Arg2,	// Read
@@ -355,7 +457,6 @@ void SyscallHandler(tSyscallRegs *Regs)
 	
 	// Create a directory
 	case SYS_MKDIR:
-		CHECK_STR_NONULL( (char*)Regs->Arg1 );
 		ret = VFS_MkDir( (char*)Regs->Arg1 );
 		break;
 	
@@ -385,10 +486,15 @@ void SyscallHandler(tSyscallRegs *Regs)
 
 	if(err == 0)	err = errno;
 	
+_return:
 	if(err != 0) {
 		LOG("ID: %i, Return errno = %i", Regs->Num, err);
+		if( callNum < NUM_SYSCALLS )
+			__atomic_add_fetch(&gaSyscall_Errors[callNum], 1, __ATOMIC_RELAXED);
 	}
 	
+	TRACE_POINT3(TRACE_EV_SYSCALL_EXIT, callNum, ret, err);
+	
 	#if BITS < 64
 	Regs->Return = ret&0xFFFFFFFF;
 	Regs->RetHi = ret >> 32;
@@ -411,35 +517,127 @@ void SyscallHandler(tSyscallRegs *Regs)
 	#endif
 }
 
+/**
+ * \brief Check the arguments described by caSyscallArgs
+ * \return Index (1-based) of the first bad argument, or 0 if all are valid
+ */
+int Syscall_int_CheckArgs(int CallNum, const tSyscallRegs *Regs)
+{
+	const Uint32	*desc = caSyscallArgs[CallNum];
+	const Uint	args[6] = {Regs->Arg1, Regs->Arg2, Regs->Arg3, Regs->Arg4, Regs->Arg5, Regs->Arg6};
+	
+	for( int i = 0; i < 6 && desc[i] != SARGT_END; i ++ )
+	{
+		const void	*ptr = (const void*)args[i];
+		Uint	param = desc[i] >> 8;
+		switch( desc[i] & 0xFF )
+		{
+		case SARGT_INT:
+			break;
+		case SARGT_STR0:
+			if( !ptr )	break;
+			/* fall through */
+		case SARGT_STR:
+			if( !ptr || !Syscall_ValidString(ptr) )
+				return i + 1;
+			break;
+		case SARGT_BUF0:
+			if( !ptr )	break;
+			/* fall through */
+		case SARGT_BUF:
+			if( !ptr || !Syscall_Valid(args[param-1], ptr) )
+				return i + 1;
+			break;
+		case SARGT_PTR0:
+			if( !ptr )	break;
+			/* fall through */
+		case SARGT_PTR:
+			if( !ptr || !Syscall_Valid(param, ptr) )
+				return i + 1;
+			break;
+		}
+	}
+	return 0;
+}
+
 /**
  * \fn int Syscall_ValidString(const char *Addr)
  * \brief Checks if a memory address contains a valid string
+ * \note Not everything below USER_MAX is user memory (e.g. per-process data
+ *       on x86), so each page's user flag is checked once it is present
  */
 int Syscall_ValidString(const char *Addr)
 {
-	// Check if the memory is user memory
-	if(!MM_IsUser( (tVAddr) Addr))	return 0;
+	tVAddr	addr = (tVAddr)Addr;
 	
-	return CheckString( Addr );
+	for( ;; )
+	{
+		if( addr >= USER_MAX )
+			return 0;
+		// One lookup per page, faulting in deferred mmap pages
+		if( !MM_GetPhysAddr( (void*)addr ) && VFS_MMap_PageFault(addr, 0) )
+			return 0;
+		if( !MM_IsUser(addr) )
+			return 0;
+		do {
+			if( *(const char*)addr == '\0' )
+				return 1;
+			addr ++;
+		} while( addr & (PAGE_SIZE-1) );
+	}
 }
 
 /**
- * \fn int Syscall_Valid(int Size, const void *Addr)
+ * \fn int Syscall_Valid(size_t Size, const void *Addr)
  * \brief Checks if a memory address is valid
  */
-int Syscall_Valid(int Size, const void *Addr)
+int Syscall_Valid(size_t Size, const void *Addr)
 {
-	if(!MM_IsUser( (tVAddr)Addr )) {
-		Log_Debug("Syscalls", "Syscall_Valid - %p not user", Addr);
+	tVAddr	addr = (tVAddr)Addr;
+	// Range check first, CheckMem only has to confirm the pages are there
+	// - CheckMem takes an int, so anything larger is refused here
+	if( addr >= USER_MAX || Size > USER_MAX - addr || Size > 0x7FFFFFFF ) {
+		Log_Debug("Syscalls", "Syscall_Valid - %p+%x not user", Addr, Size);
 		return 0;
 	}
 	
-	return CheckMem( Addr, Size );
+	if( !CheckMem( Addr, Size ) )
+		return 0;
+	
+	// CheckMem only confirms presence, supervisor pages can sit below USER_MAX
+	for( tVAddr page = addr & ~(PAGE_SIZE-1); page < addr + Size; page += PAGE_SIZE )
+	{
+		if( !MM_IsUser(page) ) {
+			Log_Debug("Syscalls", "Syscall_Valid - %p not user", page);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * \brief Check that every buffer in a (kernel copy of a) vector is user memory
+ */
+int Syscall_ValidIOVec(const tVFS_IOVec *Vecs, int Count)
+{
+	for( int i = 0; i < Count; i ++ )
+	{
+		if( Vecs[i].Length == 0 )
+			continue ;
+		if( !Vecs[i].Base || !Syscall_Valid(Vecs[i].Length, Vecs[i].Base) )
+			return 0;
+	}
+	return 1;
 }
 
 int Syscall_MM_SetFlags(const void *Addr, Uint Flags, Uint Mask)
 {
-	tPAddr	paddr = MM_GetPhysAddr(Addr);
+	tPAddr	paddr;
+
+	// Fault in deferred file pages so the flags stick
+	if( !MM_GetPhysAddr(Addr) && MM_IsUser((tVAddr)Addr) )
+		VFS_MMap_PageFault( (tVAddr)Addr, 0 );
+	paddr = MM_GetPhysAddr(Addr);
 	Flags &= MM_PFLAG_RO|MM_PFLAG_EXEC;
 	Mask &= MM_PFLAG_RO|MM_PFLAG_EXEC;
 
@@ -457,3 +655,28 @@ int Syscall_MM_SetFlags(const void *Addr, Uint Flags, Uint Mask)
 	MM_SetFlags((tVAddr)Addr, Flags, Mask);
 	return 0;
 }
+
+/**
+ * \brief Generate /Devices/system/Syscalls (call and error counts of each syscall used)
+ */
+size_t Syscall_GenStatsFile(char *Buffer, size_t Length)
+{
+	size_t	len = 0;
+	#define ADD(...)	do { \
+		 int	_n = snprintf(len < Length ? Buffer + len : NULL, len < Length ? Length - len : 0, __VA_ARGS__); \
+		if( _n > 0 )	len += _n; \
+	} while(0)
+	
+	ADD("Name\tCalls\tErrors\n");
+	for( int i = 0; i < NUM_SYSCALLS; i ++ )
+	{
+		Uint32	count = __atomic_load_n(&gaSyscall_Counts[i], __ATOMIC_RELAXED);
+		if( count == 0 )
+			continue ;
+		ADD("%s\t%u\t%u\n", cSYSCALL_NAMES[i], count,
+			__atomic_load_n(&gaSyscall_Errors[i], __ATOMIC_RELAXED));
+	}
+	
+	#undef ADD
+	return len;
+}
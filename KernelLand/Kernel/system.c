@@ -7,6 +7,7 @@
 #define DEBUG	1
 #include <acess.h>
 #include <hal_proc.h>
+#include <fs_sysfs.h>
 
 // === IMPORTS ===
 extern void	Arch_LoadBootModules(void);
@@ -14,6 +15,11 @@ extern int	Modules_LoadBuiltins(void);
 extern void	Modules_SetBuiltinParams(char *Name, char *ArgString);
 extern void	Debug_SetKTerminal(const char *File);
 extern void	Timer_CallbackThread(void *);
+extern void	Reclaim_WorkerThread(void *);
+extern size_t	Threads_GenProcessFile(char *Buffer, size_t Length);
+extern size_t	Syscall_GenStatsFile(char *Buffer, size_t Length);
+extern size_t	Log_GenHistoryFile(char *Buffer, size_t Length);
+extern size_t	Binary_GenStatsFile(char *Buffer, size_t Length);
 
 // === PROTOTYPES ===
 void	System_Init(char *Commandline);
@@ -32,6 +38,11 @@ char	*argv[32];
 void System_Init(char *CommandLine)
 {
 	Proc_SpawnWorker(Timer_CallbackThread, NULL);
+	Proc_SpawnWorker(Reclaim_WorkerThread, NULL);
+	SysFS_RegisterGenFile("Processes", Threads_GenProcessFile);
+	SysFS_RegisterGenFile("Syscalls", Syscall_GenStatsFile);
+	SysFS_RegisterGenFile("Log", Log_GenHistoryFile);
+	SysFS_RegisterGenFile("Binaries", Binary_GenStatsFile);
 
 	// Parse Kernel's Command Line
 	System_ParseCommandLine(CommandLine);
@@ -78,6 +78,9 @@ tGID	Threads_GetGID(void);
  int	Threads_SetUID(Uint *Errno, tUID ID);
  int	Threads_SetGID(Uint *Errno, tUID ID);
 #endif
+static void	Threads_int_FreeProcess(tProcess *Process);
+static void	Threads_int_DerefProcess(tProcess *Process);
+size_t	Threads_GenProcessFile(char *Buffer, size_t Length);
 void	Threads_int_DumpThread(tThread *thread);
 void	Threads_Dump(void);
 void	Threads_DumpActive(void);
@@ -147,40 +150,46 @@ void Threads_Delete(tThread *Thread)
 	// Clear out process state
 	Proc_ClearThread(Thread);			
 
-	Thread->Process->nThreads --;
-
-	if( Thread->Process->FirstThread == Thread )
+	tProcess	*proc = Thread->Process;
+	 int	bLast, bListed = 1;
+	SHORTLOCK( &glThreadListLock );
+	proc->nThreads --;
+	bLast = (proc->nThreads == 0);
+	if( proc->FirstThread == Thread )
 	{
-		Thread->Process->FirstThread = Thread->ProcessNext;
+		proc->FirstThread = Thread->ProcessNext;
 	}
 	else
 	{
-		tThread	*prev = Thread->Process->FirstThread;
+		tThread	*prev = proc->FirstThread;
 		while(prev && prev->ProcessNext != Thread)
 			prev = prev->ProcessNext;
 		if( !prev )
-			Log_Error("Threads", "Thread %p(%i %s) is not on the process's list",
-				Thread, Thread->TID, Thread->ThreadName
-				);
+			bListed = 0;
 		else
 			prev->ProcessNext = Thread->ProcessNext;
 	}
+	SHORTREL( &glThreadListLock );
+	if( !bListed )
+		Log_Error("Threads", "Thread %p(%i %s) is not on the process's list",
+			Thread, Thread->TID, Thread->ThreadName
+			);
 
 	// If the final thread is being terminated, clean up the process
-	if( Thread->Process->nThreads == 0 )
+	if( bLast )
 	{
-		tProcess	*proc = Thread->Process;
+		 int	bFree;
 		// VFS Cleanup
 		VFS_CloseAllUserHandles();
-		// Architecture cleanup
-		Proc_ClearProcess( proc );
-		// VFS Configuration strings
-		if( proc->CurrentWorkingDir)
-			free( proc->CurrentWorkingDir );
-		if( proc->RootDir )
-			free( proc->RootDir );
-		// Process descriptor
-		free( proc );
+		VFS_MMap_ClearAreas( proc );
+		// The address space and descriptor outlive any other references,
+		// the last of which frees them if it is dropped after this
+		SHORTLOCK( &glThreadListLock );
+		proc->bExited = 1;
+		bFree = (proc->ReferenceCount == 0);
+		SHORTREL( &glThreadListLock );
+		if( bFree )
+			Threads_int_FreeProcess( proc );
 	}
 	
 	// Free name
@@ -349,6 +358,17 @@ tThread *Threads_CloneTCB(Uint Flags)
 		newproc->nThreads = 1;
 		// Reference all handles in the VFS
 		VFS_ReferenceUserHandles();
+		// Copy deferred file mappings (the pages themselves are cloned by the MM)
+		memset( &newproc->MMapLock, 0, sizeof(newproc->MMapLock) );
+		VFS_MMap_CloneAreas(newproc);
+		// The MM clones the user pages (unless CLONE_NOUSER), limits are inherited
+		newproc->nResidentPages = (Flags & CLONE_NOUSER) ? 0 : oldproc->nResidentPages;
+		newproc->nPeakResidentPages = newproc->nResidentPages;
+		newproc->MaxResidentPages = oldproc->MaxResidentPages;
+		newproc->nLimitHits = 0;
+		newproc->nCOWCopies = 0;
+		newproc->ReferenceCount = 0;
+		newproc->bExited = 0;
 
 		newproc->FirstThread = new;
 		new->ProcessNext = NULL;
@@ -362,8 +382,8 @@ tThread *Threads_CloneTCB(Uint Flags)
 	}
 	
 	// Messages are not inherited
-	new->Messages = NULL;
-	new->LastMessage = NULL;
+	new->MsgQueue = NULL;
+	new->MsgSendWait = NULL;
 	
 	// Set State
 	new->Remaining = new->Quantum = cur->Quantum;
@@ -415,8 +435,8 @@ tThread *Threads_CloneThreadZero(void)
 	new->ThreadName = NULL;
 	
 	// Messages are not inherited
-	new->Messages = NULL;
-	new->LastMessage = NULL;
+	new->MsgQueue = NULL;
+	new->MsgSendWait = NULL;
 	
 	// Set State
 	new->Remaining = new->Quantum = DEFAULT_QUANTUM;
@@ -591,7 +611,6 @@ void Threads_Exit(int TID, int Status)
  */
 void Threads_Kill(tThread *Thread, int Status)
 {
-	tMsg	*msg;
 	 int	isCurThread = Thread == Proc_GetCurThread();
 	
 	// TODO: Disown all children?
@@ -609,18 +628,16 @@ void Threads_Kill(tThread *Thread, int Status)
 	}
 	#endif
 	
+	// Leave any queue we are blocked sending to (the waiter is on our stack)
+	Proc_int_CancelSend( Thread );
+	
 	///\note Double lock is needed due to overlap of lock areas
 	
 	// Lock thread (stop us recieving messages)
 	SHORTLOCK( &Thread->IsLocked );
 	
 	// Clear Message Queue
-	while( Thread->Messages )
-	{
-		msg = Thread->Messages->Next;
-		free( Thread->Messages );
-		Thread->Messages = msg;
-	}
+	Proc_int_ClearMessages( Thread );
 	
 	// Lock thread list
 	SHORTLOCK( &glThreadListLock );
@@ -744,7 +761,7 @@ void Threads_Sleep(void)
 	SHORTLOCK( &glThreadListLock );
 	
 	// Don't sleep if there is a message waiting
-	if( cur->Messages ) {
+	if( Proc_int_HasMessages(cur) ) {
 		SHORTREL( &glThreadListLock );
 		return;
 	}
@@ -1110,6 +1127,176 @@ int Threads_SetGID(tGID ID)
 	return 0;
 }
 
+// --- Memory accounting ---
+/**
+ * \brief Check if the current process may map \a Pages more user pages
+ * \return Boolean failure (the process's memory limit would be exceeded)
+ * \note Called by the MM before allocating user memory
+ */
+int Threads_CheckMemLimit(int Pages)
+{
+	tThread	*cur = Proc_GetCurThread();
+	tProcess	*proc;
+	
+	if( !cur || !(proc = cur->Process) || !proc->MaxResidentPages )
+		return 0;
+	if( proc->nResidentPages + Pages <= proc->MaxResidentPages )
+		return 0;
+	
+	// Only log the first refusal, a runaway process will keep trying
+	if( proc->nLimitHits ++ == 0 )
+		Log_Notice("Threads", "PID %i hit its memory limit (%i pages)",
+			proc->PID, proc->MaxResidentPages);
+	errno = -ENOMEM;
+	return 1;
+}
+
+/**
+ * \brief Adjust the current process's resident page count
+ * \param Delta	Number of user pages mapped (negative for unmapped)
+ */
+void Threads_AccountPages(int Delta)
+{
+	tThread	*cur = Proc_GetCurThread();
+	tProcess	*proc;
+	 int	new;
+	
+	if( !cur || !(proc = cur->Process) )
+		return ;
+	new = __sync_add_and_fetch( &proc->nResidentPages, Delta );
+	if( new > proc->nPeakResidentPages )
+		proc->nPeakResidentPages = new;
+}
+
+/**
+ * \brief Set the current process's memory limit
+ * \param Bytes	Maximum resident user memory (rounded up to pages), 0 for none
+ * \note Only root may raise or remove an existing limit
+ */
+int Threads_SetMemLimit(Uint64 Bytes)
+{
+	tProcess	*proc = Proc_GetCurThread()->Process;
+	Uint64	pages = (Bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+	
+	if( pages > 0x7FFFFFFF ) {
+		errno = -EINVAL;
+		return -1;
+	}
+	if( proc->UID != 0 && proc->MaxResidentPages && (pages == 0 || pages > (Uint64)proc->MaxResidentPages) ) {
+		errno = -EACCES;
+		return -1;
+	}
+	Log_Debug("Threads", "PID %i's memory limit set to %i pages", proc->PID, (int)pages);
+	proc->MaxResidentPages = pages;
+	return 0;
+}
+
+/**
+ * \brief Release a process's address space and descriptor
+ * \note Called once it has no threads and no other references
+ */
+static void Threads_int_FreeProcess(tProcess *Process)
+{
+	// Architecture cleanup
+	Proc_ClearProcess( Process );
+	// VFS Configuration strings
+	if( Process->CurrentWorkingDir)
+		free( Process->CurrentWorkingDir );
+	if( Process->RootDir )
+		free( Process->RootDir );
+	// Process descriptor
+	free( Process );
+}
+
+/**
+ * \brief Drop a reference taken under glThreadListLock
+ */
+static void Threads_int_DerefProcess(tProcess *Process)
+{
+	 int	bFree;
+	SHORTLOCK( &glThreadListLock );
+	bFree = (--Process->ReferenceCount == 0 && Process->bExited);
+	SHORTREL( &glThreadListLock );
+	if( bFree )
+		Threads_int_FreeProcess( Process );
+}
+
+/**
+ * \brief Generate /Devices/system/Processes (see SysFS_RegisterGenFile)
+ * 
+ * One line per process (sizes in pages):
+ * <pid>\t<resident>\t<peak>\t<shared>\t<private>\t<limit>\t<limit hits>\t<cow copies>\t<name>\n
+ * - shared: also referenced by another address space, the page cache or the zero page
+ * \note The processes are collected (and referenced) under glThreadListLock,
+ *       and their page tables walked after it is released
+ */
+size_t Threads_GenProcessFile(char *Buffer, size_t Length)
+{
+	struct {
+		tProcess	*Proc;
+		char	Name[32];
+	}	*procs = NULL;
+	 int	nProcs, space = 0;
+	size_t	len = 0;
+	
+	#define ADD(...)	do { \
+		 int	_n = snprintf(len < Length ? Buffer + len : NULL, len < Length ? Length - len : 0, __VA_ARGS__); \
+		if( _n > 0 )	len += _n; \
+	} while(0)
+	
+	ADD("PID\tRes\tPeak\tShared\tPrivate\tLimit\tHits\tCOW\tName\n");
+	
+	// Can't allocate with the lock held, so size the array first and retry
+	// if processes were created in the meantime
+	for( ;; )
+	{
+		SHORTLOCK( &glThreadListLock );
+		nProcs = 0;
+		for( tThread *thread = gAllThreads; thread; thread = thread->GlobalNext )
+		{
+			tProcess	*proc = thread->Process;
+			// One line per process, from its first thread
+			if( !proc || proc->FirstThread != thread )
+				continue ;
+			if( nProcs < space ) {
+				proc->ReferenceCount ++;
+				procs[nProcs].Proc = proc;
+				strncpy(procs[nProcs].Name, (thread->ThreadName ? thread->ThreadName : ""),
+					sizeof(procs[nProcs].Name)-1);
+				procs[nProcs].Name[sizeof(procs[nProcs].Name)-1] = '\0';
+			}
+			nProcs ++;
+		}
+		SHORTREL( &glThreadListLock );
+		
+		if( nProcs <= space )
+			break;
+		for( int i = 0; i < space; i ++ )
+			Threads_int_DerefProcess( procs[i].Proc );
+		if( procs )	free( procs );
+		space = nProcs + 8;
+		procs = malloc( space * sizeof(*procs) );
+		if( !procs )
+			return len;
+	}
+	
+	for( int i = 0; i < nProcs; i ++ )
+	{
+		tProcess	*proc = procs[i].Proc;
+		size_t	shared, private;
+		MM_CountUserPages(proc, &shared, &private);
+		ADD("%i\t%i\t%i\t%i\t%i\t%i\t%i\t%i\t%s\n",
+			(int)proc->PID, proc->nResidentPages, proc->nPeakResidentPages,
+			(int)shared, (int)private, proc->MaxResidentPages,
+			proc->nLimitHits, proc->nCOWCopies, procs[i].Name);
+		Threads_int_DerefProcess( proc );
+	}
+	if( procs )	free( procs );
+	
+	#undef ADD
+	return len;
+}
+
 // --- Per-thread storage ---
 int *Threads_GetErrno(void)
 {
@@ -1172,6 +1359,7 @@ void Threads_int_DumpThread(tThread *thread)
 	Log("  KStack %p", thread->KernelStack);
 	if( thread->bInstrTrace )
 		Log("  Tracing Enabled");
+	Proc_int_DumpMessageQueue(thread);
 	Proc_DumpThreadCPUState(thread);
 }
 
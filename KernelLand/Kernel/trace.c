@@ -0,0 +1,233 @@
+/*
+ * Acess2 Kernel
+ * - By John Hodge (thePowersGang)
+ *
+ * trace.c
+ * - Kernel tracepoints and sampling profiler
+ *
+ * Events are written into a per-CPU ring of fixed-size binary records. Slots
+ * are reserved with an atomic increment of the ring head, so tracepoints
+ * need no lock and can nest (e.g. an IRQ firing during a syscall
+ * tracepoint). When a ring fills, the oldest records are overwritten and
+ * counted as lost when the reader catches up.
+ */
+#define DEBUG	0
+#include <acess.h>
+#include <threads_int.h>
+#include <hal_proc.h>
+#include <trace.h>
+
+#define TRACE_RING_SIZE	1024	// Records per CPU, must be a power of two
+#define TRACE_RING_MASK	(TRACE_RING_SIZE-1)
+
+// === TYPES ===
+typedef struct sTraceRing
+{
+	volatile Uint	Head;	//!< Next record to be written (free-running)
+	Uint	Tail;	//!< Next record to be read (only touched by the reader)
+	Uint	nLost;	//!< Records overwritten before they were read
+	 int	TickCount;	//!< Timer ticks since the last profiler sample
+	tTraceRecord	*Records;
+} tTraceRing;
+
+// === PROTOTYPES ===
+static Uint64	Trace_int_Timestamp(void);
+static tTraceRecord	*Trace_int_Reserve(int Event);
+static void	Trace_int_Commit(tTraceRecord *Rec, int Event);
+
+// === GLOBALS ===
+volatile int	gbTrace_Enabled;
+ int	giTrace_SampleInterval;	//!< Profiler period in timer ticks (0 = off)
+tMutex	glTrace_ReaderLock;
+tTraceRing	gaTrace_Rings[MAX_CPUS];
+
+// === CODE ===
+static Uint64 Trace_int_Timestamp(void)
+{
+	#if ARCHDIR_IS_x86 || ARCHDIR_IS_x86_64
+	Uint32	lo, hi;
+	__asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((Uint64)hi << 32) | lo;
+	#else
+	return now();
+	#endif
+}
+
+/**
+ * \brief Reserve a slot in the current CPU's ring
+ * \return Record to fill, or NULL if tracing isn't set up
+ */
+static tTraceRecord *Trace_int_Reserve(int Event)
+{
+	 int	cpu = GetCPUNum();
+	tTraceRing	*ring = &gaTrace_Rings[cpu];
+	tTraceRecord	*rec;
+	tThread	*cur;
+
+	if( !ring->Records )
+		return NULL;
+
+	rec = &ring->Records[ __sync_fetch_and_add(&ring->Head, 1) & TRACE_RING_MASK ];
+	// Invalidate the slot while it is being filled, the reader skips these
+	rec->Event = TRACE_EV_NONE;
+	__sync_synchronize();
+
+	cur = Proc_GetCurThread();
+	rec->Timestamp = Trace_int_Timestamp();
+	rec->CPU = cpu;
+	rec->TID = (cur ? cur->TID : -1);
+	return rec;
+}
+
+static void Trace_int_Commit(tTraceRecord *Rec, int Event)
+{
+	__sync_synchronize();
+	Rec->Event = Event;
+}
+
+/**
+ * \brief Record a tracepoint (use TRACE_POINT* instead of calling directly)
+ */
+void Trace_Event(int Event, int Count, Uint64 A0, Uint64 A1, Uint64 A2)
+{
+	tTraceRecord	*rec = Trace_int_Reserve(Event);
+	if( !rec )	return ;
+	rec->Count = Count;
+	rec->Data[0] = A0;
+	rec->Data[1] = A1;
+	rec->Data[2] = A2;
+	Trace_int_Commit(rec, Event);
+}
+
+void Trace_IRQ(int IRQ)
+{
+	TRACE_POINT1(TRACE_EV_IRQ, IRQ);
+}
+
+int Trace_SampleDue(void)
+{
+	tTraceRing	*ring;
+	if( !gbTrace_Enabled || giTrace_SampleInterval <= 0 )
+		return 0;
+	ring = &gaTrace_Rings[GetCPUNum()];
+	if( ++ring->TickCount < giTrace_SampleInterval )
+		return 0;
+	ring->TickCount = 0;
+	return 1;
+}
+
+void Trace_Sample(int Count, const Uint *Frames)
+{
+	tTraceRecord	*rec = Trace_int_Reserve(TRACE_EV_SAMPLE);
+	if( !rec )	return ;
+	if( Count > TRACE_SAMPLE_DEPTH )
+		Count = TRACE_SAMPLE_DEPTH;
+	rec->Count = Count;
+	for( int i = 0; i < Count; i ++ )
+		rec->Data[i] = Frames[i];
+	Trace_int_Commit(rec, TRACE_EV_SAMPLE);
+}
+
+/**
+ * \brief Allocate the rings (if needed) and switch tracing on
+ */
+int Trace_Start(void)
+{
+	Mutex_Acquire( &glTrace_ReaderLock );
+	for( int i = 0; i < MAX_CPUS; i ++ )
+	{
+		tTraceRing	*ring = &gaTrace_Rings[i];
+		if( ring->Records )	continue ;
+		ring->Records = calloc( TRACE_RING_SIZE, sizeof(tTraceRecord) );
+		if( !ring->Records ) {
+			Mutex_Release( &glTrace_ReaderLock );
+			Log_Warning("Trace", "Unable to allocate trace ring for CPU%i", i);
+			return -1;
+		}
+		ring->Head = ring->Tail = 0;
+	}
+	Mutex_Release( &glTrace_ReaderLock );
+	gbTrace_Enabled = 1;
+	Log_Log("Trace", "Tracing enabled (%i records/CPU, sample every %i ticks)",
+		TRACE_RING_SIZE, giTrace_SampleInterval);
+	return 0;
+}
+
+/**
+ * \brief Switch tracing off (buffered records can still be read)
+ */
+void Trace_Stop(void)
+{
+	gbTrace_Enabled = 0;
+}
+
+void Trace_SetSampleInterval(int Ticks)
+{
+	giTrace_SampleInterval = (Ticks < 0 ? 0 : Ticks);
+}
+
+/**
+ * \brief Consume buffered records from all CPUs
+ * \return Number of bytes copied (always a multiple of sizeof(tTraceRecord))
+ */
+size_t Trace_Read(void *Buffer, size_t Length)
+{
+	tTraceRecord	*out = Buffer;
+	size_t	space = Length / sizeof(tTraceRecord);
+	size_t	count = 0;
+
+	Mutex_Acquire( &glTrace_ReaderLock );
+	for( int i = 0; i < MAX_CPUS && count < space; i ++ )
+	{
+		tTraceRing	*ring = &gaTrace_Rings[i];
+		Uint	head = ring->Head;
+		if( !ring->Records )	continue ;
+
+		// Writer lapped us, skip to the oldest surviving record
+		if( head - ring->Tail > TRACE_RING_SIZE ) {
+			ring->nLost += head - ring->Tail - TRACE_RING_SIZE;
+			ring->Tail = head - TRACE_RING_SIZE;
+		}
+
+		while( ring->Tail != head && count < space )
+		{
+			tTraceRecord	*rec = &ring->Records[ring->Tail & TRACE_RING_MASK];
+			ring->Tail ++;
+			if( rec->Event == TRACE_EV_NONE )
+				continue ;	// Still being written, or torn
+			out[count++] = *rec;
+		}
+	}
+	Mutex_Release( &glTrace_ReaderLock );
+
+	LOG("%i records read", count);
+	return count * sizeof(tTraceRecord);
+}
+
+/**
+ * \brief Discard all buffered records
+ */
+void Trace_Clear(void)
+{
+	Mutex_Acquire( &glTrace_ReaderLock );
+	for( int i = 0; i < MAX_CPUS; i ++ )
+		gaTrace_Rings[i].Tail = gaTrace_Rings[i].Head;
+	Mutex_Release( &glTrace_ReaderLock );
+}
+
+void Trace_DumpStats(void)
+{
+	Log_Log("Trace", "Tracing %s, sample interval %i ticks",
+		(gbTrace_Enabled ? "on" : "off"), giTrace_SampleInterval);
+	for( int i = 0; i < MAX_CPUS; i ++ )
+	{
+		tTraceRing	*ring = &gaTrace_Rings[i];
+		if( !ring->Records )	continue ;
+		Log_Log("Trace", "CPU%i: %i written, %i pending, %i lost",
+			i, ring->Head, ring->Head - ring->Tail, ring->nLost);
+	}
+}
+
+// === EXPORTS ===
+EXPORTV(gbTrace_Enabled);
+EXPORT(Trace_Event);
@@ -12,6 +12,10 @@
 #include <vfs.h>
 #include <vfs_ext.h>
 #include <vfs_int.h>
+#include <trace.h>
+
+// === CONSTANTS ===
+#define VFS_GATHER_MAX	4096	// Vectored writes up to this size go to the driver in one call
 
 // === CODE ===
 /**
@@ -56,6 +60,7 @@ size_t VFS_Read(int FD, size_t Length, void *Buffer)
 	Uint	flags = 0;
 	flags |= (h->Mode & VFS_OPENFLAG_NONBLOCK) ? VFS_IOFLAG_NOBLOCK : 0;
 	ret = h->Node->Type->Read(h->Node, h->Position, Length, Buffer, flags);
+	TRACE_POINT3(TRACE_EV_VFS_READ, FD, Length, ret);
 	if(ret == (size_t)-1)	LEAVE_RET('i', -1);
 	
 	h->Position += ret;
@@ -93,6 +98,7 @@ size_t VFS_ReadAt(int FD, Uint64 Offset, size_t Length, void *Buffer)
 	Uint	flags = 0;
 	flags |= (h->Mode & VFS_OPENFLAG_NONBLOCK) ? VFS_IOFLAG_NOBLOCK : 0;
 	ret = h->Node->Type->Read(h->Node, Offset, Length, Buffer, flags);
+	TRACE_POINT3(TRACE_EV_VFS_READ, FD, Length, ret);
 	if(ret == (size_t)-1)	return -1;
 	return ret;
 }
@@ -133,6 +139,7 @@ size_t VFS_Write(int FD, size_t Length, const void *Buffer)
 	Uint flags = 0;
 	flags |= (h->Mode & VFS_OPENFLAG_NONBLOCK) ? VFS_IOFLAG_NOBLOCK : 0;
 	ret = h->Node->Type->Write(h->Node, h->Position, Length, Buffer, flags);
+	TRACE_POINT3(TRACE_EV_VFS_WRITE, FD, Length, ret);
 	if(ret == (size_t)-1)	return -1;
 
 	h->Position += ret;
@@ -165,10 +172,143 @@ size_t VFS_WriteAt(int FD, Uint64 Offset, size_t Length, const void *Buffer)
 	Uint flags = 0;
 	flags |= (h->Mode & VFS_OPENFLAG_NONBLOCK) ? VFS_IOFLAG_NOBLOCK : 0;
 	ret = h->Node->Type->Write(h->Node, Offset, Length, Buffer, flags);
+	TRACE_POINT3(TRACE_EV_VFS_WRITE, FD, Length, ret);
 	if(ret == (size_t)-1)	return -1;
 	return ret;
 }
 
+/**
+ * \brief Read into each buffer in turn, stopping at the first short read
+ */
+size_t VFS_ReadV(int FD, const tVFS_IOVec *Vecs, int Count)
+{
+	tVFS_Handle	*h;
+	size_t	total = 0;
+	
+	ENTER("xFD pVecs iCount", FD, Vecs, Count);
+	
+	h = VFS_GetHandle(FD);
+	if(!h)	LEAVE_RET('i', -1);
+	if( !(h->Mode & VFS_OPENFLAG_READ) )	LEAVE_RET('i', -1);
+	if( h->Node->Flags & VFS_FFLAG_DIRECTORY )	LEAVE_RET('i', -1);
+	if( !h->Node->Type || !h->Node->Type->Read )	LEAVE_RET('i', -1);
+	
+	Uint	flags = 0;
+	flags |= (h->Mode & VFS_OPENFLAG_NONBLOCK) ? VFS_IOFLAG_NOBLOCK : 0;
+	for( int i = 0; i < Count; i ++ )
+	{
+		if( Vecs[i].Length == 0 )
+			continue ;
+		size_t ret = h->Node->Type->Read(h->Node, h->Position, Vecs[i].Length, Vecs[i].Base, flags);
+		TRACE_POINT3(TRACE_EV_VFS_READ, FD, Vecs[i].Length, ret);
+		if( ret == (size_t)-1 ) {
+			if( total == 0 )
+				LEAVE_RET('i', -1);
+			break;
+		}
+		h->Position += ret;
+		total += ret;
+		if( ret < Vecs[i].Length )
+			break;
+	}
+	
+	LEAVE('x', total);
+	return total;
+}
+
+/**
+ * \brief Write each buffer in turn
+ *
+ * If the whole write is small it is gathered into one buffer first, so
+ * e.g. a stdio flush and the data that caused it reach a terminal together.
+ */
+size_t VFS_WriteV(int FD, const tVFS_IOVec *Vecs, int Count)
+{
+	tVFS_Handle	*h;
+	size_t	total = 0, ret;
+	
+	ENTER("xFD pVecs iCount", FD, Vecs, Count);
+	
+	h = VFS_GetHandle(FD);
+	if(!h) {
+		LOG("Bad Handle");
+		LEAVE_RET('i', -1);
+	}
+	if( !(h->Mode & VFS_OPENFLAG_WRITE) ) {
+		LOG("FD%i not opened for writing", FD);
+		LEAVE_RET('i', -1);
+	}
+	if( h->Node->Flags & VFS_FFLAG_DIRECTORY ) {
+		LOG("FD%i is a director", FD);
+		LEAVE_RET('i', -1);
+	}
+	if( !h->Node->Type || !h->Node->Type->Write ) {
+		LOG("FD%i has no write method", FD);
+		LEAVE_RET('i', 0);
+	}
+	if( !MM_GetPhysAddr(h->Node->Type->Write) ) {
+		Log_Error("VFS", "Node type %p(%s) write method is junk %p",
+			h->Node->Type, h->Node->Type->TypeName,
+			h->Node->Type->Write);
+		LEAVE_RET('i', -1);
+	}
+	
+	Uint	flags = 0;
+	flags |= (h->Mode & VFS_OPENFLAG_NONBLOCK) ? VFS_IOFLAG_NOBLOCK : 0;
+	
+	for( int i = 0; i < Count; i ++ )
+	{
+		if( total + Vecs[i].Length < total ) {
+			LOG("Total length overflows");
+			LEAVE_RET('i', -1);
+		}
+		total += Vecs[i].Length;
+	}
+	
+	if( Count > 1 && total <= VFS_GATHER_MAX )
+	{
+		char	*buf = malloc(total);
+		if( buf )
+		{
+			size_t	ofs = 0;
+			for( int i = 0; i < Count; i ++ ) {
+				memcpy(buf + ofs, Vecs[i].Base, Vecs[i].Length);
+				ofs += Vecs[i].Length;
+			}
+			LOG("Gathered %i buffers (0x%x bytes)", Count, total);
+			ret = h->Node->Type->Write(h->Node, h->Position, total, buf, flags);
+			free(buf);
+			TRACE_POINT3(TRACE_EV_VFS_WRITE, FD, total, ret);
+			if( ret == (size_t)-1 )	LEAVE_RET('i', -1);
+			h->Position += ret;
+			LEAVE('x', ret);
+			return ret;
+		}
+		// Out of memory, fall back to one call per buffer
+	}
+	
+	total = 0;
+	for( int i = 0; i < Count; i ++ )
+	{
+		if( Vecs[i].Length == 0 )
+			continue ;
+		ret = h->Node->Type->Write(h->Node, h->Position, Vecs[i].Length, Vecs[i].Base, flags);
+		TRACE_POINT3(TRACE_EV_VFS_WRITE, FD, Vecs[i].Length, ret);
+		if( ret == (size_t)-1 ) {
+			if( total == 0 )
+				LEAVE_RET('i', -1);
+			break;
+		}
+		h->Position += ret;
+		total += ret;
+		if( ret < Vecs[i].Length )
+			break;
+	}
+	
+	LEAVE('x', total);
+	return total;
+}
+
 /**
  * \fn Uint64 VFS_Tell(int FD)
  * \brief Returns the current file position
@@ -275,6 +415,8 @@ EXPORT(VFS_Read);
 EXPORT(VFS_Write);
 EXPORT(VFS_ReadAt);
 EXPORT(VFS_WriteAt);
+EXPORT(VFS_ReadV);
+EXPORT(VFS_WriteV);
 EXPORT(VFS_IOCtl);
 EXPORT(VFS_Seek);
 EXPORT(VFS_Tell);
@@ -4,37 +4,84 @@
  *
  * mmap.c
  * - VFS_MMap support
+ *
+ * File mappings in user memory are demand paged. VFS_MMap only records the
+ * area (tVFS_MMapArea) against the process, and the pages are filled by
+ * VFS_MMap_PageFault when they are first touched. Pages read from a file are
+ * kept in a per-node cache (tVFS_MMapPageBlock) so later mappings of the same
+ * file share the physical pages. Cached pages that are no longer mapped
+ * anywhere are handed back under memory pressure by VFS_MMap_int_Shrink.
  */
 #define DEBUG	0
 #include <acess.h>
 #include <vfs.h>
 #include <vfs_ext.h>
 #include <vfs_int.h>
+#include <vfs_threads.h>
+#include <threads_int.h>
+#include <reclaim.h>
 
 #define MMAP_PAGES_PER_BLOCK	16
+#define MMAP_READAHEAD_PAGES	8	// Maximum pages filled by a single fault
 
 // === STRUCTURES ===
 typedef struct sVFS_MMapPageBlock	tVFS_MMapPageBlock;
 struct sVFS_MMapPageBlock
 {
 	tVFS_MMapPageBlock	*Next;
+	tVFS_MMapPageBlock	*GlobalNext;	// Oldest first, for reclaim
+	tVFS_Node	*Node;	// Owning node (referenced)
 	Uint64	BaseOffset;	// Must be a multiple of MMAP_PAGES_PER_BLOCK*PAGE_SIZE
+	Uint32	SharedWrite;	// Pages that have been writable in a shared mapping (never evicted)
 	tPAddr	PhysAddrs[MMAP_PAGES_PER_BLOCK];
 };
 
+typedef struct sVFS_MMapArea	tVFS_MMapArea;
+/**
+ * \brief Lazily populated region of a process's address space
+ */
+struct sVFS_MMapArea
+{
+	tVFS_MMapArea	*Next;
+	tVAddr	Base;	//!< First page of the area
+	tVAddr	End;	//!< Page after the last page of the area
+	tVFS_Node	*Node;	//!< Backing file (referenced)
+	Uint64	PageNum;	//!< File page mapped at \a Base
+	 int	Protection;
+	 int	Flags;
+};
+
+// === PROTOTYPES ===
+static tPAddr	*VFS_MMap_int_GetCacheSlot(tVFS_Node *Node, Uint64 PageNum);
+static void	VFS_MMap_int_MarkShared(tVFS_Node *Node, Uint64 PageNum);
+static size_t	VFS_MMap_int_Shrink(tReclaim_Shrinker *Self, size_t Pages, int Flags);
+static void	VFS_MMap_int_SetFlags(tVAddr VAddr, int Protection, int Flags);
+static int	VFS_MMap_int_FillPages(tVFS_Node *Node, tVAddr VAddr, Uint64 PageNum, int MaxPages, int Protection, int Flags);
+static void	VFS_MMap_int_RemoveAreas(tProcess *Proc, tVAddr Base, tVAddr End);
+
+// === GLOBALS ===
+tPAddr	giVFS_MMapZeroPage;	//!< Physical address returned by MM_AllocateZero
+tMutex	glVFS_MMapBlocks;	//!< Protects the global block list (taken after Node->Lock)
+tVFS_MMapPageBlock	*gVFS_MMapBlocks;
+tVFS_MMapPageBlock	*gVFS_MMapBlocksTail;
+ int	gbVFS_MMapShrinkerRegistered;
+tReclaim_Shrinker	gVFS_MMapShrinker = {
+	.Name = "VFS MMap",
+	.Shrink = VFS_MMap_int_Shrink
+};
+
 // === CODE ===
 void *VFS_MMap(void *DestHint, size_t Length, int Protection, int Flags, int FD, Uint64 Offset)
 {
 	tVFS_Handle	*h;
 	tVAddr	mapping_dest, mapping_base;
 	 int	npages, pagenum;
-	tVFS_MMapPageBlock	*pb, *prev;
 
 	ENTER("pDestHint iLength xProtection xFlags xFD XOffset", DestHint, Length, Protection, Flags, FD, Offset);
 
 	if( Flags & MMAP_MAP_ANONYMOUS )
 		Offset = (tVAddr)DestHint & 0xFFF;
-	
+
 	npages = ((Offset & (PAGE_SIZE-1)) + Length + (PAGE_SIZE - 1)) / PAGE_SIZE;
 	pagenum = Offset / PAGE_SIZE;
 
@@ -50,7 +97,31 @@ void *VFS_MMap(void *DestHint, size_t Length, int Protection, int Flags, int FD,
 		LOG("%i pages anonymous to %p", npages, mapping_dest);
 		for( ; npages --; mapping_dest += PAGE_SIZE, ofs += PAGE_SIZE )
 		{
+			#ifdef MM_LARGE_PAGE_SIZE
+			// Whole aligned 2 MiB chunks of a huge mapping get one large page
+			// (only succeeds if nothing is mapped there yet)
+			if( (Flags & MMAP_MAP_HUGE) && (Protection & MMAP_PROT_WRITE)
+			 && !(mapping_dest & (MM_LARGE_PAGE_SIZE-1)) && mapping_dest >= mapping_base
+			 && npages + 1 >= MM_LARGE_PAGE_SIZE/PAGE_SIZE
+			 && mapping_dest + MM_LARGE_PAGE_SIZE <= USER_MAX
+			 && MM_AllocateLarge(mapping_dest) )
+			{
+				LOG("Large page at %p", mapping_dest);
+				memset( (void*)mapping_dest, 0, MM_LARGE_PAGE_SIZE );
+				npages -= MM_LARGE_PAGE_SIZE/PAGE_SIZE - 1;
+				mapping_dest += MM_LARGE_PAGE_SIZE - PAGE_SIZE;
+				ofs += MM_LARGE_PAGE_SIZE - PAGE_SIZE;
+				continue ;
+			}
+			#endif
+			// A partial first page may belong to a file mapping that hasn't been touched yet
+			if( ofs == 0 && (mapping_base & (PAGE_SIZE-1)) && !MM_GetPhysAddr((void*)mapping_dest) )
+				VFS_MMap_PageFault(mapping_dest, 0);
+
 			if( MM_GetPhysAddr((void*)mapping_dest) ) {
+				// Already zero
+				if( giVFS_MMapZeroPage && MM_GetPhysAddr((void*)mapping_dest) == giVFS_MMapZeroPage )
+					continue ;
 				// TODO: Set flags to COW if needed (well, if shared)
 				MM_SetFlags(mapping_dest, MM_PFLAG_COW, MM_PFLAG_COW);
 				LOG("clear from %p, %i bytes", (void*)(mapping_base + ofs),
@@ -59,9 +130,18 @@ void *VFS_MMap(void *DestHint, size_t Length, int Protection, int Flags, int FD,
 				memset( (void*)(mapping_base + ofs), 0, PAGE_SIZE - (mapping_base & (PAGE_SIZE-1)));
 				LOG("dune");
 			}
+			else if( mapping_dest < USER_MAX && (Protection & MMAP_PROT_WRITE) ) {
+				// Share the zero page until the first write
+				tPAddr	zero = MM_AllocateZero(mapping_dest);
+				if( !zero ) {
+					Log_Warning("VFS", "VFS_MMap: Anon map to %p failed", mapping_dest);
+					continue ;
+				}
+				giVFS_MMapZeroPage = zero;
+				LOG("Zero page at %p", mapping_dest);
+			}
 			else {
 				LOG("New empty page");
-				// TODO: Map a COW zero page instead
 				if( !MM_Allocate(mapping_dest) ) {
 					// TODO: Error
 					Log_Warning("VFS", "VFS_MMap: Anon alloc to %p failed", mapping_dest);
@@ -77,97 +157,67 @@ void *VFS_MMap(void *DestHint, size_t Length, int Protection, int Flags, int FD,
 	if( !h || !h->Node )	LEAVE_RET('n', NULL);
 
 	LOG("h = %p", h);
-	
-	Mutex_Acquire( &h->Node->Lock );
 
-	// Search for existing mapping for each page
-	// - Sorted list of 16 page blocks
-	for(
-		pb = h->Node->MMapInfo, prev = NULL;
-		pb && pb->BaseOffset + MMAP_PAGES_PER_BLOCK < pagenum;
-		prev = pb, pb = pb->Next
-		)
-		;
+	// User mappings of normal files are filled on demand
+	if( mapping_dest < USER_MAX && h->Node->Type && !h->Node->Type->MMap )
+	{
+		tProcess	*proc = Proc_GetCurThread()->Process;
+		tVFS_MMapArea	*area, *prev;
 
-	LOG("pb = %p, pb->BaseOffset = %X", pb, pb ? pb->BaseOffset : 0);
+		area = malloc( sizeof(tVFS_MMapArea) );
+		if( !area )	LEAVE_RET('n', NULL);
+		area->Base = mapping_dest;
+		area->End = mapping_dest + npages * PAGE_SIZE;
+		area->Node = h->Node;
+		area->PageNum = pagenum;
+		area->Protection = Protection;
+		area->Flags = Flags;
+		_ReferenceNode(h->Node);
 
-	// - Allocate a block if needed
-	if( !pb || pb->BaseOffset > pagenum )
-	{
-		void	*old_pb = pb;
-		pb = calloc( 1, sizeof(tVFS_MMapPageBlock) );
-		if(!pb) {
-			Mutex_Release( &h->Node->Lock );
-			LEAVE_RET('n', NULL);
-		}
-		pb->Next = old_pb;
-		pb->BaseOffset = pagenum - pagenum % MMAP_PAGES_PER_BLOCK;
-		if(prev)
-			prev->Next = pb;
+		Mutex_Acquire( &proc->MMapLock );
+		// Replace anything that was already mapped here
+		VFS_MMap_int_RemoveAreas(proc, area->Base, area->End);
+		// - Keep the list sorted by address
+		for( prev = NULL, area->Next = proc->MMapAreas; area->Next && area->Next->Base < area->Base; )
+		{
+			prev = area->Next;
+			area->Next = prev->Next;
+		}
+		if( prev )
+			prev->Next = area;
 		else
-			h->Node->MMapInfo = pb;
+			proc->MMapAreas = area;
+
+		// Pages that are already present (e.g. shared with an earlier mapping) just get flags
+		for( ; npages --; mapping_dest += PAGE_SIZE )
+		{
+			if( MM_GetPhysAddr( (void*)mapping_dest ) == 0 )
+				continue ;
+			LOG("Flag update on %p", mapping_dest);
+			if( (MM_GetFlags(mapping_dest) & MM_PFLAG_RO) && (Protection & MMAP_PROT_WRITE) )
+				MM_SetFlags(mapping_dest, 0, MM_PFLAG_RO);
+			if( Flags & MMAP_MAP_PRIVATE )
+				MM_SetFlags(mapping_dest, MM_PFLAG_COW, MM_PFLAG_COW);
+		}
+		Mutex_Release( &proc->MMapLock );
+
+		LOG("Deferred %i pages at %p", (area->End - area->Base) / PAGE_SIZE, area->Base);
+		LEAVE('p', mapping_base);
+		return (void*)mapping_base;
 	}
 
+	Mutex_Acquire( &h->Node->Lock );
+
 	// - Map (and allocate) pages
 	while( npages -- )
 	{
 		if( MM_GetPhysAddr( (void*)mapping_dest ) == 0 )
 		{
-			if( pb->PhysAddrs[pagenum - pb->BaseOffset] == 0 )
-			{
-				tVFS_NodeType	*nt = h->Node->Type;
-				if( !nt ) 
-				{
-					// TODO: error
-				}
-				else if( nt->MMap )
-					nt->MMap(h->Node, pagenum*PAGE_SIZE, PAGE_SIZE, (void*)mapping_dest);
-				else
-				{
-					 int	read_len;
-					// Allocate pages and read data
-					if( MM_Allocate(mapping_dest) == 0 ) {
-						// TODO: Unwrap
-						Mutex_Release( &h->Node->Lock );
-						LEAVE('n');
-						return NULL;
-					}
-					// TODO: Clip read length
-					read_len = nt->Read(h->Node, pagenum*PAGE_SIZE, PAGE_SIZE,
-						(void*)mapping_dest, 0);
-					// TODO: This was commented out, why?
-					if( read_len != PAGE_SIZE ) {
-						memset( (void*)(mapping_dest+read_len), 0, PAGE_SIZE-read_len );
-					}
-				}
-				pb->PhysAddrs[pagenum - pb->BaseOffset] = MM_GetPhysAddr( (void*)mapping_dest );
-				MM_SetPageNode( pb->PhysAddrs[pagenum - pb->BaseOffset], h->Node );
-				MM_RefPhys( pb->PhysAddrs[pagenum - pb->BaseOffset] );
-				LOG("Read and map %X to %p (%P)", pagenum*PAGE_SIZE, mapping_dest,
-					pb->PhysAddrs[pagenum - pb->BaseOffset]);
-			}
-			else
-			{
-				MM_Map( mapping_dest, pb->PhysAddrs[pagenum - pb->BaseOffset] );
-				MM_RefPhys( pb->PhysAddrs[pagenum - pb->BaseOffset] );
-				LOG("Cached map %X to %p (%P)", pagenum*PAGE_SIZE, mapping_dest,
-					pb->PhysAddrs[pagenum - pb->BaseOffset]);
-			}
-			h->Node->ReferenceCount ++;
-		
-			// Set flags
-			if( !(Protection & MMAP_PROT_WRITE) ) {
-				MM_SetFlags(mapping_dest, MM_PFLAG_RO, MM_PFLAG_RO);
-			}
-			else {
-				MM_SetFlags(mapping_dest, 0, MM_PFLAG_RO);
-			}
-			
-			if( Protection & MMAP_PROT_EXEC ) {
-				MM_SetFlags(mapping_dest, MM_PFLAG_EXEC, MM_PFLAG_EXEC);
-			}
-			else {
-				MM_SetFlags(mapping_dest, 0, MM_PFLAG_EXEC);
+			if( VFS_MMap_int_FillPages(h->Node, mapping_dest, pagenum, 1, Protection, Flags) == 0 ) {
+				// TODO: Unwrap
+				Mutex_Release( &h->Node->Lock );
+				LEAVE('n');
+				return NULL;
 			}
 		}
 		else
@@ -177,36 +227,524 @@ void *VFS_MMap(void *DestHint, size_t Length, int Protection, int Flags, int FD,
 			{
 				MM_SetFlags(mapping_dest, 0, MM_PFLAG_RO);
 			}
+			if( Flags & MMAP_MAP_PRIVATE )
+				MM_SetFlags(mapping_dest, MM_PFLAG_COW, MM_PFLAG_COW);
 		}
-		if( Flags & MMAP_MAP_PRIVATE )
-			MM_SetFlags(mapping_dest, MM_PFLAG_COW, MM_PFLAG_COW);
 		pagenum ++;
 		mapping_dest += PAGE_SIZE;
+	}
+
+	Mutex_Release( &h->Node->Lock );
 
-		// Roll on to next block if needed
-		if(pagenum - pb->BaseOffset == MMAP_PAGES_PER_BLOCK)
+	LEAVE('p', mapping_base);
+	return (void*)mapping_base;
+}
+
+/**
+ * \brief Get the cache entry for a page of a file (allocating a block if needed)
+ * \note Node->Lock must be held
+ */
+static tPAddr *VFS_MMap_int_GetCacheSlot(tVFS_Node *Node, Uint64 PageNum)
+{
+	tVFS_MMapPageBlock	*pb, *prev;
+	Uint64	base = PageNum - PageNum % MMAP_PAGES_PER_BLOCK;
+
+	// Sorted list of 16 page blocks
+	for( pb = Node->MMapInfo, prev = NULL; pb && pb->BaseOffset < base; prev = pb, pb = pb->Next )
+		;
+
+	if( !pb || pb->BaseOffset != base )
+	{
+		tVFS_MMapPageBlock	*new_pb = calloc( 1, sizeof(tVFS_MMapPageBlock) );
+		if( !new_pb )
+			return NULL;
+		new_pb->Next = pb;
+		new_pb->BaseOffset = base;
+		new_pb->Node = Node;
+		_ReferenceNode(Node);
+		if(prev)
+			prev->Next = new_pb;
+		else
+			Node->MMapInfo = new_pb;
+		pb = new_pb;
+
+		if( !gbVFS_MMapShrinkerRegistered ) {
+			gbVFS_MMapShrinkerRegistered = 1;
+			Reclaim_Register( &gVFS_MMapShrinker );
+		}
+		Mutex_Acquire( &glVFS_MMapBlocks );
+		if( gVFS_MMapBlocksTail )
+			gVFS_MMapBlocksTail->GlobalNext = pb;
+		else
+			gVFS_MMapBlocks = pb;
+		gVFS_MMapBlocksTail = pb;
+		Mutex_Release( &glVFS_MMapBlocks );
+	}
+
+	return &pb->PhysAddrs[PageNum - base];
+}
+
+/**
+ * \brief Flag a cached page as possibly modified through a shared mapping
+ * \note Node->Lock must be held
+ */
+static void VFS_MMap_int_MarkShared(tVFS_Node *Node, Uint64 PageNum)
+{
+	Uint64	base = PageNum - PageNum % MMAP_PAGES_PER_BLOCK;
+	for( tVFS_MMapPageBlock *pb = Node->MMapInfo; pb && pb->BaseOffset <= base; pb = pb->Next )
+	{
+		if( pb->BaseOffset == base ) {
+			pb->SharedWrite |= 1 << (PageNum - base);
+			break;
+		}
+	}
+}
+
+/**
+ * \brief Shrinker for the page cache
+ *
+ * A cached page is clean and unused when the cache holds the only reference
+ * and the page node (gapPageNodes) still names the cache's file. Busy nodes
+ * are skipped rather than waited on, which also means a fault that runs out
+ * of memory under Node->Lock can't deadlock against us.
+ */
+static size_t VFS_MMap_int_Shrink(tReclaim_Shrinker *Self, size_t Pages, int Flags)
+{
+	tVFS_MMapPageBlock	*pb, *prev = NULL, *next;
+	size_t	freed = 0;
+
+	if( Flags & RECLAIM_FLAG_ATOMIC ) {
+		if( Mutex_TryAcquire( &glVFS_MMapBlocks ) )
+			return 0;
+	}
+	else
+		Mutex_Acquire( &glVFS_MMapBlocks );
+
+	for( pb = gVFS_MMapBlocks; pb && freed < Pages; pb = next )
+	{
+		tVFS_Node	*node = pb->Node;
+		 int	nleft = 0;
+
+		next = pb->GlobalNext;
+		if( Mutex_TryAcquire( &node->Lock ) ) {
+			prev = pb;
+			continue ;
+		}
+
+		for( int i = 0; i < MMAP_PAGES_PER_BLOCK; i ++ )
 		{
-			if( pb->Next && pb->Next->BaseOffset == pagenum )
-				pb = pb->Next;
-			else
+			tPAddr	paddr = pb->PhysAddrs[i];
+			void	*owner;
+			if( !paddr )
+				continue ;
+			if( freed == Pages || (pb->SharedWrite & (1 << i)) || MM_GetRefCount(paddr) != 1
+			 || MM_GetPageNode(paddr, &owner) || owner != node ) {
+				nleft ++;
+				continue ;
+			}
+			LOG("Evict %P (%p:%X)", paddr, node, (pb->BaseOffset + i) * PAGE_SIZE);
+			MM_SetPageNode(paddr, NULL);
+			MM_DerefPhys(paddr);
+			pb->PhysAddrs[i] = 0;
+			freed ++;
+		}
+
+		// Empty blocks are freed (not in atomic context, that would need the heap)
+		if( nleft || (Flags & RECLAIM_FLAG_ATOMIC) ) {
+			Mutex_Release( &node->Lock );
+			prev = pb;
+			continue ;
+		}
+		tVFS_MMapPageBlock	**pp = (tVFS_MMapPageBlock**)&node->MMapInfo;
+		while( *pp != pb )
+			pp = &(*pp)->Next;
+		*pp = pb->Next;
+		if( prev )
+			prev->GlobalNext = next;
+		else
+			gVFS_MMapBlocks = next;
+		if( gVFS_MMapBlocksTail == pb )
+			gVFS_MMapBlocksTail = prev;
+		Mutex_Release( &node->Lock );
+		free(pb);
+		_CloseNode(node);
+	}
+
+	Mutex_Release( &glVFS_MMapBlocks );
+	return freed;
+}
+
+static void VFS_MMap_int_SetFlags(tVAddr VAddr, int Protection, int Flags)
+{
+	if( !(Protection & MMAP_PROT_WRITE) )
+		MM_SetFlags(VAddr, MM_PFLAG_RO, MM_PFLAG_RO);
+	else
+		MM_SetFlags(VAddr, 0, MM_PFLAG_RO);
+
+	if( Protection & MMAP_PROT_EXEC )
+		MM_SetFlags(VAddr, MM_PFLAG_EXEC, MM_PFLAG_EXEC);
+	else
+		MM_SetFlags(VAddr, 0, MM_PFLAG_EXEC);
+
+	if( Flags & MMAP_MAP_PRIVATE )
+		MM_SetFlags(VAddr, MM_PFLAG_COW, MM_PFLAG_COW);
+}
+
+/**
+ * \brief Map pages of a file, starting at \a VAddr
+ * \param MaxPages	Maximum number of pages to fill, stops early at the first present page
+ * \return Number of pages mapped (zero on error)
+ * \note Node->Lock must be held
+ *
+ * Pages already in the node's cache are shared, runs of uncached pages are
+ * read with a single request to the driver.
+ */
+static int VFS_MMap_int_FillPages(tVFS_Node *Node, tVAddr VAddr, Uint64 PageNum, int MaxPages, int Protection, int Flags)
+{
+	tVFS_NodeType	*nt = Node->Type;
+	 int	done = 0;
+
+	if( !nt )
+		return 0;
+
+	while( done < MaxPages )
+	{
+		tVAddr	va = VAddr + done * PAGE_SIZE;
+		tPAddr	*slot;
+		 int	run;
+
+		if( done && MM_GetPhysAddr( (void*)va ) )
+			break;
+
+		slot = VFS_MMap_int_GetCacheSlot(Node, PageNum + done);
+		if( !slot )
+			break;
+
+		if( *slot )
+		{
+			MM_Map( va, *slot );
+			MM_RefPhys( *slot );
+			LOG("Cached map %X to %p (%P)", (PageNum+done)*PAGE_SIZE, va, *slot);
+			run = 1;
+		}
+		else if( nt->MMap )
+		{
+			nt->MMap(Node, (PageNum+done)*PAGE_SIZE, PAGE_SIZE, (void*)va);
+			*slot = MM_GetPhysAddr( (void*)va );
+			MM_SetPageNode( *slot, Node );
+			MM_RefPhys( *slot );
+			run = 1;
+		}
+		else
+		{
+			size_t	read_len;
+
+			// Collect the run of pages that need to be read
+			for( run = 0; done + run < MaxPages; run ++ )
 			{
-				tVFS_MMapPageBlock	*oldpb = pb;
-				pb = malloc( sizeof(tVFS_MMapPageBlock) );
-				pb->Next = oldpb->Next;
-				pb->BaseOffset = pagenum;
-				memset(pb->PhysAddrs, 0, sizeof(pb->PhysAddrs));
-				oldpb->Next = pb;
+				tPAddr	*s;
+				if( run ) {
+					if( MM_GetPhysAddr( (void*)(va + run*PAGE_SIZE) ) )
+						break;
+					s = VFS_MMap_int_GetCacheSlot(Node, PageNum + done + run);
+					if( !s || *s )
+						break;
+				}
+				if( MM_Allocate(va + run*PAGE_SIZE) == 0 )
+					break;
 			}
+			if( run == 0 )
+				break;
+
+			// TODO: Clip read length
+			read_len = nt->Read(Node, (PageNum+done)*PAGE_SIZE, run*PAGE_SIZE, (void*)va, 0);
+			if( read_len > run*PAGE_SIZE )
+				read_len = 0;
+			if( read_len != run*PAGE_SIZE )
+				memset( (void*)(va+read_len), 0, run*PAGE_SIZE-read_len );
+
+			for( int i = 0; i < run; i ++ )
+			{
+				tPAddr	paddr = MM_GetPhysAddr( (void*)(va + i*PAGE_SIZE) );
+				slot = VFS_MMap_int_GetCacheSlot(Node, PageNum + done + i);
+				if( !slot )
+					continue ;	// Stays private to this mapping
+				*slot = paddr;
+				MM_SetPageNode( paddr, Node );
+				MM_RefPhys( paddr );
+			}
+			LOG("Read and map %X+%i pages to %p", (PageNum+done)*PAGE_SIZE, run, va);
+		}
+
+		for( int i = 0; i < run; i ++ )
+		{
+			Node->ReferenceCount ++;
+			VFS_MMap_int_SetFlags(va + i*PAGE_SIZE, Protection, Flags);
+			if( (Protection & MMAP_PROT_WRITE) && !(Flags & MMAP_MAP_PRIVATE) )
+				VFS_MMap_int_MarkShared(Node, PageNum + done + i);
+		}
+		done += run;
+	}
+
+	return done;
+}
+
+/**
+ * \brief Fill a page of a deferred file mapping
+ * \param Addr	Faulting address
+ * \param bWrite	Fault was caused by a write
+ * \return 0 if the page is now mapped, 1 if \a Addr isn't in a mapping
+ * \note Called by the architecture's page fault handler (with IRQs enabled)
+ */
+int VFS_MMap_PageFault(tVAddr Addr, int bWrite)
+{
+	tProcess	*proc = Proc_GetCurThread()->Process;
+	tVFS_MMapArea	*area;
+	tVAddr	page = Addr & ~(PAGE_SIZE-1);
+	 int	npages, rv = 1;
+
+	Mutex_Acquire( &proc->MMapLock );
+	for( area = proc->MMapAreas; area && area->End <= page; area = area->Next )
+		;
+	if( !area || area->Base > page ) {
+		Mutex_Release( &proc->MMapLock );
+		return 1;
+	}
+	ENTER("pAddr bbWrite", Addr, bWrite);
+
+	if( bWrite && !(area->Protection & MMAP_PROT_WRITE) ) {
+		LOG("Write to read-only mapping");
+	}
+	// Another thread got here first
+	else if( MM_GetPhysAddr( (void*)page ) ) {
+		rv = 0;
+	}
+	else {
+		// Read ahead within the mapping
+		npages = (area->End - page) / PAGE_SIZE;
+		if( npages > MMAP_READAHEAD_PAGES )
+			npages = MMAP_READAHEAD_PAGES;
+		Mutex_Acquire( &area->Node->Lock );
+		npages = VFS_MMap_int_FillPages(area->Node, page,
+			area->PageNum + (page - area->Base) / PAGE_SIZE, npages,
+			area->Protection, area->Flags);
+		Mutex_Release( &area->Node->Lock );
+		LOG("Filled %i pages", npages);
+		rv = (npages == 0);
+	}
+
+	Mutex_Release( &proc->MMapLock );
+	LEAVE('i', rv);
+	return rv;
+}
+
+/**
+ * \brief Fault in any deferred pages in a buffer
+ * \note Used before checking that a user buffer is valid
+ */
+void VFS_MMap_Populate(const void *Addr, size_t Length)
+{
+	tVAddr	page = (tVAddr)Addr & ~(PAGE_SIZE-1);
+	tVAddr	end = (tVAddr)Addr + Length;
+
+	for( ; page < end; page += PAGE_SIZE )
+	{
+		if( !MM_GetPhysAddr( (void*)page ) && VFS_MMap_PageFault(page, 0) )
+			break;
+	}
+}
+
+/**
+ * \brief Count the cached pages of part of a file
+ * \param FD	Open handle to the file
+ * \param Offset	Start of the range (bytes)
+ * \param Length	Length of the range (bytes)
+ * \param Resident	Incremented for each page in the cache
+ * \param Shared	Incremented for each cached page mapped by more than one address space
+ */
+void VFS_MMap_CountCached(int FD, Uint64 Offset, size_t Length, size_t *Resident, size_t *Shared)
+{
+	tVFS_Handle	*h = VFS_GetHandle(FD);
+	Uint64	first = Offset / PAGE_SIZE;
+	Uint64	last = (Offset + Length + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	if( !h || !h->Node )
+		return ;
+
+	Mutex_Acquire( &h->Node->Lock );
+	for( tVFS_MMapPageBlock *pb = h->Node->MMapInfo; pb && pb->BaseOffset < last; pb = pb->Next )
+	{
+		for( int i = 0; i < MMAP_PAGES_PER_BLOCK; i ++ )
+		{
+			Uint64	page = pb->BaseOffset + i;
+			if( page < first || page >= last || !pb->PhysAddrs[i] )
+				continue ;
+			(*Resident) ++;
+			// One reference is the cache's own
+			if( MM_GetRefCount(pb->PhysAddrs[i]) > 2 )
+				(*Shared) ++;
 		}
 	}
-	
 	Mutex_Release( &h->Node->Lock );
+}
 
-	LEAVE('p', mapping_base);
-	return (void*)mapping_base;
+/**
+ * \brief Check if any part of a region is claimed by a deferred mapping
+ */
+int VFS_MMap_IsReserved(tVAddr Addr, size_t Length)
+{
+	tProcess	*proc = Proc_GetCurThread()->Process;
+	tVFS_MMapArea	*area;
+	 int	ret = 0;
+
+	Mutex_Acquire( &proc->MMapLock );
+	for( area = proc->MMapAreas; area && area->Base < Addr + Length; area = area->Next )
+	{
+		if( area->End > Addr ) {
+			ret = 1;
+			break;
+		}
+	}
+	Mutex_Release( &proc->MMapLock );
+	return ret;
+}
+
+/**
+ * \brief Remove (or trim) areas overlapping [Base, End)
+ * \note Proc->MMapLock must be held
+ */
+static void VFS_MMap_int_RemoveAreas(tProcess *Proc, tVAddr Base, tVAddr End)
+{
+	tVFS_MMapArea	*area, *prev = NULL;
+
+	for( area = Proc->MMapAreas; area && area->Base < End; )
+	{
+		tVFS_MMapArea	*next = area->Next;
+		if( area->End <= Base ) {
+			prev = area;
+			area = next;
+			continue ;
+		}
+
+		if( area->Base < Base && area->End > End )
+		{
+			// Split in two
+			tVFS_MMapArea	*tail = malloc( sizeof(tVFS_MMapArea) );
+			if( tail ) {
+				*tail = *area;
+				tail->Base = End;
+				tail->PageNum += (End - area->Base) / PAGE_SIZE;
+				_ReferenceNode(tail->Node);
+				area->Next = tail;
+			}
+			area->End = Base;
+			break;
+		}
+		else if( area->Base < Base ) {
+			area->End = Base;
+			prev = area;
+		}
+		else if( area->End > End ) {
+			area->PageNum += (End - area->Base) / PAGE_SIZE;
+			area->Base = End;
+			break;
+		}
+		else {
+			if( prev )
+				prev->Next = next;
+			else
+				Proc->MMapAreas = next;
+			_CloseNode(area->Node);
+			free(area);
+		}
+		area = next;
+	}
+}
+
+/**
+ * \brief Duplicate the current process's deferred mappings into a new process
+ */
+void VFS_MMap_CloneAreas(tProcess *Dest)
+{
+	tProcess	*proc = Proc_GetCurThread()->Process;
+	tVFS_MMapArea	*area, **dest_ptr = &Dest->MMapAreas;
+
+	Mutex_Acquire( &proc->MMapLock );
+	for( area = proc->MMapAreas; area; area = area->Next )
+	{
+		tVFS_MMapArea	*new = malloc( sizeof(tVFS_MMapArea) );
+		if( !new ) {
+			Log_Warning("VFS", "VFS_MMap_CloneAreas: Out of memory, %p+%x not copied",
+				area->Base, area->End - area->Base);
+			continue ;
+		}
+		*new = *area;
+		_ReferenceNode(new->Node);
+		*dest_ptr = new;
+		dest_ptr = &new->Next;
+	}
+	*dest_ptr = NULL;
+	Mutex_Release( &proc->MMapLock );
+}
+
+/**
+ * \brief Release all deferred mappings of a process (on exit or exec)
+ */
+void VFS_MMap_ClearAreas(tProcess *Process)
+{
+	Mutex_Acquire( &Process->MMapLock );
+	while( Process->MMapAreas )
+	{
+		tVFS_MMapArea	*area = Process->MMapAreas;
+		Process->MMapAreas = area->Next;
+		_CloseNode(area->Node);
+		free(area);
+	}
+	Mutex_Release( &Process->MMapLock );
 }
 
 int VFS_MUnmap(void *Addr, size_t Length)
 {
+	tProcess	*proc = Proc_GetCurThread()->Process;
+	tVAddr	base = (tVAddr)Addr & ~(PAGE_SIZE-1);
+	tVAddr	end = ((tVAddr)Addr + Length + PAGE_SIZE-1) & ~(PAGE_SIZE-1);
+
+	if( base >= USER_MAX )
+		return 0;
+
+	Mutex_Acquire( &proc->MMapLock );
+	VFS_MMap_int_RemoveAreas(proc, base, end);
+	for( ; base < end; base += PAGE_SIZE )
+	{
+		#ifdef MM_LARGE_PAGE_SIZE
+		// Large pages (from MMAP_MAP_HUGE) go whole, or are split when only
+		// part of one is being unmapped
+		if( base == ((tVAddr)Addr & ~(PAGE_SIZE-1)) || !(base & (MM_LARGE_PAGE_SIZE-1)) )
+		{
+			tVAddr	lbase = base & ~(tVAddr)(MM_LARGE_PAGE_SIZE-1);
+			tPAddr	phys;
+			Uint	flags;
+			if( (1ULL << MM_GetPageEntry(lbase, &phys, &flags)) == MM_LARGE_PAGE_SIZE )
+			{
+				if( base == lbase && lbase + MM_LARGE_PAGE_SIZE <= end ) {
+					MM_Deallocate(base);
+					base += MM_LARGE_PAGE_SIZE - PAGE_SIZE;
+					continue ;
+				}
+				if( MM_SplitLarge(base) ) {
+					Log_Warning("VFS", "VFS_MUnmap: Can't split large page at %p, left mapped", lbase);
+					if( lbase + MM_LARGE_PAGE_SIZE < end )
+						base = lbase + MM_LARGE_PAGE_SIZE - PAGE_SIZE;
+					else
+						base = end - PAGE_SIZE;
+					continue ;
+				}
+			}
+		}
+		#endif
+		if( MM_GetPhysAddr( (void*)base ) )
+			MM_Deallocate(base);
+	}
+	Mutex_Release( &proc->MMapLock );
 	return 0;
 }
@@ -20,7 +20,7 @@ void	VFS_int_Unmount(tVFS_Mount *Mount);
 void	VFS_UpdateMountFile(void);
 
 // === GLOBALS ===
-tRWLock	glVFS_MountList;
+tPCPURWLock	glVFS_MountList;
 tVFS_Mount	*gVFS_Mounts;
 tVFS_Mount	*gVFS_RootMount = NULL;
 Uint32	giVFS_NextMountIdent = 1;
@@ -171,7 +171,7 @@ int VFS_Mount(const char *Device, const char *MountPoint, const char *Filesystem
 	if(!gVFS_RootMount)	gVFS_RootMount = mnt;
 	
 	// Add to mount list
-	RWLock_AcquireWrite( &glVFS_MountList );
+	PCPURWLock_AcquireWrite( &glVFS_MountList );
 	{
 		mnt->Next = NULL;
 		if(gVFS_Mounts) {
@@ -183,7 +183,7 @@ int VFS_Mount(const char *Device, const char *MountPoint, const char *Filesystem
 			gVFS_Mounts = mnt;
 		}
 	}
-	RWLock_Release( &glVFS_MountList );
+	PCPURWLock_Release( &glVFS_MountList );
 	
 	Log_Log("VFS", "Mounted '%s' to '%s' ('%s')", Device, MountPoint, fs->Name);
 	
@@ -224,13 +224,13 @@ void VFS_int_Unmount(tVFS_Mount *Mount)
 int VFS_Unmount(const char *Mountpoint)
 {
 	tVFS_Mount	*mount, *prev = NULL;
-	RWLock_AcquireWrite( &glVFS_MountList );
+	PCPURWLock_AcquireWrite( &glVFS_MountList );
 	for( mount = gVFS_Mounts; mount; prev = mount, mount = mount->Next )
 	{
 		if( strcmp(Mountpoint, mount->MountPoint) == 0 ) {
 			if( mount->OpenHandleCount ) {
 				LOG("Mountpoint busy");
-				RWLock_Release(&glVFS_MountList);
+				PCPURWLock_Release(&glVFS_MountList);
 				Log_Log("VFS", "Unmount of '%s' deferred, still busy (%i open handles)",
 					Mountpoint, mount->OpenHandleCount);
 				return EBUSY;
@@ -242,7 +242,7 @@ int VFS_Unmount(const char *Mountpoint)
 			break;
 		}
 	}
-	RWLock_Release( &glVFS_MountList );
+	PCPURWLock_Release( &glVFS_MountList );
 	if( !mount ) {
 		LOG("Mountpoint not found");
 		return ENOENT;
@@ -260,10 +260,10 @@ int VFS_UnmountAll(void)
 	 int	nUnmounted = 0;
 	tVFS_Mount	*mount, *prev = NULL, *next;
 
-	RWLock_AcquireWrite( &glVFS_MountList );
+	PCPURWLock_AcquireWrite( &glVFS_MountList );
 	// If we've unmounted the final filesystem, all good
 	if( gVFS_Mounts == NULL) {
-		RWLock_Release( &glVFS_MountList );
+		PCPURWLock_Release( &glVFS_MountList );
 		
 		// Final unmount means VFS completely deinited
 		VFS_Deinit();
@@ -292,7 +292,7 @@ int VFS_UnmountAll(void)
 		mount = prev;
 		nUnmounted ++;
 	}
-	RWLock_Release( &glVFS_MountList );
+	PCPURWLock_Release( &glVFS_MountList );
 
 	VFS_UpdateMountFile();
 
@@ -306,7 +306,7 @@ tVFS_Mount *VFS_GetMountByIdent(Uint32 MountID)
 {
 	tVFS_Mount	*mnt;
 	
-	RWLock_AcquireRead(&glVFS_MountList);
+	PCPURWLock_AcquireRead(&glVFS_MountList);
 	for(mnt = gVFS_Mounts; mnt; mnt = mnt->Next)
 	{
 		if(mnt->Identifier == MountID)
@@ -314,7 +314,7 @@ tVFS_Mount *VFS_GetMountByIdent(Uint32 MountID)
 	}
 	if(mnt)
 		mnt->OpenHandleCount ++;
-	RWLock_Release(&glVFS_MountList);
+	PCPURWLock_Release(&glVFS_MountList);
 	return mnt;
 }
 
@@ -332,17 +332,17 @@ void VFS_UpdateMountFile(void)
 	// Format:
 	// <device>\t<location>\t<type>\t<options>\n
 	
-	RWLock_AcquireRead( &glVFS_MountList );
+	PCPURWLock_AcquireRead( &glVFS_MountList );
 	for(mnt = gVFS_Mounts; mnt; mnt = mnt->Next)
 	{
 		len += 4 + strlen(mnt->Device) + strlen(mnt->MountPoint)
 			+ strlen(mnt->Filesystem->Name) + strlen(mnt->Options);
 	}
-	RWLock_Release( &glVFS_MountList );
+	PCPURWLock_Release( &glVFS_MountList );
 	
 	buf = malloc( len + 1 );
 	len = 0;
-	RWLock_AcquireRead( &glVFS_MountList );
+	PCPURWLock_AcquireRead( &glVFS_MountList );
 	for(mnt = gVFS_Mounts; mnt; mnt = mnt->Next)
 	{
 		strcpy( &buf[len], mnt->Device );
@@ -361,7 +361,7 @@ void VFS_UpdateMountFile(void)
 		len += strlen(mnt->Options);
 		buf[len++] = '\n';
 	}
-	RWLock_Release( &glVFS_MountList );
+	PCPURWLock_Release( &glVFS_MountList );
 	buf[len] = 0;
 	
 	SysFS_UpdateFile( giVFS_MountFileID, buf, len );
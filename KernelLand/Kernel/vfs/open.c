@@ -228,7 +228,7 @@ restart_parse:
 	
 	// Find Mountpoint
 	longestMount = gVFS_RootMount;
-	RWLock_AcquireRead( &glVFS_MountList );
+	PCPURWLock_AcquireRead( &glVFS_MountList );
 	for(mnt = gVFS_Mounts; mnt; mnt = mnt->Next)
 	{
 		// Quick Check
@@ -250,7 +250,7 @@ restart_parse:
 			}
 			if(MountPoint)
 				*MountPoint = mnt;
-			RWLock_Release( &glVFS_MountList );
+			PCPURWLock_Release( &glVFS_MountList );
 			LOG("Mount %p root", mnt);
 			_ReferenceMount(mnt, "ParsePath - Mount Root");
 			LEAVE('p', mnt->RootNode);
@@ -265,7 +265,7 @@ restart_parse:
 	}
 	
 	_ReferenceMount(longestMount, "ParsePath");
-	RWLock_Release( &glVFS_MountList );
+	PCPURWLock_Release( &glVFS_MountList );
 	
 	// Save to shorter variable
 	mnt = longestMount;
@@ -6,6 +6,7 @@
 #define VERSION	VER2(0,10)
 #include <acess.h>
 #include <api_drv_common.h>
+#include <rwlock.h>
 #include "ipstack.h"
 #include "link.h"
 
@@ -34,6 +35,7 @@ tRoute	*IPStack_FindRoute(int AddressType, tInterface *Interface, void *Address)
 
 // === GLOBALS ===
  int	giIP_NextRouteId = 1;
+tPCPURWLock	glIP_Routes;	//!< Protects gIP_Routes (read on every packet sent)
 tRoute	*gIP_Routes;
 tRoute	*gIP_RoutesEnd;
 tVFS_NodeType	gIP_RouteNodeType = {
@@ -62,8 +64,12 @@ int IPStack_RouteDir_ReadDir(tVFS_Node *Node, int Pos, char Dest[FILENAME_MAX])
 {
 	tRoute	*rt;
 	
+	PCPURWLock_AcquireRead( &glIP_Routes );
 	for(rt = gIP_Routes; rt && Pos --; rt = rt->Next);
-	if( !rt )	return -EINVAL;
+	if( !rt ) {
+		PCPURWLock_Release( &glIP_Routes );
+		return -EINVAL;
+	}
 	
 	{
 		 int	addrlen = IPStack_GetAddressSize(rt->AddressType);
@@ -71,8 +77,9 @@ int IPStack_RouteDir_ReadDir(tVFS_Node *Node, int Pos, char Dest[FILENAME_MAX])
 		ofs = sprintf(Dest, "%i:", rt->AddressType);
 		ofs += Hex(Dest+ofs, addrlen, rt->Network);
 		sprintf(Dest+ofs, ":%i:%i", rt->SubnetBits, rt->Metric);
-		return 0;
 	}
+	PCPURWLock_Release( &glIP_Routes );
+	return 0;
 }
 
 /**
@@ -141,12 +148,18 @@ tVFS_Node *IPStack_RouteDir_FindDir(tVFS_Node *Node, const char *Name, Uint Flag
 		if( Name[ofs] != '\0' )	return NULL;
 		if( num < 0)	return NULL;		
 
+		tVFS_Node	*ret = NULL;
+		PCPURWLock_AcquireRead( &glIP_Routes );
 		for( tRoute *rt = gIP_Routes; rt; rt = rt->Next )
 		{
-			if( rt->Node.Inode > num )	return NULL;
-			if( rt->Node.Inode == num )	return &rt->Node;
+			if( rt->Node.Inode > num )	break;
+			if( rt->Node.Inode == num ) {
+				ret = &rt->Node;
+				break;
+			}
 		}
-		return NULL;
+		PCPURWLock_Release( &glIP_Routes );
+		return ret;
 	}
 	else
 	{
@@ -159,7 +172,9 @@ tVFS_Node *IPStack_RouteDir_FindDir(tVFS_Node *Node, const char *Name, Uint Flag
 		
 		_Route_ParseRouteName(Name, addrData, &subnet_bits, &metric);
 
+		PCPURWLock_AcquireRead( &glIP_Routes );
 		tRoute *rt = _Route_FindExactRoute(type, addrData, subnet_bits, metric);
+		PCPURWLock_Release( &glIP_Routes );
 		if(rt)	return &rt->Node;
 		return NULL;
 	}
@@ -192,7 +207,10 @@ tVFS_Node *IPStack_RouteDir_MkNod(tVFS_Node *Node, const char *Name, Uint Flags)
 	_Route_ParseRouteName(Name, addrdata, &subnet, &metric);
 
 	// Check for duplicates
-	if( _Route_FindExactRoute(type, addrdata, subnet, metric) ) {
+	PCPURWLock_AcquireRead( &glIP_Routes );
+	tRoute *dup = _Route_FindExactRoute(type, addrdata, subnet, metric);
+	PCPURWLock_Release( &glIP_Routes );
+	if( dup ) {
 		errno = EEXIST;
 		return NULL;
 	}
@@ -212,16 +230,19 @@ int IPStack_RouteDir_Unlink(tVFS_Node *Node, const char *OldName)
 	
 	if( Threads_GetUID() != 0 )	return -EACCES;
 
+	 int	type = _Route_ParseRouteName(OldName, NULL, NULL, NULL);
+	if(type <= 0)	return -EINVAL;
+	Uint8	addr[IPStack_GetAddressSize(type)];
+	 int	subnet, metric;
+	_Route_ParseRouteName(OldName, addr, &subnet, &metric);
+
+	PCPURWLock_AcquireWrite( &glIP_Routes );
 	// Get the original route entry
-	{
-		 int	type = _Route_ParseRouteName(OldName, NULL, NULL, NULL);
-		if(type <= 0)	return -EINVAL;
-		Uint8	addr[IPStack_GetAddressSize(type)];
-		 int	subnet, metric;
-		_Route_ParseRouteName(OldName, addr, &subnet, &metric);
-		
-		rt = _Route_FindExactRoute(type, addr, subnet, metric);
-	}	
+	rt = _Route_FindExactRoute(type, addr, subnet, metric);
+	if( !rt ) {
+		PCPURWLock_Release( &glIP_Routes );
+		return -ENOENT;
+	}
 
 	// Delete the route
 	tRoute	*prev = NULL;
@@ -231,10 +252,17 @@ int IPStack_RouteDir_Unlink(tVFS_Node *Node, const char *OldName)
 		prev->Next = rt->Next;
 	else
 		gIP_Routes = rt->Next;
+	if( gIP_RoutesEnd == rt )
+		gIP_RoutesEnd = prev;
+	PCPURWLock_Release( &glIP_Routes );
+	
 	free(rt);
 	return 0;
 }
 
+/**
+ * \note Caller must hold glIP_Routes
+ */
 tRoute *_Route_FindExactRoute(int Type, void *Network, int Subnet, int Metric)
 {
 	for(tRoute *rt = gIP_Routes; rt; rt = rt->Next)
@@ -399,6 +427,7 @@ tRoute *IPStack_Route_Create(int AddrType, void *Network, int SubnetBits, int Me
 
 
 	// Add to list
+	PCPURWLock_AcquireWrite( &glIP_Routes );
 	if( gIP_RoutesEnd ) {
 		gIP_RoutesEnd->Next = rt;
 		gIP_RoutesEnd = rt;
@@ -406,6 +435,7 @@ tRoute *IPStack_Route_Create(int AddrType, void *Network, int SubnetBits, int Me
 	else {
 		gIP_Routes = gIP_RoutesEnd = rt;
 	}
+	PCPURWLock_Release( &glIP_Routes );
 	
 //	Log_Log("IPStack", "Route entry for '%s' created", InterfaceName);
 	
@@ -506,6 +536,7 @@ tRoute *IPStack_FindRoute(int AddressType, tInterface *Interface, void *Address)
 	addrSize = IPStack_GetAddressSize(AddressType);
 	
 	// Check against explicit routes
+	PCPURWLock_AcquireRead( &glIP_Routes );
 	for( rt = gIP_Routes; rt; rt = rt->Next )
 	{
 		// Check interface
@@ -534,6 +565,7 @@ tRoute *IPStack_FindRoute(int AddressType, tInterface *Interface, void *Address)
 		
 		best = rt;
 	}
+	PCPURWLock_Release( &glIP_Routes );
 	
 	// Check against implicit routes
 	if( !best && !Interface )
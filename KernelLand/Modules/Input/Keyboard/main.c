@@ -25,6 +25,7 @@
 extern void	Threads_ToggleTrace(int TID);
 extern void	Threads_Dump(void);
 extern void	Heap_Stats(void);
+extern void	Mutex_DumpStats(void);
 #endif
 
 // === PROTOTYPES ===
@@ -292,6 +293,8 @@ void Keyboard_HandleKey(tKeyboard *Source, Uint32 HIDKeySym)
 		case 'h':	Heap_Stats();	return;
 		// PMem Statistics
 		case 'm':	MM_DumpStatistics();	return;
+		// Mutex Contention Statistics
+		case 'l':	Mutex_DumpStats();	return;
 		// Dump Structure
 		case 's':	return;
 		}
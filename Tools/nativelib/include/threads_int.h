@@ -59,6 +59,7 @@ struct sThread
 
 	 int	RetStatus;
 	void	*WaitPointer;
+	 int	CurCPU;	// Always 0, checked by the kernel's mutex/rwlock code
 
 	// Init Only
 	void	(*SpawnFcn)(void*);
@@ -0,0 +1,841 @@
+/*
+ * Acess2 Prelinker
+ * - By John Hodge (thePowersGang)
+ *
+ * prelink.c
+ * - Gives a set of shared libraries fixed load addresses and pre-applies their
+ *   relocations, so ld-acess can skip relocating them at process start
+ *
+ * Usage: prelink [-n] [-v] [-b <top address>] <library.so> [...]
+ *   -b	Highest address to use, libraries are placed downwards from here
+ *   	(default 0xB0000000 for ELF32, 0x600000000000 for ELF64)
+ *   -n	Dry run, print the layout without writing anything
+ *   -v	List the relocations left for ld-acess
+ *
+ * Every library that should share the layout must be given in the same run
+ * (e.g. all of every .so in Usermode/Output/<arch>/Libs). The run stamps them all with
+ * one DT_GNU_PRELINKED value, and ld-acess only trusts a prelinked library if
+ * each of its dependencies carries the same stamp. Anything else (a library
+ * loaded elsewhere, a dependency rebuilt or not prelinked, an executable that
+ * interposes a symbol) falls back to normal relocation.
+ *
+ * Only relocations whose result doesn't depend on the original contents are
+ * pre-applied (relative, GLOB_DAT, JMP_SLOT and RELA absolute), so the image
+ * can still be relocated from scratch. Symbols defined by more than one of the
+ * libraries, or not defined by any (e.g. ld-acess's system calls) are left for
+ * ld-acess, sorted to the front of each table.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define PAGE_SIZE	0x1000
+#define BASE_ALIGN	0x10000	// Kernel's BIN_GRANUALITY
+#define MAX_IMAGES	64
+#define MAX_NEEDED	16
+#define MAX_LOADS	8
+
+// --- ELF constants (see Usermode/Libraries/ld-acess.so_src/elf32.h) ---
+#define ET_DYN	3
+#define EM_386	3
+#define EM_X86_64	62
+#define PT_LOAD	1
+#define PT_DYNAMIC	2
+#define PT_GNU_STACK	0x6474E551
+#define SHT_SYMTAB	2
+#define SHT_DYNSYM	11
+#define SHF_ALLOC	2
+#define SHN_UNDEF	0
+#define SHN_LORESERVE	0xFF00
+#define STB_GLOBAL	1
+#define STB_WEAK	2
+#define STT_TLS	6
+
+enum {
+	DT_NULL, DT_NEEDED, DT_PLTRELSZ, DT_PLTGOT, DT_HASH, DT_STRTAB, DT_SYMTAB,
+	DT_RELA, DT_RELASZ, DT_RELAENT, DT_STRSZ, DT_SYMENT, DT_INIT, DT_FINI,
+	DT_SONAME, DT_RPATH, DT_SYMBOLIC, DT_REL, DT_RELSZ, DT_RELENT, DT_PLTREL,
+	DT_DEBUG, DT_TEXTREL, DT_JMPREL, DT_BIND_NOW, DT_INIT_ARRAY, DT_FINI_ARRAY,
+	DT_INIT_ARRAYSZ, DT_FINI_ARRAYSZ, DT_RUNPATH, DT_FLAGS, DT_PREINIT_ARRAY = 32
+};
+#define DT_GNU_PRELINKED	0x6FFFFDF5
+#define DT_GNU_HASH	0x6FFFFEF5
+#define DT_VERSYM	0x6FFFFFF0
+#define DT_RELACOUNT	0x6FFFFFF9
+#define DT_RELCOUNT	0x6FFFFFFA
+#define DT_VERDEF	0x6FFFFFFC
+#define DT_VERNEED	0x6FFFFFFE
+#define DT_ACESS_PRELINK_RELCOUNT	0x6A000001
+#define DT_ACESS_PRELINK_PLTCOUNT	0x6A000002
+#define DF_TEXTREL	0x4
+
+#define R_386_NONE	0
+#define R_386_GLOB_DAT	6
+#define R_386_JMP_SLOT	7
+#define R_386_RELATIVE	8
+#define R_X86_64_NONE	0
+#define R_X86_64_64	1
+#define R_X86_64_GLOB_DAT	6
+#define R_X86_64_JUMP_SLOT	7
+#define R_X86_64_RELATIVE	8
+
+// --- Field offsets (ELF32 : ELF64) ---
+#define W(I)	((I)->b64 ? 8 : 4)	// Address size
+#define EH_ENTRY	24
+#define EH_PHOFF(I)	((I)->b64 ? 32 : 28)
+#define EH_SHOFF(I)	((I)->b64 ? 40 : 32)
+#define EH_PHNUM(I)	((I)->b64 ? 56 : 44)
+#define EH_SHNUM(I)	((I)->b64 ? 60 : 48)
+#define PH_ENTSIZE(I)	((I)->b64 ? 56 : 32)
+#define PH_OFFSET(I)	((I)->b64 ?  8 :  4)
+#define PH_VADDR(I)	((I)->b64 ? 16 :  8)
+#define PH_PADDR(I)	((I)->b64 ? 24 : 12)
+#define PH_FILESZ(I)	((I)->b64 ? 32 : 16)
+#define PH_MEMSZ(I)	((I)->b64 ? 40 : 20)
+#define SH_ENTSIZE(I)	((I)->b64 ? 64 : 40)
+#define SH_FLAGS	8
+#define SH_ADDR(I)	((I)->b64 ? 16 : 12)
+#define SH_OFFSET(I)	((I)->b64 ? 24 : 16)
+#define SH_SIZE(I)	((I)->b64 ? 32 : 20)
+#define SYM_ENTSIZE(I)	((I)->b64 ? 24 : 16)
+#define SYM_VALUE(I)	((I)->b64 ?  8 :  4)
+#define SYM_INFO(I)	((I)->b64 ?  4 : 12)
+#define SYM_SHNDX(I)	((I)->b64 ?  6 : 14)
+
+typedef struct
+{
+	uint64_t	VAddr;
+	uint64_t	Offset;
+	uint64_t	FileSize;
+} tLoadSeg;
+
+typedef struct
+{
+	uint64_t	Ofs;	// File offset of the table
+	uint64_t	Size;	// Bytes
+	 int	bRela;
+	 int	NumRuntime;	// Entries left for ld-acess
+} tRelTable;
+
+typedef struct sImage
+{
+	const char	*Path;
+	const char	*Name;	// Basename, matched against DT_NEEDED
+	uint8_t	*Data;
+	size_t	Size;
+	 int	b64;
+	 int	Machine;
+	 int	bSkip;	// Not prelinked (problem found, or a dependency isn't in the set)
+
+	 int	NumLoads;
+	tLoadSeg	Loads[MAX_LOADS];	// Original addresses
+	uint64_t	OldBase, NewBase, Span;
+
+	uint64_t	DynOfs;
+	 int	DynCount;	// Including spare DT_NULLs
+	uint64_t	DynSymOfs, DynStrOfs;
+	 int	NumDynSyms;
+	uint64_t	PltGotOfs;
+	tRelTable	Rel;	// DT_REL or DT_RELA
+	tRelTable	Plt;	// DT_JMPREL
+
+	 int	NumNeeded;
+	 int	Needed[MAX_NEEDED];	// Index in gaImages, -1 for ld-acess
+	 int	bInClosure;	// Scratch for FindDefinition
+	 int	NumPreapplied;
+} tImage;
+
+// === PROTOTYPES ===
+ int	main(int argc, char *argv[]);
+void	PrintUsage(const char *ProgName);
+ int	LoadImage(tImage *Img, const char *Path);
+ int	ParseDynamic(tImage *Img);
+void	ShiftImage(tImage *Img);
+void	PrelinkImage(tImage *Img);
+ int	FindDefinition(const char *Name, uint64_t *Value);
+void	MarkClosure(tImage *Img);
+uint32_t	LayoutStamp(void);
+ int	SetDynTag(tImage *Img, uint64_t Tag, uint64_t Value);
+ int	WriteImage(tImage *Img);
+uint64_t	Rd(tImage *Img, uint64_t Ofs, int Size);
+void	Wr(tImage *Img, uint64_t Ofs, int Size, uint64_t Value);
+uint64_t	AddrToOfs(tImage *Img, uint64_t Addr);
+
+// === GLOBALS ===
+ int	gbDryRun;
+ int	gbVerbose;
+ int	giNumImages;
+tImage	gaImages[MAX_IMAGES];
+
+// === CODE ===
+int main(int argc, char *argv[])
+{
+	uint64_t	top = 0;
+	 int	changed;
+
+	for( int i = 1; i < argc; i ++ )
+	{
+		if( argv[i][0] != '-' ) {
+			if( giNumImages == MAX_IMAGES ) {
+				fprintf(stderr, "Too many libraries (max %i)\n", MAX_IMAGES);
+				return 1;
+			}
+			if( LoadImage(&gaImages[giNumImages], argv[i]) )
+				return 1;
+			giNumImages ++;
+			continue ;
+		}
+		switch( argv[i][1] )
+		{
+		case 'b':
+			if( i + 1 >= argc )	{ PrintUsage(argv[0]); return 1; }
+			top = strtoull(argv[++i], NULL, 0);
+			break;
+		case 'n':	gbDryRun = 1;	break;
+		case 'v':	gbVerbose = 1;	break;
+		default:
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+	if( giNumImages == 0 ) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+	for( int i = 1; i < giNumImages; i ++ )
+	{
+		if( gaImages[i].b64 != gaImages[0].b64 || gaImages[i].Machine != gaImages[0].Machine ) {
+			fprintf(stderr, "%s: Different class/machine to %s\n", gaImages[i].Path, gaImages[0].Path);
+			return 1;
+		}
+	}
+	if( top == 0 )
+		top = gaImages[0].b64 ? 0x600000000000ULL : 0xB0000000;
+
+	// Dependencies (by basename), a library is only usable if all of them are in the set
+	for( int i = 0; i < giNumImages; i ++ )
+	{
+		if( !gaImages[i].bSkip && ParseDynamic(&gaImages[i]) )
+			gaImages[i].bSkip = 1;
+	}
+	do {
+		changed = 0;
+		for( int i = 0; i < giNumImages; i ++ )
+		{
+			tImage	*img = &gaImages[i];
+			for( int j = 0; !img->bSkip && j < img->NumNeeded; j ++ )
+			{
+				if( img->Needed[j] >= 0 && gaImages[img->Needed[j]].bSkip ) {
+					fprintf(stderr, "%s: Needs %s, which is not being prelinked\n",
+						img->Name, gaImages[img->Needed[j]].Name);
+					img->bSkip = 1;
+					changed = 1;
+				}
+			}
+		}
+	} while( changed );
+
+	// Assign bases, downwards from the top
+	for( int i = 0; i < giNumImages; i ++ )
+	{
+		tImage	*img = &gaImages[i];
+		if( img->bSkip )	continue ;
+		top = (top - img->Span) & ~(uint64_t)(BASE_ALIGN-1);
+		img->NewBase = top;
+		ShiftImage(img);
+	}
+
+	// Resolve against the new addresses
+	for( int i = 0; i < giNumImages; i ++ )
+	{
+		if( !gaImages[i].bSkip )
+			PrelinkImage(&gaImages[i]);
+	}
+
+	// Stamp and write
+	uint32_t	stamp = LayoutStamp();
+	printf("Layout %08x\n", stamp);
+	for( int i = 0; i < giNumImages; i ++ )
+	{
+		tImage	*img = &gaImages[i];
+		if( img->bSkip ) {
+			printf("  %-24s skipped\n", img->Name);
+			continue ;
+		}
+		printf("  %-24s 0x%010llx-0x%010llx %5i pre-applied, %i+%i left\n",
+			img->Name, (unsigned long long)img->NewBase, (unsigned long long)(img->NewBase + img->Span),
+			img->NumPreapplied, img->Rel.NumRuntime, img->Plt.NumRuntime);
+		if( SetDynTag(img, DT_GNU_PRELINKED, stamp)
+		 || SetDynTag(img, DT_ACESS_PRELINK_RELCOUNT, img->Rel.NumRuntime)
+		 || SetDynTag(img, DT_ACESS_PRELINK_PLTCOUNT, img->Plt.NumRuntime) )
+			return 1;
+		if( !gbDryRun && WriteImage(img) )
+			return 1;
+	}
+	return 0;
+}
+
+void PrintUsage(const char *ProgName)
+{
+	fprintf(stderr, "Usage: %s [-n] [-v] [-b <top address>] <library.so> [...]\n", ProgName);
+	fprintf(stderr, " -b	Highest address to place libraries at\n");
+	fprintf(stderr, " -n	Dry run, don't modify the libraries\n");
+	fprintf(stderr, " -v	List relocations left for ld-acess\n");
+}
+
+/**
+ * \brief Read a library and check it can be prelinked
+ * \return Non-zero on fatal error (an unsuitable library is just marked bSkip)
+ */
+int LoadImage(tImage *Img, const char *Path)
+{
+	FILE	*fp;
+	uint64_t	phoff, lo = -1, hi = 0;
+
+	memset(Img, 0, sizeof(*Img));
+	Img->Path = Path;
+	Img->Name = strrchr(Path, '/') ? strrchr(Path, '/') + 1 : Path;
+
+	fp = fopen(Path, "rb");
+	if( !fp ) {
+		perror(Path);
+		return 1;
+	}
+	fseek(fp, 0, SEEK_END);
+	Img->Size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	Img->Data = malloc(Img->Size);
+	if( !Img->Data || fread(Img->Data, 1, Img->Size, fp) != Img->Size ) {
+		fprintf(stderr, "%s: Read failed\n", Path);
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+
+	if( Img->Size < 64 || memcmp(Img->Data, "\x7F""ELF", 4) != 0 ) {
+		fprintf(stderr, "%s: Not an ELF file\n", Path);
+		return 1;
+	}
+	// Host and target are both assumed little endian
+	if( Img->Data[5] != 1 ) {
+		fprintf(stderr, "%s: Big-endian images are not supported\n", Path);
+		return 1;
+	}
+	Img->b64 = (Img->Data[4] == 2);
+	Img->Machine = Rd(Img, 18, 2);
+	if( Rd(Img, 16, 2) != ET_DYN ) {
+		fprintf(stderr, "%s: Not a shared library, skipping\n", Path);
+		Img->bSkip = 1;
+		return 0;
+	}
+	if( Img->Machine != (Img->b64 ? EM_X86_64 : EM_386) ) {
+		fprintf(stderr, "%s: Machine type %i not supported\n", Path, Img->Machine);
+		return 1;
+	}
+
+	phoff = Rd(Img, EH_PHOFF(Img), W(Img));
+	for( int i = 0; i < (int)Rd(Img, EH_PHNUM(Img), 2); i ++ )
+	{
+		uint64_t	ph = phoff + i * PH_ENTSIZE(Img);
+		uint32_t	type = Rd(Img, ph, 4);
+		uint64_t	vaddr = Rd(Img, ph + PH_VADDR(Img), W(Img));
+		if( type == PT_LOAD )
+		{
+			if( Img->NumLoads == MAX_LOADS ) {
+				fprintf(stderr, "%s: Too many PT_LOAD segments\n", Path);
+				return 1;
+			}
+			Img->Loads[Img->NumLoads].VAddr = vaddr;
+			Img->Loads[Img->NumLoads].Offset = Rd(Img, ph + PH_OFFSET(Img), W(Img));
+			Img->Loads[Img->NumLoads].FileSize = Rd(Img, ph + PH_FILESZ(Img), W(Img));
+			Img->NumLoads ++;
+			if( vaddr < lo )	lo = vaddr;
+			if( vaddr + Rd(Img, ph + PH_MEMSZ(Img), W(Img)) > hi )
+				hi = vaddr + Rd(Img, ph + PH_MEMSZ(Img), W(Img));
+		}
+		else if( type == PT_DYNAMIC )
+		{
+			Img->DynOfs = Rd(Img, ph + PH_OFFSET(Img), W(Img));
+			Img->DynCount = Rd(Img, ph + PH_FILESZ(Img), W(Img)) / (2*W(Img));
+		}
+	}
+	if( Img->NumLoads == 0 || Img->DynOfs == 0 ) {
+		fprintf(stderr, "%s: No PT_LOAD or PT_DYNAMIC\n", Path);
+		return 1;
+	}
+	Img->OldBase = lo & ~(uint64_t)(PAGE_SIZE-1);
+	Img->Span = hi - Img->OldBase;
+	return 0;
+}
+
+/**
+ * \brief Locate the tables from the dynamic section and match up DT_NEEDED
+ * \return Non-zero if the image can't be prelinked
+ */
+int ParseDynamic(tImage *Img)
+{
+	uint64_t	relAddr = 0, relSize = 0, pltAddr = 0, pltSize = 0;
+	uint64_t	symAddr = 0, strAddr = 0, hashAddr = 0, pltgot = 0;
+	 int	pltRela = 0, spare = 0, nTags = 0;
+	uint64_t	needed[MAX_NEEDED];
+	uint64_t	shoff;
+
+	for( int i = 0; i < Img->DynCount; i ++ )
+	{
+		uint64_t	tag = Rd(Img, Img->DynOfs + i*2*W(Img), W(Img));
+		uint64_t	val = Rd(Img, Img->DynOfs + i*2*W(Img) + W(Img), W(Img));
+		if( tag == DT_NULL ) {
+			spare ++;
+			continue ;
+		}
+		if( spare ) {
+			fprintf(stderr, "%s: Entries after DT_NULL\n", Img->Name);
+			return 1;
+		}
+		switch(tag)
+		{
+		case DT_NEEDED:
+			if( Img->NumNeeded == MAX_NEEDED ) {
+				fprintf(stderr, "%s: Too many DT_NEEDED\n", Img->Name);
+				return 1;
+			}
+			needed[Img->NumNeeded++] = val;
+			break;
+		case DT_SYMTAB:	symAddr = val;	break;
+		case DT_STRTAB:	strAddr = val;	break;
+		case DT_HASH:	hashAddr = val;	break;
+		case DT_PLTGOT:	pltgot = val;	break;
+		case DT_REL:	relAddr = val;	break;
+		case DT_RELSZ:	relSize = val;	break;
+		case DT_RELA:	relAddr = val;	Img->Rel.bRela = 1;	break;
+		case DT_RELASZ:	relSize = val;	break;
+		case DT_JMPREL:	pltAddr = val;	break;
+		case DT_PLTRELSZ:	pltSize = val;	break;
+		case DT_PLTREL:	pltRela = (val == DT_RELA);	break;
+		case DT_TEXTREL:
+			fprintf(stderr, "%s: Has text relocations, skipping\n", Img->Name);
+			return 1;
+		case DT_FLAGS:
+			if( val & DF_TEXTREL ) {
+				fprintf(stderr, "%s: Has text relocations, skipping\n", Img->Name);
+				return 1;
+			}
+			break;
+		case DT_GNU_PRELINKED:
+		case DT_ACESS_PRELINK_RELCOUNT:
+		case DT_ACESS_PRELINK_PLTCOUNT:
+			nTags --;	// Already has a slot
+			break;
+		}
+	}
+	// Three tags, and a terminating DT_NULL
+	nTags += 3;
+	if( spare < nTags + 1 ) {
+		fprintf(stderr, "%s: Only %i spare dynamic entries (need %i), relink with --spare-dynamic-tags\n",
+			Img->Name, spare, nTags + 1);
+		return 1;
+	}
+	if( !symAddr || !strAddr ) {
+		fprintf(stderr, "%s: No DT_SYMTAB/DT_STRTAB\n", Img->Name);
+		return 1;
+	}
+	Img->DynSymOfs = AddrToOfs(Img, symAddr);
+	Img->DynStrOfs = AddrToOfs(Img, strAddr);
+	Img->PltGotOfs = pltgot ? AddrToOfs(Img, pltgot) : 0;
+	if( relAddr ) {
+		Img->Rel.Ofs = AddrToOfs(Img, relAddr);
+		Img->Rel.Size = relSize;
+	}
+	if( pltAddr ) {
+		Img->Plt.Ofs = AddrToOfs(Img, pltAddr);
+		Img->Plt.Size = pltSize;
+		Img->Plt.bRela = pltRela;
+	}
+	// Partitioning the tables separately needs them not to overlap
+	if( relAddr && pltAddr && pltAddr < relAddr + relSize && relAddr < pltAddr + pltSize ) {
+		fprintf(stderr, "%s: DT_JMPREL overlaps DT_REL(A)\n", Img->Name);
+		return 1;
+	}
+
+	// Symbol count, from the section headers if present
+	shoff = Rd(Img, EH_SHOFF(Img), W(Img));
+	for( int i = 0; shoff && i < (int)Rd(Img, EH_SHNUM(Img), 2); i ++ )
+	{
+		uint64_t	sh = shoff + i*SH_ENTSIZE(Img);
+		if( Rd(Img, sh + 4, 4) == SHT_DYNSYM )
+			Img->NumDynSyms = Rd(Img, sh + SH_SIZE(Img), W(Img)) / SYM_ENTSIZE(Img);
+	}
+	if( !Img->NumDynSyms && hashAddr )
+		Img->NumDynSyms = Rd(Img, AddrToOfs(Img, hashAddr) + 4, 4);
+	if( !Img->NumDynSyms ) {
+		fprintf(stderr, "%s: Can't determine the number of dynamic symbols\n", Img->Name);
+		return 1;
+	}
+
+	// Match dependencies to the other images
+	for( int i = 0; i < Img->NumNeeded; i ++ )
+	{
+		const char *name = (const char*)Img->Data + Img->DynStrOfs + needed[i];
+		 int	j;
+		// ld-acess isn't prelinked, symbols from it are always left for it to resolve
+		if( strcmp(name, "libld-acess.so") == 0 || strcmp(name, "ld-acess.so") == 0 ) {
+			Img->Needed[i] = -1;
+			continue ;
+		}
+		for( j = 0; j < giNumImages; j ++ )
+		{
+			if( strcmp(gaImages[j].Name, name) == 0 )
+				break;
+		}
+		if( j == giNumImages ) {
+			fprintf(stderr, "%s: Needs %s, which is not being prelinked\n", Img->Name, name);
+			return 1;
+		}
+		Img->Needed[i] = j;
+	}
+	return 0;
+}
+
+/**
+ * \brief Move an image from its current base to Img->NewBase
+ */
+void ShiftImage(tImage *Img)
+{
+	uint64_t	delta = Img->NewBase - Img->OldBase;
+	uint64_t	phoff = Rd(Img, EH_PHOFF(Img), W(Img));
+	uint64_t	shoff = Rd(Img, EH_SHOFF(Img), W(Img));
+	 int	bShiftedDynSym = 0;
+
+	if( Rd(Img, EH_ENTRY, W(Img)) )
+		Wr(Img, EH_ENTRY, W(Img), Rd(Img, EH_ENTRY, W(Img)) + delta);
+
+	// Program headers
+	for( int i = 0; i < (int)Rd(Img, EH_PHNUM(Img), 2); i ++ )
+	{
+		uint64_t	ph = phoff + i * PH_ENTSIZE(Img);
+		uint32_t	type = Rd(Img, ph, 4);
+		if( type == 0 || type == PT_GNU_STACK )
+			continue ;
+		Wr(Img, ph + PH_VADDR(Img), W(Img), Rd(Img, ph + PH_VADDR(Img), W(Img)) + delta);
+		Wr(Img, ph + PH_PADDR(Img), W(Img), Rd(Img, ph + PH_PADDR(Img), W(Img)) + delta);
+	}
+
+	// Section headers (for debuggers), and symbol tables
+	for( int i = 0; shoff && i < (int)Rd(Img, EH_SHNUM(Img), 2); i ++ )
+	{
+		uint64_t	sh = shoff + i*SH_ENTSIZE(Img);
+		uint32_t	type = Rd(Img, sh + 4, 4);
+		if( (Rd(Img, sh + SH_FLAGS, W(Img)) & SHF_ALLOC) && Rd(Img, sh + SH_ADDR(Img), W(Img)) )
+			Wr(Img, sh + SH_ADDR(Img), W(Img), Rd(Img, sh + SH_ADDR(Img), W(Img)) + delta);
+		if( type == SHT_SYMTAB || type == SHT_DYNSYM )
+		{
+			uint64_t	ofs = Rd(Img, sh + SH_OFFSET(Img), W(Img));
+			uint64_t	count = Rd(Img, sh + SH_SIZE(Img), W(Img)) / SYM_ENTSIZE(Img);
+			for( uint64_t s = 0; s < count; s ++ )
+			{
+				uint64_t	sym = ofs + s * SYM_ENTSIZE(Img);
+				uint16_t	shndx = Rd(Img, sym + SYM_SHNDX(Img), 2);
+				if( shndx == SHN_UNDEF || shndx >= SHN_LORESERVE )
+					continue ;
+				if( (Rd(Img, sym + SYM_INFO(Img), 1) & 0xF) == STT_TLS )
+					continue ;
+				Wr(Img, sym + SYM_VALUE(Img), W(Img), Rd(Img, sym + SYM_VALUE(Img), W(Img)) + delta);
+			}
+			if( type == SHT_DYNSYM )
+				bShiftedDynSym = 1;
+		}
+	}
+	// No section headers, use the dynamic section's idea of the symbol table
+	for( int s = 0; !bShiftedDynSym && s < Img->NumDynSyms; s ++ )
+	{
+		uint64_t	sym = Img->DynSymOfs + s * SYM_ENTSIZE(Img);
+		uint16_t	shndx = Rd(Img, sym + SYM_SHNDX(Img), 2);
+		if( shndx == SHN_UNDEF || shndx >= SHN_LORESERVE )
+			continue ;
+		if( (Rd(Img, sym + SYM_INFO(Img), 1) & 0xF) == STT_TLS )
+			continue ;
+		Wr(Img, sym + SYM_VALUE(Img), W(Img), Rd(Img, sym + SYM_VALUE(Img), W(Img)) + delta);
+	}
+
+	// Dynamic section pointers
+	for( int i = 0; i < Img->DynCount; i ++ )
+	{
+		uint64_t	ent = Img->DynOfs + i*2*W(Img);
+		switch( Rd(Img, ent, W(Img)) )
+		{
+		case DT_PLTGOT:	case DT_HASH:	case DT_STRTAB:	case DT_SYMTAB:
+		case DT_RELA:	case DT_INIT:	case DT_FINI:	case DT_REL:
+		case DT_JMPREL:	case DT_INIT_ARRAY:	case DT_FINI_ARRAY:	case DT_PREINIT_ARRAY:
+		case DT_GNU_HASH:	case DT_VERSYM:	case DT_VERDEF:	case DT_VERNEED:
+			Wr(Img, ent + W(Img), W(Img), Rd(Img, ent + W(Img), W(Img)) + delta);
+			break;
+		}
+	}
+
+	// GOT[0] holds the link-time address of _DYNAMIC
+	if( Img->PltGotOfs && Rd(Img, Img->PltGotOfs, W(Img)) )
+		Wr(Img, Img->PltGotOfs, W(Img), Rd(Img, Img->PltGotOfs, W(Img)) + delta);
+
+	// Relocation offsets, and anything relative to the base
+	tRelTable	*tabs[2] = {&Img->Rel, &Img->Plt};
+	for( int t = 0; t < 2; t ++ )
+	{
+		 int	entsize = W(Img) * (tabs[t]->bRela ? 3 : 2);
+		for( uint64_t e = tabs[t]->Ofs; e && e < tabs[t]->Ofs + tabs[t]->Size; e += entsize )
+		{
+			uint64_t	info = Rd(Img, e + W(Img), W(Img));
+			uint32_t	type = Img->b64 ? (info & 0xFFFFFFFF) : (info & 0xFF);
+			uint64_t	target;
+
+			Wr(Img, e, W(Img), Rd(Img, e, W(Img)) + delta);
+			target = AddrToOfs(Img, Rd(Img, e, W(Img)) - delta);
+			if( type == R_386_RELATIVE )	// == R_X86_64_RELATIVE
+			{
+				if( tabs[t]->bRela ) {
+					// Pre-apply too, so ld-acess can skip these
+					uint64_t	addend = Rd(Img, e + 2*W(Img), W(Img)) + delta;
+					Wr(Img, e + 2*W(Img), W(Img), addend);
+					Wr(Img, target, W(Img), addend);
+				}
+				else
+					Wr(Img, target, W(Img), Rd(Img, target, W(Img)) + delta);
+			}
+			else if( type == R_386_JMP_SLOT && Rd(Img, target, W(Img)) )	// == R_X86_64_JUMP_SLOT
+			{
+				// Address of the PLT stub (used by lazy binding)
+				Wr(Img, target, W(Img), Rd(Img, target, W(Img)) + delta);
+			}
+		}
+	}
+
+	// Loads are kept at their original addresses for AddrToOfs
+}
+
+/**
+ * \brief Pre-apply an image's symbol relocations, and move the rest to the front of each table
+ */
+void PrelinkImage(tImage *Img)
+{
+	tRelTable	*tabs[2] = {&Img->Rel, &Img->Plt};
+
+	for( int i = 0; i < giNumImages; i ++ )
+		gaImages[i].bInClosure = 0;
+	MarkClosure(Img);
+
+	for( int t = 0; t < 2; t ++ )
+	{
+		tRelTable	*tab = tabs[t];
+		 int	entsize = W(Img) * (tab->bRela ? 3 : 2);
+		 int	count = tab->Size / entsize;
+		uint8_t	*sorted;
+		 int	nRuntime = 0, nDone = 0;
+
+		if( !tab->Ofs || !count )
+			continue ;
+		sorted = malloc(tab->Size);
+		// First pass counts the runtime entries, second fills in both halves in order
+		for( int pass = 0; pass < 2; pass ++ )
+		{
+			 int	runtimeIdx = 0, doneIdx = nRuntime;
+			for( int i = 0; i < count; i ++ )
+			{
+				uint64_t	e = tab->Ofs + i * entsize;
+				uint64_t	info = Rd(Img, e + W(Img), W(Img));
+				uint32_t	type = Img->b64 ? (info & 0xFFFFFFFF) : (info & 0xFF);
+				uint32_t	symidx = Img->b64 ? (info >> 32) : (info >> 8);
+				 int	bRuntime = 1;
+
+				if( symidx == 0 )
+				{
+					// RELATIVE (and NONE) are handled by the shift
+					bRuntime = !(type == R_386_RELATIVE || type == R_386_NONE);
+				}
+				else if( type == R_386_GLOB_DAT || type == R_386_JMP_SLOT
+				      || (Img->b64 && type == R_X86_64_64 && tab->bRela) )
+				{
+					uint64_t	sym = Img->DynSymOfs + symidx * SYM_ENTSIZE(Img);
+					const char	*name = (const char*)Img->Data + Img->DynStrOfs + Rd(Img, sym, 4);
+					uint64_t	value;
+					if( FindDefinition(name, &value) )
+					{
+						bRuntime = 0;
+						if( pass == 1 ) {
+							if( type == R_X86_64_64 && Img->b64 )
+								value += Rd(Img, e + 2*W(Img), W(Img));
+							Wr(Img, AddrToOfs(Img, Rd(Img, e, W(Img)) - (Img->NewBase - Img->OldBase)), W(Img), value);
+						}
+					}
+					else if( pass == 1 && gbVerbose )
+						printf("%s: '%s' left for ld-acess\n", Img->Name, name);
+				}
+
+				if( pass == 0 ) {
+					nRuntime += bRuntime;
+					nDone += !bRuntime;
+				}
+				else if( bRuntime )
+					memcpy(sorted + (runtimeIdx++) * entsize, Img->Data + e, entsize);
+				else
+					memcpy(sorted + (doneIdx++) * entsize, Img->Data + e, entsize);
+			}
+		}
+		memcpy(Img->Data + tab->Ofs, sorted, tab->Size);
+		free(sorted);
+		tab->NumRuntime = nRuntime;
+		Img->NumPreapplied += nDone;
+	}
+
+	// The RELATIVE entries are no longer guaranteed to come first
+	for( int i = 0; i < Img->DynCount; i ++ )
+	{
+		uint64_t	ent = Img->DynOfs + i*2*W(Img);
+		uint64_t	tag = Rd(Img, ent, W(Img));
+		if( tag == DT_RELCOUNT || tag == DT_RELACOUNT )
+			Wr(Img, ent + W(Img), W(Img), 0);
+	}
+}
+
+/**
+ * \brief Find the unique definition of a symbol in the set
+ * \return Boolean, true if exactly one library defines it and it's in the closure from MarkClosure
+ */
+int FindDefinition(const char *Name, uint64_t *Value)
+{
+	 int	nDefs = 0, bReachable = 0;
+	for( int i = 0; i < giNumImages; i ++ )
+	{
+		tImage	*img = &gaImages[i];
+		if( img->bSkip )	continue ;
+		for( int s = 1; s < img->NumDynSyms; s ++ )
+		{
+			uint64_t	sym = img->DynSymOfs + s * SYM_ENTSIZE(img);
+			uint8_t	info = Rd(img, sym + SYM_INFO(img), 1);
+			if( Rd(img, sym + SYM_SHNDX(img), 2) == SHN_UNDEF )
+				continue ;
+			if( (info >> 4) != STB_GLOBAL && (info >> 4) != STB_WEAK )
+				continue ;
+			if( strcmp((const char*)img->Data + img->DynStrOfs + Rd(img, sym, 4), Name) != 0 )
+				continue ;
+			nDefs ++;
+			if( img->bInClosure ) {
+				bReachable = 1;
+				*Value = Rd(img, sym + SYM_VALUE(img), W(img));
+			}
+			break;
+		}
+	}
+	return nDefs == 1 && bReachable;
+}
+
+void MarkClosure(tImage *Img)
+{
+	if( Img->bInClosure )
+		return ;
+	Img->bInClosure = 1;
+	for( int i = 0; i < Img->NumNeeded; i ++ )
+	{
+		if( Img->Needed[i] >= 0 )
+			MarkClosure(&gaImages[ Img->Needed[i] ]);
+	}
+}
+
+/**
+ * \brief Hash of every prelinked library's name, base and exported symbol values (FNV-1a)
+ */
+uint32_t LayoutStamp(void)
+{
+	uint32_t	h = 2166136261u;
+	#define HASH(v)	do { h ^= (uint8_t)(v); h *= 16777619; } while(0)
+	for( int i = 0; i < giNumImages; i ++ )
+	{
+		tImage	*img = &gaImages[i];
+		if( img->bSkip )	continue ;
+		for( const char *p = img->Name; *p; p ++ )
+			HASH(*p);
+		for( int b = 0; b < 64; b += 8 )
+			HASH(img->NewBase >> b);
+		for( int s = 1; s < img->NumDynSyms; s ++ )
+		{
+			uint64_t	sym = img->DynSymOfs + s * SYM_ENTSIZE(img);
+			uint64_t	val;
+			if( Rd(img, sym + SYM_SHNDX(img), 2) == SHN_UNDEF )
+				continue ;
+			val = Rd(img, sym + SYM_VALUE(img), W(img));
+			for( int b = 0; b < 64; b += 8 )
+				HASH(val >> b);
+		}
+	}
+	#undef HASH
+	return h ? h : 1;
+}
+
+/**
+ * \brief Set a dynamic tag, using a spare DT_NULL if it isn't present yet
+ */
+int SetDynTag(tImage *Img, uint64_t Tag, uint64_t Value)
+{
+	for( int i = 0; i < Img->DynCount - 1; i ++ )
+	{
+		uint64_t	ent = Img->DynOfs + i*2*W(Img);
+		uint64_t	tag = Rd(Img, ent, W(Img));
+		if( tag == Tag || tag == DT_NULL ) {
+			Wr(Img, ent, W(Img), Tag);
+			Wr(Img, ent + W(Img), W(Img), Value);
+			return 0;
+		}
+	}
+	fprintf(stderr, "%s: No space in the dynamic section\n", Img->Name);
+	return 1;
+}
+
+int WriteImage(tImage *Img)
+{
+	FILE	*fp = fopen(Img->Path, "wb");
+	if( !fp ) {
+		perror(Img->Path);
+		return 1;
+	}
+	if( fwrite(Img->Data, 1, Img->Size, fp) != Img->Size ) {
+		fprintf(stderr, "%s: Write failed\n", Img->Path);
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+	return 0;
+}
+
+uint64_t Rd(tImage *Img, uint64_t Ofs, int Size)
+{
+	uint64_t	ret = 0;
+	if( Ofs + Size > Img->Size ) {
+		fprintf(stderr, "%s: Offset 0x%llx out of range\n", Img->Path, (unsigned long long)Ofs);
+		exit(1);
+	}
+	memcpy(&ret, Img->Data + Ofs, Size);
+	return ret;
+}
+
+void Wr(tImage *Img, uint64_t Ofs, int Size, uint64_t Value)
+{
+	if( Ofs + Size > Img->Size ) {
+		fprintf(stderr, "%s: Offset 0x%llx out of range\n", Img->Path, (unsigned long long)Ofs);
+		exit(1);
+	}
+	memcpy(Img->Data + Ofs, &Value, Size);
+}
+
+/**
+ * \brief Convert an address (from before ShiftImage) to a file offset
+ */
+uint64_t AddrToOfs(tImage *Img, uint64_t Addr)
+{
+	for( int i = 0; i < Img->NumLoads; i ++ )
+	{
+		tLoadSeg	*seg = &Img->Loads[i];
+		if( seg->VAddr <= Addr && Addr < seg->VAddr + seg->FileSize )
+			return seg->Offset + (Addr - seg->VAddr);
+	}
+	fprintf(stderr, "%s: Address 0x%llx is not in the file\n", Img->Path, (unsigned long long)Addr);
+	exit(1);
+}
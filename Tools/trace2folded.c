@@ -0,0 +1,262 @@
+/*
+ * Acess2 Kernel Trace Tools
+ * - By John Hodge (thePowersGang)
+ *
+ * trace2folded.c
+ * - Converts a dump of /Devices/trace into folded stacks (for flamegraph.pl)
+ *   or a text event listing
+ *
+ * Usage: trace2folded [-e] [-s <nm output>] <trace dump>
+ *   -e	List all events instead of folding profiler samples
+ *   -s	Symbol table (output of `nm -n Acess2.x86_64.bin`) used to name frames
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define TRACE_SAMPLE_DEPTH	6
+
+// Must match KernelLand/Kernel/include/trace.h
+enum eTraceEvents
+{
+	TRACE_EV_NONE,
+	TRACE_EV_SCHED_SWITCH,
+	TRACE_EV_SYSCALL_ENTER,
+	TRACE_EV_SYSCALL_EXIT,
+	TRACE_EV_VFS_READ,
+	TRACE_EV_VFS_WRITE,
+	TRACE_EV_IRQ,
+	TRACE_EV_PAGEFAULT,
+	TRACE_EV_SAMPLE,
+	NUM_TRACE_EV
+};
+
+typedef struct sTraceRecord
+{
+	uint64_t	Timestamp;
+	uint16_t	Event;
+	uint8_t	CPU;
+	uint8_t	Count;
+	uint32_t	TID;
+	uint64_t	Data[TRACE_SAMPLE_DEPTH];
+} tTraceRecord;
+
+typedef struct sSymbol
+{
+	uint64_t	Address;
+	char	*Name;
+} tSymbol;
+
+// === PROTOTYPES ===
+ int	main(int argc, char *argv[]);
+ int	LoadSymbols(const char *Path);
+const char	*GetSymbol(uint64_t Address, char *Buffer);
+ int	CompareStrings(const void *a, const void *b);
+void	PrintEvent(const tTraceRecord *Rec);
+void	FoldSamples(const tTraceRecord *Recs, size_t Count);
+
+// === GLOBALS ===
+const char * const csaEVENT_NAMES[NUM_TRACE_EV] = {
+	"none", "sched_switch", "syscall_enter", "syscall_exit",
+	"vfs_read", "vfs_write", "irq", "pagefault", "sample"
+};
+ int	giNumSymbols;
+tSymbol	*gaSymbols;
+
+// === CODE ===
+int main(int argc, char *argv[])
+{
+	const char	*dumpFile = NULL;
+	const char	*symFile = NULL;
+	 int	bListEvents = 0;
+	FILE	*fp;
+	tTraceRecord	*recs = NULL;
+	size_t	count = 0, space = 0;
+
+	for( int i = 1; i < argc; i ++ )
+	{
+		if( strcmp(argv[i], "-e") == 0 )
+			bListEvents = 1;
+		else if( strcmp(argv[i], "-s") == 0 && i + 1 < argc )
+			symFile = argv[++i];
+		else if( argv[i][0] != '-' && !dumpFile )
+			dumpFile = argv[i];
+		else {
+			fprintf(stderr, "Usage: %s [-e] [-s <nm output>] <trace dump>\n", argv[0]);
+			return 1;
+		}
+	}
+	if( !dumpFile ) {
+		fprintf(stderr, "Usage: %s [-e] [-s <nm output>] <trace dump>\n", argv[0]);
+		return 1;
+	}
+
+	if( symFile && LoadSymbols(symFile) ) {
+		perror(symFile);
+		return 1;
+	}
+
+	fp = fopen(dumpFile, "rb");
+	if( !fp ) {
+		perror(dumpFile);
+		return 1;
+	}
+	for( ;; )
+	{
+		if( count == space ) {
+			space = (space ? space * 2 : 1024);
+			recs = realloc(recs, space * sizeof(tTraceRecord));
+			if( !recs ) {
+				perror("realloc");
+				return 1;
+			}
+		}
+		if( fread(&recs[count], sizeof(tTraceRecord), 1, fp) != 1 )
+			break;
+		count ++;
+	}
+	fclose(fp);
+
+	if( bListEvents ) {
+		for( size_t i = 0; i < count; i ++ )
+			PrintEvent(&recs[i]);
+	}
+	else {
+		FoldSamples(recs, count);
+	}
+
+	free(recs);
+	return 0;
+}
+
+/**
+ * \brief Load a sorted `nm -n` listing
+ */
+int LoadSymbols(const char *Path)
+{
+	FILE	*fp = fopen(Path, "r");
+	char	line[512];
+	 int	space = 0;
+
+	if( !fp )	return -1;
+
+	while( fgets(line, sizeof(line), fp) )
+	{
+		unsigned long long	addr;
+		char	type, name[400];
+		if( sscanf(line, "%llx %c %399s", &addr, &type, name) != 3 )
+			continue ;
+		if( type != 'T' && type != 't' )
+			continue ;
+		if( giNumSymbols == space ) {
+			space = (space ? space * 2 : 1024);
+			gaSymbols = realloc(gaSymbols, space * sizeof(tSymbol));
+			if( !gaSymbols ) {
+				fclose(fp);
+				return -1;
+			}
+		}
+		gaSymbols[giNumSymbols].Address = addr;
+		gaSymbols[giNumSymbols].Name = strdup(name);
+		giNumSymbols ++;
+	}
+	fclose(fp);
+	return 0;
+}
+
+/**
+ * \brief Get the name of the function containing \a Address
+ * \note Falls back to the raw address if no symbol table was given
+ */
+const char *GetSymbol(uint64_t Address, char *Buffer)
+{
+	 int	lo = 0, hi = giNumSymbols;
+
+	// Binary search for the last symbol <= Address
+	while( lo < hi )
+	{
+		 int	mid = (lo + hi) / 2;
+		if( gaSymbols[mid].Address <= Address )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if( lo == 0 ) {
+		sprintf(Buffer, "0x%llx", (unsigned long long)Address);
+		return Buffer;
+	}
+	return gaSymbols[lo-1].Name;
+}
+
+int CompareStrings(const void *a, const void *b)
+{
+	return strcmp( *(char * const *)a, *(char * const *)b );
+}
+
+void PrintEvent(const tTraceRecord *Rec)
+{
+	const char	*name = (Rec->Event < NUM_TRACE_EV ? csaEVENT_NAMES[Rec->Event] : "?");
+	char	buf[32];
+
+	printf("%20llu CPU%i TID%-5i %-14s",
+		(unsigned long long)Rec->Timestamp, Rec->CPU, (int)Rec->TID, name);
+	for( int i = 0; i < Rec->Count && i < TRACE_SAMPLE_DEPTH; i ++ )
+	{
+		if( Rec->Event == TRACE_EV_SAMPLE )
+			printf(" %s", GetSymbol(Rec->Data[i], buf));
+		else
+			printf(" 0x%llx", (unsigned long long)Rec->Data[i]);
+	}
+	printf("\n");
+}
+
+/**
+ * \brief Print one "root;...;leaf count" line per unique sampled stack
+ */
+void FoldSamples(const tTraceRecord *Recs, size_t Count)
+{
+	char	**stacks = malloc(Count * sizeof(char*));
+	size_t	nStacks = 0;
+
+	if( !stacks ) {
+		perror("malloc");
+		return ;
+	}
+
+	for( size_t i = 0; i < Count; i ++ )
+	{
+		const tTraceRecord	*rec = &Recs[i];
+		char	line[TRACE_SAMPLE_DEPTH*128];
+		char	buf[32];
+		size_t	len = 0;
+
+		if( rec->Event != TRACE_EV_SAMPLE || rec->Count == 0 )
+			continue ;
+
+		// Data[0] is the leaf, so emit in reverse
+		for( int j = rec->Count; j --; )
+		{
+			const char	*sym = GetSymbol(rec->Data[j], buf);
+			len += snprintf(line + len, sizeof(line) - len, "%s%s",
+				(len ? ";" : ""), sym);
+			if( len >= sizeof(line) )
+				len = sizeof(line) - 1;
+		}
+		stacks[nStacks++] = strdup(line);
+	}
+
+	qsort(stacks, nStacks, sizeof(char*), CompareStrings);
+
+	for( size_t i = 0; i < nStacks; )
+	{
+		size_t	j = i;
+		while( j < nStacks && strcmp(stacks[i], stacks[j]) == 0 )
+			j ++;
+		printf("%s %zu\n", stacks[i], j - i);
+		for( ; i < j; i ++ )
+			free(stacks[i]);
+	}
+	free(stacks);
+}
+
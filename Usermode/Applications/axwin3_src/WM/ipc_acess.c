@@ -177,7 +177,9 @@ int IPC_Type_Sys_Compare(const void *Ident1, const void *Ident2)
 
 void IPC_Type_Sys_Send(const void *Ident, size_t Length, const void *Data)
 {
-	_SysSendMessage( *(const tid_t*)Ident, Length, Data );
+	// Never block the window manager on a client that isn't reading its queue
+	if( _SysSendMessageEx( *(const tid_t*)Ident, Length, Data, SENDMSG_NONBLOCK ) )
+		_SysDebug("IPC_Type_Sys_Send: Message to %i dropped (queue full or thread gone)", *(const tid_t*)Ident);
 }
 
 int IPC_Type_IPCPipe_GetSize(const void *Ident)
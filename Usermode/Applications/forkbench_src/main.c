@@ -0,0 +1,173 @@
+/*
+ * Acess2 Fork/Spawn Microbenchmark
+ * - By John Hodge (thePowersGang)
+ *
+ * main.c
+ * - Times fork+exit+wait, COW faults after a fork, and spawn+wait
+ */
+#include <acess/sys.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PAGE_SIZE	0x1000
+
+// === PROTOTYPES ===
+ int	main(int argc, char *argv[]);
+void	PrintUsage(const char *ProgName);
+void	PrintResult(const char *Name, int Count, int64_t Time);
+ int	Bench_Fork(int Count, char *Buffer, int Pages, int ChildPages);
+ int	Bench_ParentWrite(int Count, char *Buffer, int Pages);
+ int	Bench_Spawn(int Count, const char *Path);
+
+// === GLOBALS ===
+ int	giIterations = 1000;
+ int	giBufferPages = 256;	// 1 MiB
+ int	giChildPages = 0;
+const char	*gsSpawnPath = NULL;
+
+// === CODE ===
+int main(int argc, char *argv[])
+{
+	char	*buffer;
+	
+	for( int i = 1; i < argc; i ++ )
+	{
+		if( argv[i][0] != '-' ) {
+			PrintUsage(argv[0]);
+			return 1;
+		}
+		switch( argv[i][1] )
+		{
+		case 'x':	// Child mode for -s
+			return 0;
+		case 'n':
+			if( i + 1 >= argc )	{ PrintUsage(argv[0]); return 1; }
+			giIterations = atoi(argv[++i]);
+			break;
+		case 'p':
+			if( i + 1 >= argc )	{ PrintUsage(argv[0]); return 1; }
+			giBufferPages = atoi(argv[++i]);
+			break;
+		case 'w':
+			if( i + 1 >= argc )	{ PrintUsage(argv[0]); return 1; }
+			giChildPages = atoi(argv[++i]);
+			break;
+		case 's':
+			if( i + 1 >= argc )	{ PrintUsage(argv[0]); return 1; }
+			gsSpawnPath = argv[++i];
+			break;
+		case 'h':
+		default:
+			PrintUsage(argv[0]);
+			return 0;
+		}
+	}
+	if( giChildPages > giBufferPages )
+		giChildPages = giBufferPages;
+	
+	// Give the address space something for fork to share
+	buffer = malloc( giBufferPages * PAGE_SIZE );
+	if( !buffer ) {
+		fprintf(stderr, "Unable to allocate %i pages\n", giBufferPages);
+		return 1;
+	}
+	memset(buffer, 0xA5, giBufferPages * PAGE_SIZE);
+	
+	printf("%i iterations, %i pages resident, child writes %i pages\n",
+		giIterations, giBufferPages, giChildPages);
+	
+	if( Bench_Fork(giIterations, buffer, giBufferPages, giChildPages) )
+		return 1;
+	if( Bench_ParentWrite(giIterations / 10 + 1, buffer, giBufferPages) )
+		return 1;
+	if( gsSpawnPath && Bench_Spawn(giIterations, gsSpawnPath) )
+		return 1;
+	
+	free(buffer);
+	return 0;
+}
+
+void PrintUsage(const char *ProgName)
+{
+	fprintf(stderr, "Usage: %s [-n iterations] [-p resident pages] [-w child write pages] [-s spawn binary]\n",
+		ProgName);
+	fprintf(stderr, " -s <path> spawns `<path> -x` (e.g. this binary, which exits immediately)\n");
+}
+
+void PrintResult(const char *Name, int Count, int64_t Time)
+{
+	printf("%-16s %6i ops in %6lli ms, %6lli us/op\n", Name, Count, Time, Time * 1000 / Count);
+}
+
+/**
+ * \brief fork, optionally dirty some pages in the child, exit and wait
+ */
+int Bench_Fork(int Count, char *Buffer, int Pages, int ChildPages)
+{
+	int64_t	start = _SysTimestamp();
+	for( int i = 0; i < Count; i ++ )
+	{
+		int tid = _SysClone(CLONE_VM, 0);
+		if( tid < 0 ) {
+			fprintf(stderr, "fork failed after %i iterations\n", i);
+			return 1;
+		}
+		if( tid == 0 )
+		{
+			for( int j = 0; j < ChildPages; j ++ )
+				Buffer[j * PAGE_SIZE] = j;
+			_exit(0);
+		}
+		_SysWaitTID(tid, NULL);
+	}
+	PrintResult("fork+exit", Count, _SysTimestamp() - start);
+	return 0;
+}
+
+/**
+ * \brief Time the parent's COW faults after a child that exits straight away
+ */
+int Bench_ParentWrite(int Count, char *Buffer, int Pages)
+{
+	int64_t	total = 0;
+	for( int i = 0; i < Count; i ++ )
+	{
+		int tid = _SysClone(CLONE_VM, 0);
+		if( tid < 0 ) {
+			fprintf(stderr, "fork failed after %i iterations\n", i);
+			return 1;
+		}
+		if( tid == 0 )
+			_exit(0);
+		_SysWaitTID(tid, NULL);
+		
+		int64_t	start = _SysTimestamp();
+		for( int j = 0; j < Pages; j ++ )
+			Buffer[j * PAGE_SIZE] = i;
+		total += _SysTimestamp() - start;
+	}
+	PrintResult("parent-rewrite", Count, total);
+	return 0;
+}
+
+/**
+ * \brief Spawn a binary (with `-x`) and wait for it
+ */
+int Bench_Spawn(int Count, const char *Path)
+{
+	const char	*argv[] = {Path, "-x", NULL};
+	 int	fds[3] = {0, 1, 2};
+	int64_t	start = _SysTimestamp();
+	for( int i = 0; i < Count; i ++ )
+	{
+		int pid = _SysSpawn(Path, argv, NULL, 3, fds, NULL);
+		if( pid <= 0 ) {
+			fprintf(stderr, "Unable to spawn '%s'\n", Path);
+			return 1;
+		}
+		_SysWaitTID(pid, NULL);
+	}
+	PrintResult("spawn+exit", Count, _SysTimestamp() - start);
+	return 0;
+}
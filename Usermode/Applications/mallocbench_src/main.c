@@ -0,0 +1,163 @@
+/*
+ * Acess2 Allocator Microbenchmark
+ * - By John Hodge (thePowersGang)
+ *
+ * main.c
+ * - Times malloc/free pairs, a random working set, and large blocks
+ */
+#include <acess/sys.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_SLOTS	1024
+
+// === PROTOTYPES ===
+ int	main(int argc, char *argv[]);
+void	PrintUsage(const char *ProgName);
+void	PrintResult(const char *Name, int Count, int64_t Time);
+ int	Bench_Pairs(int Count, size_t Size);
+ int	Bench_WorkingSet(int Count);
+ int	Bench_Large(int Count);
+static unsigned int	Rand(void);
+
+// === GLOBALS ===
+ int	giIterations = 100000;
+ int	gbVerbose = 0;
+unsigned int	giRandState = 0x1234567;
+void	*gaSlots[NUM_SLOTS];
+
+// === CODE ===
+int main(int argc, char *argv[])
+{
+	for( int i = 1; i < argc; i ++ )
+	{
+		if( argv[i][0] != '-' ) {
+			PrintUsage(argv[0]);
+			return 1;
+		}
+		switch( argv[i][1] )
+		{
+		case 'n':
+			if( i + 1 >= argc )	{ PrintUsage(argv[0]); return 1; }
+			giIterations = atoi(argv[++i]);
+			break;
+		case 'v':
+			gbVerbose = 1;
+			break;
+		case 'h':
+		default:
+			PrintUsage(argv[0]);
+			return 0;
+		}
+	}
+	if( giIterations <= 0 )
+		giIterations = 1;
+
+	printf("%i iterations\n", giIterations);
+
+	if( Bench_Pairs(giIterations, 32) )
+		return 1;
+	if( Bench_Pairs(giIterations, 1000) )
+		return 1;
+	if( Bench_WorkingSet(giIterations) )
+		return 1;
+	if( Bench_Large(giIterations / 100 + 1) )
+		return 1;
+
+	if( gbVerbose )
+		malloc_stats();
+	return 0;
+}
+
+void PrintUsage(const char *ProgName)
+{
+	fprintf(stderr, "Usage: %s [-n iterations] [-v]\n", ProgName);
+	fprintf(stderr, " -v prints the allocator's statistics when done\n");
+}
+
+void PrintResult(const char *Name, int Count, int64_t Time)
+{
+	if( Time == 0 )
+		Time = 1;
+	printf("%-16s %7i ops in %6lli ms, %6lli ops/ms\n", Name, Count, Time, Count / Time);
+}
+
+/**
+ * \brief malloc immediately followed by free of a fixed size
+ */
+int Bench_Pairs(int Count, size_t Size)
+{
+	char	name[16];
+	int64_t	start = _SysTimestamp();
+	for( int i = 0; i < Count; i ++ )
+	{
+		char *p = malloc(Size);
+		if( !p ) {
+			fprintf(stderr, "malloc(%i) failed after %i iterations\n", (int)Size, i);
+			return 1;
+		}
+		p[0] = i;
+		free(p);
+	}
+	snprintf(name, sizeof(name), "pair-%i", (int)Size);
+	PrintResult(name, Count, _SysTimestamp() - start);
+	return 0;
+}
+
+/**
+ * \brief Replace random slots of a working set with blocks of 16 to 4096 bytes
+ */
+int Bench_WorkingSet(int Count)
+{
+	int64_t	start = _SysTimestamp();
+	for( int i = 0; i < Count; i ++ )
+	{
+		unsigned int	r = Rand();
+		 int	slot = r % NUM_SLOTS;
+		size_t	size = 16 << ((r >> 10) % 9);
+
+		free( gaSlots[slot] );
+		gaSlots[slot] = malloc(size);
+		if( !gaSlots[slot] ) {
+			fprintf(stderr, "malloc(%i) failed after %i iterations\n", (int)size, i);
+			return 1;
+		}
+		memset(gaSlots[slot], 0, 16);
+	}
+	for( int i = 0; i < NUM_SLOTS; i ++ )
+	{
+		free( gaSlots[i] );
+		gaSlots[i] = NULL;
+	}
+	PrintResult("working-set", Count, _SysTimestamp() - start);
+	return 0;
+}
+
+/**
+ * \brief Allocate, touch and free blocks of 256 KiB to 4 MiB
+ */
+int Bench_Large(int Count)
+{
+	int64_t	start = _SysTimestamp();
+	for( int i = 0; i < Count; i ++ )
+	{
+		size_t	size = 0x40000 << (Rand() % 5);
+		char *p = malloc(size);
+		if( !p ) {
+			fprintf(stderr, "malloc(%i) failed after %i iterations\n", (int)size, i);
+			return 1;
+		}
+		p[0] = 1;
+		p[size-1] = 1;
+		free(p);
+	}
+	PrintResult("large", Count, _SysTimestamp() - start);
+	return 0;
+}
+
+static unsigned int Rand(void)
+{
+	giRandState = giRandState * 1103515245 + 12345;
+	return giRandState >> 8;
+}
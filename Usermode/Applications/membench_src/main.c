@@ -0,0 +1,176 @@
+/*
+ * Acess2 Memory/String Routine Microbenchmark
+ * - By John Hodge (thePowersGang)
+ *
+ * main.c
+ * - Times libc's mem* and str* routines over a range of sizes and alignments
+ *
+ * Run with LIBC_STRING=generic (or sse2, avx2) to compare against the
+ * routines libc would otherwise pick for this CPU.
+ */
+#include <acess/sys.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_SIZE	(1024*1024)
+#define ALIGN_SLACK	64
+
+enum eTests
+{
+	TEST_MEMCPY,
+	TEST_MEMMOVE,
+	TEST_MEMSET,
+	TEST_MEMCMP,
+	TEST_MEMCHR,
+	TEST_STRLEN,
+	NUM_TESTS
+};
+
+// === PROTOTYPES ===
+ int	main(int argc, char *argv[]);
+void	PrintUsage(const char *ProgName);
+int64_t	RunTest(int Test, size_t Size, int Misalign, int Count);
+
+// === GLOBALS ===
+const char	*gasTestNames[NUM_TESTS] = {"memcpy", "memmove", "memset", "memcmp", "memchr", "strlen"};
+const size_t	gaSizes[] = {8, 16, 64, 256, 1024, 4096, 65536, MAX_SIZE};
+const int	gaMisaligns[] = {0, 1, 7};
+size_t	giBytesPerRun = 64*1024*1024;
+char	*gpSrc, *gpDst;
+volatile int	giSink;
+
+// === CODE ===
+int main(int argc, char *argv[])
+{
+	 int	only = -1;
+
+	for( int i = 1; i < argc; i ++ )
+	{
+		if( argv[i][0] != '-' ) {
+			PrintUsage(argv[0]);
+			return 1;
+		}
+		switch( argv[i][1] )
+		{
+		case 'b':
+			if( i + 1 >= argc )	{ PrintUsage(argv[0]); return 1; }
+			giBytesPerRun = atoi(argv[++i]) * 1024 * 1024;
+			break;
+		case 't':
+			if( i + 1 >= argc )	{ PrintUsage(argv[0]); return 1; }
+			i ++;
+			for( only = 0; only < NUM_TESTS && strcmp(argv[i], gasTestNames[only]) != 0; only ++ )
+				;
+			if( only == NUM_TESTS ) {
+				fprintf(stderr, "Unknown test '%s'\n", argv[i]);
+				return 1;
+			}
+			break;
+		case 'h':
+		default:
+			PrintUsage(argv[0]);
+			return 0;
+		}
+	}
+	if( giBytesPerRun == 0 )
+		giBytesPerRun = 1024*1024;
+
+	gpSrc = malloc(MAX_SIZE + ALIGN_SLACK);
+	gpDst = malloc(MAX_SIZE + ALIGN_SLACK);
+	if( !gpSrc || !gpDst ) {
+		fprintf(stderr, "Unable to allocate buffers\n");
+		return 1;
+	}
+	// No zero bytes (strlen runs to the end), and no 0xFF (memchr's target)
+	for( int i = 0; i < MAX_SIZE + ALIGN_SLACK; i ++ )
+		gpSrc[i] = 1 + i % 250;
+	memcpy(gpDst, gpSrc, MAX_SIZE + ALIGN_SLACK);
+
+	printf("MB/s, %i MiB per cell (misalignment of the source)\n", (int)(giBytesPerRun >> 20));
+	for( int t = 0; t < NUM_TESTS; t ++ )
+	{
+		if( only != -1 && t != only )
+			continue ;
+		printf("%-8s %8s", gasTestNames[t], "size");
+		for( unsigned int a = 0; a < sizeof(gaMisaligns)/sizeof(gaMisaligns[0]); a ++ )
+			printf("  +%-6i", gaMisaligns[a]);
+		printf("\n");
+		for( unsigned int s = 0; s < sizeof(gaSizes)/sizeof(gaSizes[0]); s ++ )
+		{
+			size_t	size = gaSizes[s];
+			 int	count = giBytesPerRun / size;
+			printf("%-8s %8i", "", (int)size);
+			for( unsigned int a = 0; a < sizeof(gaMisaligns)/sizeof(gaMisaligns[0]); a ++ )
+			{
+				int64_t	time = RunTest(t, size, gaMisaligns[a], count);
+				if( time == 0 )
+					time = 1;
+				printf("  %7lli", (long long)(giBytesPerRun / 1000) / time);
+			}
+			printf("\n");
+		}
+	}
+
+	free(gpSrc);
+	free(gpDst);
+	return 0;
+}
+
+void PrintUsage(const char *ProgName)
+{
+	fprintf(stderr, "Usage: %s [-b MiB per cell] [-t test]\n", ProgName);
+	fprintf(stderr, "Tests: memcpy memmove memset memcmp memchr strlen\n");
+	fprintf(stderr, "Set LIBC_STRING=generic|sse2|avx2 to limit the routines libc uses\n");
+}
+
+/**
+ * \brief Run one routine \a Count times
+ * \return Time taken in milliseconds
+ */
+int64_t RunTest(int Test, size_t Size, int Misalign, int Count)
+{
+	char	*src = gpSrc + Misalign;
+	char	*dst = gpDst;
+	 int	sink = 0;
+
+	// memmove and memset scribble on the destination, memcmp wants it equal
+	if( Test == TEST_MEMCMP )
+		memcpy(gpDst, gpSrc, MAX_SIZE + ALIGN_SLACK);
+
+	int64_t	start = _SysTimestamp();
+
+	switch(Test)
+	{
+	case TEST_MEMCPY:
+		for( int i = 0; i < Count; i ++ )
+			memcpy(dst, src, Size);
+		break;
+	case TEST_MEMMOVE:
+		// Overlapping, the slow direction
+		for( int i = 0; i < Count; i ++ )
+			memmove(dst + Misalign + 16, dst + Misalign, Size - (Size > 16 ? 16 : 0));
+		break;
+	case TEST_MEMSET:
+		for( int i = 0; i < Count; i ++ )
+			memset(dst + Misalign, i, Size);
+		break;
+	case TEST_MEMCMP:
+		for( int i = 0; i < Count; i ++ )
+			sink += memcmp(src, dst + Misalign, Size);
+		break;
+	case TEST_MEMCHR:
+		for( int i = 0; i < Count; i ++ )
+			sink += memchr(src, 0xFF, Size) != NULL;
+		break;
+	case TEST_STRLEN:
+		src[Size-1] = '\0';
+		for( int i = 0; i < Count; i ++ )
+			sink += strlen(src);
+		src[Size-1] = 1;
+		break;
+	}
+
+	giSink = sink;
+	return _SysTimestamp() - start;
+}
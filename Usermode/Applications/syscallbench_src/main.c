@@ -0,0 +1,152 @@
+/*
+ * Acess2 Syscall Microbenchmark
+ * - By John Hodge (thePowersGang)
+ *
+ * main.c
+ * - Times a null syscall, small pipe round trips and large file reads
+ *   (for comparing AcessNative transports, or kernel entry paths)
+ */
+#include <acess/sys.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BULK_SIZE	(64*1024)
+
+// === PROTOTYPES ===
+ int	main(int argc, char *argv[]);
+void	PrintUsage(const char *ProgName);
+void	PrintResult(const char *Name, int Count, int64_t Time);
+ int	Bench_Null(int Count);
+ int	Bench_Pipe(int Count, size_t Size);
+ int	Bench_FileRead(int Count, const char *Path);
+
+// === GLOBALS ===
+ int	giIterations = 10000;
+const char	*gsReadPath = NULL;
+
+// === CODE ===
+int main(int argc, char *argv[])
+{
+	for( int i = 1; i < argc; i ++ )
+	{
+		if( argv[i][0] != '-' ) {
+			PrintUsage(argv[0]);
+			return 1;
+		}
+		switch( argv[i][1] )
+		{
+		case 'n':
+			if( i + 1 >= argc )	{ PrintUsage(argv[0]); return 1; }
+			giIterations = atoi(argv[++i]);
+			break;
+		case 'f':
+			if( i + 1 >= argc )	{ PrintUsage(argv[0]); return 1; }
+			gsReadPath = argv[++i];
+			break;
+		case 'h':
+		default:
+			PrintUsage(argv[0]);
+			return 0;
+		}
+	}
+	if( giIterations <= 0 )
+		giIterations = 1;
+	if( !gsReadPath )
+		gsReadPath = argv[0];
+
+	printf("%i iterations\n", giIterations);
+
+	if( Bench_Null(giIterations) )
+		return 1;
+	if( Bench_Pipe(giIterations, 1) )
+		return 1;
+	if( Bench_Pipe(giIterations, 64) )
+		return 1;
+	if( Bench_Pipe(giIterations, 1024) )
+		return 1;
+	if( Bench_FileRead(giIterations / 10 + 1, gsReadPath) )
+		return 1;
+
+	return 0;
+}
+
+void PrintUsage(const char *ProgName)
+{
+	fprintf(stderr, "Usage: %s [-n iterations] [-f file for bulk reads]\n", ProgName);
+	fprintf(stderr, " -f defaults to this binary, reads are %i KiB\n", BULK_SIZE/1024);
+}
+
+void PrintResult(const char *Name, int Count, int64_t Time)
+{
+	// us/op is too coarse for the fast paths, so print ns
+	printf("%-16s %6i ops in %6lli ms, %6lli ns/op\n", Name, Count, Time, Time * 1000000 / Count);
+}
+
+/**
+ * \brief Cheapest syscall there is, measures the transport/entry overhead alone
+ */
+int Bench_Null(int Count)
+{
+	int64_t	start = _SysTimestamp();
+	for( int i = 0; i < Count; i ++ )
+		_SysGetPID();
+	PrintResult("getpid", Count, _SysTimestamp() - start);
+	return 0;
+}
+
+/**
+ * \brief Write then read back \a Size bytes through an anonymous FIFO
+ */
+int Bench_Pipe(int Count, size_t Size)
+{
+	char	buf[Size];
+	char	name[32];
+	 int	fd = _SysOpen("/Devices/fifo/anon", OPENFLAG_READ|OPENFLAG_WRITE);
+	if( fd == -1 ) {
+		fprintf(stderr, "Unable to open an anonymous FIFO\n");
+		return 1;
+	}
+	memset(buf, 0x5A, Size);
+
+	int64_t	start = _SysTimestamp();
+	for( int i = 0; i < Count; i ++ )
+	{
+		if( _SysWrite(fd, buf, Size) != Size || _SysRead(fd, buf, Size) != Size ) {
+			fprintf(stderr, "FIFO I/O failed after %i iterations\n", i);
+			_SysClose(fd);
+			return 1;
+		}
+	}
+	snprintf(name, sizeof(name), "pipe %i", (int)Size);
+	PrintResult(name, Count, _SysTimestamp() - start);
+
+	_SysClose(fd);
+	return 0;
+}
+
+/**
+ * \brief Read a file in large chunks (rewinding at EOF)
+ */
+int Bench_FileRead(int Count, const char *Path)
+{
+	char	*buf = malloc(BULK_SIZE);
+	 int	fd = _SysOpen(Path, OPENFLAG_READ);
+	if( fd == -1 || !buf ) {
+		fprintf(stderr, "Unable to open '%s'\n", Path);
+		free(buf);
+		return 1;
+	}
+
+	int64_t	start = _SysTimestamp();
+	for( int i = 0; i < Count; i ++ )
+	{
+		if( _SysRead(fd, buf, BULK_SIZE) < BULK_SIZE )
+			_SysSeek(fd, 0, SEEK_SET);
+	}
+	PrintResult("read 64k", Count, _SysTimestamp() - start);
+
+	_SysClose(fd);
+	free(buf);
+	return 0;
+}
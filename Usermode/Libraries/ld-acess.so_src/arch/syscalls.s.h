@@ -9,6 +9,7 @@ SYSCALL2(_SysKill, SYS_KILL)
 //SYSCALL0(sleep, SYS_SLEEP)
 SYSCALL1(_SysWaitEvent, SYS_WAITEVENT)
 SYSCALL2(_SysWaitTID, SYS_WAITTID)
+SYSCALL4(_SysFutex, SYS_FUTEX)	// uint32_t*, int, uint32_t, int64_t*
 
 SYSCALL0(gettid, SYS_GETTID)
 SYSCALL0(_SysGetPID, SYS_GETPID)
@@ -23,8 +24,10 @@ SYSCALL2(_SysGetName, SYS_GETNAME)
 SYSCALL0(_SysTimestamp, SYS_GETTIME)
 
 SYSCALL1(_SysSetPri, SYS_SETPRI)
+SYSCALL1(_SysSetMemLimit, SYS_SETMEMLIMIT)	// size_t
 
 SYSCALL3(_SysSendMessage, SYS_SENDMSG)
+SYSCALL4(_SysSendMessageEx, SYS_SENDMSGEX)	// int, size_t, void*, int
 SYSCALL3(_SysGetMessage, SYS_GETMSG)
 
 SYSCALL5(_SysSpawn, SYS_SPAWN)
@@ -38,6 +41,8 @@ SYSCALL6(_SysDebug, 0x100)
 SYSCALL1(_SysGetPhys, SYS_GETPHYS)	// uint64_t _SysGetPhys(uint addr)
 SYSCALL1(_SysAllocate, SYS_ALLOCATE)	// uint64_t _SysAllocate(uint addr)
 SYSCALL3(_SysSetMemFlags, SYS_SETFLAGS)	// uint32_t SysSetMemFlags(uint addr, uint flags, uint mask)
+SYSCALL6(_SysMMap, SYS_MMAP)	// void*, size_t, uint, int, uint64_t
+SYSCALL2(_SysMUnmap, SYS_MUNMAP)	// void*, size_t
 // VFS System calls
 SYSCALL2(_SysOpen, SYS_OPEN)	// char*, int
 SYSCALL3(_SysOpenChild, SYS_OPENCHILD)	// int, char*, int
@@ -47,6 +52,8 @@ SYSCALL3(_SysFDFlags, SYS_FDCTL)	// int, int, int
 SYSCALL1(_SysClose, SYS_CLOSE)	// int
 SYSCALL3(_SysRead, SYS_READ)	// int, uint, void*
 SYSCALL3(_SysWrite, SYS_WRITE)	// int, uint, void*
+SYSCALL3(_SysReadV, SYS_READV)	// int, t_sysIOVec*, int
+SYSCALL3(_SysWriteV, SYS_WRITEV)	// int, const t_sysIOVec*, int
 SYSCALL4(_SysSeek, SYS_SEEK)	// int, uint64_t, int
 SYSCALL1(_SysTell, SYS_TELL)	// int
 SYSCALL3(_SysFInfo, SYS_FINFO)	// int, void*, int
@@ -206,3 +206,21 @@ clone:
 	pop ebp
 	ret
 
+; Lazy PLT binding (see ElfLazyResolve)
+; - PLT0 has pushed GOT[1] (the image base), above that is the relocation offset
+[global ElfLazyTrampoline]
+[extern ElfLazyResolve]
+ElfLazyTrampoline:
+	push eax
+	push ecx
+	push edx
+	push DWORD [esp+16]	; Relocation offset
+	push DWORD [esp+16]	; Image base
+	call ElfLazyResolve
+	add esp, 8
+	mov [esp+16], eax	; Replace the offset with the target
+	pop edx
+	pop ecx
+	pop eax
+	add esp, 4	; Drop the base
+	ret	; and jump to the target, which returns to the original caller
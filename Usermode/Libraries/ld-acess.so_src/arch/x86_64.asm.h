@@ -190,4 +190,51 @@ _exit:
 	SYSCALL_OP
 	jmp $
 
+; Lazy PLT binding (see ElfLazyResolve)
+; - PLT0 has pushed GOT[1] (the image base), above that is the relocation index
+[global ElfLazyTrampoline]
+[extern ElfLazyResolve]
+ElfLazyTrampoline:
+	; Argument registers (and RAX, the vector count for varargs) belong to the target
+	push rax
+	push rcx
+	push rdx
+	push rsi
+	push rdi
+	push r8
+	push r9
+	sub rsp, 8*16
+	movdqu [rsp+0*16], xmm0
+	movdqu [rsp+1*16], xmm1
+	movdqu [rsp+2*16], xmm2
+	movdqu [rsp+3*16], xmm3
+	movdqu [rsp+4*16], xmm4
+	movdqu [rsp+5*16], xmm5
+	movdqu [rsp+6*16], xmm6
+	movdqu [rsp+7*16], xmm7
+	
+	mov rdi, [rsp+8*16+7*8]	; Image base
+	mov rsi, [rsp+8*16+8*8]	; Relocation index
+	call ElfLazyResolve	; (stack is 16 byte aligned here)
+	mov r11, rax
+	
+	movdqu xmm0, [rsp+0*16]
+	movdqu xmm1, [rsp+1*16]
+	movdqu xmm2, [rsp+2*16]
+	movdqu xmm3, [rsp+3*16]
+	movdqu xmm4, [rsp+4*16]
+	movdqu xmm5, [rsp+5*16]
+	movdqu xmm6, [rsp+6*16]
+	movdqu xmm7, [rsp+7*16]
+	add rsp, 8*16
+	pop r9
+	pop r8
+	pop rdi
+	pop rsi
+	pop rdx
+	pop rcx
+	pop rax
+	add rsp, 2*8	; Drop the base and index
+	jmp r11
+
 ; vim: ft=nasm
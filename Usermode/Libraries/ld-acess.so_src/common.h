@@ -25,14 +25,39 @@ typedef uint32_t	Uint32;
 #define	MAX_STRINGS_BYTES	4096
 #define	SYSTEM_LIB_DIR	"/Acess/Libs/"
 
+// Jump slots are bound on first call where there's a resolver trampoline (arch/*.asm.h)
+#if defined(ARCHDIR_is_x86) || defined(ARCHDIR_is_x86_64)
+# define SUPPORT_LAZY_PLT	1
+#else
+# define SUPPORT_LAZY_PLT	0
+#endif
+
+// Libraries processed by Tools/prelink skip relocation when loaded at their assigned base
+#define SUPPORT_PRELINK	1
+
 // === Types ===
 typedef struct {
 	void	*Base;
 	char	*Name;
+	uint32_t	PrelinkStamp;	// DT_GNU_PRELINKED, if the prelinked layout was used
 }	tLoadedLib;
 
+typedef struct {
+	 int	Libraries;
+	 int	Lookups;
+	 int	CacheHits;
+	 int	LibraryProbes;	// GetSymbolFromBase calls
+	 int	LazySlots;	// Jump slots left for ElfLazyResolve
+	 int	Prelinked;	// Libraries that used their prelinked relocations
+	int64_t	LoadTime;	// ms in _SysLoadBin
+	int64_t	TotalTime;	// ms from SoMain to the executable's entrypoint
+}	tLdStats;
+
 // === GLOBALS ===
 extern tLoadedLib	gLoadedLibraries[MAX_LOADED_LIBRARIES];
+extern tLdStats	gLdStats;
+extern int	gbLdStatistics;
+extern int	gbLdBindNow;
 
 // === Main ===
 extern void	*DoRelocate(void *Base, char **envp, const char *Filename);
@@ -42,6 +67,12 @@ extern void	*LoadLibrary(const char *Filename, const char *SearchDir, char **env
 extern void	AddLoaded(const char *File, void *base);
 extern int	GetSymbol(const char *Name, void **Value, size_t *size);
 extern int	GetSymbolFromBase(void *base, const char *name, void **ret, size_t *size);
+extern const char	*LdGetEnv(char **envp, const char *Name);
+extern int	LdDebugOption(char **envp, const char *Option);
+extern void	LdStats_Report(void);
+extern int	Prelink_DepOK(void *Base, uint32_t Stamp);
+extern int	Prelink_IsInterposed(void *Base, uint32_t Stamp, const char *Name);
+extern void	Prelink_SetStamp(void *Base, uint32_t Stamp);
 
 // === Library Functions ===
 extern char	*strcpy(char *dest, const char *src);
@@ -28,6 +28,19 @@
 # define SUPPORT_ELF64
 #endif
 
+#ifndef SUPPORT_LAZY_PLT
+# define SUPPORT_LAZY_PLT	0	// Kernel and AcessNative bind everything up front
+#endif
+
+#ifndef SUPPORT_PRELINK
+# define SUPPORT_PRELINK	0	// Kernel and AcessNative always relocate
+#endif
+#if !SUPPORT_PRELINK
+# define Prelink_DepOK(Base, Stamp)	((void)(Base), (void)(Stamp), 0)
+# define Prelink_IsInterposed(Base, Stamp, Name)	((void)(Name), 1)
+# define Prelink_SetStamp(Base, Stamp)	do{}while(0)
+#endif
+
 // === CONSTANTS ===
 #if DEBUG
 //static const char	*csaDT_NAMES[] = {"DT_NULL", "DT_NEEDED", "DT_PLTRELSZ", "DT_PLTGOT", "DT_HASH", "DT_STRTAB", "DT_SYMTAB", "DT_RELA", "DT_RELASZ", "DT_RELAENT", "DT_STRSZ", "DT_SYMENT", "DT_INIT", "DT_FINI", "DT_SONAME", "DT_RPATH", "DT_SYMBOLIC", "DT_REL", "DT_RELSZ", "DT_RELENT", "DT_PLTREL", "DT_DEBUG", "DT_TEXTREL", "DT_JMPREL"};
@@ -47,6 +60,14 @@ void	*Elf64Relocate(void *Base, char **envp, const char *Filename);
  int	Elf64GetSymbol(void *Base, const char *Name, void **Ret, size_t *Size);
 #endif
 uint32_t	ElfHashString(const char *name);
+uint32_t	ElfGnuHashString(const char *name);
+const uint32_t	*ElfGnuHashChain(const uint32_t *Table, int WordBits, uint32_t Hash, int *FirstSym);
+static int	ElfLazyPLT_Setup(void *Base, void *GOT, int Machine, int bBindNow, int NumSlots);
+static int	ElfPrelink_Interposed(void *Base, uint32_t Stamp, const void *Relocs, size_t Size, size_t EntSize, int NumRuntime, int b64, const void *SymTab, const char *StrTab);
+#if SUPPORT_LAZY_PLT
+void	*ElfLazyResolve(void *Base, uintptr_t Reloc);
+extern void	ElfLazyTrampoline(void);	// arch/*.asm.h
+#endif
 
 // === CODE ===
 /**
@@ -213,9 +234,15 @@ void *Elf32Relocate(void *Base, char **envp, const char *Filename)
 	Elf32_Rel	*rel = NULL;
 	Elf32_Rela	*rela = NULL;
 	void	*plt = NULL;
+	Elf32_Word	*pltgot = NULL;
 	 int	relSz=0, relEntSz=8;
 	 int	relaSz=0, relaEntSz=8;
 	 int	pltSz=0, pltType=0;
+	 int	bTextRel = 0;
+	 int	bBindNow = 0;
+	uint32_t	prelinkStamp = 0;
+	 int	prelinkRelCount = 0, prelinkPltCount = 0;
+	 int	bPrelinked = 0, bDepsOK = 1;
 	Elf32_Dyn	*dynamicTab = NULL;	// Dynamic Table Pointer
 	char	*dynstrtab = NULL;	// .dynamic String Table
 	Elf32_Sym	*dynsymtab;
@@ -261,20 +288,47 @@ void *Elf32Relocate(void *Base, char **envp, const char *Filename)
 		return (void *)(intptr_t)(hdr->entrypoint + iBaseDiff);
 	}
 
-	// Allow writing to read-only segments, just in case they need to be relocated
+	// Adjust Dynamic Table
+	dynamicTab = (void *)( (intptr_t)dynamicTab + iBaseDiff );
+
+	// Only allow writing to read-only segments if the image has text relocations
+	// - Un-protecting touches (and so faults in) every text page, and any write
+	//   leaves this process with a private copy of what would be shared text.
 	// - Will be reversed at the end of the function
-	for( i = 0; i < iSegmentCount; i ++ )
+	for( j = 0; dynamicTab[j].d_tag != DT_NULL; j++)
 	{
-		if(phtab[i].Type == PT_LOAD && !(phtab[i].Flags & PF_W) ) {
-			uintptr_t	addr = phtab[i].VAddr + iBaseDiff;
-			uintptr_t	end = addr + phtab[i].MemSize;
-			for( ; addr < end; addr += PAGE_SIZE )
-				_SysSetMemFlags(addr, 0, 1);	// Unset RO
+		if( dynamicTab[j].d_tag == DT_TEXTREL )
+			bTextRel = 1;
+		if( dynamicTab[j].d_tag == DT_FLAGS && (dynamicTab[j].d_val & DF_TEXTREL) )
+			bTextRel = 1;
+		// Linked with -z now
+		if( dynamicTab[j].d_tag == DT_BIND_NOW )
+			bBindNow = 1;
+		if( dynamicTab[j].d_tag == DT_FLAGS && (dynamicTab[j].d_val & DF_BIND_NOW) )
+			bBindNow = 1;
+		if( dynamicTab[j].d_tag == DT_FLAGS_1 && (dynamicTab[j].d_val & DF_1_NOW) )
+			bBindNow = 1;
+		// Processed by Tools/prelink
+		if( dynamicTab[j].d_tag == DT_GNU_PRELINKED )
+			prelinkStamp = dynamicTab[j].d_val;
+		if( dynamicTab[j].d_tag == DT_ACESS_PRELINK_RELCOUNT )
+			prelinkRelCount = dynamicTab[j].d_val;
+		if( dynamicTab[j].d_tag == DT_ACESS_PRELINK_PLTCOUNT )
+			prelinkPltCount = dynamicTab[j].d_val;
+	}
+	if( bTextRel )
+	{
+		DEBUGS(" elf_relocate: Image has text relocations");
+		for( i = 0; i < iSegmentCount; i ++ )
+		{
+			if(phtab[i].Type == PT_LOAD && !(phtab[i].Flags & PF_W) ) {
+				uintptr_t	addr = phtab[i].VAddr + iBaseDiff;
+				uintptr_t	end = addr + phtab[i].MemSize;
+				for( ; addr < end; addr += PAGE_SIZE )
+					_SysSetMemFlags(addr, 0, 1);	// Unset RO
+			}
 		}
 	}
-
-	// Adjust Dynamic Table
-	dynamicTab = (void *)( (intptr_t)dynamicTab + iBaseDiff );
 	
 	// === Get Symbol table and String Table ===
 	dynsymtab = NULL;
@@ -298,6 +352,7 @@ void *Elf32Relocate(void *Base, char **envp, const char *Filename)
 			break;
 		// --- Hash Table --
 		case DT_HASH:
+		case DT_GNU_HASH:
 			if(iBaseDiff != 0)	dynamicTab[j].d_val += iBaseDiff;
 //			iSymCount = ((Elf32_Word*)(intptr_t)dynamicTab[j].d_val)[1];
 			break;
@@ -323,10 +378,12 @@ void *Elf32Relocate(void *Base, char **envp, const char *Filename)
 			DEBUGS(" elf_relocate: .so Name '%s'", dynstrtab+dynamicTab[j].d_val);
 			break;
 		// --- Needed Library ---
-		case DT_NEEDED:
+		case DT_NEEDED: {
+			void	*dep;
 			libPath = dynstrtab + dynamicTab[j].d_val;
 			DEBUGS(" Required Library '%s'", libPath);
-			if(LoadLibrary(libPath, NULL, envp) == 0) {
+			dep = LoadLibrary(libPath, NULL, envp);
+			if(dep == 0) {
 				#if DEBUG
 				DEBUGS(" elf_relocate: Unable to load '%s'", libPath);
 				#else
@@ -334,10 +391,12 @@ void *Elf32Relocate(void *Base, char **envp, const char *Filename)
 				#endif
 				return 0;
 			}
+			if( prelinkStamp && !Prelink_DepOK(dep, prelinkStamp) )
+				bDepsOK = 0;
 			DEBUGS(" Lib loaded");
-			break;
+			} break;
 		// --- PLT/GOT ---
-//		case DT_PLTGOT:	pltgot = (void*)(iBaseDiff + dynamicTab[j].d_val);	break;
+		case DT_PLTGOT:	pltgot = (void*)(iBaseDiff + dynamicTab[j].d_val);	break;
 		case DT_JMPREL:	plt = (void*)(iBaseDiff + dynamicTab[j].d_val);	break;
 		case DT_PLTREL:	pltType = dynamicTab[j].d_val;	break;
 		case DT_PLTRELSZ:	pltSz = dynamicTab[j].d_val;	break;
@@ -354,6 +413,7 @@ void *Elf32Relocate(void *Base, char **envp, const char *Filename)
 		case DT_SYMTAB:
 		// --- Hash Table ---
 		case DT_HASH:
+		case DT_GNU_HASH:
 		// --- String Table ---
 		case DT_STRTAB:
 			break;
@@ -388,6 +448,17 @@ void *Elf32Relocate(void *Base, char **envp, const char *Filename)
 	
 	DEBUGS("do_relocate = %p (%p or %p)", do_relocate, &elf_doRelocate_386, &elf_doRelocate_arm);
 
+	// Loaded where Tools/prelink put it, with the same dependencies, only the
+	// entries it left (sorted to the front of each table) need processing
+	if( SUPPORT_PRELINK && prelinkStamp && iBaseDiff == 0 && bDepsOK )
+	{
+		bPrelinked = !ElfPrelink_Interposed(Base, prelinkStamp, rel, relSz, relEntSz, prelinkRelCount, 0, dynsymtab, dynstrtab)
+			&& !ElfPrelink_Interposed(Base, prelinkStamp, rela, relaSz, relaEntSz, prelinkRelCount, 0, dynsymtab, dynstrtab)
+			&& !ElfPrelink_Interposed(Base, prelinkStamp, plt, pltSz,
+				(pltType == DT_REL ? sizeof(Elf32_Rel) : sizeof(Elf32_Rela)), prelinkPltCount, 0, dynsymtab, dynstrtab);
+		DEBUGS(" elf_relocate: Prelinked, layout %s", (bPrelinked ? "valid" : "conflicts"));
+	}
+
 	#define _doRelocate(r_info, ptr, bRela, addend)	\
 		do_relocate(r_info, ptr, addend, ELF32_R_TYPE(r_info), bRela, \
 			dynstrtab + dynsymtab[ELF32_R_SYM(r_info)].nameOfs, iBaseDiff);
@@ -398,6 +469,8 @@ void *Elf32Relocate(void *Base, char **envp, const char *Filename)
 		Elf32_Word	*ptr;
 		DEBUGS(" elf_relocate: rel=0x%x, relSz=0x%x, relEntSz=0x%x", rel, relSz, relEntSz);
 		j = relSz / relEntSz;
+		if( bPrelinked && prelinkRelCount < j )
+			j = prelinkRelCount;
 		for( i = 0; i < j; i++ )
 		{
 			//DEBUGS("  Rel %i: 0x%x+0x%x", i, iBaseDiff, rel[i].r_offset);
@@ -411,10 +484,12 @@ void *Elf32Relocate(void *Base, char **envp, const char *Filename)
 		Elf32_Word	*ptr;
 		DEBUGS(" elf_relocate: rela=0x%x, relaSz=0x%x, relaEntSz=0x%x", rela, relaSz, relaEntSz);
 		j = relaSz / relaEntSz;
+		if( bPrelinked && prelinkRelCount < j )
+			j = prelinkRelCount;
 		for( i = 0; i < j; i++ )
 		{
 			ptr = (void*)(iBaseDiff + rela[i].r_offset);
-			fail |= _doRelocate(rel[i].r_info, ptr, 1, rela[i].r_addend);
+			fail |= _doRelocate(rela[i].r_info, ptr, 1, rela[i].r_addend);
 		}
 	}
 	
@@ -426,11 +501,21 @@ void *Elf32Relocate(void *Base, char **envp, const char *Filename)
 		if(pltType == DT_REL)
 		{
 			Elf32_Rel	*pltRel = plt;
+			 int	bLazy;
 			j = pltSz / sizeof(Elf32_Rel);
 			DEBUGS(" elf_relocate: PLT Reloc Type = Rel, %i entries", j);
+			// Prelinked slots hold final addresses, not stubs (even if the layout was rejected)
+			bLazy = ElfLazyPLT_Setup(Base, pltgot, hdr->machine, bBindNow || prelinkStamp, j);
+			if( bPrelinked && prelinkPltCount < j )
+				j = prelinkPltCount;
 			for(i=0;i<j;i++)
 			{
 				ptr = (void*)(iBaseDiff + pltRel[i].r_offset);
+				if( bLazy && ELF32_R_TYPE(pltRel[i].r_info) == R_386_JMP_SLOT ) {
+					// Slot holds the link-time address of the stub's push, which ends up in ElfLazyResolve
+					*ptr += iBaseDiff;
+					continue ;
+				}
 				fail |= _doRelocate(pltRel[i].r_info, ptr, 0, *ptr);
 			}
 		}
@@ -439,23 +524,25 @@ void *Elf32Relocate(void *Base, char **envp, const char *Filename)
 			Elf32_Rela	*pltRela = plt;
 			j = pltSz / sizeof(Elf32_Rela);
 			DEBUGS(" elf_relocate: PLT Reloc Type = Rela, %i entries", j);
+			if( bPrelinked && prelinkPltCount < j )
+				j = prelinkPltCount;
 			for(i=0;i<j;i++)
 			{
-				ptr = (void*)(iRealBase + pltRela[i].r_offset);
+				ptr = (void*)(iBaseDiff + pltRela[i].r_offset);
 				fail |= _doRelocate(pltRela[i].r_info, ptr, 1, pltRela[i].r_addend);
 			}
 		}
 	}
 
 	// Re-set readonly
-	for( i = 0; i < iSegmentCount; i ++ )
+	for( i = 0; bTextRel && i < iSegmentCount; i ++ )
 	{
 		// If load and not writable
 		if(phtab[i].Type == PT_LOAD && !(phtab[i].Flags & PF_W) ) {
 			uintptr_t	addr = phtab[i].VAddr + iBaseDiff;
 			uintptr_t	end = addr + phtab[i].MemSize;
 			for( ; addr < end; addr += PAGE_SIZE )
-				_SysSetMemFlags(addr, 1, 1);	// Unset RO
+				_SysSetMemFlags(addr, 1, 1);	// Set RO
 		}
 	}
 
@@ -466,6 +553,9 @@ void *Elf32Relocate(void *Base, char **envp, const char *Filename)
 
 	#undef _doRelocate
 
+	if( bPrelinked )
+		Prelink_SetStamp(Base, prelinkStamp);
+
 	DEBUGS("ElfRelocate: RETURN 0x%x to %p", hdr->entrypoint + iBaseDiff, __builtin_return_address(0));
 	return (void*)(intptr_t)( hdr->entrypoint + iBaseDiff );
 }
@@ -477,6 +567,7 @@ int Elf32GetSymbol(void *Base, const char *Name, void **ret, size_t *Size)
 	 int	nbuckets = 0;
 	Elf32_Word	*pBuckets = NULL;
 	Elf32_Word	*pChains;
+	Elf32_Word	*pGnuHash = NULL;
 	uint32_t	iNameHash;
 	const char	*dynstrtab = NULL;
 	uintptr_t	iBaseDiff = -1;
@@ -515,6 +606,9 @@ int Elf32GetSymbol(void *Base, const char *Name, void **ret, size_t *Size)
 		case DT_HASH:
 			pBuckets = (void*)(intptr_t) dynTab[i].d_val;
 			break;
+		case DT_GNU_HASH:
+			pGnuHash = (void*)(intptr_t) dynTab[i].d_val;
+			break;
 		}
 	}
 	
@@ -522,7 +616,7 @@ int Elf32GetSymbol(void *Base, const char *Name, void **ret, size_t *Size)
 		SysDebug("ERRO - No DT_SYMTAB in %p", Base);
 		return 0;
 	}
-	if( !pBuckets ) {
+	if( !pBuckets && !pGnuHash ) {
 		SysDebug("ERRO - No DT_HASH in %p", Base);
 		return 0;
 	}
@@ -535,11 +629,34 @@ int Elf32GetSymbol(void *Base, const char *Name, void **ret, size_t *Size)
 	if( (uintptr_t)symtab < (uintptr_t)Base )
 	{
 		symtab    = (void*)( (uintptr_t)symtab    + iBaseDiff );
-		pBuckets  = (void*)( (uintptr_t)pBuckets  + iBaseDiff );
 		dynstrtab = (void*)( (uintptr_t)dynstrtab + iBaseDiff );
+		if( pBuckets )
+			pBuckets  = (void*)( (uintptr_t)pBuckets  + iBaseDiff );
+		if( pGnuHash )
+			pGnuHash  = (void*)( (uintptr_t)pGnuHash  + iBaseDiff );
 		SysDebug("Executable not yet relocated");
 	}
 
+	// Prefer the GNU table, its bloom filter rejects most misses without touching the symbols
+	if( pGnuHash )
+	{
+		const Elf32_Word	*chain;
+		iNameHash = ElfGnuHashString(Name);
+		for( chain = ElfGnuHashChain(pGnuHash, 32, iNameHash, &i); chain; chain ++, i ++ )
+		{
+			if( (*chain|1) == (iNameHash|1) && symtab[i].shndx != SHN_UNDEF
+			 && strcmp(dynstrtab + symtab[i].nameOfs, Name) == 0 ) {
+				*ret = (void*)( (uintptr_t) symtab[ i ].value + iBaseDiff );
+				if(Size)	*Size = symtab[i].size;
+				return 1;
+			}
+			// Low bit marks the end of the chain
+			if( *chain & 1 )
+				break;
+		}
+		return 0;
+	}
+
 	nbuckets = pBuckets[0];
 //	iSymCount = pBuckets[1];
 	pBuckets = &pBuckets[2];
@@ -571,9 +688,9 @@ int Elf32GetSymbol(void *Base, const char *Name, void **ret, size_t *Size)
 }
 
 #ifdef SUPPORT_ELF64
-typedef int (*t_elf64_doreloc)(void *Base, const char *strtab, Elf64_Sym *symtab, Elf64_Xword r_info, void *ptr, Elf64_Sxword addend);
+typedef int (*t_elf64_doreloc)(uintptr_t BaseDiff, const char *strtab, Elf64_Sym *symtab, Elf64_Xword r_info, void *ptr, Elf64_Sxword addend);
 
-int _Elf64DoReloc_X86_64(void *Base, const char *strtab, Elf64_Sym *symtab, Elf64_Xword r_info, void *ptr, Elf64_Sxword addend)
+int _Elf64DoReloc_X86_64(uintptr_t BaseDiff, const char *strtab, Elf64_Sym *symtab, Elf64_Xword r_info, void *ptr, Elf64_Sxword addend)
 {
 	 int	sym = ELF64_R_SYM(r_info);
 	 int	type = ELF64_R_TYPE(r_info);
@@ -602,7 +719,7 @@ int _Elf64DoReloc_X86_64(void *Base, const char *strtab, Elf64_Sym *symtab, Elf6
 		*(uint64_t*)ptr = (uintptr_t)symval;
 		break;
 	case R_X86_64_RELATIVE:
-		*(uint64_t*)ptr = (uintptr_t)Base + addend;
+		*(uint64_t*)ptr = BaseDiff + addend;
 		break;
 	default:
 		SysDebug("ld-acess - _Elf64DoReloc: Unknown relocation type %i", type);
@@ -622,12 +739,19 @@ void *Elf64Relocate(void *Base, char **envp, const char *Filename)
 	Elf64_Sym	*symtab = NULL;
 	char	*strtab = NULL;
 	Elf64_Word	*hashtab = NULL;
+	Elf64_Word	*gnuhashtab = NULL;
 	Elf64_Rel	*rel = NULL;
 	 int	rel_count = 0;
 	Elf64_Rela	*rela = NULL;
 	 int	rela_count = 0;
 	void	*pltrel = NULL;
+	Elf64_Addr	*pltgot = NULL;
 	 int	plt_size = 0, plt_type = 0;
+	 int	bTextRel = 0;
+	 int	bBindNow = 0;
+	uint32_t	prelinkStamp = 0;
+	 int	prelinkRelCount = 0, prelinkPltCount = 0;
+	 int	bPrelinked = 0, bDepsOK = 1;
 
 	DEBUGS("Elf64Relocate: hdr = {");
 	DEBUGS("Elf64Relocate:  e_ident = '%.16s'", hdr->e_ident);
@@ -681,10 +805,24 @@ void *Elf64Relocate(void *Base, char **envp, const char *Filename)
 			dyntab[i].d_un.d_ptr += baseDiff;
 			hashtab = (void *)(uintptr_t)dyntab[i].d_un.d_ptr;
 			break;
+		case DT_GNU_HASH:
+			dyntab[i].d_un.d_ptr += baseDiff;
+			gnuhashtab = (void *)(uintptr_t)dyntab[i].d_un.d_ptr;
+			break;
+		// Processed by Tools/prelink
+		case DT_GNU_PRELINKED:
+			prelinkStamp = dyntab[i].d_un.d_val;
+			break;
+		case DT_ACESS_PRELINK_RELCOUNT:
+			prelinkRelCount = dyntab[i].d_un.d_val;
+			break;
+		case DT_ACESS_PRELINK_PLTCOUNT:
+			prelinkPltCount = dyntab[i].d_un.d_val;
+			break;
 		}
 	}
 
-	if( !symtab || !strtab || !hashtab ) {
+	if( !symtab || !strtab || (!hashtab && !gnuhashtab) ) {
 		SysDebug("ld-acess - Elf64Relocate: Missing Symbol, string or hash table");
 		return NULL;
 	}
@@ -702,11 +840,15 @@ void *Elf64Relocate(void *Base, char **envp, const char *Filename)
 
 		case DT_NEEDED: {
 			char *libPath = strtab + dyntab[i].d_un.d_val;
+			void	*dep;
 			DEBUGS("Elf64Relocate: libPath = '%s'", libPath);
-			if(LoadLibrary(libPath, NULL, envp) == 0) {
+			dep = LoadLibrary(libPath, NULL, envp);
+			if(dep == 0) {
 				SysDebug("ld-acess - Elf64Relocate: Unable to load '%s'", libPath);
 				return NULL;
 			}
+			if( prelinkStamp && !Prelink_DepOK(dep, prelinkStamp) )
+				bDepsOK = 0;
 			} break;
 		
 		// Relocation entries
@@ -748,12 +890,60 @@ void *Elf64Relocate(void *Base, char **envp, const char *Filename)
 		case DT_PLTRELSZ:
 			plt_size = dyntab[i].d_un.d_val;
 			break;
+		case DT_PLTGOT:
+			pltgot = (void *)(uintptr_t)(dyntab[i].d_un.d_ptr + baseDiff);
+			break;
+		case DT_TEXTREL:
+			bTextRel = 1;
+			break;
+		case DT_BIND_NOW:
+			bBindNow = 1;
+			break;
+		case DT_FLAGS:
+			if( dyntab[i].d_un.d_val & DF_TEXTREL )
+				bTextRel = 1;
+			if( dyntab[i].d_un.d_val & DF_BIND_NOW )
+				bBindNow = 1;
+			break;
+		case DT_FLAGS_1:
+			if( dyntab[i].d_un.d_val & DF_1_NOW )
+				bBindNow = 1;
+			break;
 		}
 	}
 
+	// Text relocations need the read-only segments writable (see Elf32Relocate)
+	if( bTextRel )
+	{
+		DEBUGS("Elf64Relocate: Image has text relocations");
+		for( i = 0; i < hdr->e_phnum; i ++ )
+		{
+			if(phtab[i].p_type == PT_LOAD && !(phtab[i].p_flags & PF_W) ) {
+				uintptr_t	addr = phtab[i].p_vaddr + baseDiff;
+				uintptr_t	end = addr + phtab[i].p_memsz;
+				for( ; addr < end; addr += PAGE_SIZE )
+					_SysSetMemFlags(addr, 0, 1);	// Unset RO
+			}
+		}
+	}
+
+	// See Elf32Relocate
+	if( SUPPORT_PRELINK && prelinkStamp && baseDiff == 0 && bDepsOK )
+	{
+		bPrelinked = !ElfPrelink_Interposed(Base, prelinkStamp, rel, rel_count*sizeof(Elf64_Rel), sizeof(Elf64_Rel), prelinkRelCount, 1, symtab, strtab)
+			&& !ElfPrelink_Interposed(Base, prelinkStamp, rela, rela_count*sizeof(Elf64_Rela), sizeof(Elf64_Rela), prelinkRelCount, 1, symtab, strtab)
+			&& !ElfPrelink_Interposed(Base, prelinkStamp, pltrel, plt_size,
+				(plt_type == DT_REL ? sizeof(Elf64_Rel) : sizeof(Elf64_Rela)), prelinkPltCount, 1, symtab, strtab);
+		DEBUGS("Elf64Relocate: Prelinked, layout %s", (bPrelinked ? "valid" : "conflicts"));
+	}
+	if( bPrelinked ) {
+		if( prelinkRelCount < rel_count )	rel_count = prelinkRelCount;
+		if( prelinkRelCount < rela_count )	rela_count = prelinkRelCount;
+	}
+
 	// Relocation function
 	t_elf64_doreloc fpElf64DoReloc = &_Elf64DoReloc_X86_64;
-	#define _Elf64DoReloc(info, ptr, addend)	fpElf64DoReloc(Base, strtab, symtab, info, ptr, addend)
+	#define _Elf64DoReloc(info, ptr, addend)	fpElf64DoReloc(baseDiff, strtab, symtab, info, ptr, addend)
 
 	int fail = 0;
 	if( rel )
@@ -781,6 +971,8 @@ void *Elf64Relocate(void *Base, char **envp, const char *Filename)
 		if( plt_type == DT_REL ) {
 			Elf64_Rel	*plt = pltrel;
 			 int	count = plt_size / sizeof(Elf64_Rel);
+			if( bPrelinked && prelinkPltCount < count )
+				count = prelinkPltCount;
 			DEBUGS("plt rel count = %i", count);
 			for( i = 0; i < count; i ++ )
 			{
@@ -791,19 +983,40 @@ void *Elf64Relocate(void *Base, char **envp, const char *Filename)
 		else {
 			Elf64_Rela	*plt = pltrel;
 			 int	count = plt_size / sizeof(Elf64_Rela);
+			 int	bLazy = ElfLazyPLT_Setup(Base, pltgot, hdr->e_machine, bBindNow || prelinkStamp, count);
+			if( bPrelinked && prelinkPltCount < count )
+				count = prelinkPltCount;
 			DEBUGS("plt rela count = %i", count);
 			for( i = 0; i < count; i ++ )
 			{
 				uint64_t *ptr = (void *)(uintptr_t)( plt[i].r_offset + baseDiff );
+				if( bLazy && ELF64_R_TYPE(plt[i].r_info) == R_X86_64_JUMP_SLOT ) {
+					// See Elf32Relocate
+					*ptr += baseDiff;
+					continue ;
+				}
 				fail |= _Elf64DoReloc( plt[i].r_info, ptr, plt[i].r_addend);
 			}
 		}
 	}
 
+	// Re-set readonly
+	for( i = 0; bTextRel && i < hdr->e_phnum; i ++ )
+	{
+		if(phtab[i].p_type == PT_LOAD && !(phtab[i].p_flags & PF_W) ) {
+			uintptr_t	addr = phtab[i].p_vaddr + baseDiff;
+			uintptr_t	end = addr + phtab[i].p_memsz;
+			for( ; addr < end; addr += PAGE_SIZE )
+				_SysSetMemFlags(addr, 1, 1);	// Set RO
+		}
+	}
+
 	if( fail ) {
 		DEBUGS("Elf64Relocate: Failure");
 		return NULL;
 	}
+	if( bPrelinked )
+		Prelink_SetStamp(Base, prelinkStamp);
 
 	{
 	void *ret = (void *)(uintptr_t)(hdr->e_entry + baseDiff);
@@ -821,6 +1034,7 @@ int Elf64GetSymbol(void *Base, const char *Name, void **Ret, size_t *Size)
 	 int	i;
 	Elf64_Word	*pBuckets;
 	Elf64_Word	*pChains;
+	Elf64_Word	*pGnuHash = NULL;
 	uint32_t	iNameHash;
 	const char	*dynstrtab;
 	uintptr_t	iBaseDiff = -1;
@@ -868,10 +1082,36 @@ int Elf64GetSymbol(void *Base, const char *Name, void **Ret, size_t *Size)
 			case DT_HASH:
 				pBuckets = (void*)(intptr_t) dynTab[j].d_un.d_val;
 				break;
+			case DT_GNU_HASH:
+				pGnuHash = (void*)(intptr_t) dynTab[j].d_un.d_val;
+				break;
 			}
 		}
 	}
 
+	if( pGnuHash )
+	{
+		const Elf64_Word	*chain;
+		iNameHash = ElfGnuHashString(Name);
+		for( chain = ElfGnuHashChain(pGnuHash, 64, iNameHash, &i); chain; chain ++, i ++ )
+		{
+			if( (*chain|1) == (iNameHash|1) && symtab[i].st_shndx != SHN_UNDEF
+			 && strcmp(dynstrtab + symtab[i].st_name, Name) == 0 ) {
+				*Ret = (void*)( (intptr_t)symtab[i].st_value + iBaseDiff );
+				if(Size)	*Size = symtab[i].st_size;
+				DEBUGS("%s = %p", Name, *Ret);
+				return 1;
+			}
+			if( *chain & 1 )
+				break;
+		}
+		return 0;
+	}
+	if( !pBuckets ) {
+		SysDebug("ERROR - No DT_HASH in %p", Base);
+		return 0;
+	}
+
 	nbuckets = pBuckets[0];
 //	iSymCount = pBuckets[1];
 	pBuckets = &pBuckets[2];
@@ -906,6 +1146,162 @@ int Elf64GetSymbol(void *Base, const char *Name, void **Ret, size_t *Size)
 #endif
 
 
+/**
+ * \brief Decide if an image's jump slots can be bound lazily, and hook up the resolver if so
+ * \param GOT	DT_PLTGOT, entries 1 and 2 are reserved for the dynamic linker
+ * \return Boolean, true if jump slots should be left for ElfLazyResolve
+ */
+static int ElfLazyPLT_Setup(void *Base, void *GOT, int Machine, int bBindNow, int NumSlots)
+{
+#if SUPPORT_LAZY_PLT
+	uintptr_t	*got = GOT;
+	
+	if( !got || bBindNow || gbLdBindNow )
+		return 0;
+	// Only the native machine type has a trampoline
+	#if defined(ARCHDIR_is_x86)
+	if( Machine != EM_386 )	return 0;
+	#else
+	if( Machine != EM_X86_64 )	return 0;
+	#endif
+	
+	// The PLT's first stub pushes GOT[1] and jumps to GOT[2]
+	got[1] = (uintptr_t)Base;
+	got[2] = (uintptr_t)&ElfLazyTrampoline;
+	gLdStats.LazySlots += NumSlots;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * \brief Check the symbols of a prelinked relocation table's pre-applied entries
+ * \param Relocs	DT_REL/DT_RELA/DT_JMPREL table (can be NULL)
+ * \param Size	Size of the table in bytes
+ * \param NumRuntime	Entries at the start of the table left for ld-acess (DT_ACESS_PRELINK_*COUNT)
+ * \return Boolean, true if any of them would now resolve to a different definition
+ */
+static int ElfPrelink_Interposed(void *Base, uint32_t Stamp, const void *Relocs, size_t Size, size_t EntSize,
+	int NumRuntime, int b64, const void *SymTab, const char *StrTab)
+{
+	 int	count;
+	if( !Relocs || !EntSize )
+		return 0;
+	count = Size / EntSize;
+	for( int i = NumRuntime; i < count; i ++ )
+	{
+		const uint8_t	*ent = (const uint8_t*)Relocs + i * EntSize;
+		uint32_t	sym;
+		// r_info follows r_offset, and st_name is the first field of both symbol types
+		if( b64 )
+			sym = ELF64_R_SYM( *(const Elf64_Xword*)(ent + sizeof(Elf64_Addr)) );
+		else
+			sym = ELF32_R_SYM( *(const Elf32_Word*)(ent + sizeof(Elf32_Addr)) );
+		if( sym == 0 )
+			continue ;
+		const uint32_t	*name = (const void*)( (const uint8_t*)SymTab + sym * (b64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym)) );
+		if( Prelink_IsInterposed(Base, Stamp, StrTab + *name) )
+			return 1;
+	}
+	return 0;
+}
+
+#if SUPPORT_LAZY_PLT
+/**
+ * \brief Bind a jump slot on its first call
+ * \param Base	Image base (from GOT[1])
+ * \param Reloc	DT_JMPREL entry, byte offset for ELF32 and index for ELF64 (as pushed by the PLT)
+ * \return Address of the target function, ElfLazyTrampoline jumps there
+ */
+void *ElfLazyResolve(void *Base, uintptr_t Reloc)
+{
+	static volatile int	lock;
+	Elf32_Ehdr	*hdr = Base;
+	intptr_t	iBaseDiff = -1;
+	const char	*name = NULL;
+	void	*val;
+	uintptr_t	*slot = NULL;
+	 int	i;
+	
+	// Another thread may be in GetSymbol (which updates the symbol cache)
+	while( __sync_lock_test_and_set(&lock, 1) )
+		__asm__ __volatile__ ("pause");
+	
+	// Tables were rebased in place by the relocator, except ELF32's DT_JMPREL
+	if( hdr->e_ident[4] == ELFCLASS32 )
+	{
+		Elf32_Phdr	*phtab = (void*)( (uintptr_t)Base + hdr->phoff );
+		Elf32_Dyn	*dynTab = NULL;
+		Elf32_Sym	*symtab = NULL;
+		const char	*strtab = NULL;
+		Elf32_Rel	*rel = NULL;
+		for( i = 0; i < hdr->phentcount; i ++ )
+		{
+			if(phtab[i].Type == PT_LOAD && (uintptr_t)iBaseDiff > phtab[i].VAddr)
+				iBaseDiff = phtab[i].VAddr;
+			if(phtab[i].Type == PT_DYNAMIC)
+				dynTab = (void*)(intptr_t)phtab[i].VAddr;
+		}
+		iBaseDiff = (intptr_t)Base - (iBaseDiff & ~0xFFF);
+		dynTab = (void*)( (intptr_t)dynTab + iBaseDiff );
+		for( i = 0; dynTab[i].d_tag != DT_NULL; i ++ )
+		{
+			switch(dynTab[i].d_tag)
+			{
+			case DT_SYMTAB:	symtab = (void*)(intptr_t)dynTab[i].d_val;	break;
+			case DT_STRTAB:	strtab = (void*)(intptr_t)dynTab[i].d_val;	break;
+			case DT_JMPREL:	rel = (void*)(intptr_t)(dynTab[i].d_val + iBaseDiff);	break;
+			}
+		}
+		rel = (void*)( (uintptr_t)rel + Reloc );
+		name = strtab + symtab[ ELF32_R_SYM(rel->r_info) ].nameOfs;
+		slot = (void*)( rel->r_offset + iBaseDiff );
+	}
+	#ifdef SUPPORT_ELF64
+	else
+	{
+		Elf64_Ehdr	*hdr64 = Base;
+		Elf64_Phdr	*phtab = (void*)( (uintptr_t)Base + (uintptr_t)hdr64->e_phoff );
+		Elf64_Dyn	*dynTab = NULL;
+		Elf64_Sym	*symtab = NULL;
+		const char	*strtab = NULL;
+		Elf64_Rela	*rela = NULL;
+		for( i = 0; i < hdr64->e_phnum; i ++ )
+		{
+			if(phtab[i].p_type == PT_LOAD && (uintptr_t)iBaseDiff > phtab[i].p_vaddr)
+				iBaseDiff = phtab[i].p_vaddr;
+			if(phtab[i].p_type == PT_DYNAMIC)
+				dynTab = (void*)(intptr_t)phtab[i].p_vaddr;
+		}
+		iBaseDiff = (intptr_t)Base - iBaseDiff;
+		dynTab = (void*)( (intptr_t)dynTab + iBaseDiff );
+		for( i = 0; dynTab[i].d_tag != DT_NULL; i ++ )
+		{
+			switch(dynTab[i].d_tag)
+			{
+			case DT_SYMTAB:	symtab = (void*)(intptr_t)dynTab[i].d_un.d_ptr;	break;
+			case DT_STRTAB:	strtab = (void*)(intptr_t)dynTab[i].d_un.d_ptr;	break;
+			case DT_JMPREL:	rela = (void*)(intptr_t)dynTab[i].d_un.d_ptr;	break;
+			}
+		}
+		rela = &rela[Reloc];
+		name = strtab + symtab[ ELF64_R_SYM(rela->r_info) ].st_name;
+		slot = (void*)(uintptr_t)( rela->r_offset + iBaseDiff );
+	}
+	#endif
+	
+	if( !GetSymbol(name, &val, NULL) ) {
+		SysDebug("ld-acess - ElfLazyResolve: Unable to bind '%s' for %p", name, Base);
+		_exit(-1);
+	}
+	*slot = (uintptr_t)val;
+	
+	__sync_lock_release(&lock);
+	return val;
+}
+#endif
+
 uint32_t ElfHashString(const char *name)
 {
 	uint32_t	h = 0, g;
@@ -919,3 +1315,61 @@ uint32_t ElfHashString(const char *name)
 	return h;
 }
 
+/**
+ * \brief Hash function used by DT_GNU_HASH (h * 33 + c)
+ */
+uint32_t ElfGnuHashString(const char *name)
+{
+	uint32_t	h = 5381;
+	while(*name)
+		h = (h << 5) + h + *(uint8_t*)name++;
+	return h;
+}
+
+/**
+ * \brief Find the hash chain for a name in a DT_GNU_HASH table
+ * \param Table	DT_GNU_HASH table (nbuckets, symoffset, bloom size, bloom shift, ...)
+ * \param WordBits	Size of a bloom filter word (32 or 64, follows the ELF class)
+ * \param Hash	ElfGnuHashString of the name
+ * \param FirstSym	Set to the symbol index of the first chain entry
+ * \return First chain entry, or NULL if the name is not in the table
+ */
+const uint32_t *ElfGnuHashChain(const uint32_t *Table, int WordBits, uint32_t Hash, int *FirstSym)
+{
+	uint32_t	nbuckets = Table[0];
+	uint32_t	symoffset = Table[1];
+	uint32_t	bloomsize = Table[2];
+	uint32_t	shift = Table[3];
+	const uint32_t	*buckets;
+	uint32_t	sym;
+
+	if( nbuckets == 0 || bloomsize == 0 )
+		return NULL;
+
+	// Each name sets two bits in one bloom word
+	if( WordBits == 64 )
+	{
+		const uint64_t	*bloom = (const void*)&Table[4];
+		uint64_t	word = bloom[ (Hash / 64) % bloomsize ];
+		uint64_t	mask = (1ULL << (Hash % 64)) | (1ULL << ((Hash >> shift) % 64));
+		if( (word & mask) != mask )
+			return NULL;
+		buckets = (const void*)&bloom[bloomsize];
+	}
+	else
+	{
+		const uint32_t	*bloom = &Table[4];
+		uint32_t	word = bloom[ (Hash / 32) % bloomsize ];
+		uint32_t	mask = (1U << (Hash % 32)) | (1U << ((Hash >> shift) % 32));
+		if( (word & mask) != mask )
+			return NULL;
+		buckets = &bloom[bloomsize];
+	}
+
+	// Symbols below symoffset aren't hashed, so that marks an empty bucket
+	sym = buckets[ Hash % nbuckets ];
+	if( sym < symoffset )
+		return NULL;
+	*FirstSym = sym;
+	return &buckets[ nbuckets + sym - symoffset ];
+}
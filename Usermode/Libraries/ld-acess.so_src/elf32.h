@@ -210,7 +210,7 @@ enum {
 #define	ELF32_R_INFO(s,t)	(((s)<<8)+((t)&0xFF))	// Takes a type and symbol index and returns an info value
 
 struct elf32_dyn_s {
-	Elf32_Half	d_tag;
+	Elf32_Sword	d_tag;
 	Elf32_Word	d_val;	//Also d_ptr
 };
 
@@ -239,10 +239,26 @@ enum {
 	DT_DEBUG,	//!< Debugging Entry - Unknown contents
 	DT_TEXTREL,	//!< Indicates that modifcations to a non-writeable segment may occur
 	DT_JMPREL,	//!< Address of PLT only relocation entries
+	DT_BIND_NOW,	//!< Process all relocations before transferring control
+	DT_INIT_ARRAY,
+	DT_FINI_ARRAY,
+	DT_INIT_ARRAYSZ,
+	DT_FINI_ARRAYSZ,
+	DT_RUNPATH,
+	DT_FLAGS,	//!< DF_* flags
+	DT_ACESS_PRELINK_RELCOUNT = 0x6A000001,	//!< Tools/prelink: DT_REL(A) entries still to be processed
+	DT_ACESS_PRELINK_PLTCOUNT = 0x6A000002,	//!< Tools/prelink: DT_JMPREL entries still to be processed
+	DT_GNU_PRELINKED = 0x6FFFFDF5,	//!< Layout stamp, set by Tools/prelink
+	DT_GNU_HASH = 0x6FFFFEF5,	//!< Address of GNU-style (bloom filtered) hash table
+	DT_FLAGS_1 = 0x6FFFFFFB,	//!< DF_1_* flags
 	DT_LOPROC = 0x70000000,	//!< Low Definable
 	DT_HIPROC = 0x7FFFFFFF	//!< High Definable
 };
 
+#define DF_TEXTREL	0x4	//!< DT_FLAGS: Same as DT_TEXTREL
+#define DF_BIND_NOW	0x8	//!< DT_FLAGS: Same as DT_BIND_NOW
+#define DF_1_NOW	0x1	//!< DT_FLAGS_1: Same as DT_BIND_NOW
+
 typedef struct sElf32_Ehdr	Elf32_Ehdr;
 typedef struct sElf32_Phdr	Elf32_Phdr;
 typedef struct sElf32_Shent	Elf32_Shent;
@@ -4,6 +4,7 @@
 #define _SysKill	acess__SysKill
 #define _SysWaitEvent	acess__SysWaitEvent
 #define _SysWaitTID	acess__SysWaitTID
+#define _SysFutex	acess__SysFutex
 #define gettid	acess_gettid
 #define _SysGetPID	acess__SysGetPID
 #define _SysGetUID	acess__SysGetUID
@@ -15,6 +16,7 @@
 #define _SysTimestamp	acess__SysTimestamp
 #define _SysSetPri	acess__SysSetPri
 #define _SysSendMessage	acess__SysSendMessage
+#define _SysSendMessageEx	acess__SysSendMessageEx
 #define _SysGetMessage	acess__SysGetMessage
 #define _SysSpawn	acess__SysSpawn
 #define _SysExecVE	acess__SysExecVE
@@ -33,6 +35,8 @@
 #define _SysClose	acess__SysClose
 #define _SysRead	acess__SysRead
 #define _SysWrite	acess__SysWrite
+#define _SysReadV	acess__SysReadV
+#define _SysWriteV	acess__SysWriteV
 #define _SysSeek	acess__SysSeek
 #define _SysTell	acess__SysTell
 #define _SysFInfo	acess__SysFInfo
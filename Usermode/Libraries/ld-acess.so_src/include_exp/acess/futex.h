@@ -0,0 +1,23 @@
+/*
+ * Acess2 Dynamic Linker
+ * - By John Hodge (thePowersGang)
+ *
+ * acess/futex.h
+ * - Futex operation codes (shared with the kernel)
+ */
+#ifndef _ACESS__FUTEX_H_
+#define _ACESS__FUTEX_H_
+
+/**
+ * \brief Sleep while *Address == Value (or until timeout)
+ * \return 0 when woken, -1 with errno EAGAIN (value changed), ETIMEDOUT or EINTR
+ */
+#define FUTEX_WAIT	0
+/**
+ * \brief Wake at most Value threads sleeping on Address
+ * \return Number of threads woken
+ */
+#define FUTEX_WAKE	1
+
+#endif
+
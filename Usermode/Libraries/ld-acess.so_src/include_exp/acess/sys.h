@@ -32,9 +32,20 @@
 # define SEEK_END	-1
 #endif
 #define GETMSG_IGNORE	((void*)-1)
+#define SENDMSG_NONBLOCK	0x1
 #define FILEFLAG_DIRECTORY	0x10
 #define FILEFLAG_SYMLINK	0x20
 #define CLONE_VM	0x10
+// _SysMMap (protection in the low 16 bits, flags in the high 16)
+#define MMAP_PROT_READ	0x001
+#define MMAP_PROT_WRITE	0x002
+#define MMAP_PROT_EXEC	0x004
+#define MMAP_MAP_SHARED	0x001
+#define MMAP_MAP_PRIVATE	0x002
+#define MMAP_MAP_FIXED	0x004
+#define MMAP_MAP_ANONYMOUS	0x008
+#define MMAP_MAP_HUGE	0x010	// Use large (2 MiB) pages for anonymous memory if possible
+#define MMAP_PROTFLAGS(prot, flags)	((prot)|((flags)<<16))
 
 #ifdef ARCHDIR_is_native
 # include "_native_syscallmod.h"
@@ -52,6 +63,7 @@ extern void	_exit(int status)	__attribute__((noreturn));
 extern int	_SysKill(int pid, int sig);
 extern int	_SysWaitEvent(int EventMask);
 extern int	_SysWaitTID(int id, int *status);
+extern int	_SysFutex(volatile uint32_t *addr, int op, uint32_t val, const int64_t *timeout);
 extern int	_SysClone(int flags, void *stack);
 extern int	_SysExecVE(const char *path, char **argv, char **envp);
 extern int	_SysSpawn(const char *Path, const char **argv, const char **envp, int nFDs, int *FDs, struct s_sys_spawninfo *info);
@@ -84,6 +96,8 @@ extern size_t	_SysRead(int fd, void *buffer, size_t length);
 extern int	_SysClose(int fd);
 extern int	_SysFDCtl(int fd, int option, ...);
 extern size_t	_SysWrite(int fd, const void *buffer, size_t length);
+extern size_t	_SysReadV(int fd, const t_sysIOVec *vecs, int count);
+extern size_t	_SysWriteV(int fd, const t_sysIOVec *vecs, int count);
 extern int	_SysSeek(int fd, int64_t offset, int whence);
 extern uint64_t	_SysTell(int fd);
 extern int	_SysIOCtl(int fd, int id, void *data);
@@ -98,12 +112,16 @@ extern int	_SysUnlink(const char *pathname);
 
 // --- IPC ---
 extern int	_SysSendMessage(int dest, size_t length, const void *Data);
+extern int	_SysSendMessageEx(int dest, size_t length, const void *Data, int flags);
 extern int	_SysGetMessage(int *src, size_t buflen, void *Data);
 
 // --- MEMORY ---
 extern uint64_t	_SysGetPhys(uintptr_t vaddr);
 extern uint64_t	_SysAllocate(uintptr_t vaddr);
 extern uint32_t	_SysSetMemFlags(uintptr_t vaddr, uint32_t flags, uint32_t mask);
+extern int	_SysSetMemLimit(size_t bytes);	// 0 = no limit, inherited by children
+extern void	*_SysMMap(void *addr, size_t length, unsigned int protflags, int fd, uint64_t offset);
+extern int	_SysMUnmap(void *addr, size_t length);
 extern void	*_SysLoadBin(const char *path, void **entry);
 extern int	_SysUnloadBin(void *base);
 extern void	SysSetFaultHandler(int (*Hanlder)(int));
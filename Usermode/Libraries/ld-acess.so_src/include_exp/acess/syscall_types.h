@@ -8,6 +8,7 @@
 #ifndef _ACESS__SYSCALL_TYPES_H_
 #define _ACESS__SYSCALL_TYPES_H_
 
+#include <stddef.h>	// size_t
 #include "fd_set.h"
 
 struct s_sysACL {
@@ -30,6 +31,16 @@ struct s_sysFInfo {
 typedef struct s_sysFInfo	t_sysFInfo;
 typedef struct s_sysACL	t_sysACL;
 
+/**
+ * \brief One buffer of a _SysReadV/_SysWriteV call (same layout as POSIX struct iovec)
+ */
+struct s_sysIOVec {
+	void	*base;
+	size_t	len;
+};
+typedef struct s_sysIOVec	t_sysIOVec;
+#define SYS_IOV_MAX	16	/*!< Maximum number of buffers in one call */
+
 struct s_sys_spawninfo
 {
 	unsigned int	flags;
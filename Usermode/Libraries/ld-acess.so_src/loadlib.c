@@ -14,8 +14,26 @@
 # define DEBUGS(v...)	
 #endif
 
+#define SYMCACHE_SIZE	1024	// Must be a power of two
+#define SYMCACHE_MAX	(SYMCACHE_SIZE*3/4)	// Stop adding past this, keeps probe runs short
+
+// === TYPES ===
+typedef struct
+{
+	const char	*Name;	// NULL if free
+	uint32_t	Hash;
+	void	*Value;
+	size_t	Size;
+	 int	bLocal;	// From caLocalExports
+} tSymCacheEnt;
+
 // === PROTOTYPES ===
 void	*IsFileLoaded(const char *file);
+static int	SymCache_Lookup(const char *Name, uint32_t Hash, void **Value, size_t *Size);
+static int	SymCache_Add(const char *Name, uint32_t Hash, void *Value, size_t Size, int bLocal);
+static void	SymCache_AddLocals(void);
+static void	SymCache_Clear(void);
+static tLoadedLib	*FindLoaded(void *Base);
 
 // === IMPORTS ===
 extern const struct {
@@ -25,12 +43,22 @@ extern const struct {
 extern const int	ciNumLocalExports;
 extern char	**gEnvP;
 extern char	gLinkedBase[];
+extern uint32_t	ElfGnuHashString(const char *name);
 
 // === GLOABLS ===
 tLoadedLib	gLoadedLibraries[MAX_LOADED_LIBRARIES];
 char	gsLoadedStrings[MAX_STRINGS_BYTES];
 char	*gsNextAvailString = gsLoadedStrings;
 //tLoadLib	*gpLoadedLibraries = NULL;
+// Resolved symbols, so each name only walks the library list once
+// - Lookups search in load order and libraries only get appended, so an entry
+//   stays correct until something is unloaded.
+tSymCacheEnt	gaSymCache[SYMCACHE_SIZE];
+ int	giSymCacheUsed;
+ int	gbSymCacheHasLocals;	// Set once every local export is in the cache
+ int	gbLdStatistics;	// LD_DEBUG=statistics
+ int	gbLdBindNow;	// LD_BIND_NOW set, resolve all jump slots at load
+tLdStats	gLdStats;
 
 // === CODE ===
 const char *FindLibrary(char *DestBuf, const char *SoName, const char *ExtraSearchDir)
@@ -79,7 +107,10 @@ void *LoadLibrary(const char *SoName, const char *SearchDir, char **envp)
 
 	DEBUGS(" LoadLibrary: SysLoadBin()");	
 	// Load Library
+	int64_t	start = _SysTimestamp();
 	base = _SysLoadBin(filename, (void**)&fEntry);
+	gLdStats.LoadTime += _SysTimestamp() - start;
+	gLdStats.Libraries ++;
 	if(!base) {
 		DEBUGS("LoadLibrary: RETURN 0");
 		return 0;
@@ -161,6 +192,7 @@ void AddLoaded(const char *File, void *base)
 	
 	// Set information
 	gLoadedLibraries[i].Base = base;
+	gLoadedLibraries[i].PrelinkStamp = 0;
 	strcpy(name, File);
 	gLoadedLibraries[i].Name = name;
 	gsNextAvailString = &name[length+1];
@@ -198,6 +230,7 @@ void Unload(void *Base)
 		// Compact Entry
 		gLoadedLibraries[j].Base = gLoadedLibraries[i].Base;
 		gLoadedLibraries[j].Name = str;
+		gLoadedLibraries[j].PrelinkStamp = gLoadedLibraries[i].PrelinkStamp;
 	}
 	
 	// NULL Last Entry
@@ -205,6 +238,9 @@ void Unload(void *Base)
 	gLoadedLibraries[j].Name = NULL;
 	// Save next string
 	gsNextAvailString = str;
+	
+	// Cached values may point into the unloaded image (and names into its string table)
+	SymCache_Clear();
 }
 
 /**
@@ -214,15 +250,30 @@ void Unload(void *Base)
 int GetSymbol(const char *name, void **Value, size_t *Size)
 {
 	 int	i;
+	uint32_t	hash = ElfGnuHashString(name);
+	size_t	size;
+	
+	gLdStats.Lookups ++;
+	
+	SymCache_AddLocals();
 	
-	//SysDebug("ciNumLocalExports = %i", ciNumLocalExports);
-	for(i=0;i<ciNumLocalExports;i++)
+	if( SymCache_Lookup(name, hash, Value, Size) ) {
+		gLdStats.CacheHits ++;
+		return 1;
+	}
+	
+	// Cache full, check the local exports by hand
+	if( !gbSymCacheHasLocals )
 	{
-		if( strcmp(caLocalExports[i].Name, name) == 0 ) {
-			*Value = caLocalExports[i].Value;
-			if(Size)
-				*Size = 0;
-			return 1;
+		//SysDebug("ciNumLocalExports = %i", ciNumLocalExports);
+		for(i=0;i<ciNumLocalExports;i++)
+		{
+			if( strcmp(caLocalExports[i].Name, name) == 0 ) {
+				*Value = caLocalExports[i].Value;
+				if(Size)
+					*Size = 0;
+				return 1;
+			}
 		}
 	}
 	
@@ -234,8 +285,14 @@ int GetSymbol(const char *name, void **Value, size_t *Size)
 		
 		//SysDebug(" GetSymbol: Trying 0x%x, '%s'",
 		//	gLoadedLibraries[i].Base, gLoadedLibraries[i].Name);
-		if(GetSymbolFromBase(gLoadedLibraries[i].Base, name, Value, Size))
+		gLdStats.LibraryProbes ++;
+		if(GetSymbolFromBase(gLoadedLibraries[i].Base, name, Value, &size))
+		{
+			if(Size)
+				*Size = size;
+			SymCache_Add(name, hash, *Value, size, 0);
 			return 1;
+		}
 	}
 	SysDebug("GetSymbol: === Symbol '%s' not found ===", name);
 	return 0;
@@ -257,3 +314,201 @@ int GetSymbolFromBase(void *base, const char *name, void **ret, size_t *Size)
 	return 0;
 }
 
+static tLoadedLib *FindLoaded(void *Base)
+{
+	for( int i = 0; i < MAX_LOADED_LIBRARIES && gLoadedLibraries[i].Base; i ++ )
+	{
+		if( gLoadedLibraries[i].Base == Base )
+			return &gLoadedLibraries[i];
+	}
+	return NULL;
+}
+
+/**
+ * \brief Check that a dependency of a prelinked library was loaded with the same layout
+ */
+int Prelink_DepOK(void *Base, uint32_t Stamp)
+{
+	tLoadedLib	*lib;
+	// Not prelinked, only ever resolved against (see Tools/prelink.c)
+	if( Base == &gLinkedBase )
+		return 1;
+	lib = FindLoaded(Base);
+	return lib && lib->PrelinkStamp == Stamp;
+}
+
+/**
+ * \brief Check if a symbol a prelinked library bound to another library in its layout is now found elsewhere first
+ * \return Boolean, true if GetSymbol could return a different definition
+ */
+int Prelink_IsInterposed(void *Base, uint32_t Stamp, const char *Name)
+{
+	void	*val;
+	size_t	size;
+	
+	// ld-acess's exports come first
+	SymCache_AddLocals();
+	if( gbSymCacheHasLocals ) {
+		if( SymCache_Lookup(Name, ElfGnuHashString(Name), &val, &size) == 2 )
+			return 1;
+	}
+	else {
+		for( int i = 0; i < ciNumLocalExports; i ++ )
+		{
+			if( strcmp(caLocalExports[i].Name, Name) == 0 )
+				return 1;
+		}
+	}
+	
+	// The prelinker only binds symbols with one definition in the layout, so
+	// only libraries outside it (e.g. the executable) can take precedence
+	for( int i = 0; i < MAX_LOADED_LIBRARIES && gLoadedLibraries[i].Base; i ++ )
+	{
+		if( gLoadedLibraries[i].Base == Base || gLoadedLibraries[i].PrelinkStamp == Stamp )
+			continue ;
+		gLdStats.LibraryProbes ++;
+		if( GetSymbolFromBase(gLoadedLibraries[i].Base, Name, &val, &size) )
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * \brief Record that \a Base was loaded using its prelinked relocations
+ */
+void Prelink_SetStamp(void *Base, uint32_t Stamp)
+{
+	tLoadedLib	*lib = FindLoaded(Base);
+	if( lib ) {
+		lib->PrelinkStamp = Stamp;
+		gLdStats.Prelinked ++;
+	}
+}
+
+/**
+ * \brief Find a previously resolved symbol
+ * \return 0 if not cached, 1 if found, 2 if found and it's one of ld-acess's exports
+ */
+static int SymCache_Lookup(const char *Name, uint32_t Hash, void **Value, size_t *Size)
+{
+	// Linear probing
+	for( uint32_t i = Hash; ; i ++ )
+	{
+		tSymCacheEnt	*ent = &gaSymCache[i % SYMCACHE_SIZE];
+		if( !ent->Name )
+			return 0;
+		if( ent->Hash == Hash && strcmp(ent->Name, Name) == 0 ) {
+			*Value = ent->Value;
+			if(Size)
+				*Size = ent->Size;
+			return 1 + ent->bLocal;
+		}
+	}
+}
+
+/**
+ * \brief Add a resolved symbol to the cache
+ * \note \a Name is not copied, it must stay valid until the cache is cleared
+ * \return Boolean success (0 if the cache is full)
+ */
+static int SymCache_Add(const char *Name, uint32_t Hash, void *Value, size_t Size, int bLocal)
+{
+	tSymCacheEnt	*ent;
+	uint32_t	i;
+	
+	if( giSymCacheUsed >= SYMCACHE_MAX )
+		return 0;
+	for( i = Hash; gaSymCache[i % SYMCACHE_SIZE].Name; i ++ )
+	{
+		// Already present (e.g. duplicate local export)
+		if( gaSymCache[i % SYMCACHE_SIZE].Hash == Hash && strcmp(gaSymCache[i % SYMCACHE_SIZE].Name, Name) == 0 )
+			return 1;
+	}
+	ent = &gaSymCache[i % SYMCACHE_SIZE];
+	ent->Name = Name;
+	ent->Hash = Hash;
+	ent->Value = Value;
+	ent->Size = Size;
+	ent->bLocal = bLocal;
+	giSymCacheUsed ++;
+	return 1;
+}
+
+/**
+ * \brief Seed the cache with ld-acess's own exports (they take priority over libraries)
+ */
+static void SymCache_AddLocals(void)
+{
+	 int	i;
+	if( gbSymCacheHasLocals )
+		return ;
+	for( i = 0; i < ciNumLocalExports; i ++ )
+	{
+		const char *ename = caLocalExports[i].Name;
+		if( !SymCache_Add(ename, ElfGnuHashString(ename), caLocalExports[i].Value, 0, 1) )
+			break;
+	}
+	gbSymCacheHasLocals = (i == ciNumLocalExports);
+}
+
+static void SymCache_Clear(void)
+{
+	for( int i = 0; i < SYMCACHE_SIZE; i ++ )
+		gaSymCache[i].Name = NULL;
+	giSymCacheUsed = 0;
+	gbSymCacheHasLocals = 0;
+}
+
+/**
+ * \brief Get the value of an environment variable (ld-acess runs before libc's getenv)
+ * \return Value, or NULL if unset
+ */
+const char *LdGetEnv(char **envp, const char *Name)
+{
+	for( ; envp && *envp; envp ++ )
+	{
+		const char *e = *envp;
+		const char *n = Name;
+		while( *n && *e == *n )
+			e ++, n ++;
+		if( *n == '\0' && *e == '=' )
+			return e + 1;
+	}
+	return NULL;
+}
+
+/**
+ * \brief Check for an option in the comma separated LD_DEBUG environment variable
+ */
+int LdDebugOption(char **envp, const char *Option)
+{
+	const char	*val = LdGetEnv(envp, "LD_DEBUG");
+	 int	len = strlen(Option);
+	
+	while( val && *val )
+	{
+		 int	i;
+		for( i = 0; i < len && val[i] == Option[i]; i ++ )
+			;
+		if( i == len && (val[i] == ',' || val[i] == '\0') )
+			return 1;
+		while( *val && *val != ',' )
+			val ++;
+		if( *val == ',' )
+			val ++;
+	}
+	return 0;
+}
+
+/**
+ * \brief Print lookup/timing statistics to the debug log (LD_DEBUG=statistics)
+ */
+void LdStats_Report(void)
+{
+	SysDebug("ld-acess - %i libraries loaded, %i ms in SysLoadBin, %i ms total",
+		gLdStats.Libraries, (int)gLdStats.LoadTime, (int)gLdStats.TotalTime);
+	SysDebug("ld-acess - %i symbol lookups, %i cache hits, %i library probes, %i symbols cached",
+		gLdStats.Lookups, gLdStats.CacheHits, gLdStats.LibraryProbes, giSymCacheUsed);
+	SysDebug("ld-acess - %i jump slots left for lazy binding%s, %i libraries prelinked",
+		gLdStats.LazySlots, (gbLdBindNow ? " (LD_BIND_NOW)" : ""), gLdStats.Prelinked);
+}
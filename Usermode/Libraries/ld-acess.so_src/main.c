@@ -24,8 +24,13 @@ extern int	memcmp(const void *m1, const void *m2, size_t size);
 void *SoMain(void *base, int argc, char **argv, char **envp)
 {
 	void	*ret;
+	int64_t	start = _SysTimestamp();
+	const char	*bindnow;
 	 
 	gEnvP = envp;
+	gbLdStatistics = LdDebugOption(envp, "statistics");
+	bindnow = LdGetEnv(envp, "LD_BIND_NOW");
+	gbLdBindNow = (bindnow && *bindnow);
 
 	// - Assume that the file pointer will be less than 4096
 	if((intptr_t)base < 0x1000) {
@@ -50,6 +55,9 @@ void *SoMain(void *base, int argc, char **argv, char **envp)
 	}
 
 	SysDebug("ld-acess - SoMain: ret = %p", ret);	
+	gLdStats.TotalTime = _SysTimestamp() - start;
+	if( gbLdStatistics )
+		LdStats_Report();
 	return ret;
 }
 
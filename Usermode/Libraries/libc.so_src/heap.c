@@ -1,9 +1,19 @@
 /*
 AcessOS Basic LibC
 heap.c - Heap Manager
+
+Small blocks (up to 128 KiB, header included) are rounded up to one of 48
+size classes and kept on per-class free lists, so malloc and free are O(1).
+The free lists live in a few caches, each with its own lock. A single
+threaded process only uses the first. Once the heap finds a lock contended
+(threads are in use), callers pick a cache by their stack address. Caches
+refill from, and overflow to, central lists that carve new runs from sbrk.
+Anything bigger gets its own anonymous mapping, unmapped again by free.
 */
 #include <acess/sys.h>
+#include <acess/futex.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include "lib.h"
 
@@ -16,25 +26,70 @@ heap.c - Heap Manager
 // === Constants ===
 #define MAGIC	0xACE55051	//AcessOS1
 #define MAGIC_FREE	(~MAGIC)
-#define BLOCK_SIZE	16	//Minimum
-#define HEAP_INIT_SIZE	0x10000
+#define MAGIC_LARGE	0xACE5B16B	// Block is a mapping of its own
+#define NUM_CLASSES	48
+#define SMALL_MAX	0x20000	// Block size of the largest class
+#define RUN_SIZE	0x10000	// Bytes carved per refill (at least two blocks)
+#define CACHE_BYTES	0x8000	// Per-class cache batch, in bytes
+#define NUM_CACHES	8
+#define PAGE_SIZE	0x1000
+
+// Large allocations are mapped in a window of address space managed here
+// (the kernel has no allocator for it)
+#if __SIZEOF_POINTER__ == 8
+# define LARGE_WINDOW_BASE	0x0000010000000000	// 1 TiB, well clear of the heap and libraries
+# define LARGE_WINDOW_END	0x0000020000000000
+#else
+# define LARGE_WINDOW_BASE	0x40000000
+# define LARGE_WINDOW_END	0x60000000
+#endif
+#define LARGE_MAX_HOLES	128
 
-typedef unsigned int Uint;
+// Huge pages (set MALLOC_HUGEPAGES=1): runs are carved from 2 MiB-page backed
+// arenas instead of sbrk, and large blocks of at least HUGE_MIN are mapped
+// with 2 MiB pages
+#define HUGE_PAGE_SIZE	0x200000
+#define HUGE_MIN	(HUGE_PAGE_SIZE/2)
 
 // === TYPES ===
 typedef struct {
 	uint32_t	magic;
-	size_t	size;
+	uint32_t	sizeclass;
+	uint64_t	size;	//!< Block size including this header (mapping size for large blocks)
 	char	data[];
 }	heap_head;
+//! Free blocks link through their data
+#define NEXT_FREE(__head)	(*(heap_head**)(__head)->data)
+
 typedef struct {
-	heap_head	*header;
-	uint32_t	magic;
-}	heap_foot;
+	volatile uint32_t	Lock;
+	 int	Count[NUM_CLASSES];
+	heap_head	*Free[NUM_CLASSES];
+	uint64_t	nAlloc[NUM_CLASSES];
+	uint64_t	nFree[NUM_CLASSES];
+}	tHeapCache;
+
+typedef struct {
+	uintptr_t	Base;
+	uintptr_t	End;
+}	tHeapHole;
 
 // === LOCAL VARIABLES ===
 static void	*_heap_start = NULL;
 static void	*_heap_end = NULL;
+static int	gbHeapThreaded;
+static tHeapCache	gaHeapCaches[NUM_CACHES];
+// - Protected by glHeapLock
+static volatile uint32_t	glHeapLock;
+static heap_head	*gaHeapFree[NUM_CLASSES];
+static int	gaHeapFreeCount[NUM_CLASSES];
+static uint64_t	gaHeapRunBytes[NUM_CLASSES];
+static uintptr_t	gHeapLargeNext;
+static tHeapHole	gaHeapLargeHoles[LARGE_MAX_HOLES];
+static int	giHeapLargeHoles;
+static uintptr_t	gHeapArenaCur, gHeapArenaEnd;
+static uint64_t	gHeapLargeCount, gHeapLargeBytes;
+static uint64_t	gHeapSbrkBytes, gHeapArenaBytes;
 
 // === PROTOTYPES ===
 EXPORT void	*malloc(size_t bytes);
@@ -42,13 +97,61 @@ EXPORT void	*calloc(size_t bytes, size_t count);
 EXPORT void	free(void *mem);
 EXPORT void	*realloc(void *mem, size_t bytes);
 EXPORT void	*sbrk(int increment);
-LOCAL void	*extendHeap(int bytes);
+EXPORT void	malloc_stats(void);
 static void	*FindHeapBase();
 LOCAL uint	brk(uintptr_t newpos);
-LOCAL void	Heap_Dump(void);
+static void	Heap_int_Lock(volatile uint32_t *Lock);
+static void	Heap_int_Unlock(volatile uint32_t *Lock);
+static tHeapCache	*Heap_int_GetCache(void);
+static int	Heap_int_Refill(tHeapCache *Cache, int Class);
+static void	Heap_int_Flush(tHeapCache *Cache, int Class, int Count);
+static int	Heap_int_CarveRun(int Class);
+static void	*Heap_int_GetCore(size_t Size);
+static void	*Heap_int_AllocLarge(size_t Size);
+static void	Heap_int_FreeLarge(heap_head *Head);
+static uintptr_t	Heap_int_LargeReserve(size_t Size, size_t Align);
+static void	Heap_int_LargeRelease(uintptr_t Base, size_t Size);
+static int	Heap_int_HoleInsert(int Index, uintptr_t Base, uintptr_t End);
+static int	Heap_int_HugeEnabled(void);
 
 //Code
 
+/**
+ * \brief Get the size class of a block (\a Size includes the header)
+ */
+static inline int Heap_int_SizeClass(size_t Size)
+{
+	 int	shift;
+	// 16 byte steps up to 128, then four classes per power of two
+	if( Size <= 128 )
+		return (Size + 15) / 16 - 1;
+	shift = 31 - __builtin_clz( (unsigned int)(Size - 1) );
+	return 8 + (shift - 7) * 4 + (((Size - 1) >> (shift - 2)) & 3);
+}
+
+/**
+ * \brief Get the block size of a size class
+ */
+static inline size_t Heap_int_ClassSize(int Class)
+{
+	 int	shift;
+	if( Class < 8 )
+		return (Class + 1) * 16;
+	shift = 7 + (Class - 8) / 4;
+	return ((size_t)1 << shift) + ((size_t)((Class - 8) % 4 + 1) << (shift - 2));
+}
+
+/**
+ * \brief Number of blocks moved between a cache and the central lists at once
+ */
+static inline int Heap_int_Batch(int Class)
+{
+	 int	ret = CACHE_BYTES / Heap_int_ClassSize(Class);
+	if( ret < 2 )	return 2;
+	if( ret > 32 )	return 32;
+	return ret;
+}
+
 /**
  \fn EXPORT void *malloc(size_t bytes)
  \brief Allocates memory from the heap space
@@ -57,99 +160,39 @@ LOCAL void	Heap_Dump(void);
 */
 EXPORT void *malloc(size_t bytes)
 {
-	size_t	bestSize;
-	size_t	closestMatch = 0;
-	void	*bestMatchAddr = 0;
-	heap_head	*curBlock;
-
-//	_SysDebug("&_heap_start = %p, _heap_start = %p", &_heap_start, _heap_start);
-	// Initialise Heap
-	if(_heap_start == NULL)
-	{
-		_heap_start = sbrk(0);
-		_heap_end = _heap_start;
-		extendHeap(HEAP_INIT_SIZE);
-	}
-	
-	curBlock = _heap_start;
-//	_SysDebug("_heap_start = %p", _heap_start);
-	
-	bestSize = bytes + sizeof(heap_head) + sizeof(heap_foot) + BLOCK_SIZE - 1;
-	bestSize = (bestSize/BLOCK_SIZE)*BLOCK_SIZE;	//Round up to block size
-	
-	while( (uintptr_t)curBlock < (uintptr_t)_heap_end)
-	{
-		//_SysDebug(" malloc: curBlock = 0x%x, curBlock->magic = 0x%x\n", curBlock, curBlock->magic);
-		if(curBlock->magic == MAGIC_FREE)
-		{
-			if(curBlock->size == bestSize)
-				break;
-			if(bestSize < curBlock->size && (curBlock->size < closestMatch || closestMatch == 0)) {
-				closestMatch = curBlock->size;
-				bestMatchAddr = curBlock;
-			}
-		}
-		else if(curBlock->magic != MAGIC)
-		{
-			//Corrupt Heap
-			Heap_Dump();
-			_SysDebug("malloc: Corrupt Heap\n");
-			return NULL;
-		}
-		curBlock = (heap_head*)((uintptr_t)curBlock + curBlock->size);
-	}
-	
-	if((uintptr_t)curBlock < (uintptr_t)_heap_start) {
-		_SysDebug("malloc: Heap underrun for some reason\n");
+	size_t	size = bytes + sizeof(heap_head);
+	tHeapCache	*cache;
+	heap_head	*ret;
+	 int	class;
+
+	if( size < bytes )	return NULL;
+	// Room for the free list link
+	if( size < sizeof(heap_head) + sizeof(heap_head*) )
+		size = sizeof(heap_head) + sizeof(heap_head*);
+	if( size > SMALL_MAX )
+		return Heap_int_AllocLarge(size);
+
+	class = Heap_int_SizeClass(size);
+	cache = Heap_int_GetCache();
+	Heap_int_Lock(&cache->Lock);
+	if( !cache->Free[class] && Heap_int_Refill(cache, class) ) {
+		Heap_int_Unlock(&cache->Lock);
+		_SysDebug("malloc: Out of Heap Space");
 		return NULL;
 	}
-	
-	//Found a perfect match
-	if((uintptr_t)curBlock < (uintptr_t)_heap_end) {
-		curBlock->magic = MAGIC;
-		return (void*)((uintptr_t)curBlock + sizeof(heap_head));
-	}
-	
-	//Out of Heap Space
-	if(!closestMatch) {
-		curBlock = extendHeap(bestSize);	//Allocate more
-		if(curBlock == NULL) {
-			_SysDebug("malloc: Out of Heap Space\n");
-			return NULL;
-		}
-		curBlock->magic = MAGIC;
-		DEBUGS("malloc(0x%x) = %p (extend) 0x%x", bytes, curBlock->data, bestSize);
-		return curBlock->data;
-	}
-	
-	heap_head *besthead = (void*)bestMatchAddr;
-	
-	//Split Block?
-	if(closestMatch - bestSize > BLOCK_SIZE) {
-		heap_foot	*foot;
-		curBlock = (heap_head*)bestMatchAddr;
-		curBlock->magic = MAGIC;
-		curBlock->size = bestSize;
-		foot = (heap_foot*)(bestMatchAddr + bestSize - sizeof(heap_foot));
-		foot->header = curBlock;
-		foot->magic = MAGIC;
-
-		curBlock = (heap_head*)(bestMatchAddr + bestSize);
-		curBlock->magic = MAGIC_FREE;
-		curBlock->size = closestMatch - bestSize;
-		
-		foot = (heap_foot*)(bestMatchAddr + closestMatch - sizeof(heap_foot));
-		foot->header = curBlock;
-		
-		besthead->magic = MAGIC;	//mark as used
-		DEBUGS("malloc(0x%x) = %p (split) 0x%x", bytes, besthead->data, bestSize);
-		return besthead->data;
+	ret = cache->Free[class];
+	cache->Free[class] = NEXT_FREE(ret);
+	cache->Count[class] --;
+	cache->nAlloc[class] ++;
+	Heap_int_Unlock(&cache->Lock);
+
+	if( ret->magic != MAGIC_FREE || ret->sizeclass != (uint32_t)class ) {
+		_SysDebug("malloc: Corrupt Heap (block %p magic 0x%x)", ret, ret->magic);
+		return NULL;
 	}
-	
-	//Don't Split the block
-	besthead->magic = MAGIC;
-	DEBUGS("malloc(0x%x) = %p (reuse) 0x%x", bytes, besthead->data, besthead->size);
-	return besthead->data;
+	ret->magic = MAGIC;
+	DEBUGS("malloc(0x%x) = %p (class %i)", bytes, ret->data, class);
+	return ret->data;
 }
 
 /**
@@ -160,9 +203,14 @@ EXPORT void *malloc(size_t bytes)
  */
 EXPORT void *calloc(size_t __nmemb, size_t __size)
 {
-	void	*ret = malloc(__size*__nmemb);
+	size_t	bytes = __size*__nmemb;
+	void	*ret;
+	if(__size && bytes / __size != __nmemb)	return NULL;
+	ret = malloc(bytes);
 	if(!ret)	return NULL;
-	memset(ret, 0, __size*__nmemb);
+	// Fresh mappings are already zero
+	if( ((heap_head*)ret - 1)->magic != MAGIC_LARGE )
+		memset(ret, 0, bytes);
 	return ret;
 }
 
@@ -173,39 +221,32 @@ EXPORT void *calloc(size_t __nmemb, size_t __size)
 */
 EXPORT void free(void *mem)
 {
-	heap_head	*head = (void*)((intptr_t)mem-sizeof(heap_head));
-	
+	heap_head	*head = (heap_head*)mem - 1;
+	tHeapCache	*cache;
+	 int	class;
+
 	// Sanity please!
 	if(!mem)	return;
-	
+
+	if( head->magic == MAGIC_LARGE ) {
+		Heap_int_FreeLarge(head);
+		return ;
+	}
 	if(head->magic != MAGIC)	//Valid Heap Address
 		return;
-	
-	head->magic = MAGIC_FREE;
+
 	DEBUGS("free(%p) : 0x%x bytes", mem, head->size);
-	
-	//Unify Right
-	if((uintptr_t)head + head->size < (uintptr_t)_heap_end)
-	{
-		heap_head	*nextHead = (heap_head*)((intptr_t)head + head->size);
-		if(nextHead->magic == MAGIC_FREE) {	//Is the next block free
-			head->size += nextHead->size;	//Amalgamate
-			nextHead->magic = 0;	//For Security
-		}
-	}
-	//Unify Left
-	if((uintptr_t)head - sizeof(heap_foot) > (uintptr_t)_heap_start)
-	{
-		heap_head	*prevHead;
-		heap_foot	*prevFoot = (heap_foot *)((intptr_t)head - sizeof(heap_foot));
-		if(prevFoot->magic == MAGIC) {
-			prevHead = prevFoot->header;
-			if(prevHead->magic == MAGIC_FREE) {
-				prevHead->size += head->size;	//Amalgamate
-				head->magic = 0;	//For Security
-			}
-		}
-	}
+	class = head->sizeclass;
+	head->magic = MAGIC_FREE;
+
+	cache = Heap_int_GetCache();
+	Heap_int_Lock(&cache->Lock);
+	NEXT_FREE(head) = cache->Free[class];
+	cache->Free[class] = head;
+	cache->nFree[class] ++;
+	if( ++cache->Count[class] > 2*Heap_int_Batch(class) )
+		Heap_int_Flush(cache, class, Heap_int_Batch(class));
+	Heap_int_Unlock(&cache->Lock);
 }
 
 /**
@@ -219,71 +260,34 @@ EXPORT void *realloc(void *oldPos, size_t bytes)
 {
 	void *ret;
 	heap_head	*head;
-	
+	size_t	oldSize;
+
 	if(oldPos == NULL) {
 		return malloc(bytes);
 	}
-	
-	//Check for free space after block
-	head = (heap_head*)((uintptr_t)oldPos-sizeof(heap_head));
-	
-	//Hack to used free's amagamating algorithym and malloc's splitting
-	free(oldPos);
-	
+
+	head = (heap_head*)oldPos - 1;
+	if( head->magic != MAGIC && head->magic != MAGIC_LARGE )
+		return NULL;
+	oldSize = head->size - sizeof(heap_head);
+
+	//Still fits
+	if(bytes <= oldSize)
+		return oldPos;
+
 	//Allocate new memory
 	ret = malloc(bytes);
 	if(ret == NULL)
 		return NULL;
-	
+
 	//Copy Old Data
-	if(ret != oldPos) {
-		memcpy(ret, oldPos, head->size-sizeof(heap_head)-sizeof(heap_foot));
-	}
-	
+	memcpy(ret, oldPos, oldSize);
+	free(oldPos);
+
 	//Return
 	return ret;
 }
 
-/**
- * \fn LOCAL void *extendHeap(int bytes)
- * \brief Create a new block at the end of the heap area
- * \param bytes	Integer - Size reqired
- * \return Pointer to last free block
- */
-
-LOCAL void *extendHeap(int bytes)
-{
-	heap_head	*head = _heap_end;
-	heap_foot	*foot;
-	
-	//Expand Memory Space  (Use foot as a temp pointer)
-	foot = sbrk(bytes);
-	if(foot == (void*)-1)
-		return NULL;
-	
-	//Create New Block
-	// Header
-	head->magic = MAGIC_FREE;	//Unallocated
-	head->size = bytes;
-	// Footer
-	foot = _heap_end + bytes - sizeof(heap_foot);
-	foot->header = head;
-	foot->magic = MAGIC;
-	
-	//Combine with previous block if nessasary
-	if(_heap_end != _heap_start && ((heap_foot*)((uintptr_t)_heap_end-sizeof(heap_foot)))->magic == MAGIC) {
-		heap_head	*tmpHead = ((heap_foot*)((uintptr_t)_heap_end-sizeof(heap_foot)))->header;
-		if(tmpHead->magic == MAGIC_FREE) {
-			tmpHead->size += bytes;
-			foot->header = tmpHead;
-			head = tmpHead;
-		}
-	}
-	
-	_heap_end = (void*) ((uintptr_t)foot+sizeof(heap_foot));
-	return head;
-}
-
 /**
  \fn EXPORT void *sbrk(int increment)
  \brief Increases the program's memory space
@@ -323,7 +327,9 @@ EXPORT void *sbrk(int increment)
 		return (void *)oldEnd;
 	}
 
-	increment -= curEnd & 0xFFF;
+	// Use up the rest of the current page (if it was started)
+	if( curEnd & 0xFFF )
+		increment -= 0x1000 - (curEnd & 0xFFF);
 	curEnd += 0xFFF;	curEnd &= ~0xFFF;
 	while( increment > 0 )
 	{
@@ -336,6 +342,8 @@ EXPORT void *sbrk(int increment)
 		increment -= 0x1000;
 		curEnd += 0x1000;
 	}
+	// Stop exactly where asked, the rest of the last page is used next time
+	curEnd += increment;
 
 	//_SysDebug("sbrk: RETURN %p", (void *) oldEnd);
 	return (void *) oldEnd;
@@ -346,20 +354,46 @@ EXPORT void *sbrk(int increment)
  */
 EXPORT int IsHeap(void *ptr)
 {
-	#if 0
-	heap_head	*head;
-	heap_foot	*foot;
-	#endif
-	if( (uintptr_t)ptr < (uintptr_t)_heap_start )	return 0;
-	if( (uintptr_t)ptr > (uintptr_t)_heap_end )	return 0;
-	
-	#if 0
-	head = (void*)((Uint)ptr - 4);
-	if( head->magic != MAGIC )	return 0;
-	foot = (void*)( (Uint)ptr + head->size - sizeof(heap_foot) );
-	if( foot->magic != MAGIC )	return 0;
-	#endif
-	return 1;
+	if( (uintptr_t)ptr >= (uintptr_t)_heap_start && (uintptr_t)ptr < (uintptr_t)_heap_end )
+		return 1;
+	if( (uintptr_t)ptr >= LARGE_WINDOW_BASE && (uintptr_t)ptr < gHeapLargeNext )
+		return 1;
+	return 0;
+}
+
+/**
+ * \brief Print allocator statistics to stderr
+ */
+EXPORT void malloc_stats(void)
+{
+	uint64_t	runBytes = 0, usedBytes = 0;
+
+	fprintf(stderr, "Class    Size   InUse    Free      Allocs\n");
+	for( int class = 0; class < NUM_CLASSES; class ++ )
+	{
+		int64_t	allocs = 0, frees = 0;
+		 int	nFree = gaHeapFreeCount[class];
+
+		if( !gaHeapRunBytes[class] )
+			continue ;
+		for( int i = 0; i < NUM_CACHES; i ++ )
+		{
+			allocs += gaHeapCaches[i].nAlloc[class];
+			frees += gaHeapCaches[i].nFree[class];
+			nFree += gaHeapCaches[i].Count[class];
+		}
+		fprintf(stderr, "%5i %7i %7lli %7i %11lli\n",
+			class, (int)Heap_int_ClassSize(class), (long long)(allocs - frees), nFree, (long long)allocs);
+		runBytes += gaHeapRunBytes[class];
+		usedBytes += (allocs - frees) * Heap_int_ClassSize(class);
+	}
+	fprintf(stderr, "small: %lli KiB in runs, %lli KiB in use\n",
+		(long long)(runBytes >> 10), (long long)(usedBytes >> 10));
+	fprintf(stderr, "large: %lli mappings, %lli KiB (%i address space holes)\n",
+		(long long)gHeapLargeCount, (long long)(gHeapLargeBytes >> 10), giHeapLargeHoles);
+	fprintf(stderr, "core: %lli KiB from sbrk, %lli KiB in huge arenas\n",
+		(long long)(gHeapSbrkBytes >> 10), (long long)(gHeapArenaBytes >> 10));
+	fprintf(stderr, "caches: %s\n", gbHeapThreaded ? "per thread" : "single");
 }
 
 // === STATIC FUNCTIONS ===
@@ -374,7 +408,7 @@ static void *FindHeapBase()
 	uint	addr;
 	uint	stretch = 0;
 	uint64_t	tmp;
-	
+
 	// Scan address space
 	for(addr = 0;
 		addr < MAX;
@@ -395,7 +429,7 @@ static void *FindHeapBase()
 		//	"push %%ebx;mov %%edx,%%ebx;int $0xAC;pop %%ebx"
 		//	::"a"(256),"d"("%x"),"c"(addr));
 	}
-	
+
 	return NULL;
 	#else
 	return (void*)0x00900000;
@@ -408,28 +442,28 @@ LOCAL uint brk(uintptr_t newpos)
 	uint	pages;
 	uint	ret = curpos;
 	 int	delta;
-	
+
 	_SysDebug("brk: (newpos=0x%x)", newpos);
-	
+
 	// Find initial position
 	if(curpos == 0)	curpos = (uintptr_t)FindHeapBase();
-	
+
 	// Get Current Position
 	if(newpos == 0)	return curpos;
-	
+
 	if(newpos < curpos)	return newpos;
-	
+
 	delta = newpos - curpos;
 	_SysDebug(" brk: delta = 0x%x", delta);
-	
+
 	// Do we need to add pages
 	if(curpos & 0xFFF && (curpos & 0xFFF) + delta < 0x1000)
 		return curpos += delta;
-	
+
 	// Page align current position
 	if(curpos & 0xFFF)	delta -= 0x1000 - (curpos & 0xFFF);
 	curpos = (curpos + 0xFFF) & ~0xFFF;
-	
+
 	// Allocate Pages
 	pages = (delta + 0xFFF) >> 12;
 	while(pages--)
@@ -438,31 +472,378 @@ LOCAL uint brk(uintptr_t newpos)
 		curpos += 0x1000;
 		delta -= 0x1000;
 	}
-	
+
 	// Bring the current position to exactly what we want
 	curpos -= ((delta + 0xFFF) & ~0xFFF) - delta;
-	
+
 	return ret;	// Return old curpos
 }
 
-void Heap_Dump(void)
+/**
+ * \brief Acquire a heap lock (same scheme as pthread mutexes)
+ */
+static void Heap_int_Lock(volatile uint32_t *Lock)
+{
+	uint32_t	c = __sync_val_compare_and_swap(Lock, 0, 1);
+	if( c == 0 )
+		return ;
+
+	// Someone else has it, so there's more than one thread
+	gbHeapThreaded = 1;
+	if( c != 2 )
+		c = __sync_lock_test_and_set(Lock, 2);
+	while( c != 0 )
+	{
+		_SysFutex(Lock, FUTEX_WAIT, 2, NULL);
+		c = __sync_lock_test_and_set(Lock, 2);
+	}
+}
+
+static void Heap_int_Unlock(volatile uint32_t *Lock)
 {
-	heap_head *cur = _heap_start;
-	while( cur < (heap_head*)_heap_end )
+	if( __sync_fetch_and_sub(Lock, 1) != 1 )
 	{
-		switch( cur->magic )
+		*Lock = 0;
+		__sync_synchronize();
+		_SysFutex(Lock, FUTEX_WAKE, 1, NULL);
+	}
+}
+
+/**
+ * \brief Get the cache for the calling thread
+ * \note There's no TLS, so threads are told apart by their stacks. Two threads
+ *       sharing a cache only costs contention, any cache can hold any block.
+ */
+static tHeapCache *Heap_int_GetCache(void)
+{
+	uintptr_t	key;
+	if( !gbHeapThreaded )
+		return &gaHeapCaches[0];
+	key = (uintptr_t)__builtin_frame_address(0) >> 20;
+	return &gaHeapCaches[ (key ^ (key >> 8)) % NUM_CACHES ];
+}
+
+/**
+ * \brief Move a batch of free blocks from the central list into \a Cache
+ * \note Called with the cache locked
+ * \return Non-zero if no memory could be found
+ */
+static int Heap_int_Refill(tHeapCache *Cache, int Class)
+{
+	 int	count = Heap_int_Batch(Class);
+
+	Heap_int_Lock(&glHeapLock);
+	if( !gaHeapFree[Class] && Heap_int_CarveRun(Class) ) {
+		Heap_int_Unlock(&glHeapLock);
+		return 1;
+	}
+	while( count -- && gaHeapFree[Class] )
+	{
+		heap_head	*blk = gaHeapFree[Class];
+		gaHeapFree[Class] = NEXT_FREE(blk);
+		gaHeapFreeCount[Class] --;
+		NEXT_FREE(blk) = Cache->Free[Class];
+		Cache->Free[Class] = blk;
+		Cache->Count[Class] ++;
+	}
+	Heap_int_Unlock(&glHeapLock);
+	return 0;
+}
+
+/**
+ * \brief Return \a Count blocks from \a Cache to the central list
+ * \note Called with the cache locked
+ */
+static void Heap_int_Flush(tHeapCache *Cache, int Class, int Count)
+{
+	Heap_int_Lock(&glHeapLock);
+	while( Count -- && Cache->Free[Class] )
+	{
+		heap_head	*blk = Cache->Free[Class];
+		Cache->Free[Class] = NEXT_FREE(blk);
+		Cache->Count[Class] --;
+		NEXT_FREE(blk) = gaHeapFree[Class];
+		gaHeapFree[Class] = blk;
+		gaHeapFreeCount[Class] ++;
+	}
+	Heap_int_Unlock(&glHeapLock);
+}
+
+/**
+ * \brief Split a new run of memory into free blocks of a class
+ * \note Called with glHeapLock held
+ */
+static int Heap_int_CarveRun(int Class)
+{
+	size_t	size = Heap_int_ClassSize(Class);
+	size_t	count = RUN_SIZE / size;
+	char	*run;
+
+	if( count < 2 )	count = 2;
+	run = Heap_int_GetCore(count * size);
+	if( !run )
+		return 1;
+	DEBUGS("Heap_int_CarveRun: %i x 0x%x at %p", count, size, run);
+
+	// Build the list backwards, so blocks are handed out in address order
+	for( size_t i = count; i --; )
+	{
+		heap_head	*blk = (void*)(run + i * size);
+		blk->magic = MAGIC_FREE;
+		blk->sizeclass = Class;
+		blk->size = size;
+		NEXT_FREE(blk) = gaHeapFree[Class];
+		gaHeapFree[Class] = blk;
+	}
+	gaHeapFreeCount[Class] += count;
+	gaHeapRunBytes[Class] += count * size;
+	return 0;
+}
+
+/**
+ * \brief Get memory for runs, from a huge arena or sbrk
+ * \note Called with glHeapLock held
+ */
+static void *Heap_int_GetCore(size_t Size)
+{
+	void	*ret;
+
+	if( Heap_int_HugeEnabled() )
+	{
+		// Start a new arena (the end of the last one is left unused)
+		if( gHeapArenaEnd - gHeapArenaCur < Size )
 		{
-		case MAGIC:
-			_SysDebug("Used block %p[0x%x] - ptr=%p", cur, cur->size, cur->data);
-			break;
-		case MAGIC_FREE:
-			_SysDebug("Free block %p[0x%x] - ptr=%p", cur, cur->size, cur->data);
-			break;
-		default:
-			_SysDebug("Block %p bad magic (0x%x)", cur, cur->magic);
-			return ;
+			size_t	len = (Size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+			uintptr_t	addr = Heap_int_LargeReserve(len, HUGE_PAGE_SIZE);
+			if( addr && _SysMMap((void*)addr, len,
+				MMAP_PROTFLAGS(MMAP_PROT_READ|MMAP_PROT_WRITE, MMAP_MAP_PRIVATE|MMAP_MAP_ANONYMOUS|MMAP_MAP_HUGE),
+				-1, 0) )
+			{
+				gHeapArenaCur = addr;
+				gHeapArenaEnd = addr + len;
+				gHeapArenaBytes += len;
+			}
+			else if( addr ) {
+				Heap_int_LargeRelease(addr, len);
+			}
+		}
+		if( gHeapArenaEnd - gHeapArenaCur >= Size ) {
+			ret = (void*)gHeapArenaCur;
+			gHeapArenaCur += Size;
+			return ret;
 		}
-		cur = (void*)( (char*)cur + cur->size );
+		// Fall back to sbrk
+	}
+
+	if( _heap_start == NULL ) {
+		_heap_start = sbrk(0);
+		_heap_end = _heap_start;
 	}
+	// Keep blocks aligned if something else has used sbrk
+	if( (uintptr_t)sbrk(0) & 15 )
+		sbrk( 16 - ((uintptr_t)sbrk(0) & 15) );
+	if( (int)Size < 0 )
+		return NULL;
+	ret = sbrk(Size);
+	if( ret == (void*)-1 )
+		return NULL;
+	_heap_end = (char*)ret + Size;
+	gHeapSbrkBytes += Size;
+	return ret;
 }
 
+/**
+ * \brief Give a large block a mapping of its own
+ * \param Size	Block size, including header
+ */
+static void *Heap_int_AllocLarge(size_t Size)
+{
+	unsigned int	flags = MMAP_MAP_PRIVATE|MMAP_MAP_ANONYMOUS;
+	size_t	align = PAGE_SIZE, mapSize;
+	heap_head	*head;
+	uintptr_t	addr;
+
+	if( Heap_int_HugeEnabled() && Size >= HUGE_MIN ) {
+		flags |= MMAP_MAP_HUGE;
+		align = HUGE_PAGE_SIZE;
+	}
+	mapSize = (Size + align - 1) & ~(align - 1);
+	if( mapSize < Size )
+		return NULL;
+
+	Heap_int_Lock(&glHeapLock);
+	addr = Heap_int_LargeReserve(mapSize, align);
+	Heap_int_Unlock(&glHeapLock);
+	if( !addr ) {
+		_SysDebug("malloc: Out of address space for 0x%x bytes", mapSize);
+		return NULL;
+	}
+
+	if( !_SysMMap((void*)addr, mapSize, MMAP_PROTFLAGS(MMAP_PROT_READ|MMAP_PROT_WRITE, flags), -1, 0) ) {
+		_SysDebug("malloc: Unable to map 0x%x bytes at %p", mapSize, (void*)addr);
+		Heap_int_Lock(&glHeapLock);
+		Heap_int_LargeRelease(addr, mapSize);
+		Heap_int_Unlock(&glHeapLock);
+		return NULL;
+	}
+
+	Heap_int_Lock(&glHeapLock);
+	gHeapLargeCount ++;
+	gHeapLargeBytes += mapSize;
+	Heap_int_Unlock(&glHeapLock);
+
+	head = (void*)addr;
+	head->magic = MAGIC_LARGE;
+	head->sizeclass = 0;
+	head->size = mapSize;
+	DEBUGS("malloc(0x%x) = %p (mapped)", Size - sizeof(heap_head), head->data);
+	return head->data;
+}
+
+/**
+ * \brief Unmap a large block
+ */
+static void Heap_int_FreeLarge(heap_head *Head)
+{
+	size_t	size = Head->size;
+
+	Head->magic = 0;
+	_SysMUnmap(Head, size);
+
+	Heap_int_Lock(&glHeapLock);
+	Heap_int_LargeRelease((uintptr_t)Head, size);
+	gHeapLargeCount --;
+	gHeapLargeBytes -= size;
+	Heap_int_Unlock(&glHeapLock);
+}
+
+/**
+ * \brief Find space in the large block window, reusing holes first
+ * \note Called with glHeapLock held
+ * \return Address, or 0 if the window is full
+ */
+static uintptr_t Heap_int_LargeReserve(size_t Size, size_t Align)
+{
+	uintptr_t	base, next;
+
+	for( int i = 0; i < giHeapLargeHoles; i ++ )
+	{
+		tHeapHole	*hole = &gaHeapLargeHoles[i];
+		base = (hole->Base + Align - 1) & ~(Align - 1);
+		if( base > hole->End || hole->End - base < Size )
+			continue ;
+
+		if( base + Size == hole->End ) {
+			// Used up the end of the hole
+			if( base == hole->Base ) {
+				memmove(hole, hole + 1, (giHeapLargeHoles - i - 1) * sizeof(*hole));
+				giHeapLargeHoles --;
+			}
+			else
+				hole->End = base;
+		}
+		else if( base == hole->Base ) {
+			hole->Base = base + Size;
+		}
+		else {
+			// From the middle, the hole becomes two
+			if( Heap_int_HoleInsert(i + 1, base + Size, hole->End) )
+				continue ;
+			hole->End = base;
+		}
+		return base;
+	}
+
+	// Extend the used part of the window
+	if( !gHeapLargeNext )
+		gHeapLargeNext = LARGE_WINDOW_BASE;
+	base = (gHeapLargeNext + Align - 1) & ~(Align - 1);
+	if( base > LARGE_WINDOW_END || LARGE_WINDOW_END - base < Size )
+		return 0;
+	next = gHeapLargeNext;
+	gHeapLargeNext = base + Size;
+	// Keep the alignment gap for smaller blocks
+	if( base != next )
+		Heap_int_LargeRelease(next, base - next);
+	return base;
+}
+
+/**
+ * \brief Return a range to the large block window
+ * \note Called with glHeapLock held
+ */
+static void Heap_int_LargeRelease(uintptr_t Base, size_t Size)
+{
+	uintptr_t	end = Base + Size;
+	 int	i;
+
+	for( i = 0; i < giHeapLargeHoles && gaHeapLargeHoles[i].Base < Base; i ++ )
+		;
+
+	// Merge with the neighbouring holes
+	if( i > 0 && gaHeapLargeHoles[i-1].End == Base )
+	{
+		i --;
+		gaHeapLargeHoles[i].End = end;
+		if( i + 1 < giHeapLargeHoles && gaHeapLargeHoles[i+1].Base == end ) {
+			gaHeapLargeHoles[i].End = gaHeapLargeHoles[i+1].End;
+			memmove(&gaHeapLargeHoles[i+1], &gaHeapLargeHoles[i+2],
+				(giHeapLargeHoles - i - 2) * sizeof(tHeapHole));
+			giHeapLargeHoles --;
+		}
+	}
+	else if( i < giHeapLargeHoles && gaHeapLargeHoles[i].Base == end )
+	{
+		gaHeapLargeHoles[i].Base = Base;
+	}
+	else if( end == gHeapLargeNext )
+	{
+		gHeapLargeNext = Base;
+		return ;
+	}
+	else if( Heap_int_HoleInsert(i, Base, end) )
+	{
+		// Out of hole slots, the address space is lost (the memory isn't)
+		DEBUGS("Heap_int_LargeRelease: Leaking %p+0x%x", Base, Size);
+		return ;
+	}
+
+	// Hand the top hole back to the unused part of the window
+	if( giHeapLargeHoles && gaHeapLargeHoles[giHeapLargeHoles-1].End == gHeapLargeNext ) {
+		gHeapLargeNext = gaHeapLargeHoles[giHeapLargeHoles-1].Base;
+		giHeapLargeHoles --;
+	}
+}
+
+static int Heap_int_HoleInsert(int Index, uintptr_t Base, uintptr_t End)
+{
+	if( giHeapLargeHoles == LARGE_MAX_HOLES )
+		return 1;
+	memmove(&gaHeapLargeHoles[Index+1], &gaHeapLargeHoles[Index],
+		(giHeapLargeHoles - Index) * sizeof(tHeapHole));
+	gaHeapLargeHoles[Index].Base = Base;
+	gaHeapLargeHoles[Index].End = End;
+	giHeapLargeHoles ++;
+	return 0;
+}
+
+/**
+ * \brief Check if huge pages should be used (MALLOC_HUGEPAGES=1)
+ * \note Only x86_64 can back user memory with large pages, elsewhere the
+ *       rounding to 2 MiB would just waste memory
+ * \note Needs a kernel whose page lookups resolve addresses inside a large
+ *       page (older x86_64 kernels failed CheckMem on any unaligned buffer in one)
+ */
+static int Heap_int_HugeEnabled(void)
+{
+	#if ARCHDIR_is_x86_64
+	static int	enabled = -1;
+	if( enabled == -1 ) {
+		const char	*val = getenv("MALLOC_HUGEPAGES");
+		enabled = (val && *val == '1');
+	}
+	return enabled;
+	#else
+	return 0;
+	#endif
+}
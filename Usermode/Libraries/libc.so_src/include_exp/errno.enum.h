@@ -28,6 +28,7 @@ enum {
 	
 	EALREADY,	// Operation was a NOP
 	EINTERNAL,	// Internal Error
+	ETIMEDOUT,	// Operation timed out
 	
 	NUM_ERRNO
 };
@@ -52,6 +52,7 @@ extern void	*malloc(size_t bytes);
 extern void	*calloc(size_t __nmemb, size_t __size);
 extern void	*realloc(void *__ptr, size_t __size);
 extern int	IsHeap(void *ptr);
+extern void	malloc_stats(void);
 
 /* --- Random --- */
 extern void	srand(unsigned int seed);
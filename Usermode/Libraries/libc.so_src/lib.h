@@ -28,6 +28,32 @@ struct sCPUID
 {
 	uint8_t	SSE;
 	uint8_t	SSE2;
+	uint8_t	AVX2;	//!< Also requires the OS to save YMM state
+	uint8_t	ERMS;	//!< Enhanced rep movsb/stosb
 };
 
+extern tCPUID	gCPU_Features;
+
+/**
+ * \brief Implementations of the hot string.c routines
+ * \note Selected once by _string_init, based on gCPU_Features
+ */
+typedef struct sStringOps
+{
+	void	*(*Memcpy)(void *dest, const void *src, size_t n);
+	void	*(*Memmove)(void *dest, const void *src, size_t n);
+	void	*(*Memset)(void *dest, int val, size_t n);
+	 int	(*Memcmp)(const void *p1, const void *p2, size_t n);
+	void	*(*Memchr)(const void *ptr, int val, size_t n);
+	size_t	(*Strlen)(const char *str);
+	char	*(*Strchr)(const char *str, int ch);
+	const char	*Name;
+} tStringOps;
+
+extern tStringOps	gLibC_StringOps;
+extern void	_string_init(void);
+#if defined(__i386__) || defined(__x86_64__)
+extern void	_string_init_x86(tStringOps *Ops, const char *Limit);
+#endif
+
 #endif
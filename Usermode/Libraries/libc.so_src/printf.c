@@ -17,8 +17,21 @@ typedef char	BOOL;
 #define TRUE	1
 #define FALSE	0
 
+#define PRINTF_STAGE_SIZE	256	// Stack buffer used ahead of FILE output
+
 // === TYPES ===
-typedef void	(*printf_putch_t)(void *h, char ch);
+/**
+ * \brief Output sink, characters are staged in \a Buf and passed on in bulk
+ */
+typedef struct sPrintfSink
+{
+	char	*Buf;
+	size_t	Pos;	//!< Bytes used in Buf
+	size_t	Size;
+	size_t	Total;	//!< Characters emitted (including those flushed or dropped)
+	void	(*Flush)(struct sPrintfSink *Sink);	//!< NULL for fixed buffers (overflow is dropped)
+	void	*Handle;
+}	tPrintfSink;
 enum eFPN {
 	FPN_STD,
 	FPN_SCI,
@@ -26,15 +39,90 @@ enum eFPN {
 };
 
 // === PROTOTYPES ===
+static inline void	_printf_putch(tPrintfSink *Sink, char ch);
+static void	_printf_write(tPrintfSink *Sink, const char *Data, size_t Length);
+static void	_printf_fill(tPrintfSink *Sink, char ch, int Count);
 void	itoa(char *buf, uint64_t num, size_t base, int minLength, char pad, int bSigned);
-size_t	_printf_itoa(printf_putch_t putch_cb, void *putch_h, uint64_t num,
+size_t	_printf_itoa(tPrintfSink *Sink, uint64_t num,
 	size_t base, int bUpper,
 	int bSigned, char SignChar, int Precision,
 	int PadLength, char PadChar, int bPadRight);
-size_t	_printf_ftoa_hex(printf_putch_t putch_cb, void *putch_h, long double num, int Precision, int bForcePoint, int bForceSign, int bCapitals);
-size_t	_printf_ftoa(printf_putch_t putch_cb, void *putch_h, long double num, size_t Base, enum eFPN Notation, int Precision, int bForcePoint, int bForceSign, int bCapitals);
+size_t	_printf_ftoa_hex(tPrintfSink *Sink, long double num, int Precision, int bForcePoint, int bForceSign, int bCapitals);
+size_t	_printf_ftoa(tPrintfSink *Sink, long double num, size_t Base, enum eFPN Notation, int Precision, int bForcePoint, int bForceSign, int bCapitals);
+
+// === GLOBALS ===
+#define _DEC_ROW(h)	h"0" h"1" h"2" h"3" h"4" h"5" h"6" h"7" h"8" h"9"
+#define _HEX_ROW(h)	_DEC_ROW(h) h"a" h"b" h"c" h"d" h"e" h"f"
+#define _HEX_ROWU(h)	_DEC_ROW(h) h"A" h"B" h"C" h"D" h"E" h"F"
+//! "00" to "99", two decimal digits per lookup
+const char	cDEC_PAIRS[] = _DEC_ROW("0") _DEC_ROW("1") _DEC_ROW("2") _DEC_ROW("3") _DEC_ROW("4")
+	_DEC_ROW("5") _DEC_ROW("6") _DEC_ROW("7") _DEC_ROW("8") _DEC_ROW("9");
+//! "00" to "ff", one byte per lookup
+const char	cHEX_PAIRS[] = _HEX_ROW("0") _HEX_ROW("1") _HEX_ROW("2") _HEX_ROW("3") _HEX_ROW("4")
+	_HEX_ROW("5") _HEX_ROW("6") _HEX_ROW("7") _HEX_ROW("8") _HEX_ROW("9")
+	_HEX_ROW("a") _HEX_ROW("b") _HEX_ROW("c") _HEX_ROW("d") _HEX_ROW("e") _HEX_ROW("f");
+const char	cHEX_PAIRS_U[] = _HEX_ROWU("0") _HEX_ROWU("1") _HEX_ROWU("2") _HEX_ROWU("3") _HEX_ROWU("4")
+	_HEX_ROWU("5") _HEX_ROWU("6") _HEX_ROWU("7") _HEX_ROWU("8") _HEX_ROWU("9")
+	_HEX_ROWU("A") _HEX_ROWU("B") _HEX_ROWU("C") _HEX_ROWU("D") _HEX_ROWU("E") _HEX_ROWU("F");
+#undef _DEC_ROW
+#undef _HEX_ROW
+#undef _HEX_ROWU
 
 // === CODE ===
+static inline void _printf_putch(tPrintfSink *Sink, char ch)
+{
+	if( Sink->Pos == Sink->Size && Sink->Flush )
+		Sink->Flush(Sink);
+	if( Sink->Pos < Sink->Size )
+		Sink->Buf[Sink->Pos++] = ch;
+	Sink->Total ++;
+}
+
+/**
+ * \brief Append a run of characters to the sink (as few copies as the buffer allows)
+ */
+static void _printf_write(tPrintfSink *Sink, const char *Data, size_t Length)
+{
+	Sink->Total += Length;
+	while( Length )
+	{
+		if( Sink->Pos == Sink->Size ) {
+			if( !Sink->Flush )
+				return ;
+			Sink->Flush(Sink);
+		}
+		size_t	len = Sink->Size - Sink->Pos;
+		if( len > Length )	len = Length;
+		memcpy(Sink->Buf + Sink->Pos, Data, len);
+		Sink->Pos += len;
+		Data += len;
+		Length -= len;
+	}
+}
+
+/**
+ * \brief Append \a Count copies of \a ch (padding)
+ */
+static void _printf_fill(tPrintfSink *Sink, char ch, int Count)
+{
+	if( Count <= 0 )
+		return ;
+	Sink->Total += Count;
+	while( Count )
+	{
+		if( Sink->Pos == Sink->Size ) {
+			if( !Sink->Flush )
+				return ;
+			Sink->Flush(Sink);
+		}
+		size_t	len = Sink->Size - Sink->Pos;
+		if( len > (size_t)Count )	len = Count;
+		memset(Sink->Buf + Sink->Pos, ch, len);
+		Sink->Pos += len;
+		Count -= len;
+	}
+}
+
 /**
  * \fn EXPORT void vsnprintf(char *buf, const char *format, va_list args)
  * \brief Prints a formatted string to a buffer
@@ -42,11 +130,11 @@ size_t	_printf_ftoa(printf_putch_t putch_cb, void *putch_h, long double num, siz
  * \param format	String - Format String
  * \param args	VarArgs List - Arguments
  */
-EXPORT int _vcprintf_int(printf_putch_t putch_cb, void *putch_h, const char *format, va_list args)
+EXPORT int _vcprintf_int(tPrintfSink *Sink, const char *format, va_list args)
 {
 	char	tmp[65];
 	 int	c, minSize, precision, len;
-	size_t	pos = 0;
+	size_t	start = Sink->Total;
 	char	*p;
 	uint64_t	arg;
 	long double	arg_f;
@@ -54,23 +142,27 @@ EXPORT int _vcprintf_int(printf_putch_t putch_cb, void *putch_h, const char *for
 	BOOL	bLongLong, bLong, bJustifyLeft, bAltForm;
 	char	cNumPad, cPlus;
 
-	#define _addchar(ch) do { \
-		putch_cb(putch_h, ch); \
-		pos ++; \
-	} while(0)
+	#define _addchar(ch)	_printf_putch(Sink, ch)
 
 	tmp[32] = '\0';
 	
-	while((c = *format++) != 0)
+	for( ;; )
 	{
-		// Non-control character
-		if (c != '%') {
-			_addchar(c);
-			continue;
-		}
+		// Copy literal text up to the next conversion in one go
+		// (so a format without any is a single write)
+		const char	*lit = format;
+		while( *format && *format != '%' )
+			format ++;
+		if( format != lit )
+			_printf_write(Sink, lit, format - lit);
+		if( *format == '\0' )
+			break;
+		format ++;
 		
 		// Control Character
 		c = *format++;
+		if(c == '\0')
+			break;
 		if(c == '%') {	// Literal %
 			_addchar('%');
 			continue;
@@ -173,14 +265,14 @@ EXPORT int _vcprintf_int(printf_putch_t putch_cb, void *putch_h, const char *for
 			arg = bLongLong ? va_arg(args, int64_t) : va_arg(args, int32_t);
 			if( arg == 0 && precision == 0 )
 				break;
-			pos += _printf_itoa(putch_cb, putch_h, arg, 10, FALSE,
+			_printf_itoa(Sink, arg, 10, FALSE,
 				TRUE, cPlus, precision, minSize, cNumPad, bJustifyLeft);
 			break;
 		
 		// Unsigned Integer
 		case 'u':
-			arg = bLongLong ? va_arg(args, int64_t) : va_arg(args, int32_t);
-			pos += _printf_itoa(putch_cb, putch_h, arg, 10, FALSE,
+			arg = bLongLong ? va_arg(args, uint64_t) : va_arg(args, uint32_t);
+			_printf_itoa(Sink, arg, 10, FALSE,
 				FALSE, '\0', precision, minSize, cNumPad, bJustifyLeft);
 			break;
 		
@@ -190,7 +282,7 @@ EXPORT int _vcprintf_int(printf_putch_t putch_cb, void *putch_h, const char *for
 			_addchar('0');
 			_addchar('x');
 			arg = va_arg(args, intptr_t);
-			pos += _printf_itoa(putch_cb, putch_h, arg, 16, FALSE,
+			_printf_itoa(Sink, arg, 16, FALSE,
 				FALSE, '\0', sizeof(intptr_t)*2, 0,'\0',FALSE);
 			break;
 		// Unsigned Hexadecimal
@@ -200,8 +292,8 @@ EXPORT int _vcprintf_int(printf_putch_t putch_cb, void *putch_h, const char *for
 				_addchar('0');
 				_addchar(c);
 			}
-			arg = bLongLong ? va_arg(args, int64_t) : va_arg(args, int32_t);
-			pos += _printf_itoa(putch_cb, putch_h, arg, 16, c=='X',
+			arg = bLongLong ? va_arg(args, uint64_t) : va_arg(args, uint32_t);
+			_printf_itoa(Sink, arg, 16, c=='X',
 				FALSE, '\0', precision, minSize,cNumPad,bJustifyLeft);
 			break;
 		
@@ -210,8 +302,8 @@ EXPORT int _vcprintf_int(printf_putch_t putch_cb, void *putch_h, const char *for
 			if(bAltForm) {
 				_addchar('0');
 			}
-			arg = bLongLong ? va_arg(args, int64_t) : va_arg(args, int32_t);
-			pos += _printf_itoa(putch_cb, putch_h, arg, 8, FALSE,
+			arg = bLongLong ? va_arg(args, uint64_t) : va_arg(args, uint32_t);
+			_printf_itoa(Sink, arg, 8, FALSE,
 				FALSE, '\0', precision, minSize,cNumPad,bJustifyLeft);
 			break;
 		
@@ -221,8 +313,8 @@ EXPORT int _vcprintf_int(printf_putch_t putch_cb, void *putch_h, const char *for
 				_addchar('0');
 				_addchar('b');
 			}
-			arg = bLongLong ? va_arg(args, int64_t) : va_arg(args, int32_t);
-			pos += _printf_itoa(putch_cb, putch_h, arg, 2, FALSE,
+			arg = bLongLong ? va_arg(args, uint64_t) : va_arg(args, uint32_t);
+			_printf_itoa(Sink, arg, 2, FALSE,
 				FALSE, '\0', precision, minSize,cNumPad,bJustifyLeft);
 			break;
 
@@ -230,28 +322,28 @@ EXPORT int _vcprintf_int(printf_putch_t putch_cb, void *putch_h, const char *for
 		case 'f':
 		case 'F':
 			arg_f = bLong ? va_arg(args, long double) : va_arg(args, double);
-			pos += _printf_ftoa(putch_cb, putch_h, arg_f, 10, FPN_STD,
+			_printf_ftoa(Sink, arg_f, 10, FPN_STD,
 				precision, 0, bJustifyLeft, c == 'F');
 			break;
 		// Scientific Float
 		case 'e':
 		case 'E':
 			arg_f = bLong ? va_arg(args, long double) : va_arg(args, double);
-			pos += _printf_ftoa(putch_cb, putch_h, arg_f, 10, FPN_SCI,
+			_printf_ftoa(Sink, arg_f, 10, FPN_SCI,
 				precision, 0, bJustifyLeft, c == 'E');
 			break;
 		// Scientific Float
 		case 'g':
 		case 'G':
 			arg_f = bLong ? va_arg(args, long double) : va_arg(args, double);
-			pos += _printf_ftoa(putch_cb, putch_h, arg_f, 10, FPN_SHORTEST,
+			_printf_ftoa(Sink, arg_f, 10, FPN_SHORTEST,
 				precision, 0, bJustifyLeft, c == 'G');
 			break;
 		// Hexadecimal Scientific
 		case 'a':
 		case 'A':
 			arg_f = bLong ? va_arg(args, long double) : va_arg(args, double);
-			pos += _printf_ftoa_hex(putch_cb, putch_h, arg_f, precision, 0, bJustifyLeft, c == 'A');
+			_printf_ftoa_hex(Sink, arg_f, precision, 0, bJustifyLeft, c == 'A');
 			break;
 
 		// String
@@ -264,14 +356,10 @@ EXPORT int _vcprintf_int(printf_putch_t putch_cb, void *putch_h, const char *for
 			else
 				len = strlen(p);
 			if(!bJustifyLeft)
-				while(minSize > len++)	_addchar(' ');
-			while( *p ) {
-				if(precision >= 0 && precision -- == 0)
-					break;
-				_addchar(*p++);
-			}
+				_printf_fill(Sink, ' ', minSize - len);
+			_printf_write(Sink, p, len);
 			if(bJustifyLeft)
-				while(minSize > len++)	_addchar(' ');
+				_printf_fill(Sink, ' ', minSize - len);
 			break;
 
 		// Unknown, just treat it as a character
@@ -283,28 +371,17 @@ EXPORT int _vcprintf_int(printf_putch_t putch_cb, void *putch_h, const char *for
 	}
 	#undef _addchar
 	
-	return pos;
-}
-
-struct s_sprintf_info {
-	char	*dest;
-	size_t	ofs;
-	size_t	maxlen;
-};
-
-void _vsnprintf_putch(void *h, char ch)
-{
-	struct s_sprintf_info	*info = h;
-	if(info->ofs < info->maxlen)
-		info->dest[info->ofs++] = ch;
+	return Sink->Total - start;
 }
 
 EXPORT int vsnprintf(char *__s, size_t __maxlen, const char *__format, va_list __args)
 {
-	struct s_sprintf_info	info = {__s, 0, __maxlen};
+	// Formats straight into the destination, leaving room for the NUL
+	tPrintfSink	sink = {.Buf = __s, .Size = (__s && __maxlen) ? __maxlen - 1 : 0};
 	int ret;
-	ret = _vcprintf_int(_vsnprintf_putch, &info, __format, __args);
-	_vsnprintf_putch(&info, '\0');
+	ret = _vcprintf_int(&sink, __format, __args);
+	if( __s && __maxlen )
+		__s[sink.Pos] = '\0';
 	return ret;
 }
 
@@ -333,14 +410,20 @@ EXPORT int sprintf(char *buf, const char *format, ...)
 	return ret;
 }
 
-void _vfprintf_putch(void *h, char ch)
+static void _vfprintf_flush(tPrintfSink *Sink)
 {
-	fputc(ch, h);
+	fwrite(Sink->Buf, 1, Sink->Pos, Sink->Handle);
+	Sink->Pos = 0;
 }
 
 EXPORT int vfprintf(FILE *__fp, const char *__format, va_list __args)
 {
-	return _vcprintf_int(_vfprintf_putch, __fp, __format, __args);
+	char	stage[PRINTF_STAGE_SIZE];
+	tPrintfSink	sink = {.Buf = stage, .Size = sizeof(stage), .Flush = _vfprintf_flush, .Handle = __fp};
+	 int	ret;
+	ret = _vcprintf_int(&sink, __format, __args);
+	_vfprintf_flush(&sink);
+	return ret;
 }
 
 EXPORT int fprintf(FILE *fp, const char *format, ...)
@@ -377,10 +460,10 @@ EXPORT int printf(const char *format, ...)
 
 void itoa(char *buf, uint64_t num, size_t base, int minLength, char pad, int bSigned)
 {
-	struct s_sprintf_info	info = {buf, 0, 1024};
+	tPrintfSink	sink = {.Buf = buf, .Size = 1024};
 	if(!buf)	return;
-	_printf_itoa(_vsnprintf_putch, &info, num, base, FALSE, bSigned, '\0', 0, minLength, pad, FALSE);
-	buf[info.ofs] = '\0';
+	_printf_itoa(&sink, num, base, FALSE, bSigned, '\0', 0, minLength, pad, FALSE);
+	buf[sink.Pos] = '\0';
 }
 
 const char cDIGITS[] = "0123456789abcdef";
@@ -394,13 +477,14 @@ const char cUDIGITS[] = "0123456789ABCDEF";
  * \param pad	Padding used to ensure minLength
  * \param bSigned	Signed number output?
  */
-size_t _printf_itoa(printf_putch_t putch_cb, void *putch_h, uint64_t num,
+size_t _printf_itoa(tPrintfSink *Sink, uint64_t num,
 	size_t base, int bUpper,
 	int bSigned, char SignChar, int Precision,
 	int PadLength, char PadChar, int bPadRight)
 {
 	char	tmpBuf[64];
-	 int	pos = 0;
+	char	*digits = tmpBuf + sizeof(tmpBuf);	// Filled from the end
+	 int	pos;
 	size_t	ret = 0;
 	 int	sign_is_neg = 0;
 	const char *map = bUpper ? cUDIGITS : cDIGITS;
@@ -415,39 +499,81 @@ size_t _printf_itoa(printf_putch_t putch_cb, void *putch_h, uint64_t num,
 		sign_is_neg = 1;
 	}
 	
-	// Encode into reversed string
-	while(num > base-1) {
-		tmpBuf[pos++] = map[ num % base ];
-		num = (uint64_t) num / (uint64_t)base;		// Shift {number} right 1 digit
+	// Encode backwards, two digits per step for the common bases
+	if( base == 10 )
+	{
+		while( num >= 100 ) {
+			digits -= 2;
+			memcpy(digits, &cDEC_PAIRS[(num % 100)*2], 2);
+			num /= 100;
+		}
+		if( num >= 10 ) {
+			digits -= 2;
+			memcpy(digits, &cDEC_PAIRS[num*2], 2);
+		}
+		else
+			*--digits = '0' + num;
 	}
-
-	tmpBuf[pos++] = map[ num % base ];		// Last digit of {number}
+	else if( base == 16 )
+	{
+		const char	*pairs = bUpper ? cHEX_PAIRS_U : cHEX_PAIRS;
+		while( num >= 0x100 ) {
+			digits -= 2;
+			memcpy(digits, &pairs[(num & 0xFF)*2], 2);
+			num >>= 8;
+		}
+		if( num >= 0x10 ) {
+			digits -= 2;
+			memcpy(digits, &pairs[num*2], 2);
+		}
+		else
+			*--digits = map[num];
+	}
+	else
+	{
+		while(num > base-1) {
+			*--digits = map[ num % base ];
+			num = (uint64_t) num / (uint64_t)base;		// Shift {number} right 1 digit
+		}
+		*--digits = map[ num % base ];		// Last digit of {number}
+	}
+	pos = tmpBuf + sizeof(tmpBuf) - digits;
 	
 	// length of number, minus the sign character
 	PadLength -= pos + (sign_is_neg || SignChar != '\0');
 	Precision -= pos + (sign_is_neg || SignChar != '\0');
-	if( !bPadRight )
+	// Spaces go before the sign, zeros after it
+	if( !bPadRight && PadLength > 0 && PadChar != '0' )
 	{
-		while(PadLength-- > 0)
-			putch_cb(putch_h, PadChar), ret ++;
+		_printf_fill(Sink, PadChar, PadLength);
+		ret += PadLength;
 	}
 	
 	if(sign_is_neg)
-		putch_cb(putch_h, '-'), ret++;	// Negative sign character
+		_printf_putch(Sink, '-'), ret++;	// Negative sign character
 	else if(SignChar)
-		putch_cb(putch_h, SignChar), ret++;	// positive sign character
+		_printf_putch(Sink, SignChar), ret++;	// positive sign character
 	else {
 	}
 	
-	while( Precision-- > 0 )
-		putch_cb(putch_h, '0'), ret++;
-	while(pos--)
-		putch_cb(putch_h, tmpBuf[pos]), ret++;	// Reverse the order of characters
+	if( !bPadRight && PadLength > 0 && PadChar == '0' )
+	{
+		_printf_fill(Sink, PadChar, PadLength);
+		ret += PadLength;
+	}
+	
+	if( Precision > 0 )
+	{
+		_printf_fill(Sink, '0', Precision);
+		ret += Precision;
+	}
+	_printf_write(Sink, digits, pos);
+	ret += pos;
 
-	if( bPadRight )
+	if( bPadRight && PadLength > 0 )
 	{
-		while(PadLength-- > 0)
-			putch_cb(putch_h, PadChar), ret ++;
+		_printf_fill(Sink, PadChar, PadLength);
+		ret += PadLength;
 	}
 	
 	return ret;
@@ -507,7 +633,7 @@ double _longdiv(double num, double den, int *quot)
 	return num;
 }
 
-size_t _printf_ftoa_hex(printf_putch_t putch_cb, void *putch_h, long double num, int Precision, int bForcePoint, int bForceSign, int bCapitals)
+size_t _printf_ftoa_hex(tPrintfSink *Sink, long double num, int Precision, int bForcePoint, int bForceSign, int bCapitals)
 {
 	uint64_t	significand;
 	int16_t	exponent;
@@ -517,9 +643,9 @@ size_t _printf_ftoa_hex(printf_putch_t putch_cb, void *putch_h, long double num,
 
 	#define _putch(_ch) do{\
 		if(bCapitals)\
-			putch_cb(putch_h, toupper(_ch));\
+			_printf_putch(Sink, toupper(_ch));\
 		else\
-			putch_cb(putch_h, _ch);\
+			_printf_putch(Sink, _ch);\
 		ret ++;\
 	}while(0)
 
@@ -574,15 +700,15 @@ size_t _printf_ftoa_hex(printf_putch_t putch_cb, void *putch_h, long double num,
 		significand <<= 4;
 	}
 	_putch('p');
-	//ret += _printf_itoa(putch_cb, putch_h, exp_16, 16, bCapitals, TRUE, '+', 0, 0, '\0', 0);
-	ret += _printf_itoa(putch_cb, putch_h, exponent, 10, bCapitals, TRUE, '+', 0, 0, '\0', 0);
+	//ret += _printf_itoa(Sink, exp_16, 16, bCapitals, TRUE, '+', 0, 0, '\0', 0);
+	ret += _printf_itoa(Sink, exponent, 10, bCapitals, TRUE, '+', 0, 0, '\0', 0);
 	
 	#undef _putch
 	return ret;
 }
 
 #if 0
-size_t _printf_itoa_fixed(printf_putch_t putch_cb, void *putch_h, uint64_t num, size_t Base)
+size_t _printf_itoa_fixed(tPrintfSink *Sink, uint64_t num, size_t Base)
 {
 	uint64_t	den;
 	size_t	ret = 0;
@@ -591,7 +717,7 @@ size_t _printf_itoa_fixed(printf_putch_t putch_cb, void *putch_h, uint64_t num,
 	
 	while( den )
 	{
-		putch_cb(putch_h, cDIGITS[num / den]);
+		_printf_putch(Sink, cDIGITS[num / den]);
 		ret ++;
 		num %= den;
 		den /= Base;
@@ -600,13 +726,13 @@ size_t _printf_itoa_fixed(printf_putch_t putch_cb, void *putch_h, uint64_t num,
 	return ret;
 }
 
-size_t _printf_ftoa_dec(printf_putch_t putch_cb, void *putch_h, long double num, enum eFPN Notation, int Precision, int bForcePoint, int bForceSign, int bCapitals)
+size_t _printf_ftoa_dec(tPrintfSink *Sink, long double num, enum eFPN Notation, int Precision, int bForcePoint, int bForceSign, int bCapitals)
 {
 	size_t	ret = 0;
 	 int	i;
 
 	#define _putch(_ch) do{\
-		putch_cb(putch_h, bCapitals ? toupper(_ch) : _ch), ret++;\
+		_printf_putch(Sink, bCapitals ? toupper(_ch) : _ch), ret++;\
 	}while(0)
 	
 	uint64_t	significand;
@@ -667,12 +793,12 @@ size_t _printf_ftoa_dec(printf_putch_t putch_cb, void *putch_h, long double num,
 
 	
 	// Whole portion
-	ret += _printf_itoa(putch_cb, putch_h, whole, 10, FALSE, FALSE, '\0', 0, 0, '\0', FALSE);
+	ret += _printf_itoa(Sink, whole, 10, FALSE, FALSE, '\0', 0, 0, '\0', FALSE);
 	for(i = pre_zeros; i --; )	_putch('0');
 	// TODO: Conditional point
 	_putch('-');
 	for(i = post_zeros; i--; )	_putch('0');
-	ret += _printf_itoa_fixed(putch_cb, putch_h, part, 10);
+	ret += _printf_itoa_fixed(Sink, part, 10);
 	
 	#undef _putch
 
@@ -680,7 +806,7 @@ size_t _printf_ftoa_dec(printf_putch_t putch_cb, void *putch_h, long double num,
 }
 #endif
 
-size_t _printf_ftoa(printf_putch_t putch_cb, void *putch_h, long double num, size_t Base, enum eFPN Notation, int Precision, int bForcePoint, int bForceSign, int bCapitals)
+size_t _printf_ftoa(tPrintfSink *Sink, long double num, size_t Base, enum eFPN Notation, int Precision, int bForcePoint, int bForceSign, int bCapitals)
 {
 	uint64_t	significand;
 	int16_t	exponent;
@@ -690,9 +816,9 @@ size_t _printf_ftoa(printf_putch_t putch_cb, void *putch_h, long double num, siz
 
 	#define _putch(_ch) do{\
 		if(bCapitals)\
-			putch_cb(putch_h, toupper(_ch));\
+			_printf_putch(Sink, toupper(_ch));\
 		else\
-			putch_cb(putch_h, _ch);\
+			_printf_putch(Sink, _ch);\
 		ret ++;\
 	}while(0)
 
@@ -828,7 +954,7 @@ size_t _printf_ftoa(printf_putch_t putch_cb, void *putch_h, long double num, siz
 			_putch('p');
 		else
 			_putch('e');
-		ret += _printf_itoa(putch_cb, putch_h, sci_exponent, Base, FALSE, TRUE, '+', 3, 0, '\0', FALSE);
+		ret += _printf_itoa(Sink, sci_exponent, Base, FALSE, TRUE, '+', 3, 0, '\0', FALSE);
 	}	
 
 	#undef _putch
@@ -20,6 +20,7 @@
 
 // === PROTOTYPES ===
 struct sFILE	*get_file_struct();
+static size_t	_fwrite_vec(FILE *fp, const t_sysIOVec *Vecs, int Count);
 
 // === GLOBALS ===
 struct sFILE	_iob[STDIO_MAX_STREAMS];	// IO Buffer
@@ -383,24 +384,69 @@ EXPORT int fseek(FILE *fp, long int amt, int whence)
 	}
 }
 
+/**
+ * \brief Write out anything buffered, followed by \a Vecs, in one syscall
+ * \return Number of bytes from \a Vecs written, or -1 on error
+ * \note Whatever part of the buffer could not be written stays buffered
+ * \note Only plain write buffers are combined with \a Vecs, other modes are
+ *       handled by _fflush_int (read data dropped, append seeks first) beforehand
+ */
+static size_t _fwrite_vec(FILE *fp, const t_sysIOVec *Vecs, int Count)
+{
+	t_sysIOVec	vecs[3];
+	 int	n = 0;
+	size_t	written;
+	
+	assert(Count < 3);
+	if( fp->BufferPos && (fp->Flags & FILE_FLAG_MODE_MASK) != FILE_FLAG_MODE_WRITE ) {
+		// Couldn't get the buffer out, so don't let this data overtake it
+		if( _fflush_int(fp) )
+			return 0;
+	}
+	if( fp->BufferPos ) {
+		vecs[n].base = fp->Buffer;
+		vecs[n].len = fp->BufferPos;
+		n ++;
+	}
+	for( int i = 0; i < Count; i ++ )
+		vecs[n++] = Vecs[i];
+	
+	if( n == 1 )
+		written = _SysWrite(fp->FD, vecs[0].base, vecs[0].len);
+	else
+		written = _SysWriteV(fp->FD, vecs, n);
+	if( written == (size_t)-1 )
+		return -1;
+	
+	if( written < fp->BufferPos ) {
+		memmove(fp->Buffer, fp->Buffer + written, fp->BufferPos - written);
+		fp->BufferPos -= written;
+		return 0;
+	}
+	written -= fp->BufferPos;
+	fp->BufferPos = 0;
+	return written;
+}
+
+/**
+ * \brief Write \a num elements straight to the file (after any buffered data)
+ */
 size_t _fwrite_unbuffered(FILE *fp, size_t size, size_t num, const void *data)
 {
-	size_t	ret = 0, bytes;
-	while( num -- )
-	{
-		bytes = _SysWrite(fp->FD, data, size);
-		if( bytes == (size_t)-1 ) {
-			// Oops.
-			// TODO: Set error flag
-			break;
-		}
-		if( bytes != size ) {
-			_SysDebug("_fwrite_unbuffered: Oops, rollback %i/%i bytes!", bytes, size);
-			_SysSeek(fp->FD, -bytes, SEEK_CUR);
-			break;
-		}
-		data = (char*)data + size;
+	t_sysIOVec	vec = {(void*)data, size*num};
+	size_t	bytes, ret;
+	
+	bytes = _fwrite_vec(fp, &vec, 1);
+	if( bytes == (size_t)-1 ) {
+		// TODO: Set error flag
+		return 0;
 	}
+	// Only whole elements count
+	if( bytes % size ) {
+		_SysDebug("_fwrite_unbuffered: Oops, rollback %i/%i bytes!", bytes % size, size);
+		_SysSeek(fp->FD, -(int64_t)(bytes % size), SEEK_CUR);
+	}
+	ret = bytes / size;
 	fp->Pos += ret * size;
 	return ret;
 }
@@ -444,14 +490,12 @@ EXPORT size_t fwrite(const void *ptr, size_t size, size_t num, FILE *fp)
 			// Buffering enabled
 			if( fp->BufferSpace - fp->BufferPos < size*num )
 			{
-				// If there's not enough space, flush and write-through
-				_fflush_int(fp);	// TODO: check ret
+				// If there's not enough space, write the buffer and the new data together
 				ret = _fwrite_unbuffered(fp, size, num, ptr);
 			}
 			else if( (fp->Flags & FILE_FLAG_LINEBUFFERED) && memchr(ptr,'\n',size*num) )
 			{
-				// Newline present? Flush though
-				_fflush_int(fp);	// TODO: check ret
+				// Newline present? Flush though (again, as one write)
 				ret = _fwrite_unbuffered(fp, size, num, ptr);
 			}
 			else
@@ -594,13 +638,19 @@ FILE *get_file_struct()
 
 EXPORT int puts(const char *str)
 {
-	 int	len;
+	t_sysIOVec	vecs[2];
+	size_t	len;
 	
 	if(!str)	return 0;
-	len = strlen(str);
 	
-	len = _SysWrite(_stdout, str, len);
-	_SysWrite(_stdout, "\n", 1);
+	// String and newline (plus anything stdout had buffered) in one write
+	vecs[0].base = (void*)str;
+	vecs[0].len = strlen(str);
+	vecs[1].base = "\n";
+	vecs[1].len = 1;
+	len = _fwrite_vec(stdout, vecs, 2);
+	if( len == (size_t)-1 )
+		return -1;
 	return len;
 }
 
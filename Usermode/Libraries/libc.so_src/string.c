@@ -1,13 +1,63 @@
 /*
  * AcessOS Basic C Library
  * string.c
+ *
+ * The hot memory and string routines go through gLibC_StringOps, so a
+ * faster version (e.g. SSE2) can be picked for the CPU when libc loads.
+ * The generic versions here work a word at a time.
  */
 #include <acess/sys.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <string.h>
 #include "lib.h"
 
+// === CONSTANTS ===
+typedef uintptr_t __attribute__((may_alias))	word_t;
+#define WORD_SIZE	sizeof(word_t)
+#define WORD_MASK	(WORD_SIZE-1)
+#define ONES	((word_t)-1/0xFF)	// 0x0101...01
+#define HIGHS	(ONES * 0x80)	// 0x8080...80
+//! Non-zero if any byte in \a w is zero
+#define HASZERO(w)	(((w) - ONES) & ~(w) & HIGHS)
+
+// === PROTOTYPES ===
+static void	*_memcpy_generic(void *dest, const void *src, size_t count);
+static void	*_memmove_generic(void *dest, const void *src, size_t count);
+static void	*_memset_generic(void *dest, int val, size_t count);
+static int	_memcmp_generic(const void *mem1, const void *mem2, size_t count);
+static void	*_memchr_generic(const void *ptr, int value, size_t num);
+static size_t	_strlen_generic(const char *str);
+static char	*_strchr_generic(const char *str, int character);
+
+// === GLOBALS ===
+tStringOps	gLibC_StringOps = {
+	.Memcpy = _memcpy_generic,
+	.Memmove = _memmove_generic,
+	.Memset = _memset_generic,
+	.Memcmp = _memcmp_generic,
+	.Memchr = _memchr_generic,
+	.Strlen = _strlen_generic,
+	.Strchr = _strchr_generic,
+	.Name = "generic"
+};
+
+// === CODE ===
+/**
+ * \brief Select the string routines for this CPU
+ * \note LIBC_STRING=<name> in the environment caps the selection (e.g. "generic")
+ */
+void _string_init(void)
+{
+	const char	*limit = getenv("LIBC_STRING");
+	#if defined(__i386__) || defined(__x86_64__)
+	_string_init_x86(&gLibC_StringOps, limit);
+	#else
+	(void)limit;
+	#endif
+}
+
 /**
  * \fn EXPORT int strcmp(const char *s1, const char *s2)
  * \brief Compare two strings
@@ -62,13 +112,7 @@ EXPORT int strncasecmp(const char *s1, const char *s2, size_t n)
  */
 EXPORT char *strcpy(char *dst, const char *src)
 {
-	char *_dst = dst;
-	while(*src) {
-		*dst = *src;
-		src++; dst++;
-	}
-	*dst = '\0';
-	return _dst;
+	return memcpy(dst, src, strlen(src)+1);
 }
 
 /**
@@ -90,13 +134,7 @@ EXPORT char *strncpy(char *dst, const char *src, size_t num)
  */
 EXPORT char *strcat(char *dst, const char *src)
 {
-	char	*to = dst;
-	// Find the end
-	while(*to)	to++;
-	// Copy
-	while(*src)	*to++ = *src++;
-	// End string
-	*to = '\0';
+	strcpy(dst + strlen(dst), src);
 	return dst;
 }
 
@@ -117,9 +155,7 @@ EXPORT char *strncat(char *dst, const char *src, size_t n)
  */
 EXPORT size_t strlen(const char *str)
 {
-	size_t	retval;
-	for(retval = 0; *str != '\0'; str++, retval++);
-	return retval;
+	return gLibC_StringOps.Strlen(str);
 }
 
 /**
@@ -129,9 +165,8 @@ EXPORT size_t strlen(const char *str)
  */
 EXPORT size_t strnlen(const char *str, size_t maxlen)
 {
-	size_t	len;
-	for( len = 0; maxlen -- && *str; str ++, len ++ );
-	return len;
+	const char	*end = memchr(str, '\0', maxlen);
+	return end ? (size_t)(end - str) : maxlen;
 }
 
 /**
@@ -144,7 +179,7 @@ EXPORT char *strdup(const char *str)
 	size_t	len = strlen(str);
 	char	*ret = malloc(len+1);
 	if(ret == NULL)	return NULL;
-	strcpy(ret, str);
+	memcpy(ret, str, len+1);
 	return ret;
 }
 
@@ -172,12 +207,7 @@ EXPORT char *strndup(const char *str, size_t maxlen)
  */
 EXPORT char *strchr(const char *str, int character)
 {
-	for(;*str;str++)
-	{
-		if(*str == character)
-			return (char*)str;
-	}
-	return NULL;
+	return gLibC_StringOps.Strchr(str, character);
 }
 
 /**
@@ -186,27 +216,28 @@ EXPORT char *strchr(const char *str, int character)
  */
 EXPORT char *strrchr(const char *str, int character)
 {
-	 int	i;
-	i = strlen(str)-1;
-	while(i--)
+	const char	*ret = NULL;
+	while( (str = strchr(str, character)) )
 	{
-		if(str[i] == character)
-			return (void*)&str[i];
+		ret = str;
+		if( *str == '\0' )
+			break;
+		str ++;
 	}
-	return NULL;
+	return (char*)ret;
 }
 
 /**
- * \fn EXPORT char *strstr(char *str1, const char *str2)
+ * \fn EXPORT char *strstr(const char *str1, const char *str2)
  * \brief Search a \a str1 for the first occurance of \a str2
  */
-EXPORT char *strstr(char *str1, const char *str2)
+EXPORT char *strstr(const char *str1, const char *str2)
 {
 	const char	*test = str2;
 	
 	for(;*str1;str1++)
 	{
-		if(*test == '\0')	return str1;
+		if(*test == '\0')	return (char*)str1;
 		if(*str1 == *test)	test++;
 		else	test = str2;
 	}
@@ -220,9 +251,7 @@ EXPORT char *strstr(char *str1, const char *str2)
  */
 EXPORT void *memset(void *dest, int val, size_t num)
 {
-	unsigned char *p = dest;
-	while(num--)	*p++ = val;
-	return dest;
+	return gLibC_StringOps.Memset(dest, val, num);
 }
 
 /**
@@ -231,49 +260,7 @@ EXPORT void *memset(void *dest, int val, size_t num)
  */
 EXPORT void *memcpy(void *__dest, const void *__src, size_t count)
 {
-	const int	wordmask = sizeof(void*)-1;
-	uintptr_t	src = (uintptr_t)__src;
-	uintptr_t	dst = (uintptr_t)__dest;
-
-	if( count < sizeof(void*)*2 || (dst & wordmask) != (src & wordmask) )
-	{
-		char	*dp = __dest;
-		const char	*sp = __src;
-		while(count--) *dp++ = *sp ++;
-	}
-	// TODO: Bulk aligned copies
-	#if 0
-	else if(count > 128 && (dst & 15) == (src & 15) )
-	{
-		// SSE/bulk copy
-		for( ; dst & 15; count -- )
-			*(char*)dst++ = *(char*)src++;
-		memcpy_16byte(dst, src, count / 16);
-		dst += count & ~15;
-		src += count & ~15;
-		count &= 15;
-		while(count --)
-			*(char*)dst++ = *(char*)src++;
-	}
-	#endif
-	else
-	{
-		void	**dp, **sp;
-		for( ; count && (dst & wordmask) != 0; count -- )
-			*(char*)dst++ = *(char*)src++;
-
-		dp = (void*)dst; sp = (void*)src;
-		while( count >= sizeof(void*) )
-		{
-			*dp++ = *sp++;
-			count -= sizeof(void*);
-		}
-		dst = (uintptr_t)dp; src = (uintptr_t)sp;
-		for( ; count; count -- )
-			*(char*)dst++ = *(char*)src++;
-	}
-
-	return __dest;
+	return gLibC_StringOps.Memcpy(__dest, __src, count);
 }
 
 /**
@@ -282,15 +269,7 @@ EXPORT void *memcpy(void *__dest, const void *__src, size_t count)
  */
 EXPORT void *memmove(void *dest, const void *src, size_t count)
 {
-	char *sp = (char *)src;
-	char *dp = (char *)dest;
-	// Check if the areas overlap
-	if( (uintptr_t)src < (uintptr_t)dest && (uintptr_t)dest < (uintptr_t)src+count )
-		for(;count--;)
-			dp[count] = sp[count];
-	else
-		memcpy(dest, src, count);
-	return dest;
+	return gLibC_StringOps.Memmove(dest, src, count);
 }
 
 /**
@@ -302,15 +281,7 @@ EXPORT void *memmove(void *dest, const void *src, size_t count)
  */
 EXPORT int memcmp(const void *mem1, const void *mem2, size_t count)
 {
-	const unsigned char	*p1 = mem1, *p2 = mem2;
-	while(count--)
-	{
-		if( *p1 != *p2 )
-			return *p1 - *p2;
-		p1 ++;
-		p2 ++;
-	}
-	return 0;
+	return gLibC_StringOps.Memcmp(mem1, mem2, count);
 }
 
 /**
@@ -322,15 +293,171 @@ EXPORT int memcmp(const void *mem1, const void *mem2, size_t count)
  */
 EXPORT void *memchr(const void *ptr, int value, size_t num)
 {
-	while(num--)
+	return gLibC_StringOps.Memchr(ptr, value, num);
+}
+
+// --- Generic (word at a time) versions ---
+static void *_memset_generic(void *dest, int val, size_t num)
+{
+	unsigned char	*p = dest;
+	word_t	w = ONES * (unsigned char)val;
+
+	for( ; num && ((uintptr_t)p & WORD_MASK); num -- )
+		*p++ = val;
+	for( ; num >= WORD_SIZE; num -= WORD_SIZE, p += WORD_SIZE )
+		*(word_t*)p = w;
+	while(num--)	*p++ = val;
+	return dest;
+}
+
+static void *_memcpy_generic(void *__dest, const void *__src, size_t count)
+{
+	unsigned char	*dp = __dest;
+	const unsigned char	*sp = __src;
+
+	// Only copy by word if both can be aligned
+	if( count >= WORD_SIZE*2 && ((uintptr_t)dp & WORD_MASK) == ((uintptr_t)sp & WORD_MASK) )
 	{
-		if( *(const unsigned char*)ptr == (unsigned char)value )
-			return (void*)ptr;
-		ptr ++;
+		for( ; (uintptr_t)dp & WORD_MASK; count -- )
+			*dp++ = *sp++;
+		for( ; count >= WORD_SIZE*4; count -= WORD_SIZE*4 )
+		{
+			((word_t*)dp)[0] = ((const word_t*)sp)[0];
+			((word_t*)dp)[1] = ((const word_t*)sp)[1];
+			((word_t*)dp)[2] = ((const word_t*)sp)[2];
+			((word_t*)dp)[3] = ((const word_t*)sp)[3];
+			dp += WORD_SIZE*4;
+			sp += WORD_SIZE*4;
+		}
+		for( ; count >= WORD_SIZE; count -= WORD_SIZE )
+		{
+			*(word_t*)dp = *(const word_t*)sp;
+			dp += WORD_SIZE;
+			sp += WORD_SIZE;
+		}
+	}
+	while(count--)	*dp++ = *sp++;
+	return __dest;
+}
+
+static void *_memmove_generic(void *dest, const void *src, size_t count)
+{
+	unsigned char	*dp = dest;
+	const unsigned char	*sp = src;
+
+	// Forwards is safe unless dest starts inside src
+	if( !((uintptr_t)src < (uintptr_t)dest && (uintptr_t)dest < (uintptr_t)src+count) )
+		return _memcpy_generic(dest, src, count);
+
+	dp += count;
+	sp += count;
+	if( ((uintptr_t)dp & WORD_MASK) == ((uintptr_t)sp & WORD_MASK) )
+	{
+		for( ; count && ((uintptr_t)dp & WORD_MASK); count -- )
+			*--dp = *--sp;
+		for( ; count >= WORD_SIZE; count -= WORD_SIZE )
+		{
+			dp -= WORD_SIZE;
+			sp -= WORD_SIZE;
+			*(word_t*)dp = *(const word_t*)sp;
+		}
+	}
+	while(count--)	*--dp = *--sp;
+	return dest;
+}
+
+static int _memcmp_generic(const void *mem1, const void *mem2, size_t count)
+{
+	const unsigned char	*p1 = mem1, *p2 = mem2;
+
+	if( ((uintptr_t)p1 & WORD_MASK) == ((uintptr_t)p2 & WORD_MASK) )
+	{
+		for( ; count && ((uintptr_t)p1 & WORD_MASK); count --, p1 ++, p2 ++ )
+		{
+			if( *p1 != *p2 )
+				return *p1 - *p2;
+		}
+		// Skip equal words, the byte loop below finds the difference
+		for( ; count >= WORD_SIZE; count -= WORD_SIZE, p1 += WORD_SIZE, p2 += WORD_SIZE )
+		{
+			if( *(const word_t*)p1 != *(const word_t*)p2 )
+				break;
+		}
+	}
+	for( ; count--; p1 ++, p2 ++ )
+	{
+		if( *p1 != *p2 )
+			return *p1 - *p2;
+	}
+	return 0;
+}
+
+static void *_memchr_generic(const void *ptr, int value, size_t num)
+{
+	const unsigned char	*p = ptr;
+	const unsigned char	ch = value;
+	word_t	pat = ONES * ch;
+
+	for( ; num && ((uintptr_t)p & WORD_MASK); num --, p ++ )
+	{
+		if( *p == ch )
+			return (void*)p;
+	}
+	for( ; num >= WORD_SIZE; num -= WORD_SIZE, p += WORD_SIZE )
+	{
+		word_t	w = *(const word_t*)p ^ pat;
+		if( HASZERO(w) )
+			break;
+	}
+	for( ; num; num --, p ++ )
+	{
+		if( *p == ch )
+			return (void*)p;
 	}
 	return NULL;
 }
 
+static size_t _strlen_generic(const char *str)
+{
+	const char	*p = str;
+
+	for( ; (uintptr_t)p & WORD_MASK; p ++ )
+	{
+		if( *p == '\0' )
+			return p - str;
+	}
+	// Aligned words never cross a page, so reading past the end is safe
+	while( !HASZERO(*(const word_t*)p) )
+		p += WORD_SIZE;
+	while( *p )
+		p ++;
+	return p - str;
+}
+
+static char *_strchr_generic(const char *str, int character)
+{
+	const char	ch = character;
+	word_t	pat = ONES * (unsigned char)ch;
+
+	for( ; (uintptr_t)str & WORD_MASK; str ++ )
+	{
+		if( *str == ch )	return (char*)str;
+		if( *str == '\0' )	return NULL;
+	}
+	for( ;; str += WORD_SIZE )
+	{
+		word_t	w = *(const word_t*)str;
+		if( HASZERO(w) || HASZERO(w ^ pat) )
+			break;
+	}
+	for( ; *str != ch; str ++ )
+	{
+		if( *str == '\0' )
+			return NULL;
+	}
+	return (char*)str;
+}
+
 EXPORT size_t strcspn(const char *haystack, const char *reject)
 {
 	size_t	ret = 0;
@@ -0,0 +1,434 @@
+/*
+ * AcessOS Basic C Library
+ * string_x86.c
+ * - SSE2, AVX2 and ERMS versions of the string.c routines
+ *
+ * Built with GCC's vector extensions, so each function can carry its own
+ * target() and libc can still run on a CPU without SSE2. Searches use
+ * aligned loads (which never cross a page) and mask off bytes before the
+ * start; copies use unaligned head and tail vectors around an aligned loop.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "lib.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+
+// === CONSTANTS ===
+#define ERMS_THRESHOLD	2048	// rep movsb/stosb beats vector loops above this
+
+// === TYPES ===
+typedef char	v16	__attribute__((vector_size(16), may_alias));
+typedef char	v16u	__attribute__((vector_size(16), may_alias, aligned(1)));
+typedef char	v32	__attribute__((vector_size(32), may_alias));
+typedef char	v32u	__attribute__((vector_size(32), may_alias, aligned(1)));
+typedef uint64_t	u64u	__attribute__((may_alias, aligned(1)));
+typedef uint32_t	u32u	__attribute__((may_alias, aligned(1)));
+
+#define TARGET_SSE2	__attribute__((target("sse2")))
+#define TARGET_AVX2	__attribute__((target("avx2")))
+#define MASK16(v)	((unsigned int)__builtin_ia32_pmovmskb128((v16)(v)))
+#define MASK32(v)	((unsigned int)__builtin_ia32_pmovmskb256((v32)(v)))
+
+// === PROTOTYPES ===
+static void	*_memcpy_sse2(void *dest, const void *src, size_t n);
+static void	*_memmove_sse2(void *dest, const void *src, size_t n);
+static void	*_memset_sse2(void *dest, int val, size_t n);
+static int	_memcmp_sse2(const void *p1, const void *p2, size_t n);
+static void	*_memchr_sse2(const void *ptr, int val, size_t n);
+static size_t	_strlen_sse2(const char *str);
+static char	*_strchr_sse2(const char *str, int ch);
+static void	*_memcpy_avx2(void *dest, const void *src, size_t n);
+static void	*_memset_avx2(void *dest, int val, size_t n);
+static size_t	_strlen_avx2(const char *str);
+static void	*_memchr_avx2(const void *ptr, int val, size_t n);
+static void	*_memcpy_erms(void *dest, const void *src, size_t n);
+static void	*_memset_erms(void *dest, int val, size_t n);
+
+// === GLOBALS ===
+// Whatever ERMS wraps for the small and medium sizes
+static void	*(*_memcpy_vec)(void *, const void *, size_t);
+static void	*(*_memset_vec)(void *, int, size_t);
+
+// === CODE ===
+/**
+ * \brief Pick the best routines this CPU supports
+ * \param Ops	Table to update (starts with the generic versions)
+ * \param Limit	Name of the best implementation allowed, NULL for no limit
+ */
+void _string_init_x86(tStringOps *Ops, const char *Limit)
+{
+	 int	level = 3;
+	if( Limit ) {
+		if( strcmp(Limit, "generic") == 0 )	level = 0;
+		else if( strcmp(Limit, "sse2") == 0 )	level = 1;
+		else if( strcmp(Limit, "avx2") == 0 )	level = 2;
+	}
+
+	if( level < 1 || !gCPU_Features.SSE2 )
+		return ;
+	Ops->Memcpy  = _memcpy_sse2;
+	Ops->Memmove = _memmove_sse2;
+	Ops->Memset  = _memset_sse2;
+	Ops->Memcmp  = _memcmp_sse2;
+	Ops->Memchr  = _memchr_sse2;
+	Ops->Strlen  = _strlen_sse2;
+	Ops->Strchr  = _strchr_sse2;
+	Ops->Name = "sse2";
+
+	if( level >= 2 && gCPU_Features.AVX2 )
+	{
+		Ops->Memcpy = _memcpy_avx2;
+		Ops->Memset = _memset_avx2;
+		Ops->Memchr = _memchr_avx2;
+		Ops->Strlen = _strlen_avx2;
+		Ops->Name = "avx2";
+	}
+
+	if( level >= 3 && gCPU_Features.ERMS )
+	{
+		_memcpy_vec = Ops->Memcpy;
+		_memset_vec = Ops->Memset;
+		Ops->Memcpy = _memcpy_erms;
+		Ops->Memset = _memset_erms;
+		Ops->Name = (Ops->Name[0] == 'a' ? "avx2+erms" : "sse2+erms");
+	}
+}
+
+// --- SSE2 ---
+/**
+ * \brief Copy up to 31 bytes with (possibly overlapping) unaligned moves
+ * \note Everything is loaded before anything is stored, so this also works for memmove
+ */
+static inline TARGET_SSE2 void _copy_small(char *d, const char *s, size_t n)
+{
+	if( n >= 16 ) {
+		v16u	a = *(const v16u*)s, b = *(const v16u*)(s + n - 16);
+		*(v16u*)d = a;
+		*(v16u*)(d + n - 16) = b;
+	}
+	else if( n >= 8 ) {
+		uint64_t	a = *(const u64u*)s, b = *(const u64u*)(s + n - 8);
+		*(u64u*)d = a;
+		*(u64u*)(d + n - 8) = b;
+	}
+	else if( n >= 4 ) {
+		uint32_t	a = *(const u32u*)s, b = *(const u32u*)(s + n - 4);
+		*(u32u*)d = a;
+		*(u32u*)(d + n - 4) = b;
+	}
+	else if( n ) {
+		char	a = s[0], b = s[n/2], c = s[n-1];
+		d[0] = a;
+		d[n/2] = b;
+		d[n-1] = c;
+	}
+}
+
+static TARGET_SSE2 void *_memcpy_sse2(void *dest, const void *src, size_t n)
+{
+	char	*d = dest;
+	const char	*s = src;
+
+	if( n < 32 ) {
+		_copy_small(d, s, n);
+		return dest;
+	}
+
+	// Unaligned head and tail, aligned stores in between
+	v16u	head = *(const v16u*)s;
+	v16u	tail = *(const v16u*)(s + n - 16);
+	char	*end = d + n - 16;
+	size_t	skip = 16 - ((uintptr_t)d & 15);
+	*(v16u*)d = head;
+	d += skip;
+	s += skip;
+	for( ; d + 64 <= end; d += 64, s += 64 )
+	{
+		v16u	a = ((const v16u*)s)[0], b = ((const v16u*)s)[1];
+		v16u	c = ((const v16u*)s)[2], e = ((const v16u*)s)[3];
+		((v16*)d)[0] = a;
+		((v16*)d)[1] = b;
+		((v16*)d)[2] = c;
+		((v16*)d)[3] = e;
+	}
+	for( ; d < end; d += 16, s += 16 )
+		*(v16*)d = *(const v16u*)s;
+	*(v16u*)end = tail;
+	return dest;
+}
+
+static TARGET_SSE2 void *_memmove_sse2(void *dest, const void *src, size_t n)
+{
+	char	*d = dest;
+	const char	*s = src;
+
+	if( n < 32 ) {
+		_copy_small(d, s, n);
+		return dest;
+	}
+	if( (uintptr_t)d - (uintptr_t)s >= n && (uintptr_t)s - (uintptr_t)d >= n )
+		return _memcpy_sse2(dest, src, n);
+
+	// Overlapping, load each vector before the store that could clobber it
+	if( d < s )
+	{
+		for( ; n >= 16; n -= 16, d += 16, s += 16 )
+			*(v16u*)d = *(const v16u*)s;
+		while( n-- )	*d++ = *s++;
+	}
+	else
+	{
+		d += n;
+		s += n;
+		for( ; n >= 16; n -= 16 ) {
+			d -= 16;
+			s -= 16;
+			*(v16u*)d = *(const v16u*)s;
+		}
+		while( n-- )	*--d = *--s;
+	}
+	return dest;
+}
+
+static TARGET_SSE2 void *_memset_sse2(void *dest, int val, size_t n)
+{
+	char	*d = dest;
+
+	if( n < 16 ) {
+		while( n-- )	*d++ = val;
+		return dest;
+	}
+	v16	v = (v16){0} + (char)val;
+	char	*end = d + n - 16;
+	*(v16u*)d = v;
+	d += 16 - ((uintptr_t)d & 15);
+	for( ; d + 64 <= end; d += 64 )
+	{
+		((v16*)d)[0] = v;
+		((v16*)d)[1] = v;
+		((v16*)d)[2] = v;
+		((v16*)d)[3] = v;
+	}
+	for( ; d < end; d += 16 )
+		*(v16*)d = v;
+	*(v16u*)end = v;
+	return dest;
+}
+
+static TARGET_SSE2 int _memcmp_sse2(const void *p1, const void *p2, size_t n)
+{
+	const unsigned char	*a = p1, *b = p2;
+
+	for( ; n >= 16; n -= 16, a += 16, b += 16 )
+	{
+		unsigned int	neq = ~MASK16(*(const v16u*)a == *(const v16u*)b) & 0xFFFF;
+		if( neq ) {
+			 int	i = __builtin_ctz(neq);
+			return a[i] - b[i];
+		}
+	}
+	for( ; n; n --, a ++, b ++ )
+	{
+		if( *a != *b )
+			return *a - *b;
+	}
+	return 0;
+}
+
+static TARGET_SSE2 void *_memchr_sse2(const void *ptr, int val, size_t n)
+{
+	const char	*p = ptr;
+	 int	ofs = (uintptr_t)p & 15;
+	v16	pat = (v16){0} + (char)val;
+	unsigned int	mask;
+
+	if( n == 0 )
+		return NULL;
+	// First block, ignoring bytes before ptr
+	p -= ofs;
+	mask = MASK16(*(const v16*)p == pat) >> ofs;
+	if( mask ) {
+		size_t	i = __builtin_ctz(mask);
+		return i < n ? (void*)(p + ofs + i) : NULL;
+	}
+	if( n <= (size_t)(16 - ofs) )
+		return NULL;
+	n -= 16 - ofs;
+	for( p += 16; ; p += 16 )
+	{
+		mask = MASK16(*(const v16*)p == pat);
+		if( mask ) {
+			size_t	i = __builtin_ctz(mask);
+			return i < n ? (void*)(p + i) : NULL;
+		}
+		if( n <= 16 )
+			return NULL;
+		n -= 16;
+	}
+}
+
+static TARGET_SSE2 size_t _strlen_sse2(const char *str)
+{
+	const char	*p = (const char*)((uintptr_t)str & ~15);
+	unsigned int	mask;
+
+	mask = MASK16(*(const v16*)p == (v16){0}) >> (str - p);
+	if( mask )
+		return __builtin_ctz(mask);
+	do {
+		p += 16;
+		mask = MASK16(*(const v16*)p == (v16){0});
+	} while( !mask );
+	return p + __builtin_ctz(mask) - str;
+}
+
+static TARGET_SSE2 char *_strchr_sse2(const char *str, int ch)
+{
+	const char	*p = (const char*)((uintptr_t)str & ~15);
+	v16	pat = (v16){0} + (char)ch;
+	unsigned int	mask;
+
+	{
+		v16	v = *(const v16*)p;
+		mask = MASK16((v == pat) | (v == (v16){0})) >> (str - p);
+		p = str;
+	}
+	while( !mask )
+	{
+		p = (const char*)((uintptr_t)p & ~15) + 16;
+		v16	v = *(const v16*)p;
+		mask = MASK16((v == pat) | (v == (v16){0}));
+	}
+	p += __builtin_ctz(mask);
+	return *p == (char)ch ? (char*)p : NULL;
+}
+
+// --- AVX2 ---
+static TARGET_AVX2 void *_memcpy_avx2(void *dest, const void *src, size_t n)
+{
+	char	*d = dest;
+	const char	*s = src;
+
+	if( n < 64 ) {
+		if( n >= 32 ) {
+			v32u	a = *(const v32u*)s, b = *(const v32u*)(s + n - 32);
+			*(v32u*)d = a;
+			*(v32u*)(d + n - 32) = b;
+		}
+		else
+			_copy_small(d, s, n);
+		return dest;
+	}
+
+	v32u	head = *(const v32u*)s;
+	v32u	tail = *(const v32u*)(s + n - 32);
+	char	*end = d + n - 32;
+	size_t	skip = 32 - ((uintptr_t)d & 31);
+	*(v32u*)d = head;
+	d += skip;
+	s += skip;
+	for( ; d + 128 <= end; d += 128, s += 128 )
+	{
+		v32u	a = ((const v32u*)s)[0], b = ((const v32u*)s)[1];
+		v32u	c = ((const v32u*)s)[2], e = ((const v32u*)s)[3];
+		((v32*)d)[0] = a;
+		((v32*)d)[1] = b;
+		((v32*)d)[2] = c;
+		((v32*)d)[3] = e;
+	}
+	for( ; d < end; d += 32, s += 32 )
+		*(v32*)d = *(const v32u*)s;
+	*(v32u*)end = tail;
+	return dest;
+}
+
+static TARGET_AVX2 void *_memset_avx2(void *dest, int val, size_t n)
+{
+	char	*d = dest;
+
+	if( n < 64 )
+		return _memset_sse2(dest, val, n);
+	v32	v = (v32){0} + (char)val;
+	char	*end = d + n - 32;
+	*(v32u*)d = v;
+	d += 32 - ((uintptr_t)d & 31);
+	for( ; d + 128 <= end; d += 128 )
+	{
+		((v32*)d)[0] = v;
+		((v32*)d)[1] = v;
+		((v32*)d)[2] = v;
+		((v32*)d)[3] = v;
+	}
+	for( ; d < end; d += 32 )
+		*(v32*)d = v;
+	*(v32u*)end = v;
+	return dest;
+}
+
+static TARGET_AVX2 size_t _strlen_avx2(const char *str)
+{
+	const char	*p = (const char*)((uintptr_t)str & ~31);
+	unsigned int	mask;
+
+	mask = MASK32(*(const v32*)p == (v32){0}) >> (str - p);
+	if( mask )
+		return __builtin_ctz(mask);
+	do {
+		p += 32;
+		mask = MASK32(*(const v32*)p == (v32){0});
+	} while( !mask );
+	return p + __builtin_ctz(mask) - str;
+}
+
+static TARGET_AVX2 void *_memchr_avx2(const void *ptr, int val, size_t n)
+{
+	const char	*p = ptr;
+	 int	ofs = (uintptr_t)p & 31;
+	v32	pat = (v32){0} + (char)val;
+	unsigned int	mask;
+
+	if( n == 0 )
+		return NULL;
+	p -= ofs;
+	mask = MASK32(*(const v32*)p == pat) >> ofs;
+	if( mask ) {
+		size_t	i = __builtin_ctz(mask);
+		return i < n ? (void*)(p + ofs + i) : NULL;
+	}
+	if( n <= (size_t)(32 - ofs) )
+		return NULL;
+	n -= 32 - ofs;
+	for( p += 32; ; p += 32 )
+	{
+		mask = MASK32(*(const v32*)p == pat);
+		if( mask ) {
+			size_t	i = __builtin_ctz(mask);
+			return i < n ? (void*)(p + i) : NULL;
+		}
+		if( n <= 32 )
+			return NULL;
+		n -= 32;
+	}
+}
+
+// --- ERMS ---
+static void *_memcpy_erms(void *dest, const void *src, size_t n)
+{
+	if( n < ERMS_THRESHOLD )
+		return _memcpy_vec(dest, src, n);
+	void	*d = dest;
+	__asm__ __volatile__ ("rep movsb" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
+	return dest;
+}
+
+static void *_memset_erms(void *dest, int val, size_t n)
+{
+	if( n < ERMS_THRESHOLD )
+		return _memset_vec(dest, val, n);
+	void	*d = dest;
+	__asm__ __volatile__ ("rep stosb" : "+D"(d), "+c"(n) : "a"(val) : "memory");
+	return dest;
+}
+
+#endif
@@ -7,7 +7,11 @@
 #include <stdlib.h>
 #include <acess/sys.h>
 
-#define USE_CPUID	0
+#if defined(__i386__) || defined(__x86_64__)
+# define USE_CPUID	1
+#else
+# define USE_CPUID	0
+#endif
 
 // === TYPES ===
 typedef struct {
@@ -18,6 +22,7 @@ typedef struct {
 // === PROTOTYPES ===
 #if USE_CPUID
 static void	cpuid(uint32_t Num, uint32_t *EAX, uint32_t *EBX, uint32_t *EDX, uint32_t *ECX);
+static void	_cpu_features(void);
 #endif
  int	ErrorHandler(int Fault);
 
@@ -60,16 +65,12 @@ int SoMain(UNUSED(uintptr_t, BaseAddress), UNUSED(int, argc), UNUSED(char **, ar
 	}
 	#endif
 
-	_stdio_init();	
-	
 	#if USE_CPUID
-	{
-		uint32_t	ecx, edx;
-		cpuid(1, NULL, NULL, &edx, &ecx);
-		gCPU_Features.SSE  = edx & (1 << 25);	// SSE
-		gCPU_Features.SSE2 = edx & (1 << 26);	// SSE2
-	}
+	_cpu_features();
 	#endif
+	_string_init();
+
+	_stdio_init();	
 	
 	_crt0_exit_handler = _call_atexit_handlers;
 
@@ -104,8 +105,8 @@ static void cpuid(uint32_t Num, uint32_t *EAX, uint32_t *EBX, uint32_t *EDX, uin
 	
 	__asm__ __volatile__ (
 		"cpuid"
-		: "=a"(eax), "=c"(ecx), "=d"(edx)
-		: "a"(Num)
+		: "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+		: "a"(Num), "c"(0)
 		);
 	
 	if(EAX)	*EAX = eax;
@@ -113,4 +114,29 @@ static void cpuid(uint32_t Num, uint32_t *EAX, uint32_t *EBX, uint32_t *EDX, uin
 	if(EDX)	*EDX = edx;
 	if(ECX)	*ECX = ecx;
 }
+
+/**
+ * \brief Fill gCPU_Features
+ */
+static void _cpu_features(void)
+{
+	uint32_t	max, ebx, ecx, edx;
+	
+	cpuid(0, &max, NULL, NULL, NULL);
+	cpuid(1, NULL, NULL, &edx, &ecx);
+	gCPU_Features.SSE  = !!(edx & (1 << 25));	// SSE
+	gCPU_Features.SSE2 = !!(edx & (1 << 26));	// SSE2
+	if( max < 7 )
+		return ;
+	
+	cpuid(7, NULL, &ebx, NULL, NULL);
+	gCPU_Features.ERMS = !!(ebx & (1 << 9));
+	// AVX2 is only usable if the kernel has enabled XSAVE and saves YMM (XCR0 bits 1,2)
+	if( ecx & (1 << 27) )	// OSXSAVE
+	{
+		uint32_t	xcr0, xcr0_hi;
+		__asm__ __volatile__ ("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+		gCPU_Features.AVX2 = (xcr0 & 6) == 6 && (ebx & (1 << 5));
+	}
+}
 #endif
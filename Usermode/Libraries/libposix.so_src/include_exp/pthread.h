@@ -0,0 +1,52 @@
+/*
+ * Acess2 POSIX Emulation
+ * - By John Hodge (thePowersGang)
+ *
+ * pthread.h
+ * - Thread synchronisation (futex backed)
+ */
+#ifndef _LIBPOSIX__PTHREAD_H_
+#define _LIBPOSIX__PTHREAD_H_
+
+#include <stdint.h>
+#include <time.h>	// struct timespec
+
+/**
+ * \brief Mutex
+ * \note State values: 0 = unlocked, 1 = locked, 2 = locked with waiters
+ */
+typedef struct
+{
+	volatile uint32_t	State;
+} pthread_mutex_t;
+
+/**
+ * \brief Condition variable
+ * \note Sequence is bumped on every signal, waiters sleep on the old value
+ */
+typedef struct
+{
+	volatile uint32_t	Sequence;
+} pthread_cond_t;
+
+typedef int	pthread_mutexattr_t;
+typedef int	pthread_condattr_t;
+
+#define PTHREAD_MUTEX_INITIALIZER	{0}
+#define PTHREAD_COND_INITIALIZER	{0}
+
+extern int	pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr);
+extern int	pthread_mutex_destroy(pthread_mutex_t *mutex);
+extern int	pthread_mutex_lock(pthread_mutex_t *mutex);
+extern int	pthread_mutex_trylock(pthread_mutex_t *mutex);
+extern int	pthread_mutex_unlock(pthread_mutex_t *mutex);
+
+extern int	pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr);
+extern int	pthread_cond_destroy(pthread_cond_t *cond);
+extern int	pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+extern int	pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime);
+extern int	pthread_cond_signal(pthread_cond_t *cond);
+extern int	pthread_cond_broadcast(pthread_cond_t *cond);
+
+#endif
+
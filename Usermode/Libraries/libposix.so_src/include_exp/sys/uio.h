@@ -0,0 +1,26 @@
+/*
+ * Acess2 POSIX Emulation
+ * - By John Hodge (thePowersGang)
+ *
+ * sys/uio.h
+ * - Vectored I/O
+ */
+#ifndef _LIBPOSIX__SYS__UIO_H_
+#define _LIBPOSIX__SYS__UIO_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define IOV_MAX	16	// == SYS_IOV_MAX
+
+struct iovec
+{
+	void	*iov_base;
+	size_t	iov_len;
+};
+
+extern ssize_t	readv(int fd, const struct iovec *iov, int iovcnt);
+extern ssize_t	writev(int fd, const struct iovec *iov, int iovcnt);
+
+#endif
+
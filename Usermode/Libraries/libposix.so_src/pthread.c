@@ -0,0 +1,126 @@
+/*
+ * Acess2 POSIX Emulation
+ * - By John Hodge (thePowersGang)
+ *
+ * pthread.c
+ * - Mutexes and condition variables
+ *
+ * Uncontended operations are a single atomic instruction, the kernel is
+ * only entered (via _SysFutex) when a thread actually has to sleep or
+ * there are sleepers to wake.
+ */
+#include <pthread.h>
+#include <acess/sys.h>
+#include <acess/futex.h>
+#include <errno.h>
+
+// === CODE ===
+int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr __attribute__((unused)))
+{
+	// TODO: Recursive/error-checking mutex types
+	mutex->State = 0;
+	return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex)
+{
+	if( mutex->State != 0 )
+		return EBUSY;
+	return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	uint32_t	c;
+	// Fast path - unlocked to locked
+	c = __sync_val_compare_and_swap(&mutex->State, 0, 1);
+	if( c == 0 )
+		return 0;
+	
+	// Contended - mark as having waiters and sleep until we get it
+	if( c != 2 )
+		c = __sync_lock_test_and_set(&mutex->State, 2);
+	while( c != 0 )
+	{
+		_SysFutex(&mutex->State, FUTEX_WAIT, 2, NULL);
+		c = __sync_lock_test_and_set(&mutex->State, 2);
+	}
+	return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex)
+{
+	if( __sync_val_compare_and_swap(&mutex->State, 0, 1) != 0 )
+		return EBUSY;
+	return 0;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+	// 1 -> 0 needs no syscall, 2 means someone may be asleep
+	if( __sync_fetch_and_sub(&mutex->State, 1) != 1 )
+	{
+		mutex->State = 0;
+		__sync_synchronize();
+		_SysFutex(&mutex->State, FUTEX_WAKE, 1, NULL);
+	}
+	return 0;
+}
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr __attribute__((unused)))
+{
+	cond->Sequence = 0;
+	return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond __attribute__((unused)))
+{
+	return 0;
+}
+
+static int _pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const int64_t *timeout)
+{
+	uint32_t	seq = cond->Sequence;
+	 int	rv = 0;
+	
+	pthread_mutex_unlock(mutex);
+	// If a signal happened between the unlock and here, Sequence has changed
+	// and the wait returns immediately.
+	if( _SysFutex(&cond->Sequence, FUTEX_WAIT, seq, timeout) == -1 && errno == ETIMEDOUT )
+		rv = ETIMEDOUT;
+	
+	// Re-acquire as contended, there may be other threads woken by a broadcast
+	while( __sync_lock_test_and_set(&mutex->State, 2) != 0 )
+		_SysFutex(&mutex->State, FUTEX_WAIT, 2, NULL);
+	return rv;
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+	return _pthread_cond_wait(cond, mutex, NULL);
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime)
+{
+	// clock_gettime(CLOCK_REALTIME) is _SysTimestamp based
+	int64_t	timeout = (int64_t)abstime->tv_sec * 1000 + abstime->tv_nsec / (1000*1000);
+	timeout -= _SysTimestamp();
+	if( timeout < 0 )
+		timeout = 0;
+	return _pthread_cond_wait(cond, mutex, &timeout);
+}
+
+int pthread_cond_signal(pthread_cond_t *cond)
+{
+	__sync_fetch_and_add(&cond->Sequence, 1);
+	_SysFutex(&cond->Sequence, FUTEX_WAKE, 1, NULL);
+	return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond)
+{
+	__sync_fetch_and_add(&cond->Sequence, 1);
+	_SysFutex(&cond->Sequence, FUTEX_WAKE, 0x7FFFFFFF, NULL);
+	return 0;
+}
+
@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <acess/devices/pty.h>
+#include <sys/uio.h>
 
 // === CODE ===
 int unlink(const char *pathname)
@@ -74,6 +75,17 @@ ssize_t	read(int fd, void *buf, size_t count)
 	return _SysRead(fd, buf, count);
 }
 
+// struct iovec has the same layout as t_sysIOVec
+ssize_t	writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	return _SysWriteV(fd, (const t_sysIOVec*)iov, iovcnt);
+}
+
+ssize_t	readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	return _SysReadV(fd, (const t_sysIOVec*)iov, iovcnt);
+}
+
 int seek(int fd, int whence, off_t dest)
 {
 	return _SysSeek(fd, whence, dest);